@@ -0,0 +1,246 @@
+/* Buffered access log files, written in batches from the event loop
+**
+** Copyright (C) 2026  The Merecat contributors
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions
+** are met:
+** 1. Redistributions of source code must retain the above copyright
+**    notice, this list of conditions and the following disclaimer.
+** 2. Redistributions in binary form must reproduce the above copyright
+**    notice, this list of conditions and the following disclaimer in the
+**    documentation and/or other materials provided with the distribution.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNERS OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+** THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <config.h>
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "accesslog.h"
+#include "merecat.h"
+#include "metrics.h"
+
+/* Defines. */
+#ifndef ACCESS_LOG_BUFSIZE
+#define ACCESS_LOG_BUFSIZE 65536
+#endif
+
+/* Write out early when the buffer is this full */
+#define HIGH_WATERMARK (ACCESS_LOG_BUFSIZE * 3 / 4)
+
+struct alog {
+	struct alog *next;
+	char        *file;
+	int          fd;
+	int          policy;
+	size_t       head;		/* first byte waiting in buf, a ring */
+	size_t       len;		/* bytes waiting in buf */
+	char         buf[ACCESS_LOG_BUFSIZE];
+};
+
+static struct alog *logs = NULL;
+static long alog_lines = 0, alog_flushes = 0, alog_drops = 0;
+
+
+static int open_file(struct alog *log)
+{
+	int flags = O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC;
+
+	/* With drop policy a FIFO, or similar, must never stall us */
+	if (log->policy == ALOG_DROP)
+		flags |= O_NONBLOCK;
+
+	return open(log->file, flags, 0644);
+}
+
+struct alog *alog_open(const char *file, int policy)
+{
+	struct alog *log;
+
+	for (log = logs; log; log = log->next) {
+		if (!strcmp(log->file, file))
+			return log;
+	}
+
+	log = calloc(1, sizeof(*log));
+	if (!log) {
+		syslog(LOG_ERR, "out of memory allocating access log");
+		return NULL;
+	}
+
+	log->file = strdup(file);
+	log->policy = policy;
+	if (!log->file) {
+		free(log);
+		syslog(LOG_ERR, "out of memory allocating access log");
+		return NULL;
+	}
+
+	log->fd = open_file(log);
+	if (log->fd < 0) {
+		syslog(LOG_ERR, "Failed opening access log %s: %s", file, strerror(errno));
+		free(log->file);
+		free(log);
+		return NULL;
+	}
+
+	log->next = logs;
+	logs = log;
+
+	return log;
+}
+
+/* Returns 0 when all of the buffer is written, -1 otherwise */
+static int flush(struct alog *log)
+{
+	struct iovec iov[2];
+	ssize_t num;
+	size_t first;
+	int wrote = 0;
+
+	while (log->len > 0) {
+		/* Up to the end of buf, and what has wrapped around */
+		first = MIN(log->len, sizeof(log->buf) - log->head);
+		iov[0].iov_base = &log->buf[log->head];
+		iov[0].iov_len  = first;
+		iov[1].iov_base = log->buf;
+		iov[1].iov_len  = log->len - first;
+
+		num = writev(log->fd, iov, iov[1].iov_len ? 2 : 1);
+		if (num <= 0) {
+			if (num < 0 && errno == EINTR)
+				continue;
+			if (num < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+				syslog(LOG_ERR, "Failed writing access log %s: %s", log->file, strerror(errno));
+			break;
+		}
+
+		log->head = (log->head + num) % sizeof(log->buf);
+		log->len -= num;
+		wrote = 1;
+	}
+
+	if (wrote)
+		alog_flushes++;
+	if (!log->len)
+		log->head = 0;
+
+	return log->len > 0 ? -1 : 0;
+}
+
+void alog_write(struct alog *log, const char *line, size_t len)
+{
+	size_t tail, first;
+
+	if (log->len + len > sizeof(log->buf)) {
+		/* With the block policy the file is in blocking mode, this
+		** stalls the whole worker until the disk has caught up.
+		*/
+		flush(log);
+
+		if (log->len + len > sizeof(log->buf)) {
+			alog_drops++;
+			METRIC_INC(METRIC_LOG_DROPS);
+			return;
+		}
+	}
+
+	tail  = (log->head + log->len) % sizeof(log->buf);
+	first = MIN(len, sizeof(log->buf) - tail);
+	memcpy(&log->buf[tail], line, first);
+	memcpy(log->buf, &line[first], len - first);
+	log->len += len;
+	alog_lines++;
+
+	if (log->len >= HIGH_WATERMARK)
+		flush(log);
+}
+
+void alog_flush(void)
+{
+	struct alog *log;
+
+	for (log = logs; log; log = log->next) {
+		if (log->len > 0)
+			flush(log);
+	}
+}
+
+void alog_reopen(void)
+{
+	struct alog *log;
+	int fd;
+
+	for (log = logs; log; log = log->next) {
+		flush(log);
+
+		fd = open_file(log);
+		if (fd < 0) {
+			syslog(LOG_ERR, "Failed re-opening access log %s, keeping old file: %s",
+			       log->file, strerror(errno));
+			continue;
+		}
+
+		close(log->fd);
+		log->fd = fd;
+	}
+}
+
+void alog_chown(uid_t uid, gid_t gid)
+{
+	struct alog *log;
+
+	for (log = logs; log; log = log->next) {
+		if (fchown(log->fd, uid, gid) < 0)
+			syslog(LOG_WARNING, "fchown access log %s: %s", log->file, strerror(errno));
+	}
+}
+
+int alog_enabled(void)
+{
+	return logs != NULL;
+}
+
+void alog_destroy(void)
+{
+	struct alog *log;
+
+	while (logs) {
+		log = logs;
+		logs = log->next;
+
+		flush(log);
+		close(log->fd);
+		free(log->file);
+		free(log);
+	}
+}
+
+void alog_logstats(long secs)
+{
+	if (logs && secs > 0)
+		syslog(LOG_INFO, "  access log - %ld lines (%g/sec), %ld writes, %ld dropped",
+		       alog_lines, (float)alog_lines / secs, alog_flushes, alog_drops);
+	alog_lines = alog_flushes = alog_drops = 0;
+}
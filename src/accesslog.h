@@ -0,0 +1,69 @@
+/* Buffered access log files, written in batches from the event loop
+**
+** Copyright (C) 2026  The Merecat contributors
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions
+** are met:
+** 1. Redistributions of source code must retain the above copyright
+**    notice, this list of conditions and the following disclaimer.
+** 2. Redistributions in binary form must reproduce the above copyright
+**    notice, this list of conditions and the following disclaimer in the
+**    documentation and/or other materials provided with the distribution.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNERS OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+** THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef ACCESSLOG_H_
+#define ACCESSLOG_H_
+
+#include <sys/types.h>
+
+struct alog;
+
+/* Overflow policy, when the buffer is full and the file is not draining */
+#define ALOG_DROP  0		/* drop the entry and count it */
+#define ALOG_BLOCK 1		/* wait for the file to take it, stalls the server */
+
+/* Returns a log for the given file, opened for appending.  Servers that
+** name the same file share the log.  Returns (struct alog*) 0 on error.
+*/
+extern struct alog *alog_open(const char *file, int policy);
+
+/* Appends an entry, a complete line, to the buffer.  Only written to the
+** file by alog_flush(), or if the buffer passes its high watermark.
+*/
+extern void alog_write(struct alog *log, const char *line, size_t len);
+
+/* Writes out buffered entries of all logs.  Call periodically, and when
+** exiting, or from a sub-process that is about to exit.
+*/
+extern void alog_flush(void);
+
+/* Re-opens all log files, e.g. on SIGHUP after log rotation. */
+extern void alog_reopen(void);
+
+/* Hands over the log files to the user we drop privileges to. */
+extern void alog_chown(uid_t uid, gid_t gid);
+
+/* Returns 1 if any access log is in use. */
+extern int alog_enabled(void);
+
+/* Flush and free all storage, usually in preparation for exitting. */
+extern void alog_destroy(void);
+
+/* Generate debugging statistics syslog message. */
+extern void alog_logstats(long secs);
+
+#endif /* ACCESSLOG_H_ */
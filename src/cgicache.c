@@ -0,0 +1,686 @@
+/* Micro-cache of CGI, PHP, and FastCGI responses, with request collapsing
+**
+** Copyright (C) 2026  The Merecat contributors
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions
+** are met:
+** 1. Redistributions of source code must retain the above copyright
+**    notice, this list of conditions and the following disclaimer.
+** 2. Redistributions in binary form must reproduce the above copyright
+**    notice, this list of conditions and the following disclaimer in the
+**    documentation and/or other materials provided with the distribution.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNERS OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+** THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Responses of scripts are kept for as long as they say, with max-age or
+** Expires, or as long as the server location says, if they don't.  While
+** one is being made, other requests for it wait for it instead of running
+** the same script again.  Responses that turn out not to be cacheable
+** leave a marker for a while, so requests for them are not held up.
+*/
+
+#include <config.h>
+
+#include <sys/types.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <syslog.h>
+
+#include "cgicache.h"
+#include "libhttpd.h"
+#include "merecat.h"
+#include "metrics.h"
+#include "tdate_parse.h"
+
+
+/* Defines. */
+#ifndef CGC_HASH_SIZE
+#define CGC_HASH_SIZE  1024	/* hash chains, on the key */
+#endif
+#ifndef CGC_MAX_ENTRY
+#define CGC_MAX_ENTRY  (1024 * 1024)	/* larger responses are not cached */
+#endif
+#ifndef CGC_PASS_TTL
+#define CGC_PASS_TTL   10	/* seconds a response not cacheable is remembered */
+#endif
+
+/* States of an entry */
+#define PENDING 0		/* being made, others wait for it */
+#define READY   1		/* served from here until it expires */
+#define PASS    2		/* not cacheable, run the script */
+
+/* Request headers a response may vary on, other Vary: is not cached */
+#define VARY_NUM 4
+static const char *vary_names[VARY_NUM] = {
+	"Accept", "Accept-Encoding", "Accept-Language", "User-Agent"
+};
+
+
+struct cgc {
+	struct cgc    *hnext;		/* hash chain */
+	struct cgc    *prev, *next;	/* LRU, of ready and pass entries */
+	unsigned int   hash;
+	char          *key;
+	int            state;
+	time_t         born, expires;
+	int            ttl;		/* from the location, if the script says nothing */
+
+	/* While pending the response as relayed, status line, headers, and
+	** body.  Once ready the headers to repeat, a blank line, and the body.
+	*/
+	char          *buf;
+	size_t         len, size;
+	size_t         head_len;
+	int            status;
+	char           title[40];
+	size_t         bytes;		/* accounted for, once listed */
+
+	/* Request headers of the producer, compared if the response varies */
+	int            vary;
+	char          *req[VARY_NUM];
+
+	void         **waiters;
+	int            num_waiters, max_waiters;
+};
+
+
+/* Globals. */
+static struct cgc *table[CGC_HASH_SIZE];
+static struct cgc *lru_head, *lru_tail;
+static size_t      max_bytes, cur_bytes;
+static int         num_entries;
+static long        hits, misses, collapsed, passes, evicts;
+static void      (*wake_cb)(void *arg);
+
+
+static unsigned int hash(const char *str)
+{
+	unsigned int h = 5381;
+
+	while (*str)
+		h = h * 33 + (unsigned char)*str++;
+
+	return h;
+}
+
+/* Same server, same Host:, same URL with query string */
+static char *make_key(struct http_conn *hc)
+{
+	static char key[2048];
+	int len;
+
+	len = snprintf(key, sizeof(key), "%u %s %s", hc->hs->port, hc->hdrhost, hc->encodedurl);
+	if (len < 0 || (size_t)len >= sizeof(key))
+		return NULL;
+
+	return key;
+}
+
+static const char *vary_value(struct http_conn *hc, int i)
+{
+	switch (i) {
+	case 0:
+		return hc->accept;
+	case 1:
+		return hc->accepte;
+	case 2:
+		return hc->acceptl;
+	}
+
+	return hc->useragent;
+}
+
+/* Only anonymous requests without a body, and not on HTTP/2 where
+** scripts cannot run, are served from and stored in the cache.
+*/
+static int cacheable(struct http_conn *hc)
+{
+	if (!max_bytes || !hc->mime_flag || hc->h2_stream)
+		return 0;
+	if (hc->method != METHOD_GET && hc->method != METHOD_HEAD)
+		return 0;
+	if (hc->contentlength > 0 || hc->authorization[0] || hc->remoteuser[0] || hc->cookie[0])
+		return 0;
+
+	return 1;
+}
+
+static struct cgc *find(const char *key, unsigned int h)
+{
+	struct cgc *e;
+
+	for (e = table[h % CGC_HASH_SIZE]; e; e = e->hnext) {
+		if (e->hash == h && !strcmp(e->key, key))
+			return e;
+	}
+
+	return NULL;
+}
+
+static void lru_add(struct cgc *e)
+{
+	e->prev = NULL;
+	e->next = lru_head;
+	if (lru_head)
+		lru_head->prev = e;
+	else
+		lru_tail = e;
+	lru_head = e;
+
+	e->bytes = sizeof(*e) + strlen(e->key) + e->size;
+	cur_bytes += e->bytes;
+}
+
+static void lru_del(struct cgc *e)
+{
+	if (e->prev)
+		e->prev->next = e->next;
+	else
+		lru_head = e->next;
+	if (e->next)
+		e->next->prev = e->prev;
+	else
+		lru_tail = e->prev;
+	e->prev = e->next = NULL;
+
+	cur_bytes -= e->bytes;
+	e->bytes = 0;
+}
+
+/* Everyone waiting for e can go look it up again */
+static void wake_all(struct cgc *e)
+{
+	void **waiters = e->waiters;
+	int i, num = e->num_waiters;
+
+	e->waiters = NULL;
+	e->num_waiters = e->max_waiters = 0;
+	for (i = 0; i < num; i++)
+		wake_cb(waiters[i]);
+	free(waiters);
+}
+
+static void release(struct cgc *e)
+{
+	struct cgc **pp;
+	int i;
+
+	for (pp = &table[e->hash % CGC_HASH_SIZE]; *pp; pp = &(*pp)->hnext) {
+		if (*pp == e) {
+			*pp = e->hnext;
+			break;
+		}
+	}
+	if (e->state != PENDING)
+		lru_del(e);
+
+	for (i = 0; i < VARY_NUM; i++)
+		free(e->req[i]);
+	free(e->waiters);
+	free(e->buf);
+	free(e->key);
+	free(e);
+	num_entries--;
+}
+
+static void evict(void)
+{
+	while (cur_bytes > max_bytes && lru_tail) {
+		release(lru_tail);
+		evicts++;
+	}
+}
+
+/* Remembered as not cacheable for a while, the producer is on its own */
+static void pass(struct http_conn *hc, struct cgc *e, time_t now)
+{
+	hc->cgc = NULL;
+
+	free(e->buf);
+	e->buf = NULL;
+	e->len = e->size = 0;
+	e->state = PASS;
+	e->expires = now + CGC_PASS_TTL;
+	lru_add(e);
+	passes++;
+
+	wake_all(e);
+	evict();
+}
+
+/* Cache-Control: of the response, returns 0 if it may not be stored */
+static int cache_control(char *val, int *max_age, int *s_maxage)
+{
+	char *tok;
+
+	for (tok = strtok(val, ", \t"); tok; tok = strtok(NULL, ", \t")) {
+		if (!strcasecmp(tok, "no-store") || !strcasecmp(tok, "no-cache") ||
+		    !strncasecmp(tok, "private", 7))
+			return 0;
+		if (!strncasecmp(tok, "s-maxage=", 9))
+			*s_maxage = atoi(&tok[9]);
+		else if (!strncasecmp(tok, "max-age=", 8))
+			*max_age = atoi(&tok[8]);
+	}
+
+	return 1;
+}
+
+/* Vary: of the response, returns 0 for anything but the ones we know */
+static int vary(char *val, int *mask)
+{
+	char *tok;
+	int i;
+
+	for (tok = strtok(val, ", \t"); tok; tok = strtok(NULL, ", \t")) {
+		for (i = 0; i < VARY_NUM; i++) {
+			if (!strcasecmp(tok, vary_names[i]))
+				break;
+		}
+		if (i == VARY_NUM)
+			return 0;
+		*mask |= 1 << i;
+	}
+
+	return 1;
+}
+
+/* Headers we make up ourselves when serving from the cache */
+static int own_header(const char *line)
+{
+	static const char *names[] = {
+		"Status:", "Connection:", "Keep-Alive:", "Content-Length:",
+		"Transfer-Encoding:", "Date:", "Age:"
+	};
+	size_t i;
+
+	if (!strncmp(line, "HTTP/", 5))
+		return 1;
+
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		if (!strncasecmp(line, names[i], strlen(names[i])))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Decide from the headers, all in e->buf, if and for how long the
+** response may be stored.  The headers to repeat are moved to the front
+** of e->buf.  Returns 0 if it may not be stored.
+*/
+static int judge(struct cgc *e, time_t now)
+{
+	int max_age = -1, s_maxage = -1, expires = -1, ttl, ok = 1;
+	char *line, *end, *eol, *val, *out, *cp;
+	char tmp[256];
+	size_t len;
+
+	end = strstr(e->buf, "\r\n\r\n");
+	cp = strchr(e->buf, ' ');
+	if (!end || !cp)
+		return 0;
+
+	/* Status line from httpd_cgi_headers() */
+	e->status = atoi(cp + 1);
+	cp = strchr(cp + 1, ' ');
+	eol = strstr(e->buf, "\r\n");
+	if (cp && cp < eol) {
+		len = MIN((size_t)(eol - cp - 1), sizeof(e->title) - 1);
+		memcpy(e->title, cp + 1, len);
+		e->title[len] = 0;
+	}
+
+	switch (e->status) {
+	case 200:
+	case 203:
+	case 301:
+	case 404:
+	case 410:
+		break;
+
+	default:
+		return 0;
+	}
+
+	out = e->buf;
+	for (line = eol + 2; line < end + 2; line = eol + 2) {
+		eol = strstr(line, "\r\n");
+		len = eol - line + 2;
+
+		val = strchr(line, ':');
+		if (val && val < eol) {
+			char save = *eol;
+
+			*eol = 0;
+			strlcpy(tmp, val + 1, sizeof(tmp));
+			if (!strncasecmp(line, "Set-Cookie:", 11))
+				ok = 0;
+			else if (!strncasecmp(line, "Cache-Control:", 14))
+				ok &= cache_control(tmp, &max_age, &s_maxage);
+			else if (!strncasecmp(line, "Expires:", 8)) {
+				time_t t = tdate_parse(tmp);
+
+				expires = t > now ? (int)MIN(t - now, 0x7fffffff) : 0;
+			} else if (!strncasecmp(line, "Vary:", 5))
+				ok &= vary(tmp, &e->vary);
+			*eol = save;
+		}
+		if (!ok)
+			return 0;
+
+		if (!own_header(line)) {
+			memmove(out, line, len);
+			out += len;
+		}
+	}
+
+	/* Newer HTTP/1.1 freshness first, then Expires:, then the location */
+	if (s_maxage >= 0)
+		ttl = s_maxage;
+	else if (max_age >= 0)
+		ttl = max_age;
+	else if (expires >= 0)
+		ttl = expires;
+	else
+		ttl = e->ttl;
+	if (ttl <= 0)
+		return 0;
+
+	/* The blank line, and the start of the body */
+	len = e->len - (end + 2 - e->buf);
+	memmove(out, end + 2, len);
+	e->head_len = out - e->buf + 2;
+	e->len = out - e->buf + len;
+	e->buf[e->len] = 0;
+
+	e->born = now;
+	e->expires = now + ttl;
+
+	return 1;
+}
+
+/* The Date: header, reformatted only when the second changes */
+static const char *http_date(time_t now)
+{
+	static char date[32];
+	static time_t cached = (time_t)-1;
+
+	if (now != cached) {
+		strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", gmtime(&now));
+		cached = now;
+	}
+
+	return date;
+}
+
+static void serve(struct http_conn *hc, struct cgc *e, time_t now)
+{
+	size_t body = e->len - e->head_len;
+	char buf[256];
+	int len;
+
+	len = snprintf(buf, sizeof(buf), "%s %d %s\r\n"
+		       "Date: %s\r\n"
+		       "Age: %ld\r\n"
+		       "Content-Length: %zu\r\n"
+		       "Connection: %s\r\n",
+		       hc->protocol, e->status, e->title, http_date(now),
+		       (long)(now - e->born), body,
+		       hc->do_keep_alive ? "keep-alive" : "close");
+	httpd_add_response(hc, buf, MIN((size_t)len, sizeof(buf) - 1));
+
+	hc->status = e->status;
+	hc->got_range = 0;
+	if (hc->method == METHOD_HEAD) {
+		httpd_add_response(hc, e->buf, e->head_len);
+		return;
+	}
+
+	httpd_add_response(hc, e->buf, e->len);
+	hc->bytes_sent = body;
+}
+
+
+void cgc_init(size_t bytes, void (*wake)(void *arg))
+{
+	max_bytes = bytes;
+	wake_cb = wake;
+}
+
+int cgc_lookup(struct http_conn *hc, time_t now, int wait)
+{
+	struct cgc *e;
+	char *key;
+	int i;
+
+	if (!cacheable(hc) || !(key = make_key(hc)))
+		return CGC_MISS;
+
+	e = find(key, hash(key));
+	if (!e)
+		return CGC_MISS;
+
+	if (e->state == PENDING) {
+		if (!wait)
+			return CGC_MISS;
+
+		hc->cgc = e;
+		return CGC_BUSY;
+	}
+
+	if (e->expires <= now) {
+		release(e);
+		return CGC_MISS;
+	}
+	if (e->state == PASS)
+		return CGC_MISS;
+
+	/* One variant per key, others are made, and replace it */
+	for (i = 0; i < VARY_NUM; i++) {
+		if ((e->vary & (1 << i)) && strcmp(e->req[i], vary_value(hc, i)))
+			return CGC_MISS;
+	}
+
+	serve(hc, e, now);
+	lru_del(e);
+	lru_add(e);
+	hits++;
+	METRIC_INC(METRIC_CGC_HITS);
+
+	return CGC_HIT;
+}
+
+int cgc_wait(struct http_conn *hc, void *arg)
+{
+	struct cgc *e = hc->cgc;
+
+	if (e->num_waiters == e->max_waiters) {
+		int max = MAX(e->max_waiters * 2, 4);
+		void **waiters;
+
+		waiters = realloc(e->waiters, max * sizeof(void *));
+		if (!waiters)
+			return -1;
+
+		e->waiters = waiters;
+		e->max_waiters = max;
+	}
+
+	e->waiters[e->num_waiters++] = arg;
+	collapsed++;
+	METRIC_INC(METRIC_CGC_COLLAPSED);
+
+	return 0;
+}
+
+void cgc_unwait(struct http_conn *hc, void *arg)
+{
+	struct cgc *e = hc->cgc;
+	int i;
+
+	hc->cgc = NULL;
+	for (i = 0; i < e->num_waiters; i++) {
+		if (e->waiters[i] == arg) {
+			e->waiters[i] = e->waiters[--e->num_waiters];
+			break;
+		}
+	}
+}
+
+int cgc_begin(struct http_conn *hc, time_t now)
+{
+	struct cgc *e;
+	unsigned int h;
+	char *key;
+	int i;
+
+	if (hc->method != METHOD_GET || !cacheable(hc) || !(key = make_key(hc)))
+		return -1;
+
+	h = hash(key);
+	e = find(key, h);
+	if (e) {
+		if (e->state == PENDING)
+			return -1;
+		if (e->state == PASS && e->expires > now)
+			return -1;
+
+		/* Expired, or another variant */
+		release(e);
+	}
+
+	e = calloc(1, sizeof(*e));
+	if (!e)
+		return -1;
+
+	e->hash  = h;
+	e->state = PENDING;
+	e->ttl   = hc->cgc_ttl;
+	e->hnext = table[h % CGC_HASH_SIZE];
+	table[h % CGC_HASH_SIZE] = e;
+	num_entries++;
+
+	e->key = strdup(key);
+	for (i = 0; i < VARY_NUM; i++)
+		e->req[i] = strdup(vary_value(hc, i));
+	if (!e->key || !e->req[0] || !e->req[1] || !e->req[2] || !e->req[3]) {
+		syslog(LOG_ERR, "out of memory caching CGI response");
+		release(e);
+		return -1;
+	}
+
+	hc->cgc = e;
+	misses++;
+	METRIC_INC(METRIC_CGC_MISSES);
+
+	return 0;
+}
+
+void cgc_append(struct http_conn *hc, const char *buf, size_t len, time_t now)
+{
+	struct cgc *e = hc->cgc;
+	int first = e->len == 0;
+
+	if (e->len + len >= MIN((size_t)CGC_MAX_ENTRY, max_bytes / 4)) {
+		pass(hc, e, now);
+		return;
+	}
+
+	/* Room is kept for a terminating NUL */
+	if (e->len + len >= e->size) {
+		size_t size = MAX(e->size * 2, MAX(e->len + len + 1, 4096));
+		char *ptr;
+
+		ptr = realloc(e->buf, size);
+		if (!ptr) {
+			pass(hc, e, now);
+			return;
+		}
+		e->buf = ptr;
+		e->size = size;
+	}
+	memcpy(&e->buf[e->len], buf, len);
+	e->len += len;
+	e->buf[e->len] = 0;
+
+	/* All of the headers come in the first call, those waiting for a
+	** response we are not going to keep need not wait any longer.
+	*/
+	if (first && !judge(e, now))
+		pass(hc, e, now);
+}
+
+void cgc_end(struct http_conn *hc, int ok)
+{
+	struct cgc *e = hc->cgc;
+	char *ptr;
+
+	if (!e)
+		return;
+
+	hc->cgc = NULL;
+	wake_all(e);
+	if (!ok || !e->head_len) {
+		release(e);
+		return;
+	}
+
+	ptr = realloc(e->buf, e->len + 1);
+	if (ptr) {
+		e->buf = ptr;
+		e->size = e->len + 1;
+	}
+	e->state = READY;
+	lru_add(e);
+	evict();
+}
+
+void cgc_cleanup(time_t now)
+{
+	struct cgc *e, *prev;
+
+	for (e = lru_tail; e; e = prev) {
+		prev = e->prev;
+		if (e->expires <= now)
+			release(e);
+	}
+}
+
+void cgc_destroy(void)
+{
+	struct cgc *e;
+	int i;
+
+	for (i = 0; i < CGC_HASH_SIZE; i++) {
+		while ((e = table[i]))
+			release(e);
+	}
+}
+
+/* Generate debugging statistics syslog message. */
+void cgc_logstats(long secs)
+{
+	if (hits + misses + collapsed == 0)
+		return;
+
+	syslog(LOG_INFO, "  cgicache - %d entries, %zu bytes, %ld hits, %ld misses, %ld collapsed, %ld not cacheable, %ld evicted",
+	       num_entries, cur_bytes, hits, misses, collapsed, passes, evicts);
+	hits = misses = collapsed = passes = evicts = 0;
+}
@@ -0,0 +1,86 @@
+/* Micro-cache of CGI, PHP, and FastCGI responses, with request collapsing
+**
+** Copyright (C) 2026  The Merecat contributors
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions
+** are met:
+** 1. Redistributions of source code must retain the above copyright
+**    notice, this list of conditions and the following disclaimer.
+** 2. Redistributions in binary form must reproduce the above copyright
+**    notice, this list of conditions and the following disclaimer in the
+**    documentation and/or other materials provided with the distribution.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNERS OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+** THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef CGICACHE_H_
+#define CGICACHE_H_
+
+#include <sys/types.h>
+#include <time.h>
+
+#include "libhttpd.h"
+
+/* Return values from cgc_lookup() */
+#define CGC_MISS  0		/* run the script */
+#define CGC_HIT   1		/* response added to hc->response */
+#define CGC_BUSY  2		/* being made for another connection, see cgc_wait() */
+
+/* Keep at most bytes of responses, zero disables the cache.  When a
+** response others wait for is done, or turns out not to be cacheable,
+** wake is called with the arg each of them waits with.
+*/
+extern void cgc_init(size_t bytes, void (*wake)(void *arg));
+
+/* Look up a GET or HEAD request for a script.  A fresh response is added
+** to hc->response, as it would be by httpd_send_buf().  If the response
+** is being made for another connection and wait is set, hc->cgc is set
+** to it and CGC_BUSY is returned, the caller then waits for it with
+** cgc_wait() and looks it up again when woken, this time not waiting.
+*/
+extern int cgc_lookup(struct http_conn *hc, time_t now, int wait);
+
+/* Wait for the response in hc->cgc, or stop waiting for it.  When woken
+** hc->cgc is cleared already.
+*/
+extern int  cgc_wait(struct http_conn *hc, void *arg);
+extern void cgc_unwait(struct http_conn *hc, void *arg);
+
+/* Start caching the response of the script just started for hc, sets
+** hc->cgc.  Fails if the request may not be served from the cache, or
+** the response is being made for another connection already.
+*/
+extern int cgc_begin(struct http_conn *hc, time_t now);
+
+/* The response of hc->cgc as sent to the client, from the status line
+** from httpd_cgi_headers() and on.  May clear hc->cgc, if the headers
+** say the response may not be cached.
+*/
+extern void cgc_append(struct http_conn *hc, const char *buf, size_t len, time_t now);
+
+/* Done with hc->cgc, which is kept only if ok, all of it was relayed. */
+extern void cgc_end(struct http_conn *hc, int ok);
+
+/* Drop expired responses. */
+extern void cgc_cleanup(time_t now);
+
+/* Free all storage, usually in preparation for exitting. */
+extern void cgc_destroy(void);
+
+/* Generate debugging statistics syslog message. */
+extern void cgc_logstats(long secs);
+
+#endif /* CGICACHE_H_ */
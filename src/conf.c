@@ -56,6 +56,28 @@ static void conf_errfunc(cfg_t *cfg, const char *format, va_list args)
 	vsyslog(LOG_ERR, fmt, args);
 }
 
+static void conf_etag(char *mode)
+{
+	if (!mode || !strcasecmp(mode, "strong"))
+		etag_mode = ETAG_STRONG;
+	else if (!strcasecmp(mode, "weak"))
+		etag_mode = ETAG_WEAK;
+	else if (!strcasecmp(mode, "none") || !strcasecmp(mode, "off"))
+		etag_mode = ETAG_NONE;
+	else
+		syslog(LOG_WARNING, "Invalid etag setting '%s', must be one of strong, weak, or none", mode);
+}
+
+static void conf_overflow(char *policy)
+{
+	if (!policy || !strcasecmp(policy, "drop"))
+		access_log_block = 0;
+	else if (!strcasecmp(policy, "block"))
+		access_log_block = 1;
+	else
+		syslog(LOG_WARNING, "Invalid access-log-overflow setting '%s', must be one of drop or block", policy);
+}
+
 static void conf_cgi(cfg_t *cfg)
 {
 	if (!cfg)
@@ -87,16 +109,36 @@ static void conf_ssi(cfg_t *cfg)
 {
 	if (!cfg || !cfg_getbool(cfg, "enabled")) {
 	err:
-		ssi_cgi = NULL;
 		ssi_pattern = NULL;
 		return;
 	}
 
-	ssi_cgi = cfg_getstr(cfg, "cgi-path");
+	/* SSI is built-in, cgi-path is still accepted but not used */
 	ssi_silent = cfg_getbool(cfg, "silent");
 	ssi_pattern = (char *)cfg_title(cfg);
-	if (!ssi_pattern || !ssi_cgi || access(ssi_cgi, X_OK)) {
-		syslog(LOG_WARNING, "Invalid SSI settings, check path and pattern!");
+	if (!ssi_pattern) {
+		syslog(LOG_WARNING, "Invalid SSI settings, check pattern!");
+		goto err;
+	}
+}
+
+static void conf_fastcgi(cfg_t *cfg)
+{
+	size_t i;
+
+	if (!cfg || !cfg_getbool(cfg, "enabled")) {
+	err:
+		fcgi_pattern = NULL;
+		fcgi_num_servers = 0;
+		return;
+	}
+
+	fcgi_num_servers = 0;
+	for (i = 0; i < cfg_size(cfg, "server") && i < NELEMS(fcgi_server); i++)
+		fcgi_server[fcgi_num_servers++] = cfg_getnstr(cfg, "server", i);
+	fcgi_pattern = (char *)cfg_title(cfg);
+	if (!fcgi_pattern || !fcgi_num_servers) {
+		syslog(LOG_WARNING, "Invalid FastCGI settings, check pattern and servers!");
 		goto err;
 	}
 }
@@ -131,6 +173,7 @@ static void conf_srv_location(struct srv *srv, cfg_t *cfg)
 
 		srv->location[i].pattern = (char *)cfg_title(loc);
 		srv->location[i].path    = cfg_getstr(loc, "path");
+		srv->location[i].cache   = cfg_getint(loc, "cache");
 	}
 }
 
@@ -153,6 +196,10 @@ static void conf_ssl(struct srv *srv, cfg_t *cfg)
 	srv->certfile  = cfg_getstr(ssl, "certfile");
 	srv->keyfile   = cfg_getstr(ssl, "keyfile");
 	srv->dhfile    = cfg_getstr(ssl, "dhfile"); /* Optional */
+	srv->ssl_cache   = cfg_getint(ssl, "session-cache");
+	srv->ssl_timeout = cfg_getint(ssl, "session-timeout");
+	srv->ssl_tickets = cfg_getbool(ssl, "session-tickets");
+	srv->ktls        = cfg_getbool(ssl, "ktls");
 	if (!srv->certfile || !srv->keyfile)
 		syslog(LOG_ERR, "Missing SSL certificate file(s)");
 #endif
@@ -177,6 +224,7 @@ int conf_srv(struct srv arr[], size_t len)
 		arr[0].host  = cfg_getstr(cfg, "hostname");
 		arr[0].port  = cfg_getint(cfg, "port");
 		arr[0].path  = path;
+		arr[0].access_log = access_log;
 
 		conf_ssl(&arr[0], cfg);
 
@@ -194,6 +242,10 @@ int conf_srv(struct srv arr[], size_t len)
 		arr[i].host  = cfg_getstr(srv, "hostname");
 		arr[i].port  = cfg_getint(srv, "port");
 		arr[i].path  = cfg_getstr(srv, "path");
+		arr[i].access_log = cfg_getstr(srv, "access-log");
+		if (!arr[i].access_log)
+			arr[i].access_log = access_log;
+		arr[i].max_conns = cfg_getint(srv, "max-connections");
 
 		conf_ssl(&arr[i], srv);
 		conf_redirect(&arr[i], srv);
@@ -207,6 +259,7 @@ static int read_config(char *fn)
 {
 	cfg_opt_t location_opts[] = {
 		CFG_STR ("path", NULL, CFGF_NONE),
+		CFG_INT ("cache", 0, CFGF_NONE),
 		CFG_END ()
 	};
 	cfg_opt_t redirect_opts[] = {
@@ -232,18 +285,29 @@ static int read_config(char *fn)
 		CFG_STR ("cgi-path", "cgi-bin/ssi", CFGF_NONE),
 		CFG_END ()
 	};
+	cfg_opt_t fastcgi_opts[] = {
+		CFG_BOOL("enabled", 0, CFGF_NONE),
+		CFG_STR_LIST("server", NULL, CFGF_NONE),
+		CFG_END ()
+	};
 	cfg_opt_t ssl_opts[] = {
 		CFG_STR ("protocol", SSL_DEFAULT_PROTO, CFGF_NONE),
 		CFG_STR ("ciphers", SSL_DEFAULT_CIPHERS, CFGF_NONE),
 		CFG_STR ("certfile", NULL, CFGF_NONE),
 		CFG_STR ("keyfile", NULL, CFGF_NONE),
 		CFG_STR ("dhfile", NULL, CFGF_NONE),
+		CFG_INT ("session-cache", SSL_DEFAULT_SESSION_CACHE, CFGF_NONE),
+		CFG_INT ("session-timeout", SSL_DEFAULT_SESSION_TIMEOUT, CFGF_NONE),
+		CFG_BOOL("session-tickets", 1, CFGF_NONE),
+		CFG_BOOL("ktls", 0, CFGF_NONE),
 		CFG_END ()
 	};
 	cfg_opt_t server_opts[] = {
 		CFG_STR ("hostname", hostname, CFGF_NONE),
 		CFG_INT ("port",     port, CFGF_NONE),
 		CFG_STR ("path",     path, CFGF_NONE),
+		CFG_STR ("access-log", NULL, CFGF_NONE),
+		CFG_INT ("max-connections", 0, CFGF_NONE),
 		CFG_SEC ("location", location_opts, CFGF_MULTI | CFGF_TITLE),
 		CFG_SEC ("ssl",      ssl_opts, CFGF_MULTI),
 		CFG_SEC ("redirect", redirect_opts, CFGF_MULTI | CFGF_TITLE),
@@ -254,6 +318,7 @@ static int read_config(char *fn)
 		CFG_BOOL("chroot", do_chroot, CFGF_NONE),
 		CFG_INT ("compression-level", compression_level, CFGF_NONE),
 		CFG_STR ("directory", dir, CFGF_NONE),
+		CFG_STR ("etag", "strong", CFGF_NONE),
 		CFG_STR ("data-directory", data_dir, CFGF_NONE),
 		CFG_BOOL("global-passwd", do_global_passwd, CFGF_NONE),
 		CFG_BOOL("check-symlinks", !no_symlink_check, CFGF_NONE),
@@ -265,11 +330,23 @@ static int read_config(char *fn)
 		CFG_INT ("max-age", 0, CFGF_NONE),
 		CFG_STR ("username", user, CFGF_NONE),
 		CFG_STR ("hostname", hostname, CFGF_NONE),
+		CFG_BOOL("io-uring", io_uring, CFGF_NONE),
+		CFG_BOOL("http2", do_http2, CFGF_NONE),
 		CFG_BOOL("virtual-host", do_vhost, CFGF_NONE),
 		CFG_STR ("user-agent-deny", useragent_deny, CFGF_NONE),
+		CFG_INT ("workers", workers, CFGF_NONE),
+		CFG_INT ("stat-cache", stat_cache, CFGF_NONE),
+		CFG_INT ("cache-size", cache_size, CFGF_NONE),
+		CFG_INT ("cache-files", cache_files, CFGF_NONE),
+		CFG_INT ("cgi-cache", cgi_cache, CFGF_NONE),
+		CFG_STR ("status-path", NULL, CFGF_NONE),
+		CFG_STR ("cache-manifest", NULL, CFGF_NONE),
+		CFG_STR ("access-log", NULL, CFGF_NONE),
+		CFG_STR ("access-log-overflow", "drop", CFGF_NONE),
 		CFG_SEC ("cgi", cgi_opts, CFGF_MULTI | CFGF_TITLE),
 		CFG_SEC ("php", php_opts, CFGF_MULTI | CFGF_TITLE),
 		CFG_SEC ("ssi", ssi_opts, CFGF_MULTI | CFGF_TITLE),
+		CFG_SEC ("fastcgi", fastcgi_opts, CFGF_MULTI | CFGF_TITLE),
 		CFG_SEC ("ssl", ssl_opts, CFGF_MULTI),
 		CFG_SEC ("server", server_opts, CFGF_MULTI | CFGF_TITLE),
 		CFG_END ()
@@ -324,6 +401,22 @@ static int read_config(char *fn)
 
 	charset = cfg_getstr(cfg, "charset");
 	max_age = cfg_getint(cfg, "max-age");
+	conf_etag(cfg_getstr(cfg, "etag"));
+	workers = cfg_getint(cfg, "workers");
+	io_uring = cfg_getbool(cfg, "io-uring");
+	do_http2 = cfg_getbool(cfg, "http2");
+	stat_cache = cfg_getint(cfg, "stat-cache");
+	cache_size = cfg_getint(cfg, "cache-size");
+	cache_files = cfg_getint(cfg, "cache-files");
+	cgi_cache = cfg_getint(cfg, "cgi-cache");
+	status_path = cfg_getstr(cfg, "status-path");
+	cache_manifest = cfg_getstr(cfg, "cache-manifest");
+	access_log = cfg_getstr(cfg, "access-log");
+	conf_overflow(cfg_getstr(cfg, "access-log-overflow"));
+	if (status_path && status_path[0] != '/') {
+		syslog(LOG_WARNING, "Invalid status-path '%s', must be an absolute URL path", status_path);
+		status_path = NULL;
+	}
 
 #ifdef HAVE_ZLIB_H
 	compression_level = cfg_getint(cfg, "compression-level");
@@ -336,6 +429,7 @@ static int read_config(char *fn)
 	conf_cgi(cfg_getnsec(cfg, "cgi", 0));
 	conf_php(cfg_getnsec(cfg, "php", 0));
 	conf_ssi(cfg_getnsec(cfg, "ssi", 0));
+	conf_fastcgi(cfg_getnsec(cfg, "fastcgi", 0));
 
 	return 0;
 error:
@@ -88,6 +88,7 @@ static inline int conf_srv(struct srv *arr, size_t len)
 	arr[0].ssl  = 0;
 	arr[0].host = hostname;
 	arr[0].path = data_dir;
+	arr[0].access_log = access_log;
 
 	return 1;
 }
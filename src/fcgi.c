@@ -0,0 +1,667 @@
+/* FastCGI client, streams requests to a pool of long-lived backends
+**
+** Copyright (C) 2026  The Merecat contributors
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions
+** are met:
+** 1. Redistributions of source code must retain the above copyright
+**    notice, this list of conditions and the following disclaimer.
+** 2. Redistributions in binary form must reproduce the above copyright
+**    notice, this list of conditions and the following disclaimer in the
+**    documentation and/or other materials provided with the distribution.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNERS OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+** THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <config.h>
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "fcgi.h"
+#include "merecat.h"
+
+/* Defines. */
+#ifndef FCGI_KEEP
+#define FCGI_KEEP 16
+#endif
+
+/* Request body queued for the backend before we stop reading the client */
+#ifndef FCGI_BUFSIZE
+#define FCGI_BUFSIZE 65536
+#endif
+
+#define FCGI_VERSION_1		1
+#define FCGI_HEADER_LEN		8
+#define FCGI_MAX_CONTENT	65535
+
+#define FCGI_BEGIN_REQUEST	1
+#define FCGI_END_REQUEST	3
+#define FCGI_PARAMS		4
+#define FCGI_STDIN		5
+#define FCGI_STDOUT		6
+#define FCGI_STDERR		7
+
+#define FCGI_RESPONDER		1
+#define FCGI_KEEP_CONN		1
+#define FCGI_REQUEST_COMPLETE	0
+
+/* We only ever have one request per connection */
+#define FCGI_REQUEST_ID		1
+
+struct fcgi_server {
+	char                    *name;
+	struct sockaddr_storage  addr;
+	socklen_t                len;
+	int                      idle[FCGI_KEEP];
+	int                      num_idle;
+};
+
+struct fcgi_pool {
+	struct fcgi_server *server;
+	int                 num;
+	int                 next;	/* round-robin */
+};
+
+struct fcgi {
+	struct fcgi_server *srv;
+	int                 fd;
+	int                 connecting;
+	int                 stdin_done;
+	int                 done;	/* END_REQUEST seen */
+	int                 keep;	/* ... and the backend is fine */
+	int                 error;
+
+	/* Records queued up for the backend */
+	char               *out;
+	size_t              outlen, outoff, outsize;
+
+	/* Record currently being read from the backend */
+	unsigned char       hdr[FCGI_HEADER_LEN];
+	size_t              hdrlen;
+	int                 type;
+	size_t              content, padding;
+	unsigned char       end[8];
+	size_t              endlen;
+
+	char                in[8192];
+	size_t              inlen, inoff;
+};
+
+static long fcgi_requests = 0, fcgi_connects = 0, fcgi_reused = 0, fcgi_errors = 0;
+
+
+static int parse_addr(struct fcgi_server *srv, char *name)
+{
+	struct addrinfo hints, *ai;
+	char host[256], *port;
+	size_t len;
+	int rc;
+
+	srv->name = name;
+
+	if (name[0] == '/' || !strncmp(name, "unix:", 5)) {
+		struct sockaddr_un *sun = (struct sockaddr_un *)&srv->addr;
+
+		if (name[0] != '/')
+			name += 5;
+		if (strlen(name) >= sizeof(sun->sun_path)) {
+			syslog(LOG_ERR, "FastCGI socket path %s too long", name);
+			return -1;
+		}
+
+		sun->sun_family = AF_UNIX;
+		strcpy(sun->sun_path, name);
+		srv->len = sizeof(*sun);
+
+		return 0;
+	}
+
+	port = strrchr(name, ':');
+	if (!port || port == name) {
+		syslog(LOG_ERR, "Invalid FastCGI server %s, expected host:port or a socket path", name);
+		return -1;
+	}
+
+	len = port - name;
+	if (name[0] == '[' && len > 2 && name[len - 1] == ']') {
+		name++;
+		len -= 2;
+	}
+	if (len >= sizeof(host)) {
+		syslog(LOG_ERR, "FastCGI server name %s too long", srv->name);
+		return -1;
+	}
+	memcpy(host, name, len);
+	host[len] = 0;
+	port++;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	rc = getaddrinfo(host, port, &hints, &ai);
+	if (rc) {
+		syslog(LOG_ERR, "Failed resolving FastCGI server %s: %s", srv->name, gai_strerror(rc));
+		return -1;
+	}
+
+	memcpy(&srv->addr, ai->ai_addr, ai->ai_addrlen);
+	srv->len = ai->ai_addrlen;
+	freeaddrinfo(ai);
+
+	return 0;
+}
+
+struct fcgi_pool *fcgi_pool_init(char *server[], int num)
+{
+	struct fcgi_pool *pool;
+	int i;
+
+	if (num < 1)
+		return NULL;
+
+	pool = calloc(1, sizeof(*pool));
+	if (pool)
+		pool->server = calloc(num, sizeof(struct fcgi_server));
+	if (!pool || !pool->server) {
+		syslog(LOG_ERR, "out of memory allocating FastCGI pool");
+		free(pool);
+		return NULL;
+	}
+
+	for (i = 0; i < num; i++) {
+		if (parse_addr(&pool->server[i], server[i])) {
+			free(pool->server);
+			free(pool);
+			return NULL;
+		}
+	}
+	pool->num = num;
+
+	return pool;
+}
+
+void fcgi_pool_exit(struct fcgi_pool *pool)
+{
+	struct fcgi_server *srv;
+	int i;
+
+	if (!pool)
+		return;
+
+	for (i = 0; i < pool->num; i++) {
+		srv = &pool->server[i];
+		while (srv->num_idle > 0)
+			close(srv->idle[--srv->num_idle]);
+	}
+
+	free(pool->server);
+	free(pool);
+}
+
+static int server_connect(struct fcgi_server *srv, int *connecting)
+{
+	int fd, on = 1;
+
+	fd = socket(srv->addr.ss_family, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+	if (srv->addr.ss_family != AF_UNIX)
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+	*connecting = 0;
+	if (connect(fd, (struct sockaddr *)&srv->addr, srv->len)) {
+		if (errno != EINPROGRESS) {
+			int err = errno;
+
+			close(fd);
+			errno = err;
+			return -1;
+		}
+		*connecting = 1;
+	}
+	fcgi_connects++;
+
+	return fd;
+}
+
+/* An idle connection is still usable if there is nothing to read from it */
+static int idle_ok(int fd)
+{
+	char c;
+
+	if (recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return 1;
+
+	return 0;
+}
+
+static int queue(struct fcgi *fc, const void *buf, size_t len)
+{
+	size_t size;
+	char *ptr;
+
+	if (fc->outoff > 0) {
+		memmove(fc->out, &fc->out[fc->outoff], fc->outlen - fc->outoff);
+		fc->outlen -= fc->outoff;
+		fc->outoff = 0;
+	}
+
+	if (fc->outlen + len > fc->outsize) {
+		size = MAX(fc->outsize * 2, fc->outlen + len);
+		ptr = realloc(fc->out, size);
+		if (!ptr) {
+			syslog(LOG_ERR, "out of memory queuing FastCGI request");
+			fc->error = 1;
+			return -1;
+		}
+		fc->out = ptr;
+		fc->outsize = size;
+	}
+
+	memcpy(&fc->out[fc->outlen], buf, len);
+	fc->outlen += len;
+
+	return 0;
+}
+
+static int record(struct fcgi *fc, int type, const void *buf, size_t len)
+{
+	unsigned char hdr[FCGI_HEADER_LEN];
+	const char *ptr = buf;
+	size_t num;
+
+	do {
+		num = MIN(len, FCGI_MAX_CONTENT);
+
+		hdr[0] = FCGI_VERSION_1;
+		hdr[1] = type;
+		hdr[2] = 0;
+		hdr[3] = FCGI_REQUEST_ID;
+		hdr[4] = (num >> 8) & 0xff;
+		hdr[5] = num & 0xff;
+		hdr[6] = 0;		/* padding */
+		hdr[7] = 0;
+
+		if (queue(fc, hdr, sizeof(hdr)) || (num && queue(fc, ptr, num)))
+			return -1;
+
+		ptr += num;
+		len -= num;
+	} while (len > 0);
+
+	return 0;
+}
+
+static size_t encode_len(unsigned char *buf, size_t len)
+{
+	if (len < 128) {
+		buf[0] = len;
+		return 1;
+	}
+
+	buf[0] = ((len >> 24) & 0x7f) | 0x80;
+	buf[1] = (len >> 16) & 0xff;
+	buf[2] = (len >> 8) & 0xff;
+	buf[3] = len & 0xff;
+
+	return 4;
+}
+
+/* The CGI environment, as name-value pairs, in one stream of PARAMS */
+static int params(struct fcgi *fc, char **envp)
+{
+	unsigned char *buf, *ptr;
+	size_t len = 0, nlen, vlen;
+	char *val;
+	int i, rc;
+
+	for (i = 0; envp[i]; i++)
+		len += strlen(envp[i]) + 8;
+
+	buf = malloc(len + 1);
+	if (!buf) {
+		syslog(LOG_ERR, "out of memory encoding FastCGI parameters");
+		return -1;
+	}
+
+	ptr = buf;
+	for (i = 0; envp[i]; i++) {
+		val = strchr(envp[i], '=');
+		if (!val)
+			continue;
+
+		nlen = val - envp[i];
+		vlen = strlen(++val);
+
+		ptr += encode_len(ptr, nlen);
+		ptr += encode_len(ptr, vlen);
+		memcpy(ptr, envp[i], nlen);
+		ptr += nlen;
+		memcpy(ptr, val, vlen);
+		ptr += vlen;
+	}
+
+	rc = record(fc, FCGI_PARAMS, buf, ptr - buf);
+	if (!rc && ptr > buf)
+		rc = record(fc, FCGI_PARAMS, NULL, 0);
+	free(buf);
+
+	return rc;
+}
+
+static int begin(struct fcgi *fc, char **envp)
+{
+	unsigned char body[8] = { 0, FCGI_RESPONDER, FCGI_KEEP_CONN, 0, 0, 0, 0, 0 };
+
+	if (record(fc, FCGI_BEGIN_REQUEST, body, sizeof(body)))
+		return -1;
+
+	return params(fc, envp);
+}
+
+struct fcgi *fcgi_open(struct fcgi_pool *pool, char **envp)
+{
+	struct fcgi_server *srv;
+	struct fcgi *fc;
+	int i;
+
+	if (!pool)
+		return NULL;
+
+	fc = calloc(1, sizeof(*fc));
+	if (!fc) {
+		syslog(LOG_ERR, "out of memory allocating FastCGI request");
+		return NULL;
+	}
+	fc->fd = -1;
+
+	for (i = 0; i < pool->num && fc->fd < 0; i++) {
+		srv = &pool->server[pool->next];
+		pool->next = (pool->next + 1) % pool->num;
+
+		while (srv->num_idle > 0) {
+			int fd = srv->idle[--srv->num_idle];
+
+			if (idle_ok(fd)) {
+				fc->fd = fd;
+				fcgi_reused++;
+				break;
+			}
+			close(fd);
+		}
+
+		if (fc->fd < 0) {
+			fc->fd = server_connect(srv, &fc->connecting);
+			if (fc->fd < 0) {
+				syslog(LOG_WARNING, "Failed connecting to FastCGI server %s: %s",
+				       srv->name, strerror(errno));
+				fcgi_errors++;
+				continue;
+			}
+		}
+		fc->srv = srv;
+	}
+
+	if (fc->fd < 0 || begin(fc, envp)) {
+		if (fc->fd >= 0)
+			close(fc->fd);
+		free(fc->out);
+		free(fc);
+		return NULL;
+	}
+	fcgi_requests++;
+
+	return fc;
+}
+
+int fcgi_fd(struct fcgi *fc)
+{
+	return fc->fd;
+}
+
+int fcgi_pending(struct fcgi *fc)
+{
+	return fc->connecting || fc->outoff < fc->outlen;
+}
+
+size_t fcgi_room(struct fcgi *fc)
+{
+	size_t queued = fc->outlen - fc->outoff;
+
+	if (fc->stdin_done || queued + FCGI_HEADER_LEN >= FCGI_BUFSIZE)
+		return 0;
+
+	return FCGI_BUFSIZE - queued - FCGI_HEADER_LEN;
+}
+
+size_t fcgi_write(struct fcgi *fc, const void *buf, size_t len)
+{
+	if (fc->stdin_done)
+		return 0;
+
+	if (!len) {
+		fc->stdin_done = 1;
+		record(fc, FCGI_STDIN, NULL, 0);
+		return 0;
+	}
+
+	len = MIN(len, fcgi_room(fc));
+	if (!len || record(fc, FCGI_STDIN, buf, len))
+		return 0;
+
+	return len;
+}
+
+int fcgi_flush(struct fcgi *fc)
+{
+	ssize_t num;
+
+	if (fc->error)
+		return -1;
+
+	if (fc->connecting) {
+		socklen_t len = sizeof(int);
+		int err = 0;
+
+		if (getsockopt(fc->fd, SOL_SOCKET, SO_ERROR, &err, &len) || err) {
+			syslog(LOG_WARNING, "Failed connecting to FastCGI server %s: %s",
+			       fc->srv->name, strerror(err ? err : errno));
+			if (err)
+				errno = err;
+			fcgi_errors++;
+			return -1;
+		}
+		fc->connecting = 0;
+	}
+
+	while (fc->outoff < fc->outlen) {
+		num = write(fc->fd, &fc->out[fc->outoff], fc->outlen - fc->outoff);
+		if (num < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			fc->error = 1;
+			fcgi_errors++;
+			return -1;
+		}
+		fc->outoff += num;
+	}
+	fc->outoff = fc->outlen = 0;
+
+	return 0;
+}
+
+static void log_stderr(struct fcgi *fc, const char *buf, size_t len)
+{
+	while (len > 0 && (buf[len - 1] == '\n' || buf[len - 1] == '\r'))
+		len--;
+	if (len > 0)
+		syslog(LOG_WARNING, "FastCGI %s: %.*s", fc->srv->name, (int)MIN(len, 500), buf);
+}
+
+static void record_done(struct fcgi *fc)
+{
+	if (fc->type == FCGI_END_REQUEST) {
+		fc->done = 1;
+		fc->keep = fc->endlen == sizeof(fc->end) && fc->end[4] == FCGI_REQUEST_COMPLETE;
+	}
+	fc->hdrlen = 0;
+	fc->endlen = 0;
+}
+
+/* Consumes what we have read so far, returns the number of STDOUT bytes */
+static size_t parse(struct fcgi *fc, char *buf, size_t len)
+{
+	size_t got = 0, num;
+
+	while (fc->inoff < fc->inlen && !fc->done && !fc->error) {
+		if (fc->hdrlen < FCGI_HEADER_LEN) {
+			fc->hdr[fc->hdrlen++] = fc->in[fc->inoff++];
+			if (fc->hdrlen < FCGI_HEADER_LEN)
+				continue;
+
+			if (fc->hdr[0] != FCGI_VERSION_1) {
+				syslog(LOG_WARNING, "FastCGI %s: bad record version %d", fc->srv->name, fc->hdr[0]);
+				fc->error = 1;
+				break;
+			}
+			fc->type    = fc->hdr[1];
+			fc->content = (fc->hdr[4] << 8) | fc->hdr[5];
+			fc->padding = fc->hdr[6];
+		} else if (fc->content > 0) {
+			num = MIN(fc->inlen - fc->inoff, fc->content);
+
+			switch (fc->type) {
+			case FCGI_STDOUT:
+				num = MIN(num, len - got);
+				if (!num)
+					return got;
+				memcpy(&buf[got], &fc->in[fc->inoff], num);
+				got += num;
+				break;
+
+			case FCGI_STDERR:
+				log_stderr(fc, &fc->in[fc->inoff], num);
+				break;
+
+			case FCGI_END_REQUEST:
+				if (fc->endlen < sizeof(fc->end)) {
+					size_t n = MIN(num, sizeof(fc->end) - fc->endlen);
+
+					memcpy(&fc->end[fc->endlen], &fc->in[fc->inoff], n);
+					fc->endlen += n;
+				}
+				break;
+
+			default:	/* Management records, ignore */
+				break;
+			}
+
+			fc->inoff   += num;
+			fc->content -= num;
+		} else {
+			num = MIN(fc->inlen - fc->inoff, fc->padding);
+			fc->inoff   += num;
+			fc->padding -= num;
+		}
+
+		if (!fc->content && !fc->padding)
+			record_done(fc);
+	}
+
+	return got;
+}
+
+ssize_t fcgi_read(struct fcgi *fc, void *buf, size_t len)
+{
+	size_t got = 0;
+	ssize_t num;
+
+	while (got < len) {
+		if (fc->error) {
+			errno = EPROTO;
+			return -1;
+		}
+		if (fc->done)
+			break;
+
+		if (fc->inoff == fc->inlen) {
+			if (got)
+				break;
+
+			num = read(fc->fd, fc->in, sizeof(fc->in));
+			if (num < 0) {
+				if (errno == EINTR)
+					continue;
+				if (errno != EAGAIN && errno != EWOULDBLOCK)
+					fcgi_errors++;
+				return -1;
+			}
+			if (num == 0) {
+				syslog(LOG_WARNING, "FastCGI %s: connection closed before end of request",
+				       fc->srv->name);
+				fcgi_errors++;
+				errno = ECONNRESET;
+				return -1;
+			}
+
+			fc->inlen = num;
+			fc->inoff = 0;
+		}
+
+		got += parse(fc, (char *)buf + got, len - got);
+	}
+
+	return got;
+}
+
+void fcgi_close(struct fcgi *fc)
+{
+	struct fcgi_server *srv = fc->srv;
+
+	if (fc->done && fc->keep && fc->stdin_done && !fc->error && fc->inoff == fc->inlen &&
+	    !fcgi_pending(fc) && srv->num_idle < FCGI_KEEP)
+		srv->idle[srv->num_idle++] = fc->fd;
+	else
+		close(fc->fd);
+
+	free(fc->out);
+	free(fc);
+}
+
+void fcgi_logstats(long secs)
+{
+	if (fcgi_requests && secs > 0)
+		syslog(LOG_INFO, "  FastCGI - %ld requests (%g/sec), %ld connects, %ld reused, %ld errors",
+		       fcgi_requests, (float)fcgi_requests / secs, fcgi_connects, fcgi_reused, fcgi_errors);
+	fcgi_requests = fcgi_connects = fcgi_reused = fcgi_errors = 0;
+}
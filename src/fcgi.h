@@ -0,0 +1,82 @@
+/* FastCGI client, streams requests to a pool of long-lived backends
+**
+** Copyright (C) 2026  The Merecat contributors
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions
+** are met:
+** 1. Redistributions of source code must retain the above copyright
+**    notice, this list of conditions and the following disclaimer.
+** 2. Redistributions in binary form must reproduce the above copyright
+**    notice, this list of conditions and the following disclaimer in the
+**    documentation and/or other materials provided with the distribution.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNERS OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+** THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef FCGI_H_
+#define FCGI_H_
+
+#include <sys/types.h>
+
+struct fcgi_pool;
+struct fcgi;
+
+/* Returns a pool for the given FastCGI servers, a unix socket path or
+** host:port each.  Addresses are resolved up front, in case we chroot().
+** Returns (struct fcgi_pool*) 0 on error.
+*/
+extern struct fcgi_pool *fcgi_pool_init(char *server[], int num);
+
+/* Closes all idle connections and frees the pool. */
+extern void fcgi_pool_exit(struct fcgi_pool *pool);
+
+/* Starts a request, on an idle connection from the pool or a new one to
+** the next server, and queues the CGI environment as its parameters.
+** Returns (struct fcgi*) 0 if no server can be reached.
+*/
+extern struct fcgi *fcgi_open(struct fcgi_pool *pool, char **envp);
+
+/* The descriptor of the backend connection, to watch with fdwatch. */
+extern int fcgi_fd(struct fcgi *fc);
+
+/* Returns 1 if the request has bytes queued for the backend, in which case
+** fcgi_fd() should be watched for writing rather than reading.
+*/
+extern int fcgi_pending(struct fcgi *fc);
+
+/* How much request body fcgi_write() can take right now. */
+extern size_t fcgi_room(struct fcgi *fc);
+
+/* Queues request body, len 0 ends it.  Returns the number of bytes taken. */
+extern size_t fcgi_write(struct fcgi *fc, const void *buf, size_t len);
+
+/* Sends queued bytes to the backend, without blocking.  Returns -1 on error. */
+extern int fcgi_flush(struct fcgi *fc);
+
+/* Reads response, the CGI output of the backend, without blocking.  Returns
+** the number of bytes, 0 when the response is complete, or -1 on error, with
+** errno EAGAIN if there is nothing to read yet.
+*/
+extern ssize_t fcgi_read(struct fcgi *fc, void *buf, size_t len);
+
+/* Ends the request, the connection goes back to the pool if the backend
+** completed it, otherwise it is closed.  Call fdwatch_del_fd() first.
+*/
+extern void fcgi_close(struct fcgi *fc);
+
+/* Generate debugging statistics syslog message. */
+extern void fcgi_logstats(long secs);
+
+#endif /* FCGI_H_ */
@@ -1,4 +1,4 @@
-/* fdwatch.c - fd watcher routines, either select() or poll()
+/* fdwatch.c - fd watcher routines, either select(), poll() or epoll()
 **
 ** Copyright (C) 1995-2015  Jef Poskanzer <jef@mail.acme.com>
 ** All rights reserved.
@@ -59,6 +59,28 @@
 #include <sys/event.h>
 #endif				/* HAVE_SYS_EVENT_H */
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#if defined(HAVE_EPOLL_CREATE1) && !defined(HAVE_EPOLL)
+#define HAVE_EPOLL
+#endif				/* HAVE_EPOLL_CREATE1 && !HAVE_EPOLL */
+#endif				/* HAVE_SYS_EPOLL_H */
+
+/* io_uring is used through the raw system calls, it needs the timeout
+** argument to io_uring_enter() from Linux 5.11, and falls back to epoll.
+*/
+#if defined(HAVE_EPOLL) && defined(HAVE_LINUX_IO_URING_H)
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(IORING_FEAT_EXT_ARG) && defined(__NR_io_uring_setup)
+#define HAVE_IO_URING
+#endif
+#endif
+
 #include "fdwatch.h"
 
 #ifdef HAVE_SELECT
@@ -98,6 +120,51 @@ static int kqueue_check_fd(int fd);
 static int kqueue_get_fd(int ridx);
 
 #else				/* HAVE_KQUEUE */
+# ifdef HAVE_EPOLL
+#  ifdef HAVE_IO_URING
+
+/* Decided at runtime, see fdwatch_use_uring() */
+#define WHICH                  (use_uring ? "io_uring" : "epoll")
+#define INIT(nfiles)           (want_uring && !uring_init(nfiles) ? 0 : epoll_init(nfiles))
+#define EXIT()                 (use_uring ? uring_exit() : epoll_exit())
+#define ADD_FD(fd, rw)         (use_uring ? uring_add_fd(fd, rw) : epoll_add_fd(fd, rw))
+#define DEL_FD(fd)             (use_uring ? uring_del_fd(fd) : epoll_del_fd(fd))
+#define WATCH(timeout_msecs)   (use_uring ? uring_watch(timeout_msecs) : epoll_watch(timeout_msecs))
+#define CHECK_FD(fd)           (use_uring ? uring_check_fd(fd) : epoll_check_fd(fd))
+#define GET_FD(ridx)           (use_uring ? uring_get_fd(ridx) : epoll_get_fd(ridx))
+
+static int want_uring, use_uring;
+
+static int uring_init(int nfiles);
+static void uring_exit(void);
+static void uring_add_fd(int fd, int rw);
+static void uring_del_fd(int fd);
+static int uring_watch(long timeout_msecs);
+static int uring_check_fd(int fd);
+static int uring_get_fd(int ridx);
+
+#  else				/* HAVE_IO_URING */
+
+#define WHICH                  "epoll"
+#define INIT(nfiles)           epoll_init(nfiles)
+#define EXIT()                 epoll_exit()
+#define ADD_FD(fd, rw)         epoll_add_fd(fd, rw)
+#define DEL_FD(fd)             epoll_del_fd(fd)
+#define WATCH(timeout_msecs)   epoll_watch(timeout_msecs)
+#define CHECK_FD(fd)           epoll_check_fd(fd)
+#define GET_FD(ridx)           epoll_get_fd(ridx)
+
+#  endif			/* HAVE_IO_URING */
+
+static int epoll_init(int nfiles);
+static void epoll_exit(void);
+static void epoll_add_fd(int fd, int rw);
+static void epoll_del_fd(int fd);
+static int epoll_watch(long timeout_msecs);
+static int epoll_check_fd(int fd);
+static int epoll_get_fd(int ridx);
+
+# else				/* HAVE_EPOLL */
 # ifdef HAVE_DEVPOLL
 
 #define WHICH                  "devpoll"
@@ -160,6 +227,7 @@ static int select_get_fd(int ridx);
 #   endif			/* HAVE_SELECT */
 #  endif			/* HAVE_POLL */
 # endif				/* HAVE_DEVPOLL */
+# endif				/* HAVE_EPOLL */
 #endif				/* HAVE_KQUEUE */
 
 
@@ -190,7 +258,7 @@ int fdwatch_get_nfiles(void)
 	}
 #endif
 
-#if defined(HAVE_SELECT) && ! ( defined(HAVE_POLL) || defined(HAVE_DEVPOLL) || defined(HAVE_KQUEUE) )
+#if defined(HAVE_SELECT) && ! ( defined(HAVE_POLL) || defined(HAVE_DEVPOLL) || defined(HAVE_KQUEUE) || defined(HAVE_EPOLL) )
 	/* If we use select(), then we must limit ourselves to FD_SETSIZE. */
 	nfiles = MIN(nfiles, FD_SETSIZE);
 #endif
@@ -220,6 +288,19 @@ int fdwatch_get_nfiles(void)
 	return nfiles;
 }
 
+/* Use io_uring instead of epoll, if the kernel supports it.  Must be
+** called before fdwatch_get_nfiles(), which falls back to epoll.
+*/
+void fdwatch_use_uring(int enable)
+{
+#ifdef HAVE_IO_URING
+	want_uring = enable;
+#else
+	if (enable)
+		syslog(LOG_WARNING, "Built without io_uring support, using %s", WHICH);
+#endif
+}
+
 void fdwatch_put_nfiles(void)
 {
 	free(fd_rw);
@@ -467,6 +548,466 @@ static int kqueue_get_fd(int ridx)
 #else /* HAVE_KQUEUE */
 
 
+# ifdef HAVE_EPOLL
+
+/* Level-triggered on purpose, handle_read() and handle_send() in merecat.c
+** do a single read/write per wakeup and rely on being called again while
+** there is still data, or room, left on the socket.  The cost per call to
+** epoll_wait() is proportional to the number of ready descriptors, not the
+** number of watched ones, which is the whole point of this backend.
+*/
+static struct epoll_event *eprevents;
+static int *ep_rfdidx;
+static int ep = -1;
+
+
+static int epoll_init(int nfiles)
+{
+	int i;
+
+	ep = epoll_create1(EPOLL_CLOEXEC);
+	if (ep == -1)
+		return -1;
+
+	eprevents = (struct epoll_event *)calloc(nfiles, sizeof(struct epoll_event));
+	if (!eprevents) {
+		close(ep);
+		return -1;
+	}
+
+	ep_rfdidx = (int *)malloc(sizeof(int) * nfiles);
+	if (!ep_rfdidx) {
+		close(ep);
+		free(eprevents);
+		return -1;
+	}
+
+	for (i = 0; i < nfiles; ++i)
+		ep_rfdidx[i] = -1;
+
+	return 0;
+}
+
+
+static void epoll_exit(void)
+{
+	if (ep != -1)
+		close(ep);
+	ep = -1;
+
+	free(eprevents);
+	free(ep_rfdidx);
+}
+
+
+static void epoll_add_fd(int fd, int rw)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.data.fd = fd;
+	switch (rw) {
+	case FDW_READ:
+		ev.events = EPOLLIN;
+		break;
+
+	case FDW_WRITE:
+		ev.events = EPOLLOUT;
+		break;
+
+	default:
+		break;
+	}
+
+	if (epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev) == -1)
+		syslog(LOG_ERR, "epoll_ctl(ADD, %d): %m", fd);
+}
+
+
+/* Must be called before close(), a CGI child may still hold a dup()
+** of the descriptor, in which case the kernel keeps it in the set.
+*/
+static void epoll_del_fd(int fd)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	if (epoll_ctl(ep, EPOLL_CTL_DEL, fd, &ev) == -1)
+		syslog(LOG_ERR, "epoll_ctl(DEL, %d): %m", fd);
+
+	/* Forget any pending event, fdwatch_get_next_arg() may still be
+	** iterating over the returned set when a connection is cleared.
+	*/
+	if (ep_rfdidx[fd] >= 0 && ep_rfdidx[fd] < nreturned)
+		eprevents[ep_rfdidx[fd]].events = 0;
+	ep_rfdidx[fd] = -1;
+}
+
+
+static int epoll_watch(long timeout_msecs)
+{
+	int i, r;
+
+	r = epoll_wait(ep, eprevents, nfiles, (int)timeout_msecs);
+	if (r <= 0)
+		return r;
+
+	for (i = 0; i < r; ++i)
+		ep_rfdidx[eprevents[i].data.fd] = i;
+
+	return r;
+}
+
+
+static int epoll_check_fd(int fd)
+{
+	int ridx = ep_rfdidx[fd];
+
+	if (ridx < 0 || ridx >= nreturned)
+		return 0;
+
+	if (eprevents[ridx].data.fd != fd)
+		return 0;
+
+	if (eprevents[ridx].events & EPOLLERR)
+		return 0;
+
+	switch (fd_rw[fd]) {
+	case FDW_READ:
+		return eprevents[ridx].events & (EPOLLIN | EPOLLHUP);
+
+	case FDW_WRITE:
+		return eprevents[ridx].events & (EPOLLOUT | EPOLLHUP);
+	}
+
+	return 0;
+}
+
+
+static int epoll_get_fd(int ridx)
+{
+	if (ridx < 0 || ridx >= nfiles) {
+		syslog(LOG_ERR, "bad ridx (%d) in epoll_get_fd!", ridx);
+		return -1;
+	}
+
+	return eprevents[ridx].data.fd;
+}
+
+
+#  ifdef HAVE_IO_URING
+
+/* The io_uring backend keeps the level-triggered model of epoll, with a
+** one-shot IORING_OP_POLL_ADD per watched descriptor.  A one-shot poll
+** completes at once when armed on a descriptor that is already ready, so
+** re-arming each descriptor returned by the previous call gives the same
+** semantics.  The point is the batching: all re-arms, adds and removes
+** queued since the last call are submitted, and the completions reaped,
+** by a single io_uring_enter(), where epoll needs an epoll_ctl() for
+** every change and one epoll_wait().
+**
+** Each poll is tagged with the descriptor and a generation, bumped when
+** it is deleted, so late completions for a closed, and maybe reused,
+** descriptor number are ignored.
+*/
+#define UR_SQ_ENTRIES  1024
+#define UR_CQ_MAX      65536
+#define UR_IGNORE      (~(uint64_t)0)	/* poll removals */
+
+static struct {
+	int       fd;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void     *sq_ring, *cq_ring;
+	size_t    sq_ring_sz, cq_ring_sz, sqes_sz;
+	unsigned  sq_entries;
+} ur = { .fd = -1 };
+
+static struct {
+	int fd;
+	unsigned events;
+} *ur_revents;
+static int *ur_rfdidx;
+static uint32_t *ur_gen;
+static char *ur_armed;
+
+
+static int uring_enter(unsigned submit, unsigned wait, unsigned flags, void *arg, size_t argsz)
+{
+	return syscall(__NR_io_uring_enter, ur.fd, submit, wait, flags, arg, argsz);
+}
+
+static unsigned uring_queued(void)
+{
+	return *ur.sq_tail - __atomic_load_n(ur.sq_head, __ATOMIC_ACQUIRE);
+}
+
+static struct io_uring_sqe *uring_sqe(void)
+{
+	struct io_uring_sqe *sqe;
+	unsigned tail, idx;
+
+	/* Full, submit what we have without waiting */
+	if (uring_queued() >= ur.sq_entries)
+		uring_enter(uring_queued(), 0, 0, NULL, 0);
+
+	tail = *ur.sq_tail;
+	idx  = tail & *ur.sq_mask;
+	sqe  = &ur.sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	ur.sq_array[idx] = idx;
+	__atomic_store_n(ur.sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	return sqe;
+}
+
+static uint64_t uring_tag(int fd)
+{
+	return ((uint64_t)ur_gen[fd] << 32) | (uint32_t)fd;
+}
+
+static void uring_poll(int fd, int rw)
+{
+	struct io_uring_sqe *sqe;
+	uint32_t events;
+
+	events = rw == FDW_WRITE ? POLLOUT : POLLIN;
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	events = (events << 16) | (events >> 16);
+#endif
+
+	sqe = uring_sqe();
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = events;
+	sqe->user_data = uring_tag(fd);
+	ur_armed[fd] = 1;
+}
+
+
+static int uring_init(int nfiles)
+{
+	struct io_uring_params p;
+	unsigned cq;
+	int i;
+
+	memset(&p, 0, sizeof(p));
+	for (cq = 2 * UR_SQ_ENTRIES; cq < (unsigned)nfiles * 2 && cq < UR_CQ_MAX; cq *= 2)
+		;
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = cq;
+
+	ur.fd = syscall(__NR_io_uring_setup, UR_SQ_ENTRIES, &p);
+	if (ur.fd < 0) {
+		syslog(LOG_WARNING, "io_uring_setup: %m, using epoll");
+		return -1;
+	}
+	if (!(p.features & IORING_FEAT_EXT_ARG) || !(p.features & IORING_FEAT_NODROP)) {
+		syslog(LOG_WARNING, "io_uring too old, using epoll");
+		goto fail;
+	}
+
+	ur.sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ur.cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		ur.sq_ring_sz = ur.cq_ring_sz = ur.sq_ring_sz > ur.cq_ring_sz ? ur.sq_ring_sz : ur.cq_ring_sz;
+
+	ur.sq_ring = mmap(NULL, ur.sq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			  ur.fd, IORING_OFF_SQ_RING);
+	if (ur.sq_ring == MAP_FAILED)
+		goto fail;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ur.cq_ring = ur.sq_ring;
+	} else {
+		ur.cq_ring = mmap(NULL, ur.cq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+				  ur.fd, IORING_OFF_CQ_RING);
+		if (ur.cq_ring == MAP_FAILED)
+			goto fail;
+	}
+
+	ur.sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	ur.sqes = mmap(NULL, ur.sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		       ur.fd, IORING_OFF_SQES);
+	if (ur.sqes == MAP_FAILED)
+		goto fail;
+
+	ur.sq_entries = p.sq_entries;
+	ur.sq_head  = (unsigned *)((char *)ur.sq_ring + p.sq_off.head);
+	ur.sq_tail  = (unsigned *)((char *)ur.sq_ring + p.sq_off.tail);
+	ur.sq_mask  = (unsigned *)((char *)ur.sq_ring + p.sq_off.ring_mask);
+	ur.sq_array = (unsigned *)((char *)ur.sq_ring + p.sq_off.array);
+	ur.cq_head  = (unsigned *)((char *)ur.cq_ring + p.cq_off.head);
+	ur.cq_tail  = (unsigned *)((char *)ur.cq_ring + p.cq_off.tail);
+	ur.cq_mask  = (unsigned *)((char *)ur.cq_ring + p.cq_off.ring_mask);
+	ur.cqes     = (struct io_uring_cqe *)((char *)ur.cq_ring + p.cq_off.cqes);
+
+	ur_revents = calloc(nfiles, sizeof(*ur_revents));
+	ur_rfdidx  = malloc(sizeof(int) * nfiles);
+	ur_gen     = calloc(nfiles, sizeof(uint32_t));
+	ur_armed   = calloc(nfiles, 1);
+	if (!ur_revents || !ur_rfdidx || !ur_gen || !ur_armed)
+		goto fail;
+
+	for (i = 0; i < nfiles; ++i)
+		ur_rfdidx[i] = -1;
+
+	use_uring = 1;
+	return 0;
+fail:
+	uring_exit();
+	return -1;
+}
+
+
+static void uring_exit(void)
+{
+	if (ur.sqes && ur.sqes != MAP_FAILED)
+		munmap(ur.sqes, ur.sqes_sz);
+	if (ur.cq_ring && ur.cq_ring != MAP_FAILED && ur.cq_ring != ur.sq_ring)
+		munmap(ur.cq_ring, ur.cq_ring_sz);
+	if (ur.sq_ring && ur.sq_ring != MAP_FAILED)
+		munmap(ur.sq_ring, ur.sq_ring_sz);
+	if (ur.fd != -1)
+		close(ur.fd);
+	memset(&ur, 0, sizeof(ur));
+	ur.fd = -1;
+
+	free(ur_revents);
+	free(ur_rfdidx);
+	free(ur_gen);
+	free(ur_armed);
+	ur_revents = NULL;
+	ur_rfdidx = NULL;
+	ur_gen = NULL;
+	ur_armed = NULL;
+	use_uring = 0;
+}
+
+
+static void uring_add_fd(int fd, int rw)
+{
+	uring_poll(fd, rw);
+}
+
+
+/* The removal is only queued, like everything else, but the generation
+** is bumped at once so nothing more is reported for this descriptor.
+*/
+static void uring_del_fd(int fd)
+{
+	struct io_uring_sqe *sqe;
+
+	if (ur_armed[fd]) {
+		sqe = uring_sqe();
+		sqe->opcode = IORING_OP_POLL_REMOVE;
+		sqe->fd = -1;
+		sqe->addr = uring_tag(fd);
+		sqe->user_data = UR_IGNORE;
+		ur_armed[fd] = 0;
+	}
+	ur_gen[fd]++;
+
+	/* Forget any pending event, see epoll_del_fd() */
+	if (ur_rfdidx[fd] >= 0 && ur_rfdidx[fd] < nreturned)
+		ur_revents[ur_rfdidx[fd]].events = 0;
+	ur_rfdidx[fd] = -1;
+}
+
+
+static int uring_watch(long timeout_msecs)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	struct io_uring_cqe *cqe;
+	unsigned head, tail, wait;
+	int fd, i, n, r;
+
+	/* Re-arm what was returned last time, if still watched */
+	for (i = 0; i < nreturned; ++i) {
+		fd = ur_revents[i].fd;
+		if (ur_rfdidx[fd] == i)
+			ur_rfdidx[fd] = -1;
+		if (fd_rw[fd] != -1 && !ur_armed[fd])
+			uring_poll(fd, fd_rw[fd]);
+	}
+
+	memset(&arg, 0, sizeof(arg));
+	arg.sigmask_sz = _NSIG / 8;
+	if (timeout_msecs != INFTIM) {
+		ts.tv_sec  = timeout_msecs / 1000L;
+		ts.tv_nsec = (timeout_msecs % 1000L) * 1000000L;
+		arg.ts = (uint64_t)(uintptr_t)&ts;
+	}
+	wait = timeout_msecs == 0 ? 0 : 1;
+
+	r = uring_enter(uring_queued(), wait, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+	if (r < 0 && errno != ETIME && errno != EBUSY)
+		return -1;
+
+	n = 0;
+	head = *ur.cq_head;
+	tail = __atomic_load_n(ur.cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++) {
+		cqe = &ur.cqes[head & *ur.cq_mask];
+		if (cqe->user_data == UR_IGNORE)
+			continue;
+
+		fd = (int)(uint32_t)cqe->user_data;
+		if (fd < 0 || fd >= nfiles || (uint32_t)(cqe->user_data >> 32) != ur_gen[fd] || !ur_armed[fd])
+			continue;	/* stale, deleted since */
+
+		ur_armed[fd] = 0;
+		ur_revents[n].fd = fd;
+		ur_revents[n].events = cqe->res < 0 ? POLLERR : (unsigned)cqe->res;
+		ur_rfdidx[fd] = n++;
+	}
+	__atomic_store_n(ur.cq_head, head, __ATOMIC_RELEASE);
+
+	return n;
+}
+
+
+static int uring_check_fd(int fd)
+{
+	int ridx = ur_rfdidx[fd];
+
+	if (ridx < 0 || ridx >= nreturned || ur_revents[ridx].fd != fd)
+		return 0;
+
+	if (ur_revents[ridx].events & (POLLERR | POLLNVAL))
+		return 0;
+
+	switch (fd_rw[fd]) {
+	case FDW_READ:
+		return ur_revents[ridx].events & (POLLIN | POLLHUP);
+
+	case FDW_WRITE:
+		return ur_revents[ridx].events & (POLLOUT | POLLHUP);
+	}
+
+	return 0;
+}
+
+
+static int uring_get_fd(int ridx)
+{
+	if (ridx < 0 || ridx >= nfiles) {
+		syslog(LOG_ERR, "bad ridx (%d) in uring_get_fd!", ridx);
+		return -1;
+	}
+
+	return ur_revents[ridx].fd;
+}
+
+#  endif			/* HAVE_IO_URING */
+
+
+# else /* HAVE_EPOLL */
+
+
 # ifdef HAVE_DEVPOLL
 
 static int maxdpevents;
@@ -956,4 +1497,6 @@ static int select_get_fd(int ridx)
 
 # endif				/* HAVE_DEVPOLL */
 
+# endif				/* HAVE_EPOLL */
+
 #endif				/* HAVE_KQUEUE */
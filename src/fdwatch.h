@@ -59,6 +59,12 @@
 */
 extern int fdwatch_get_nfiles(void);
 
+/* Ask for the io_uring backend, on Linux, instead of epoll.  Must be
+** called before fdwatch_get_nfiles(), falls back to epoll if the kernel
+** does not support it.
+*/
+extern void fdwatch_use_uring(int enable);
+
 /* Free initialized fdwatch data structues at exit */
 extern void fdwatch_put_nfiles(void);
 
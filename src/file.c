@@ -26,8 +26,32 @@
 ** THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <config.h>
+
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
 #include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_LINUX_OPENAT2_H
+#include <linux/openat2.h>
+#include <sys/syscall.h>
+#endif
+
+#include "file.h"
+
+/* Directories are only looked up in, so a "chmod 711" one still works */
+#ifndef O_PATH
+#ifdef O_SEARCH
+#define O_PATH O_SEARCH
+#else
+#define O_PATH O_RDONLY
+#endif
+#endif
+
+#define OPEN_FLAGS (O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK)
 
 /* Read the requested buffer completely, accounting for interruptions. */
 ssize_t file_read(int fd, void *buf, size_t len)
@@ -90,3 +114,98 @@ ssize_t file_write(int fd, void *buf, size_t len)
 	return sz;
 }
 
+/* Opens the current directory, for file_open() */
+int file_root(void)
+{
+	return open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+}
+
+/* Without openat2(), one openat() per component, following no symlink
+** and no "..".
+*/
+static int open_walk(int dirfd, const char *path)
+{
+	char name[NAME_MAX + 1];
+	const char *cp, *end;
+	size_t len;
+	int fd = dirfd, next, err, lookup = 0;
+
+	for (cp = path; ; cp = end + 1) {
+		end = strchr(cp, '/');
+		len = end ? (size_t)(end - cp) : strlen(cp);
+		if (len == 0) {
+			if (!end)
+				break;
+			continue;
+		}
+
+		if (len > NAME_MAX || (len == 2 && cp[0] == '.' && cp[1] == '.')) {
+			err = len > NAME_MAX ? ENAMETOOLONG : EXDEV;
+			goto fail;
+		}
+		memcpy(name, cp, len);
+		name[len] = 0;
+
+		lookup = end != NULL;
+		next = openat(fd, name, O_NOFOLLOW | (lookup ? O_PATH | O_DIRECTORY | O_CLOEXEC : OPEN_FLAGS));
+		if (next < 0) {
+			err = errno;
+			goto fail;
+		}
+		if (fd != dirfd)
+			close(fd);
+		fd = next;
+
+		if (!end)
+			break;
+	}
+
+	/* Only looked up so far, a trailing slash, reopen it for reading */
+	if (fd == dirfd || lookup) {
+		next = openat(fd, ".", OPEN_FLAGS);
+		err = errno;
+		if (fd != dirfd)
+			close(fd);
+		errno = err;
+		return next;
+	}
+
+	return fd;
+fail:
+	if (fd != dirfd)
+		close(fd);
+	errno = err;
+	return -1;
+}
+
+/* Opens path, relative to dirfd, for reading.  Strict, the lookup may
+** not leave dirfd, nor follow any symlink, so what is opened is what a
+** check of the path found, not something swapped in since.  One lookup
+** with openat2() where available.
+*/
+int file_open(int dirfd, const char *path, int strict)
+{
+#if defined(HAVE_LINUX_OPENAT2_H) && defined(SYS_openat2)
+	static int no_openat2;
+	struct open_how how;
+	int fd;
+
+	if (!no_openat2) {
+		memset(&how, 0, sizeof(how));
+		how.flags   = OPEN_FLAGS;
+		how.resolve = RESOLVE_NO_MAGICLINKS;
+		if (strict)
+			how.resolve |= RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS;
+
+		fd = syscall(SYS_openat2, dirfd, path[0] ? path : ".", &how, sizeof(how));
+		if (fd >= 0 || (errno != ENOSYS && errno != EPERM && errno != E2BIG))
+			return fd;
+		no_openat2 = 1;		/* old kernel, or seccomp */
+	}
+#endif
+
+	if (strict)
+		return open_walk(dirfd, path);
+
+	return openat(dirfd, path[0] ? path : ".", OPEN_FLAGS);
+}
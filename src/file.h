@@ -32,4 +32,7 @@
 ssize_t file_read  (int fd, void *buf, size_t len);
 ssize_t file_write (int fd, void *buf, size_t len);
 
+int     file_root  (void);
+int     file_open  (int dirfd, const char *path, int strict);
+
 #endif /* MERECAT_FILE_H_ */
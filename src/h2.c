@@ -0,0 +1,1611 @@
+/* HTTP/2 framing, HPACK and stream multiplexing on top of libhttpd
+**
+** Copyright (C) 2026  The Merecat contributors
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions
+** are met:
+** 1. Redistributions of source code must retain the above copyright
+**    notice, this list of conditions and the following disclaimer.
+** 2. Redistributions in binary form must reproduce the above copyright
+**    notice, this list of conditions and the following disclaimer in the
+**    documentation and/or other materials provided with the distribution.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNERS OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+** THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <config.h>
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "h2.h"
+#include "libhttpd.h"
+#include "merecat.h"
+#include "metrics.h"
+#include "mmc.h"
+
+/* Frame types, RFC 7540 section 6 */
+#define FRAME_DATA          0x0
+#define FRAME_HEADERS       0x1
+#define FRAME_PRIORITY      0x2
+#define FRAME_RST_STREAM    0x3
+#define FRAME_SETTINGS      0x4
+#define FRAME_PUSH_PROMISE  0x5
+#define FRAME_PING          0x6
+#define FRAME_GOAWAY        0x7
+#define FRAME_WINDOW_UPDATE 0x8
+#define FRAME_CONTINUATION  0x9
+
+#define FLAG_END_STREAM     0x01
+#define FLAG_ACK            0x01
+#define FLAG_END_HEADERS    0x04
+#define FLAG_PADDED         0x08
+#define FLAG_PRIORITY       0x20
+
+#define SETTINGS_HEADER_TABLE_SIZE      0x1
+#define SETTINGS_ENABLE_PUSH            0x2
+#define SETTINGS_MAX_CONCURRENT_STREAMS 0x3
+#define SETTINGS_INITIAL_WINDOW_SIZE    0x4
+#define SETTINGS_MAX_FRAME_SIZE         0x5
+
+#define ERR_NO_ERROR          0x0
+#define ERR_PROTOCOL_ERROR    0x1
+#define ERR_INTERNAL_ERROR    0x2
+#define ERR_FLOW_CONTROL      0x3
+#define ERR_FRAME_SIZE        0x6
+#define ERR_REFUSED_STREAM    0x7
+#define ERR_COMPRESSION_ERROR 0x9
+#define ERR_ENHANCE_YOUR_CALM 0xb
+#define ERR_HTTP_1_1_REQUIRED 0xd
+
+/* Protocol defaults, we never ask for anything else */
+#define FRAME_HEADER     9
+#define FRAME_SIZE       16384
+#define WINDOW_SIZE      65535
+#define WINDOW_MAX       0x7fffffff
+
+/* HPACK, RFC 7541, the dynamic table size is left at its default */
+#define HPACK_TABLE_SIZE 4096
+#define HPACK_OVERHEAD   32
+#define HPACK_ENTRIES    (HPACK_TABLE_SIZE / HPACK_OVERHEAD)
+#define H2_LIST_KEEP     4096	/* decoded header list kept between blocks */
+
+/* A growing buffer */
+struct h2_buf {
+	char   *data;
+	size_t  len, size;
+};
+
+/* Header field table entry, name and value in one allocation */
+struct hpack_entry {
+	char   *name;
+	char   *value;
+	size_t  nlen, vlen;
+};
+
+/* Dynamic table, a ring with the newest entry at head */
+struct hpack {
+	struct hpack_entry ent[HPACK_ENTRIES];
+	int     head, num;
+	size_t  size, max;
+};
+
+struct h2_stream {
+	struct h2_stream *prev, *next;
+
+	uint32_t  id;
+	int       ready;		/* response headers sent, DATA to go */
+	int       end_stream;	/* client is done sending */
+	int64_t   window;		/* send window */
+	struct http_conn *hc;	/* the request, without a socket */
+
+	char     *body;		/* rest of hc->response, after the headers */
+	size_t    body_len;
+	off_t     pos, end;	/* of hc->file_address, still to send */
+	off_t     sent;
+	uint64_t  req_at, first_at;	/* for metrics, see metrics_now() */
+};
+
+struct h2_conn {
+	struct http_conn *hc;	/* the client connection */
+	struct h2_stream *streams;
+	int       num_streams;
+	uint32_t  last_id;		/* highest stream opened by the client */
+	size_t    preface;		/* bytes of the client preface seen */
+	int       goaway;		/* either way, no new streams */
+	int       failed;		/* connection error, only flush GOAWAY */
+
+	int64_t   window;		/* connection send window */
+	int64_t   initial_window;	/* for new streams, from the client */
+	size_t    max_frame;
+	size_t    recv_used;		/* DATA received since WINDOW_UPDATE */
+
+	struct hpack dec;		/* request headers */
+	struct hpack enc;		/* response headers */
+	int       enc_update;		/* table size changed, tell the client */
+
+	uint32_t  expect;		/* stream of CONTINUATION expected, or 0 */
+	uint32_t  hdr_id;
+	int       hdr_end_stream;
+	struct h2_buf hdr;		/* header block, HPACK compressed */
+	struct h2_buf list;		/* ... and decoded, name\0value\0 pairs */
+	struct h2_buf block;		/* response header block */
+
+	struct h2_buf in;		/* incomplete frame */
+	struct h2_buf out;		/* frames to write ... */
+	size_t    out_off;		/* ... from here */
+};
+
+/* The static table, RFC 7541 appendix A */
+#define HS(name, value) { name, value, sizeof(name) - 1, sizeof(value) - 1 }
+static const struct {
+	const char *name, *value;
+	size_t      nlen, vlen;
+} hpack_static[] = {
+	HS(":authority", ""),
+	HS(":method", "GET"),
+	HS(":method", "POST"),
+	HS(":path", "/"),
+	HS(":path", "/index.html"),
+	HS(":scheme", "http"),
+	HS(":scheme", "https"),
+	HS(":status", "200"),
+	HS(":status", "204"),
+	HS(":status", "206"),
+	HS(":status", "304"),
+	HS(":status", "400"),
+	HS(":status", "404"),
+	HS(":status", "500"),
+	HS("accept-charset", ""),
+	HS("accept-encoding", "gzip, deflate"),
+	HS("accept-language", ""),
+	HS("accept-ranges", ""),
+	HS("accept", ""),
+	HS("access-control-allow-origin", ""),
+	HS("age", ""),
+	HS("allow", ""),
+	HS("authorization", ""),
+	HS("cache-control", ""),
+	HS("content-disposition", ""),
+	HS("content-encoding", ""),
+	HS("content-language", ""),
+	HS("content-length", ""),
+	HS("content-location", ""),
+	HS("content-range", ""),
+	HS("content-type", ""),
+	HS("cookie", ""),
+	HS("date", ""),
+	HS("etag", ""),
+	HS("expect", ""),
+	HS("expires", ""),
+	HS("from", ""),
+	HS("host", ""),
+	HS("if-match", ""),
+	HS("if-modified-since", ""),
+	HS("if-none-match", ""),
+	HS("if-range", ""),
+	HS("if-unmodified-since", ""),
+	HS("last-modified", ""),
+	HS("link", ""),
+	HS("location", ""),
+	HS("max-forwards", ""),
+	HS("proxy-authenticate", ""),
+	HS("proxy-authorization", ""),
+	HS("range", ""),
+	HS("referer", ""),
+	HS("refresh", ""),
+	HS("retry-after", ""),
+	HS("server", ""),
+	HS("set-cookie", ""),
+	HS("strict-transport-security", ""),
+	HS("transfer-encoding", ""),
+	HS("user-agent", ""),
+	HS("vary", ""),
+	HS("via", ""),
+	HS("www-authenticate", ""),
+};
+#define HPACK_STATIC ((size_t)NELEMS(hpack_static))
+
+/* The Huffman code, RFC 7541 appendix B, the last one is EOS */
+static const struct {
+	uint32_t code;
+	int      len;
+} huff_code[257] = {
+	{ 0x1ff8, 13 }, { 0x7fffd8, 23 }, { 0xfffffe2, 28 }, { 0xfffffe3, 28 },
+	{ 0xfffffe4, 28 }, { 0xfffffe5, 28 }, { 0xfffffe6, 28 }, { 0xfffffe7, 28 },
+	{ 0xfffffe8, 28 }, { 0xffffea, 24 }, { 0x3ffffffc, 30 }, { 0xfffffe9, 28 },
+	{ 0xfffffea, 28 }, { 0x3ffffffd, 30 }, { 0xfffffeb, 28 }, { 0xfffffec, 28 },
+	{ 0xfffffed, 28 }, { 0xfffffee, 28 }, { 0xfffffef, 28 }, { 0xffffff0, 28 },
+	{ 0xffffff1, 28 }, { 0xffffff2, 28 }, { 0x3ffffffe, 30 }, { 0xffffff3, 28 },
+	{ 0xffffff4, 28 }, { 0xffffff5, 28 }, { 0xffffff6, 28 }, { 0xffffff7, 28 },
+	{ 0xffffff8, 28 }, { 0xffffff9, 28 }, { 0xffffffa, 28 }, { 0xffffffb, 28 },
+	{ 0x14, 6 }, { 0x3f8, 10 }, { 0x3f9, 10 }, { 0xffa, 12 },
+	{ 0x1ff9, 13 }, { 0x15, 6 }, { 0xf8, 8 }, { 0x7fa, 11 },
+	{ 0x3fa, 10 }, { 0x3fb, 10 }, { 0xf9, 8 }, { 0x7fb, 11 },
+	{ 0xfa, 8 }, { 0x16, 6 }, { 0x17, 6 }, { 0x18, 6 },
+	{ 0x0, 5 }, { 0x1, 5 }, { 0x2, 5 }, { 0x19, 6 },
+	{ 0x1a, 6 }, { 0x1b, 6 }, { 0x1c, 6 }, { 0x1d, 6 },
+	{ 0x1e, 6 }, { 0x1f, 6 }, { 0x5c, 7 }, { 0xfb, 8 },
+	{ 0x7ffc, 15 }, { 0x20, 6 }, { 0xffb, 12 }, { 0x3fc, 10 },
+	{ 0x1ffa, 13 }, { 0x21, 6 }, { 0x5d, 7 }, { 0x5e, 7 },
+	{ 0x5f, 7 }, { 0x60, 7 }, { 0x61, 7 }, { 0x62, 7 },
+	{ 0x63, 7 }, { 0x64, 7 }, { 0x65, 7 }, { 0x66, 7 },
+	{ 0x67, 7 }, { 0x68, 7 }, { 0x69, 7 }, { 0x6a, 7 },
+	{ 0x6b, 7 }, { 0x6c, 7 }, { 0x6d, 7 }, { 0x6e, 7 },
+	{ 0x6f, 7 }, { 0x70, 7 }, { 0x71, 7 }, { 0x72, 7 },
+	{ 0xfc, 8 }, { 0x73, 7 }, { 0xfd, 8 }, { 0x1ffb, 13 },
+	{ 0x7fff0, 19 }, { 0x1ffc, 13 }, { 0x3ffc, 14 }, { 0x22, 6 },
+	{ 0x7ffd, 15 }, { 0x3, 5 }, { 0x23, 6 }, { 0x4, 5 },
+	{ 0x24, 6 }, { 0x5, 5 }, { 0x25, 6 }, { 0x26, 6 },
+	{ 0x27, 6 }, { 0x6, 5 }, { 0x74, 7 }, { 0x75, 7 },
+	{ 0x28, 6 }, { 0x29, 6 }, { 0x2a, 6 }, { 0x7, 5 },
+	{ 0x2b, 6 }, { 0x76, 7 }, { 0x2c, 6 }, { 0x8, 5 },
+	{ 0x9, 5 }, { 0x2d, 6 }, { 0x77, 7 }, { 0x78, 7 },
+	{ 0x79, 7 }, { 0x7a, 7 }, { 0x7b, 7 }, { 0x7ffe, 15 },
+	{ 0x7fc, 11 }, { 0x3ffd, 14 }, { 0x1ffd, 13 }, { 0xffffffc, 28 },
+	{ 0xfffe6, 20 }, { 0x3fffd2, 22 }, { 0xfffe7, 20 }, { 0xfffe8, 20 },
+	{ 0x3fffd3, 22 }, { 0x3fffd4, 22 }, { 0x3fffd5, 22 }, { 0x7fffd9, 23 },
+	{ 0x3fffd6, 22 }, { 0x7fffda, 23 }, { 0x7fffdb, 23 }, { 0x7fffdc, 23 },
+	{ 0x7fffdd, 23 }, { 0x7fffde, 23 }, { 0xffffeb, 24 }, { 0x7fffdf, 23 },
+	{ 0xffffec, 24 }, { 0xffffed, 24 }, { 0x3fffd7, 22 }, { 0x7fffe0, 23 },
+	{ 0xffffee, 24 }, { 0x7fffe1, 23 }, { 0x7fffe2, 23 }, { 0x7fffe3, 23 },
+	{ 0x7fffe4, 23 }, { 0x1fffdc, 21 }, { 0x3fffd8, 22 }, { 0x7fffe5, 23 },
+	{ 0x3fffd9, 22 }, { 0x7fffe6, 23 }, { 0x7fffe7, 23 }, { 0xffffef, 24 },
+	{ 0x3fffda, 22 }, { 0x1fffdd, 21 }, { 0xfffe9, 20 }, { 0x3fffdb, 22 },
+	{ 0x3fffdc, 22 }, { 0x7fffe8, 23 }, { 0x7fffe9, 23 }, { 0x1fffde, 21 },
+	{ 0x7fffea, 23 }, { 0x3fffdd, 22 }, { 0x3fffde, 22 }, { 0xfffff0, 24 },
+	{ 0x1fffdf, 21 }, { 0x3fffdf, 22 }, { 0x7fffeb, 23 }, { 0x7fffec, 23 },
+	{ 0x1fffe0, 21 }, { 0x1fffe1, 21 }, { 0x3fffe0, 22 }, { 0x1fffe2, 21 },
+	{ 0x7fffed, 23 }, { 0x3fffe1, 22 }, { 0x7fffee, 23 }, { 0x7fffef, 23 },
+	{ 0xfffea, 20 }, { 0x3fffe2, 22 }, { 0x3fffe3, 22 }, { 0x3fffe4, 22 },
+	{ 0x7ffff0, 23 }, { 0x3fffe5, 22 }, { 0x3fffe6, 22 }, { 0x7ffff1, 23 },
+	{ 0x3ffffe0, 26 }, { 0x3ffffe1, 26 }, { 0xfffeb, 20 }, { 0x7fff1, 19 },
+	{ 0x3fffe7, 22 }, { 0x7ffff2, 23 }, { 0x3fffe8, 22 }, { 0x1ffffec, 25 },
+	{ 0x3ffffe2, 26 }, { 0x3ffffe3, 26 }, { 0x3ffffe4, 26 }, { 0x7ffffde, 27 },
+	{ 0x7ffffdf, 27 }, { 0x3ffffe5, 26 }, { 0xfffff1, 24 }, { 0x1ffffed, 25 },
+	{ 0x7fff2, 19 }, { 0x1fffe3, 21 }, { 0x3ffffe6, 26 }, { 0x7ffffe0, 27 },
+	{ 0x7ffffe1, 27 }, { 0x3ffffe7, 26 }, { 0x7ffffe2, 27 }, { 0xfffff2, 24 },
+	{ 0x1fffe4, 21 }, { 0x1fffe5, 21 }, { 0x3ffffe8, 26 }, { 0x3ffffe9, 26 },
+	{ 0xffffffd, 28 }, { 0x7ffffe3, 27 }, { 0x7ffffe4, 27 }, { 0x7ffffe5, 27 },
+	{ 0xfffec, 20 }, { 0xfffff3, 24 }, { 0xfffed, 20 }, { 0x1fffe6, 21 },
+	{ 0x3fffe9, 22 }, { 0x1fffe7, 21 }, { 0x1fffe8, 21 }, { 0x7ffff3, 23 },
+	{ 0x3fffea, 22 }, { 0x3fffeb, 22 }, { 0x1ffffee, 25 }, { 0x1ffffef, 25 },
+	{ 0xfffff4, 24 }, { 0xfffff5, 24 }, { 0x3ffffea, 26 }, { 0x7ffff4, 23 },
+	{ 0x3ffffeb, 26 }, { 0x7ffffe6, 27 }, { 0x3ffffec, 26 }, { 0x3ffffed, 26 },
+	{ 0x7ffffe7, 27 }, { 0x7ffffe8, 27 }, { 0x7ffffe9, 27 }, { 0x7ffffea, 27 },
+	{ 0x7ffffeb, 27 }, { 0xffffffe, 28 }, { 0x7ffffec, 27 }, { 0x7ffffed, 27 },
+	{ 0x7ffffee, 27 }, { 0x7ffffef, 27 }, { 0x7fffff0, 27 }, { 0x3ffffee, 26 },
+	{ 0x3fffffff, 30 },
+};
+
+/* Decoding tree, built on first use.  Children are node indexes, and
+** leaves are -1 - symbol.  Node 0 is the root, so 0 means no child.
+*/
+static int16_t huff_tree[256][2];
+static int huff_nodes;
+
+/* Response headers that change with every response, or from one file
+** to the next, are not worth a dynamic table entry.
+*/
+static const char *hpack_volatile[] = {
+	"date",
+	"content-length",
+	"last-modified",
+	"etag",
+	"content-range",
+	"content-disposition",
+	"location",
+	"expires",
+};
+
+/* Connection-specific headers, not allowed in HTTP/2 */
+static const char *hop_by_hop[] = {
+	"connection",
+	"keep-alive",
+	"proxy-connection",
+	"transfer-encoding",
+	"upgrade",
+};
+
+static long h2_connections, h2_streams, h2_resets;
+
+static int conn_error(struct h2_conn *h2, int code);
+static void stream_done(struct h2_conn *h2, struct h2_stream *s);
+
+
+static char *buf_room(struct h2_buf *b, size_t len)
+{
+	size_t size;
+
+	if (b->len + len > b->size) {
+		size = MAX(b->size * 2, b->len + len);
+		size = MAX(size, 1024);
+		b->data = RENEW(b->data, char, size);
+		if (!b->data) {
+			syslog(LOG_ERR, "out of memory allocating an HTTP/2 buffer");
+			exit(1);
+		}
+		b->size = size;
+	}
+
+	return &b->data[b->len];
+}
+
+static void buf_add(struct h2_buf *b, const void *data, size_t len)
+{
+	memcpy(buf_room(b, len), data, len);
+	b->len += len;
+}
+
+static void buf_free(struct h2_buf *b)
+{
+	free(b->data);
+	b->data = NULL;
+	b->len = b->size = 0;
+}
+
+static void put16(char *ptr, uint32_t val)
+{
+	ptr[0] = (val >> 8) & 0xff;
+	ptr[1] = val & 0xff;
+}
+
+static void put32(char *ptr, uint32_t val)
+{
+	ptr[0] = (val >> 24) & 0xff;
+	ptr[1] = (val >> 16) & 0xff;
+	ptr[2] = (val >> 8) & 0xff;
+	ptr[3] = val & 0xff;
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+
+static void huff_init(void)
+{
+	int sym, bit, node, i;
+
+	huff_nodes = 1;
+	for (sym = 0; sym < 257; sym++) {
+		node = 0;
+		for (i = huff_code[sym].len - 1; i > 0; i--) {
+			bit = (huff_code[sym].code >> i) & 1;
+			if (!huff_tree[node][bit])
+				huff_tree[node][bit] = huff_nodes++;
+			node = huff_tree[node][bit];
+		}
+		huff_tree[node][huff_code[sym].code & 1] = -1 - sym;
+	}
+}
+
+/* Padding is at most seven bits, the most significant bits of EOS */
+static int huff_decode(const uint8_t *src, size_t len, struct h2_buf *dst)
+{
+	int node = 0, bits = 0, ones = 1;
+	int next, bit, i;
+	size_t j;
+
+	for (j = 0; j < len; j++) {
+		for (i = 7; i >= 0; i--) {
+			bit  = (src[j] >> i) & 1;
+			next = huff_tree[node][bit];
+			bits++;
+			ones &= bit;
+
+			if (next > 0) {
+				node = next;
+				continue;
+			}
+			if (next == 0 || next == -1 - 256)
+				return -1;
+
+			*buf_room(dst, 1) = -1 - next;
+			dst->len++;
+			node = bits = 0;
+			ones = 1;
+		}
+	}
+
+	if (bits > 7 || !ones)
+		return -1;
+
+	return 0;
+}
+
+static size_t huff_len(const char *src, size_t len)
+{
+	size_t bits = 0, i;
+
+	for (i = 0; i < len; i++)
+		bits += huff_code[(uint8_t)src[i]].len;
+
+	return (bits + 7) / 8;
+}
+
+static void huff_encode(const char *src, size_t len, struct h2_buf *dst)
+{
+	uint64_t acc = 0;
+	int num = 0;
+	size_t i;
+	char *ptr;
+
+	ptr = buf_room(dst, huff_len(src, len));
+	for (i = 0; i < len; i++) {
+		acc  = (acc << huff_code[(uint8_t)src[i]].len) | huff_code[(uint8_t)src[i]].code;
+		num += huff_code[(uint8_t)src[i]].len;
+		while (num >= 8) {
+			num -= 8;
+			*ptr++ = (acc >> num) & 0xff;
+		}
+	}
+	if (num > 0)
+		*ptr++ = ((acc << (8 - num)) | (0xff >> num)) & 0xff;
+
+	dst->len = ptr - dst->data;
+}
+
+
+static struct hpack_entry *hpack_get(struct hpack *t, int i)
+{
+	return &t->ent[(t->head + i) % HPACK_ENTRIES];
+}
+
+static void hpack_evict(struct hpack *t, size_t max)
+{
+	struct hpack_entry *e;
+
+	while (t->num > 0 && t->size > max) {
+		e = hpack_get(t, t->num - 1);
+		t->size -= e->nlen + e->vlen + HPACK_OVERHEAD;
+		free(e->name);
+		e->name = NULL;
+		t->num--;
+	}
+}
+
+/* Entries are at least 32 bytes, so the ring never overflows */
+static void hpack_add(struct hpack *t, const char *name, size_t nlen, const char *value, size_t vlen)
+{
+	struct hpack_entry *e;
+	size_t sz = nlen + vlen + HPACK_OVERHEAD;
+	char *ptr;
+
+	if (sz > t->max) {
+		hpack_evict(t, 0);
+		return;
+	}
+	hpack_evict(t, t->max - sz);
+
+	ptr = malloc(nlen + vlen + 1);
+	if (!ptr) {
+		syslog(LOG_ERR, "out of memory adding to an HPACK table");
+		exit(1);
+	}
+	memcpy(ptr, name, nlen);
+	memcpy(ptr + nlen, value, vlen);
+
+	t->head = (t->head + HPACK_ENTRIES - 1) % HPACK_ENTRIES;
+	e = &t->ent[t->head];
+	e->name  = ptr;
+	e->nlen  = nlen;
+	e->value = ptr + nlen;
+	e->vlen  = vlen;
+	t->num++;
+	t->size += sz;
+}
+
+/* Look up index, 1 .. 61 are static, the dynamic table follows */
+static int hpack_index(struct hpack *t, size_t idx, const char **name, size_t *nlen, const char **value, size_t *vlen)
+{
+	struct hpack_entry *e;
+
+	if (idx == 0)
+		return -1;
+
+	if (idx <= HPACK_STATIC) {
+		*name  = hpack_static[idx - 1].name;
+		*nlen  = hpack_static[idx - 1].nlen;
+		*value = hpack_static[idx - 1].value;
+		*vlen  = hpack_static[idx - 1].vlen;
+		return 0;
+	}
+
+	idx -= HPACK_STATIC + 1;
+	if (idx >= (size_t)t->num)
+		return -1;
+
+	e = hpack_get(t, idx);
+	*name  = e->name;
+	*nlen  = e->nlen;
+	*value = e->value;
+	*vlen  = e->vlen;
+
+	return 0;
+}
+
+static int hpack_int_get(const uint8_t **pp, const uint8_t *end, int prefix, size_t *val)
+{
+	const uint8_t *p = *pp;
+	size_t max = (1 << prefix) - 1;
+	size_t v;
+	int shift = 0;
+
+	if (p >= end)
+		return -1;
+
+	v = *p++ & max;
+	if (v == max) {
+		do {
+			if (p >= end || shift > 21)
+				return -1;
+			v += (size_t)(*p & 0x7f) << shift;
+			shift += 7;
+		} while (*p++ & 0x80);
+	}
+
+	*pp = p;
+	*val = v;
+
+	return 0;
+}
+
+static void hpack_int_put(struct h2_buf *b, uint8_t first, int prefix, size_t val)
+{
+	size_t max = (1 << prefix) - 1;
+	char *ptr;
+
+	ptr = buf_room(b, 8);
+	if (val < max) {
+		*ptr++ = first | val;
+	} else {
+		*ptr++ = first | max;
+		val -= max;
+		while (val >= 128) {
+			*ptr++ = (val & 0x7f) | 0x80;
+			val >>= 7;
+		}
+		*ptr++ = val;
+	}
+	b->len = ptr - b->data;
+}
+
+static int hpack_str_get(const uint8_t **pp, const uint8_t *end, struct h2_buf *dst)
+{
+	size_t len;
+	int huff;
+
+	if (*pp >= end)
+		return -1;
+
+	huff = **pp & 0x80;
+	if (hpack_int_get(pp, end, 7, &len) || len > (size_t)(end - *pp))
+		return -1;
+
+	if (huff) {
+		if (huff_decode(*pp, len, dst))
+			return -1;
+	} else {
+		buf_add(dst, *pp, len);
+	}
+	*pp += len;
+
+	return 0;
+}
+
+static void hpack_str_put(struct h2_buf *b, const char *str, size_t len)
+{
+	size_t hlen = huff_len(str, len);
+
+	if (hlen < len) {
+		hpack_int_put(b, 0x80, 7, hlen);
+		huff_encode(str, len, b);
+	} else {
+		hpack_int_put(b, 0x00, 7, len);
+		buf_add(b, str, len);
+	}
+}
+
+/* The request is turned into text for libhttpd, so line breaks and NUL
+** would let one header smuggle in another.
+*/
+static int hpack_bad(const char *str, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		if (str[i] == '\0' || str[i] == '\r' || str[i] == '\n')
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Decodes a header block to name\0value\0 pairs in out.  Returns -1 on
+** errors, the table is then out of sync and the connection is lost.  A
+** field that cannot be passed on marks the request malformed in bad.
+** Indexed fields are one byte in and up to a table entry out, so the
+** decoded list is capped as well, returning 1 past H2_MAX_HEADERS.
+*/
+static int hpack_decode(struct hpack *t, const uint8_t *p, size_t len, struct h2_buf *out, int *bad)
+{
+	const uint8_t *end = p + len;
+	const char *name, *value;
+	size_t idx, nlen, vlen, off;
+	int incr;
+
+	while (p < end) {
+		off = out->len;
+
+		if (*p & 0x80) {
+			/* Indexed field */
+			if (hpack_int_get(&p, end, 7, &idx) ||
+			    hpack_index(t, idx, &name, &nlen, &value, &vlen))
+				return -1;
+			buf_add(out, name, nlen);
+			buf_add(out, "", 1);
+			buf_add(out, value, vlen);
+			buf_add(out, "", 1);
+		} else if ((*p & 0xe0) == 0x20) {
+			/* Dynamic table size update */
+			if (hpack_int_get(&p, end, 5, &idx) || idx > HPACK_TABLE_SIZE)
+				return -1;
+			t->max = idx;
+			hpack_evict(t, t->max);
+			continue;
+		} else {
+			/* Literal, with incremental indexing, without, or never */
+			incr = (*p & 0xc0) == 0x40;
+			if (hpack_int_get(&p, end, incr ? 6 : 4, &idx))
+				return -1;
+
+			if (idx) {
+				if (hpack_index(t, idx, &name, &nlen, &value, &vlen))
+					return -1;
+				buf_add(out, name, nlen);
+			} else if (hpack_str_get(&p, end, out)) {
+				return -1;
+			}
+			nlen = out->len - off;
+			buf_add(out, "", 1);
+
+			if (hpack_str_get(&p, end, out))
+				return -1;
+			vlen = out->len - off - nlen - 1;
+			buf_add(out, "", 1);
+
+			if (incr)
+				hpack_add(t, &out->data[off], nlen, &out->data[off + nlen + 1], vlen);
+		}
+
+		if (!nlen || hpack_bad(&out->data[off], nlen) ||
+		    hpack_bad(&out->data[off + nlen + 1], vlen))
+			*bad = 1;
+		if (out->len > H2_MAX_HEADERS)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Encodes one response header, repeated fields are sent as an index
+** into the dynamic table.
+*/
+static void hpack_encode(struct h2_conn *h2, const char *name, size_t nlen, const char *value, size_t vlen)
+{
+	struct h2_buf *b = &h2->block;
+	struct hpack *t = &h2->enc;
+	struct hpack_entry *e;
+	size_t i, idx = 0;
+	int incr = 1;
+
+	for (i = 0; i < HPACK_STATIC; i++) {
+		if (hpack_static[i].nlen != nlen || memcmp(hpack_static[i].name, name, nlen))
+			continue;
+
+		if (hpack_static[i].vlen == vlen && !memcmp(hpack_static[i].value, value, vlen)) {
+			hpack_int_put(b, 0x80, 7, i + 1);
+			return;
+		}
+		if (!idx)
+			idx = i + 1;
+	}
+
+	for (i = 0; i < (size_t)t->num; i++) {
+		e = hpack_get(t, i);
+		if (e->nlen != nlen || memcmp(e->name, name, nlen))
+			continue;
+
+		if (e->vlen == vlen && !memcmp(e->value, value, vlen)) {
+			hpack_int_put(b, 0x80, 7, HPACK_STATIC + 1 + i);
+			return;
+		}
+		if (!idx)
+			idx = HPACK_STATIC + 1 + i;
+	}
+
+	for (i = 0; i < NELEMS(hpack_volatile); i++) {
+		if (strlen(hpack_volatile[i]) == nlen && !memcmp(hpack_volatile[i], name, nlen)) {
+			incr = 0;
+			break;
+		}
+	}
+
+	if (incr)
+		hpack_int_put(b, 0x40, 6, idx);
+	else
+		hpack_int_put(b, 0x00, 4, idx);
+	if (!idx)
+		hpack_str_put(b, name, nlen);
+	hpack_str_put(b, value, vlen);
+
+	if (incr)
+		hpack_add(t, name, nlen, value, vlen);
+}
+
+
+/* Queues a frame, returns where its payload goes */
+static char *frame_put(struct h2_conn *h2, int type, int flags, uint32_t id, size_t len)
+{
+	char *ptr;
+
+	ptr = buf_room(&h2->out, FRAME_HEADER + len);
+	ptr[0] = (len >> 16) & 0xff;
+	put16(&ptr[1], len);
+	ptr[3] = type;
+	ptr[4] = flags;
+	put32(&ptr[5], id & WINDOW_MAX);
+	h2->out.len += FRAME_HEADER + len;
+
+	return &ptr[FRAME_HEADER];
+}
+
+static void frame_rst(struct h2_conn *h2, uint32_t id, int code)
+{
+	put32(frame_put(h2, FRAME_RST_STREAM, 0, id, 4), code);
+}
+
+static void frame_window(struct h2_conn *h2, uint32_t id, uint32_t inc)
+{
+	put32(frame_put(h2, FRAME_WINDOW_UPDATE, 0, id, 4), inc);
+}
+
+/* The header block in h2->block, split in CONTINUATION frames as needed */
+static void frame_headers(struct h2_conn *h2, uint32_t id, int end_stream)
+{
+	size_t off = 0, len;
+	int type = FRAME_HEADERS;
+	int flags;
+
+	do {
+		len = MIN(h2->block.len - off, h2->max_frame);
+		flags = off + len == h2->block.len ? FLAG_END_HEADERS : 0;
+		if (type == FRAME_HEADERS && end_stream)
+			flags |= FLAG_END_STREAM;
+
+		memcpy(frame_put(h2, type, flags, id, len), &h2->block.data[off], len);
+		off += len;
+		type = FRAME_CONTINUATION;
+	} while (off < h2->block.len);
+}
+
+
+static struct h2_stream *stream_find(struct h2_conn *h2, uint32_t id)
+{
+	struct h2_stream *s;
+
+	for (s = h2->streams; s; s = s->next) {
+		if (s->id == id)
+			return s;
+	}
+
+	return NULL;
+}
+
+/* Each stream is a request of its own, sharing the client's address,
+** server, and TLS session, the latter only for https:// and HSTS.
+*/
+static struct h2_stream *stream_new(struct h2_conn *h2, uint32_t id)
+{
+	struct h2_stream *s;
+	struct http_conn *hc;
+
+	s = NEW(struct h2_stream, 1);
+	hc = NEW(struct http_conn, 1);
+	if (!s || !hc) {
+		free(hc);
+		free(s);
+		return NULL;
+	}
+
+	httpd_init_conn_mem(hc);
+	hc->hs = h2->hc->hs;
+	memcpy(&hc->client, &h2->hc->client, sizeof(hc->client));
+	hc->conn_fd = -1;
+	hc->cgi_rfd = hc->cgi_wfd = -1;
+	hc->ssl = h2->hc->ssl;
+	hc->h2_stream = id;
+
+	s->id = id;
+	s->hc = hc;
+	s->window = h2->initial_window;
+	s->end_stream = h2->hdr_end_stream;
+	s->req_at = metrics_now();
+
+	LIST_INSERT(s, h2->streams);
+	h2->num_streams++;
+	h2_streams++;
+
+	return s;
+}
+
+static void stream_free(struct h2_conn *h2, struct h2_stream *s, struct timeval *now)
+{
+	LIST_REMOVE(s, h2->streams);
+	h2->num_streams--;
+
+	httpd_close_conn(s->hc, now);
+	s->hc->ssl = NULL;	/* not ours */
+	httpd_destroy_conn(s->hc);
+	free(s->hc);
+	free(s);
+}
+
+static void stream_reset(struct h2_conn *h2, struct h2_stream *s, int code)
+{
+	frame_rst(h2, s->id, code);
+	stream_free(h2, s, NULL);
+	h2_resets++;
+}
+
+static int is_listed(const char *list[], size_t num, const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < num; i++) {
+		if (!strcasecmp(list[i], name))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Writes the decoded request as HTTP/1.1 text to hc->read_buf, for the
+** usual request parser.  Returns 0, or an error code to reset with.
+*/
+static int stream_request_text(struct h2_conn *h2, struct h2_stream *s)
+{
+	const char *method = NULL, *path = NULL, *scheme = NULL, *authority = NULL;
+	const char *name, *value, *ptr, *end;
+	struct http_conn *hc = s->hc;
+	struct h2_buf req = { 0 };
+	struct h2_buf cookie = { 0 };
+	int regular = 0;
+	size_t len;
+
+	ptr = h2->list.data;
+	end = ptr + h2->list.len;
+	while (ptr < end) {
+		name  = ptr;
+		value = name + strlen(name) + 1;
+		ptr   = value + strlen(value) + 1;
+
+		if (name[0] == ':') {
+			if (regular)
+				goto bad;
+
+			if (!strcmp(name, ":method"))
+				method = value;
+			else if (!strcmp(name, ":path"))
+				path = value;
+			else if (!strcmp(name, ":scheme"))
+				scheme = value;
+			else if (!strcmp(name, ":authority"))
+				authority = value;
+			else
+				goto bad;
+			continue;
+		}
+		regular = 1;
+
+		if (is_listed(hop_by_hop, NELEMS(hop_by_hop), name) ||
+		    !strcmp(name, "te") || !strcmp(name, "content-length"))
+			continue;
+		if (authority && !strcmp(name, "host"))
+			continue;
+
+		/* Split up for better compression, joined again for us */
+		if (!strcmp(name, "cookie")) {
+			if (cookie.len)
+				buf_add(&cookie, "; ", 2);
+			buf_add(&cookie, value, strlen(value));
+			continue;
+		}
+
+		buf_add(&req, name, strlen(name));
+		buf_add(&req, ": ", 2);
+		buf_add(&req, value, strlen(value));
+		buf_add(&req, "\r\n", 2);
+	}
+
+	if (!method || !path || !scheme || path[0] != '/' || strpbrk(path, " \t"))
+		goto bad;
+
+	/* Request bodies are for CGI, and those need a connection of their own */
+	if (strcmp(method, "GET") && strcmp(method, "HEAD") && strcmp(method, "OPTIONS")) {
+		buf_free(&cookie);
+		buf_free(&req);
+		return ERR_HTTP_1_1_REQUIRED;
+	}
+
+	len = strlen(method) + strlen(path) + req.len + cookie.len + 64;
+	if (authority)
+		len += strlen(authority);
+	httpd_realloc_str(&hc->read_buf, &hc->read_size, len);
+
+	len = snprintf(hc->read_buf, hc->read_size, "%s %s HTTP/2.0\r\n", method, path);
+	if (authority)
+		len += snprintf(&hc->read_buf[len], hc->read_size - len, "Host: %s\r\n", authority);
+	memcpy(&hc->read_buf[len], req.data, req.len);
+	len += req.len;
+	if (cookie.len) {
+		memcpy(&hc->read_buf[len], "Cookie: ", 8);
+		memcpy(&hc->read_buf[len + 8], cookie.data, cookie.len);
+		len += 8 + cookie.len;
+		memcpy(&hc->read_buf[len], "\r\n", 2);
+		len += 2;
+	}
+	memcpy(&hc->read_buf[len], "\r\n", 3);
+	hc->read_idx = len + 2;
+
+	buf_free(&cookie);
+	buf_free(&req);
+
+	return 0;
+bad:
+	buf_free(&cookie);
+	buf_free(&req);
+
+	return ERR_PROTOCOL_ERROR;
+}
+
+/* Sends the response libhttpd has queued in hc->response as a header
+** block, with connection-specific headers dropped.  The body, if any,
+** follows as DATA from h2_output().
+*/
+static void stream_respond(struct h2_conn *h2, struct h2_stream *s)
+{
+	struct http_conn *hc = s->hc;
+	char *ptr, *end, *eol, *colon, *value;
+	char status[4];
+	size_t len, i;
+	off_t left;
+	int code;
+
+	ptr = hc->response;
+	end = ptr + hc->responselen;
+	eol = hc->responselen ? memchr(ptr, '\n', end - ptr) : NULL;
+	colon = eol ? memchr(ptr, ' ', eol - ptr) : NULL;
+	code = colon ? atoi(colon + 1) : 0;
+	if (code < 100 || code > 999) {
+		stream_reset(h2, s, ERR_INTERNAL_ERROR);
+		return;
+	}
+
+	h2->block.len = 0;
+	if (h2->enc_update) {
+		hpack_int_put(&h2->block, 0x20, 5, h2->enc.max);
+		h2->enc_update = 0;
+	}
+
+	snprintf(status, sizeof(status), "%d", code);
+	hpack_encode(h2, ":status", 7, status, 3);
+
+	for (ptr = eol + 1; ptr < end; ptr = eol + 1) {
+		eol = memchr(ptr, '\n', end - ptr);
+		if (!eol)
+			break;
+
+		len = eol - ptr;
+		if (len > 0 && ptr[len - 1] == '\r')
+			len--;
+		if (len == 0) {
+			ptr = eol + 1;
+			break;
+		}
+
+		colon = memchr(ptr, ':', len);
+		if (!colon)
+			continue;
+
+		*colon = '\0';
+		for (i = 0; ptr + i < colon; i++)
+			ptr[i] = tolower(ptr[i]);
+		if (is_listed(hop_by_hop, NELEMS(hop_by_hop), ptr))
+			continue;
+
+		for (value = colon + 1; value < ptr + len && *value == ' '; value++)
+			;
+		hpack_encode(h2, ptr, colon - ptr, value, ptr + len - value);
+	}
+
+	if (ptr < end && hc->method != METHOD_HEAD) {
+		s->body = ptr;
+		s->body_len = end - ptr;
+	}
+
+	left = s->body_len + s->end - s->pos;
+	frame_headers(h2, s->id, left == 0);
+	s->first_at = metrics_now();
+	if (left == 0) {
+		stream_done(h2, s);
+		return;
+	}
+	s->ready = 1;
+}
+
+/* Runs the request through the same steps as a HTTP/1.1 connection, in
+** handle_request(), except for throttling, which is per connection.
+*/
+static void stream_request(struct h2_conn *h2, struct h2_stream *s, struct timeval *now)
+{
+	struct http_conn *hc = s->hc;
+	const char *buf;
+	size_t len;
+	int rc;
+
+	rc = stream_request_text(h2, s);
+	if (rc) {
+		stream_reset(h2, s, rc);
+		return;
+	}
+
+	if (httpd_got_request(hc) != GR_GOT_REQUEST) {
+		stream_reset(h2, s, ERR_PROTOCOL_ERROR);
+		return;
+	}
+
+#ifdef HAVE_ZLIB_H
+	hc->has_deflate = compression_level != 0;
+#endif
+	if (httpd_parse_request(hc) < 0)
+		goto respond;
+
+	if (hc->status_page) {
+		buf = metrics_report(&len);
+		httpd_send_buf(hc, "text/plain; version=0.0.4", buf, len);
+		goto respond;
+	}
+
+	if (httpd_start_request(hc, now) < 0) {
+		if (hc->http1_required) {
+			stream_reset(h2, s, ERR_HTTP_1_1_REQUIRED);
+			return;
+		}
+		goto respond;
+	}
+
+	if (hc->file_address) {
+		if (hc->got_range) {
+			s->pos = hc->first_byte_index;
+			s->end  = hc->last_byte_index + 1;
+		} else if (hc->bytes_to_send > 0) {
+			s->end  = hc->bytes_to_send;
+		}
+	}
+respond:
+	stream_respond(h2, s);
+}
+
+static void stream_done(struct h2_conn *h2, struct h2_stream *s)
+{
+	struct http_conn *hc = s->hc;
+
+	hc->bytes_sent = s->sent;
+	httpd_log_request(hc);
+	metrics_request(hc->status, s->sent, s->req_at, s->first_at, metrics_now());
+
+	/* Not interested in the rest of a request body */
+	if (!s->end_stream)
+		frame_rst(h2, s->id, ERR_NO_ERROR);
+
+	stream_free(h2, s, NULL);
+}
+
+/* Queues one DATA frame of the stream, if the windows allow */
+static int stream_data(struct h2_conn *h2, struct h2_stream *s)
+{
+	struct http_conn *hc = s->hc;
+	int64_t left, num;
+	size_t len;
+	char *ptr;
+
+	left = s->body_len + s->end - s->pos;
+	num  = MIN(left, (int64_t)h2->max_frame);
+	num  = MIN(num, s->window);
+	num  = MIN(num, h2->window);
+	if (num <= 0)
+		return 0;
+
+	ptr = frame_put(h2, FRAME_DATA, num == left ? FLAG_END_STREAM : 0, s->id, num);
+	len = MIN((size_t)num, s->body_len);
+	memcpy(ptr, s->body, len);
+	s->body     += len;
+	s->body_len -= len;
+	while ((size_t)num > len) {
+		size_t chunk = num - len;
+		char *data;
+
+		/* Large files are mapped a window at a time */
+		data = mmc_window(hc->file_address, &hc->sb, s->pos, &chunk);
+		if (!data) {
+			h2->out.len -= FRAME_HEADER + num;
+			stream_reset(h2, s, ERR_INTERNAL_ERROR);
+			return 0;
+		}
+		memcpy(ptr + len, data, chunk);
+		s->pos += chunk;
+		len    += chunk;
+	}
+
+	s->window  -= num;
+	h2->window -= num;
+	s->sent    += num;
+	if (num == left)
+		stream_done(h2, s);
+
+	return 1;
+}
+
+/* One frame per stream and round, so a large file does not hold up the
+** small ones requested after it.
+*/
+static void schedule(struct h2_conn *h2)
+{
+	struct h2_stream *s;
+	int more;
+
+	do {
+		more = 0;
+		LIST_FOREACH(s, h2->streams) {
+			if (h2->out.len >= H2_OUTBUF)
+				return;
+			if (s->ready)
+				more |= stream_data(h2, s);
+		}
+	} while (more && h2->window > 0);
+}
+
+
+static int conn_error(struct h2_conn *h2, int code)
+{
+	char *ptr;
+
+	if (!h2->failed) {
+		syslog(LOG_DEBUG, "%.80s: HTTP/2 connection error %d", httpd_client(h2->hc), code);
+
+		ptr = frame_put(h2, FRAME_GOAWAY, 0, 0, 8);
+		put32(ptr, h2->last_id);
+		put32(ptr + 4, code);
+	}
+	h2->goaway = 1;
+	h2->failed = 1;
+
+	return -1;
+}
+
+static void header_stream(struct h2_conn *h2, int bad, struct timeval *now)
+{
+	struct h2_stream *s;
+	uint32_t id = h2->hdr_id;
+
+	/* Trailers, or too late, the table is in sync so just ignore */
+	if (id <= h2->last_id)
+		return;
+	h2->last_id = id;
+
+	if (bad) {
+		frame_rst(h2, id, ERR_PROTOCOL_ERROR);
+		return;
+	}
+	if (h2->goaway || h2->num_streams >= H2_MAX_STREAMS) {
+		frame_rst(h2, id, ERR_REFUSED_STREAM);
+		return;
+	}
+
+	s = stream_new(h2, id);
+	if (!s) {
+		frame_rst(h2, id, ERR_REFUSED_STREAM);
+		return;
+	}
+	stream_request(h2, s, now);
+}
+
+static int header_block(struct h2_conn *h2, struct timeval *now)
+{
+	int bad = 0;
+	int rc;
+
+	h2->list.len = 0;
+	rc = hpack_decode(&h2->dec, (uint8_t *)h2->hdr.data, h2->hdr.len, &h2->list, &bad);
+	if (!rc)
+		header_stream(h2, bad, now);
+
+	/* Only the usual few hundred bytes are kept between blocks */
+	if (h2->list.size > H2_LIST_KEEP)
+		buf_free(&h2->list);
+
+	if (rc)
+		return conn_error(h2, rc > 0 ? ERR_ENHANCE_YOUR_CALM : ERR_COMPRESSION_ERROR);
+
+	return 0;
+}
+
+static int frame_headers_in(struct h2_conn *h2, int type, int flags, uint32_t id,
+			    const uint8_t *p, size_t len, struct timeval *now)
+{
+	size_t pad = 0;
+
+	if (type == FRAME_HEADERS) {
+		if (!id || !(id & 1))
+			return conn_error(h2, ERR_PROTOCOL_ERROR);
+
+		if (flags & FLAG_PADDED) {
+			if (len < 1)
+				return conn_error(h2, ERR_FRAME_SIZE);
+			pad = *p++;
+			len--;
+		}
+		if (flags & FLAG_PRIORITY) {
+			if (len < 5)
+				return conn_error(h2, ERR_FRAME_SIZE);
+			p += 5;
+			len -= 5;
+		}
+		if (pad > len)
+			return conn_error(h2, ERR_PROTOCOL_ERROR);
+		len -= pad;
+
+		h2->hdr.len = 0;
+		h2->hdr_id = id;
+		h2->hdr_end_stream = flags & FLAG_END_STREAM;
+	} else if (!h2->expect) {
+		return conn_error(h2, ERR_PROTOCOL_ERROR);
+	}
+
+	buf_add(&h2->hdr, p, len);
+	if (h2->hdr.len > H2_MAX_HEADERS)
+		return conn_error(h2, ERR_ENHANCE_YOUR_CALM);
+
+	if (!(flags & FLAG_END_HEADERS)) {
+		h2->expect = id;
+		return 0;
+	}
+	h2->expect = 0;
+
+	return header_block(h2, now);
+}
+
+static int frame_settings(struct h2_conn *h2, int flags, uint32_t id, const uint8_t *p, size_t len)
+{
+	struct h2_stream *s;
+	uint32_t val;
+	int64_t delta;
+	size_t i;
+
+	if (id)
+		return conn_error(h2, ERR_PROTOCOL_ERROR);
+	if (flags & FLAG_ACK)
+		return len ? conn_error(h2, ERR_FRAME_SIZE) : 0;
+	if (len % 6)
+		return conn_error(h2, ERR_FRAME_SIZE);
+
+	for (i = 0; i < len; i += 6) {
+		val = get32(&p[i + 2]);
+
+		switch (p[i] << 8 | p[i + 1]) {
+		case SETTINGS_HEADER_TABLE_SIZE:
+			val = MIN(val, HPACK_TABLE_SIZE);
+			if (val != h2->enc.max) {
+				h2->enc.max = val;
+				hpack_evict(&h2->enc, val);
+				h2->enc_update = 1;
+			}
+			break;
+
+		case SETTINGS_ENABLE_PUSH:
+			if (val > 1)
+				return conn_error(h2, ERR_PROTOCOL_ERROR);
+			break;
+
+		case SETTINGS_INITIAL_WINDOW_SIZE:
+			if (val > WINDOW_MAX)
+				return conn_error(h2, ERR_FLOW_CONTROL);
+
+			delta = (int64_t)val - h2->initial_window;
+			for (s = h2->streams; s; s = s->next)
+				s->window += delta;
+			h2->initial_window = val;
+			break;
+
+		case SETTINGS_MAX_FRAME_SIZE:
+			if (val < FRAME_SIZE || val > 0xffffff)
+				return conn_error(h2, ERR_PROTOCOL_ERROR);
+			h2->max_frame = MIN(val, H2_OUTBUF);
+			break;
+		}
+	}
+
+	frame_put(h2, FRAME_SETTINGS, FLAG_ACK, 0, 0);
+
+	return 0;
+}
+
+static int frame_window_update(struct h2_conn *h2, uint32_t id, const uint8_t *p, size_t len)
+{
+	struct h2_stream *s;
+	uint32_t inc;
+
+	if (len != 4)
+		return conn_error(h2, ERR_FRAME_SIZE);
+
+	inc = get32(p) & WINDOW_MAX;
+	if (!id) {
+		if (!inc)
+			return conn_error(h2, ERR_PROTOCOL_ERROR);
+		h2->window += inc;
+		if (h2->window > WINDOW_MAX)
+			return conn_error(h2, ERR_FLOW_CONTROL);
+		return 0;
+	}
+
+	s = stream_find(h2, id);
+	if (!s)
+		return 0;
+
+	if (!inc)
+		stream_reset(h2, s, ERR_PROTOCOL_ERROR);
+	else if ((s->window += inc) > WINDOW_MAX)
+		stream_reset(h2, s, ERR_FLOW_CONTROL);
+
+	return 0;
+}
+
+static int frame_in(struct h2_conn *h2, int type, int flags, uint32_t id,
+		    const uint8_t *p, size_t len, struct timeval *now)
+{
+	struct h2_stream *s;
+
+	if (h2->expect && (type != FRAME_CONTINUATION || id != h2->expect))
+		return conn_error(h2, ERR_PROTOCOL_ERROR);
+
+	switch (type) {
+	case FRAME_DATA:
+		if (!id)
+			return conn_error(h2, ERR_PROTOCOL_ERROR);
+
+		/* Bodies are not read, only made room for again */
+		h2->recv_used += len;
+		if (h2->recv_used >= WINDOW_SIZE / 2) {
+			frame_window(h2, 0, h2->recv_used);
+			h2->recv_used = 0;
+		}
+		break;
+
+	case FRAME_HEADERS:
+	case FRAME_CONTINUATION:
+		return frame_headers_in(h2, type, flags, id, p, len, now);
+
+	case FRAME_PRIORITY:
+		if (!id)
+			return conn_error(h2, ERR_PROTOCOL_ERROR);
+		if (len != 5)
+			return conn_error(h2, ERR_FRAME_SIZE);
+		break;
+
+	case FRAME_RST_STREAM:
+		if (!id)
+			return conn_error(h2, ERR_PROTOCOL_ERROR);
+		if (len != 4)
+			return conn_error(h2, ERR_FRAME_SIZE);
+
+		s = stream_find(h2, id);
+		if (s)
+			stream_free(h2, s, now);
+		break;
+
+	case FRAME_SETTINGS:
+		return frame_settings(h2, flags, id, p, len);
+
+	case FRAME_PUSH_PROMISE:
+		return conn_error(h2, ERR_PROTOCOL_ERROR);
+
+	case FRAME_PING:
+		if (id)
+			return conn_error(h2, ERR_PROTOCOL_ERROR);
+		if (len != 8)
+			return conn_error(h2, ERR_FRAME_SIZE);
+		if (!(flags & FLAG_ACK))
+			memcpy(frame_put(h2, FRAME_PING, FLAG_ACK, 0, 8), p, 8);
+		break;
+
+	case FRAME_GOAWAY:
+		h2->goaway = 1;
+		break;
+
+	case FRAME_WINDOW_UPDATE:
+		return frame_window_update(h2, id, p, len);
+
+	default:
+		break;		/* Unknown types are ignored */
+	}
+
+	return 0;
+}
+
+
+struct h2_conn *h2_open(struct http_conn *hc)
+{
+	struct h2_conn *h2;
+	char *ptr;
+
+	h2 = NEW(struct h2_conn, 1);
+	if (!h2)
+		return NULL;
+
+	if (!huff_nodes)
+		huff_init();
+
+	h2->hc = hc;
+	h2->window = h2->initial_window = WINDOW_SIZE;
+	h2->max_frame = FRAME_SIZE;
+	h2->dec.max = h2->enc.max = HPACK_TABLE_SIZE;
+
+	/* Our preface, the defaults are fine apart from the stream limit */
+	ptr = frame_put(h2, FRAME_SETTINGS, 0, 0, 6);
+	put16(ptr, SETTINGS_MAX_CONCURRENT_STREAMS);
+	put32(ptr + 2, H2_MAX_STREAMS);
+	h2_connections++;
+
+	return h2;
+}
+
+void h2_close(struct h2_conn *h2, struct timeval *now)
+{
+	struct h2_stream *s;
+
+	if (!h2)
+		return;
+
+	LIST_FOREACH(s, h2->streams)
+		stream_free(h2, s, now);
+
+	hpack_evict(&h2->dec, 0);
+	hpack_evict(&h2->enc, 0);
+	buf_free(&h2->hdr);
+	buf_free(&h2->list);
+	buf_free(&h2->block);
+	buf_free(&h2->in);
+	buf_free(&h2->out);
+	free(h2);
+}
+
+int h2_input(struct h2_conn *h2, const char *buf, size_t len, struct timeval *now)
+{
+	const uint8_t *p;
+	size_t num, off = 0;
+
+	if (h2->failed)
+		return -1;
+
+	if (h2->preface < H2_PREFACE_LEN) {
+		num = MIN(len, H2_PREFACE_LEN - h2->preface);
+		if (memcmp(buf, &H2_PREFACE[h2->preface], num))
+			return conn_error(h2, ERR_PROTOCOL_ERROR);
+
+		h2->preface += num;
+		buf += num;
+		len -= num;
+	}
+	buf_add(&h2->in, buf, len);
+
+	while (h2->in.len - off >= FRAME_HEADER) {
+		p = (uint8_t *)&h2->in.data[off];
+		num = p[0] << 16 | p[1] << 8 | p[2];
+		if (num > FRAME_SIZE)
+			return conn_error(h2, ERR_FRAME_SIZE);
+		if (h2->in.len - off < FRAME_HEADER + num)
+			break;
+
+		if (frame_in(h2, p[3], p[4], get32(&p[5]) & WINDOW_MAX, p + FRAME_HEADER, num, now))
+			return -1;
+		off += FRAME_HEADER + num;
+	}
+
+	h2->in.len -= off;
+	memmove(h2->in.data, &h2->in.data[off], h2->in.len);
+
+	return 0;
+}
+
+int h2_output(struct h2_conn *h2)
+{
+	struct iovec iov;
+	ssize_t rc;
+
+	while (1) {
+		if (h2->out_off == h2->out.len) {
+			h2->out_off = h2->out.len = 0;
+			if (!h2->failed)
+				schedule(h2);
+			if (!h2->out.len)
+				return 0;
+		}
+
+		iov.iov_base = &h2->out.data[h2->out_off];
+		iov.iov_len  = h2->out.len - h2->out_off;
+		rc = httpd_writev(h2->hc, &iov, 1);
+		if (rc < 0) {
+			if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) {
+				METRIC_INC(METRIC_WOULDBLOCKS);
+				return 1;
+			}
+			return -1;
+		}
+
+		h2->out_off += rc;
+		h2->hc->bytes_sent += rc;
+	}
+}
+
+void h2_shutdown(struct h2_conn *h2)
+{
+	char *ptr;
+
+	if (h2->goaway)
+		return;
+
+	ptr = frame_put(h2, FRAME_GOAWAY, 0, 0, 8);
+	put32(ptr, h2->last_id);
+	put32(ptr + 4, ERR_NO_ERROR);
+	h2->goaway = 1;
+}
+
+int h2_done(struct h2_conn *h2)
+{
+	if (h2->out_off < h2->out.len)
+		return 0;
+
+	return h2->failed || (h2->goaway && !h2->streams);
+}
+
+void h2_logstats(long secs)
+{
+	if (h2_connections + h2_streams == 0)
+		return;
+
+	syslog(LOG_INFO, "  h2 - %ld connections, %ld streams, %ld reset",
+	       h2_connections, h2_streams, h2_resets);
+	h2_connections = h2_streams = h2_resets = 0;
+}
@@ -0,0 +1,77 @@
+/* HTTP/2 framing, HPACK and stream multiplexing on top of libhttpd
+**
+** Copyright (C) 2026  The Merecat contributors
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions
+** are met:
+** 1. Redistributions of source code must retain the above copyright
+**    notice, this list of conditions and the following disclaimer.
+** 2. Redistributions in binary form must reproduce the above copyright
+**    notice, this list of conditions and the following disclaimer in the
+**    documentation and/or other materials provided with the distribution.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNERS OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+** THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef H2_H_
+#define H2_H_
+
+#include <sys/time.h>
+#include "libhttpd.h"
+
+/* Every HTTP/2 connection starts with this from the client, also used to
+** recognize clients with prior knowledge on plain HTTP.
+*/
+#define H2_PREFACE     "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_PREFACE_LEN 24
+
+struct h2_conn;
+
+/* Takes over connection hc, negotiated to HTTP/2 by ALPN or started with
+** the preface, and queues our SETTINGS.  Each stream gets a struct
+** http_conn of its own, run through the same request machinery, without
+** a socket.  Returns (struct h2_conn*) 0 on errors.
+*/
+extern struct h2_conn *h2_open(struct http_conn *hc);
+
+/* Frees all streams, the connection itself is closed by the caller */
+extern void h2_close(struct h2_conn *h2, struct timeval *now);
+
+/* Feeds len bytes read from the connection, starting with the preface.
+** Requests are served as soon as their headers are in, responses are
+** queued for h2_output().  Returns -1 on connection errors, a GOAWAY
+** is then queued, flush it with h2_output() before closing.
+*/
+extern int h2_input(struct h2_conn *h2, const char *buf, size_t len, struct timeval *now);
+
+/* Writes out queued frames, and DATA of the open streams round-robin,
+** as far as the flow control windows allow.  Returns 1 if the socket is
+** full, 0 if there is nothing more to send until the client has spoken,
+** or -1 on errors.
+*/
+extern int h2_output(struct h2_conn *h2);
+
+/* Graceful shutdown, queues a GOAWAY, streams already open are served */
+extern void h2_shutdown(struct h2_conn *h2);
+
+/* Returns 1 when the connection is done, after a GOAWAY either way, no
+** streams are left and all output is flushed.
+*/
+extern int h2_done(struct h2_conn *h2);
+
+/* Generate debugging statistics syslog message. */
+extern void h2_logstats(long secs);
+
+#endif /* H2_H_ */
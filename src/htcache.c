@@ -0,0 +1,437 @@
+/* Cache of parsed .htaccess and .htpasswd files, and verified credentials
+**
+** Copyright (C) 2026  The Merecat contributors
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions
+** are met:
+** 1. Redistributions of source code must retain the above copyright
+**    notice, this list of conditions and the following disclaimer.
+** 2. Redistributions in binary form must reproduce the above copyright
+**    notice, this list of conditions and the following disclaimer in the
+**    documentation and/or other materials provided with the distribution.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNERS OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+** THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <config.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "htcache.h"
+#include "libhttpd.h"
+#include "md5.h"
+
+extern char *crypt(const char *key, const char *setting);
+
+
+/* Defines. */
+#ifndef HTC_MAX_FILES
+#define HTC_MAX_FILES 64	/* parsed files, direct mapped on path */
+#endif
+#ifndef HTC_MAX_CREDS
+#define HTC_MAX_CREDS 256	/* verified credentials, direct mapped on digest */
+#endif
+#ifndef HTC_CRED_TTL
+#define HTC_CRED_TTL  60	/* seconds a verified credential is trusted */
+#endif
+
+#define HTC_TYPE_ACCESS 1
+#define HTC_TYPE_AUTH   2
+
+
+/* One line of an access file, action is 0 for lines that failed to parse. */
+struct rule {
+	int            action;
+	struct in_addr addr;
+	struct in_addr mask;
+	char          *line;	/* kept for error messages, unless a/A/d/D */
+};
+
+/* One line of a password file. */
+struct user {
+	char          *name;
+	char          *cryp;
+};
+
+struct htfile {
+	char          *path;
+	int            type;
+
+	/* Stat info, the cached copy is valid as long as these match */
+	dev_t          dev;
+	ino_t          ino;
+	off_t          size;
+	time_t         mtime;
+	time_t         ctime;
+
+	int            num;
+	struct rule   *rules;
+	struct user   *users;
+};
+
+struct cred {
+	u_int8_t       key[MD5_DIGEST_LENGTH];
+	dev_t          dev;
+	ino_t          ino;
+	time_t         mtime;
+	time_t         expires;
+};
+
+
+/* Globals. */
+static struct htfile *files[HTC_MAX_FILES];
+static struct cred    creds[HTC_MAX_CREDS];
+static long file_hits, file_misses, cred_hits, cred_misses;
+
+
+static unsigned int hash(const char *str)
+{
+	unsigned int h = 5381;
+
+	while (*str)
+		h = h * 33 + (unsigned char)*str++;
+
+	return h;
+}
+
+
+static int same_file(struct htfile *f, struct stat *sb)
+{
+	return f->dev   == sb->st_dev  &&
+	       f->ino   == sb->st_ino  &&
+	       f->size  == sb->st_size &&
+	       f->mtime == sb->st_mtime &&
+	       f->ctime == sb->st_ctime;
+}
+
+
+static void release(struct htfile *f)
+{
+	int i;
+
+	if (!f)
+		return;
+
+	for (i = 0; i < f->num; i++) {
+		if (f->rules)
+			free(f->rules[i].line);
+		if (f->users) {
+			free(f->users[i].name);
+			free(f->users[i].cryp);
+		}
+	}
+	free(f->rules);
+	free(f->users);
+	free(f->path);
+	free(f);
+}
+
+
+static void chomp(char *line)
+{
+	size_t len = strlen(line);
+
+	if (len > 0 && line[len - 1] == '\n')
+		line[len - 1] = '\0';
+}
+
+
+/* Lines are "allow|deny ADDR[/MASK]", where MASK is a prefix length or
+** a dotted quad.  Errors are not fatal here, they are recorded in the
+** rule and reported when the rule is reached, like they used to be.
+*/
+static int parse_access(struct htfile *f, FILE *fp)
+{
+	struct rule *r;
+	char line[500], copy[500];
+	char *addr, *addr1, *addr2, *mask;
+	long bits;
+	int max = 0;
+
+	while (fgets(line, sizeof(line), fp)) {
+		chomp(line);
+		strcpy(copy, line);
+
+		if (f->num >= max) {
+			max = max ? max * 2 : 8;
+			r = RENEW(f->rules, struct rule, max);
+			if (!r)
+				return -1;
+			f->rules = r;
+		}
+		r = &f->rules[f->num++];
+		memset(r, 0, sizeof(*r));
+		r->mask.s_addr = 0xffffffff;
+
+		addr1 = strrchr(line, ' ');
+		addr2 = strrchr(line, '\t');
+		if (addr1 > addr2)
+			addr = addr1;
+		else
+			addr = addr2;
+		if (!addr)
+			goto invalid;
+
+		mask = strchr(++addr, '/');
+		if (mask) {
+			*mask++ = '\0';
+			if (!*mask)
+				goto invalid;
+
+			if (!strchr(mask, '.')) {
+				bits = atol(mask);
+				if (bits < 0 || bits > 32)
+					goto invalid;
+
+				r->mask.s_addr = bits ? htonl((uint32_t)(0xffffffffUL << (32 - bits))) : 0;
+			} else {
+				if (!inet_aton(mask, &r->mask))
+					goto invalid;
+			}
+		}
+
+		if (!inet_aton(addr, &r->addr))
+			goto invalid;
+
+		r->action = line[0];
+		if (strchr("aAdD", r->action))
+			continue;
+	invalid:
+		r->line = strdup(copy);
+		if (!r->line)
+			return -1;
+	}
+
+	return 0;
+}
+
+
+static int parse_passwd(struct htfile *f, FILE *fp)
+{
+	struct user *u;
+	char line[500];
+	char *cryp;
+	int max = 0;
+
+	while (fgets(line, sizeof(line), fp)) {
+		chomp(line);
+
+		/* Split into user and encrypted password. */
+		cryp = strchr(line, ':');
+		if (!cryp)
+			continue;
+		*cryp++ = '\0';
+
+		if (f->num >= max) {
+			max = max ? max * 2 : 8;
+			u = RENEW(f->users, struct user, max);
+			if (!u)
+				return -1;
+			f->users = u;
+		}
+		u = &f->users[f->num];
+
+		u->name = strdup(line);
+		u->cryp = strdup(cryp);
+		f->num++;
+		if (!u->name || !u->cryp)
+			return -1;
+	}
+
+	return 0;
+}
+
+
+/* Returns the parsed file, from cache if still valid, or NULL if it
+** cannot be read.
+*/
+static struct htfile *lookup(const char *path, struct stat *sb, int type)
+{
+	struct htfile *f;
+	unsigned int h;
+	FILE *fp;
+	int rc;
+
+	h = hash(path) % HTC_MAX_FILES;
+	f = files[h];
+	if (f && f->type == type && same_file(f, sb) && strcmp(f->path, path) == 0) {
+		++file_hits;
+		return f;
+	}
+	++file_misses;
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return NULL;
+
+	f = NEW(struct htfile, 1);
+	if (!f) {
+		(void)fclose(fp);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	f->path  = strdup(path);
+	f->type  = type;
+	f->dev   = sb->st_dev;
+	f->ino   = sb->st_ino;
+	f->size  = sb->st_size;
+	f->mtime = sb->st_mtime;
+	f->ctime = sb->st_ctime;
+
+	if (type == HTC_TYPE_ACCESS)
+		rc = parse_access(f, fp);
+	else
+		rc = parse_passwd(f, fp);
+	(void)fclose(fp);
+
+	if (rc || !f->path) {
+		syslog(LOG_ERR, "out of memory parsing %.80s", path);
+		release(f);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	release(files[h]);
+	files[h] = f;
+
+	return f;
+}
+
+
+int htc_access(const char *path, struct stat *sb, struct in_addr *addr, const char **line)
+{
+	struct htfile *f;
+	struct rule *r;
+	int i;
+
+	f = lookup(path, sb, HTC_TYPE_ACCESS);
+	if (!f)
+		return HTC_EOPEN;
+
+	for (i = 0; i < f->num; i++) {
+		r = &f->rules[i];
+		if (!r->action)
+			goto invalid;
+
+		/*
+		 * Does client addr match this rule?
+		 * TODO: Generalize and add IPv6 support
+		 */
+		if ((addr->s_addr & r->mask.s_addr) != (r->addr.s_addr & r->mask.s_addr))
+			continue;
+
+		switch (r->action) {
+		case 'd':
+		case 'D':
+			break;
+
+		case 'a':
+		case 'A':
+			return HTC_ALLOW;
+
+		default:
+			goto invalid;
+		}
+	}
+
+	return HTC_DENY;
+invalid:
+	*line = r->line;
+	return HTC_EINVAL;
+}
+
+
+int htc_auth(const char *path, struct stat *sb, const char *name, const char *pass, time_t now)
+{
+	u_int8_t key[MD5_DIGEST_LENGTH];
+	struct htfile *f;
+	struct cred *c;
+	char *crypt_result;
+	MD5_CTX ctx;
+	int i;
+
+	/* Credentials are looked up, and stored, by digest only */
+	MD5Init(&ctx);
+	MD5Update(&ctx, (const u_int8_t *)path, strlen(path) + 1);
+	MD5Update(&ctx, (const u_int8_t *)name, strlen(name) + 1);
+	MD5Update(&ctx, (const u_int8_t *)pass, strlen(pass));
+	MD5Final(key, &ctx);
+
+	c = &creds[(key[0] | key[1] << 8) % HTC_MAX_CREDS];
+	if (memcmp(c->key, key, sizeof(key)) == 0 && now < c->expires &&
+	    c->dev == sb->st_dev && c->ino == sb->st_ino && c->mtime == sb->st_mtime) {
+		++cred_hits;
+		return HTC_ALLOW;
+	}
+	++cred_misses;
+
+	f = lookup(path, sb, HTC_TYPE_AUTH);
+	if (!f)
+		return HTC_EOPEN;
+
+	for (i = 0; i < f->num; i++) {
+		if (strcmp(f->users[i].name, name))
+			continue;
+
+		/* So is the password right? */
+		crypt_result = crypt(pass, f->users[i].cryp);
+		if (!crypt_result || strcmp(crypt_result, f->users[i].cryp))
+			return HTC_DENY;
+
+		memcpy(c->key, key, sizeof(key));
+		c->dev     = sb->st_dev;
+		c->ino     = sb->st_ino;
+		c->mtime   = sb->st_mtime;
+		c->expires = now + HTC_CRED_TTL;
+
+		return HTC_ALLOW;
+	}
+
+	/* Didn't find that user. */
+	return HTC_DENY;
+}
+
+
+void htc_destroy(void)
+{
+	int i;
+
+	for (i = 0; i < HTC_MAX_FILES; i++) {
+		release(files[i]);
+		files[i] = NULL;
+	}
+	memset(creds, 0, sizeof(creds));
+}
+
+
+/* Generate debugging statistics syslog message. */
+void htc_logstats(long secs)
+{
+	if (file_hits + file_misses + cred_hits + cred_misses == 0)
+		return;
+
+	syslog(LOG_INFO, "  htcache - %ld file hits, %ld misses, %ld credential hits, %ld misses",
+	       file_hits, file_misses, cred_hits, cred_misses);
+	file_hits = file_misses = cred_hits = cred_misses = 0;
+}
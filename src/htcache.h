@@ -0,0 +1,60 @@
+/* Cache of parsed .htaccess and .htpasswd files, and verified credentials
+**
+** Copyright (C) 2026  The Merecat contributors
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions
+** are met:
+** 1. Redistributions of source code must retain the above copyright
+**    notice, this list of conditions and the following disclaimer.
+** 2. Redistributions in binary form must reproduce the above copyright
+**    notice, this list of conditions and the following disclaimer in the
+**    documentation and/or other materials provided with the distribution.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNERS OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+** THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef HTCACHE_H_
+#define HTCACHE_H_
+
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <time.h>
+
+/* Return values from htc_access() and htc_auth() */
+#define HTC_ALLOW    1		/* access granted */
+#define HTC_DENY     0		/* address restriction, or bad user/password */
+#define HTC_EOPEN   -1		/* file exists but cannot be read, see errno */
+#define HTC_EINVAL  -2		/* invalid line in access file */
+
+/* Check client address against the access file at path.  The file is
+** parsed once and then reused until its stat info in sbP changes, so
+** pass in a fresh stat of the file.  On HTC_EINVAL the offending line
+** is returned in lineP.
+*/
+extern int htc_access(const char *path, struct stat *sbP, struct in_addr *addr, const char **lineP);
+
+/* Check user and password against the password file at path, parsed
+** and cached like htc_access().  Verified credentials are remembered,
+** by digest not in clear text, for a short while to save on crypt().
+*/
+extern int htc_auth(const char *path, struct stat *sbP, const char *user, const char *pass, time_t now);
+
+/* Free all storage, usually in preparation for exitting. */
+extern void htc_destroy(void);
+
+/* Generate debugging statistics syslog message. */
+extern void htc_logstats(long secs);
+
+#endif /* HTCACHE_H_ */
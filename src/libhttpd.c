@@ -50,6 +50,7 @@
 #include <stdarg.h>
 
 #include <stdint.h>		/* int64_t */
+#include <netinet/tcp.h>
 #include <inttypes.h>		/* PRId64 */
 
 #ifdef HAVE_OSRELDATE_H
@@ -58,6 +59,10 @@
 
 #include <wordexp.h>
 
+#ifdef HAVE_SYS_SENDFILE_H
+# include <sys/sendfile.h>
+#endif
+
 #ifdef HAVE_DIRENT_H
 # include <dirent.h>
 # define NAMLEN(dirent) strlen((dirent)->d_name)
@@ -75,17 +80,21 @@
 # endif
 #endif
 
-extern char *crypt(const char *key, const char *setting);
-extern FILE *tempfile(void);
-
+#include "accesslog.h"
 #include "base64.h"
+#include "cgicache.h"
+#include "fcgi.h"
 #include "file.h"
+#include "htcache.h"
 #include "libhttpd.h"
 #include "match.h"
-#include "md5.h"
 #include "merecat.h"
 #include "mmc.h"
+#include "probe.h"
+#include "scan.h"
+#include "ssi.h"
 #include "ssl.h"
+#include "statcache.h"
 #include "tdate_parse.h"
 #include "timers.h"
 
@@ -167,8 +176,10 @@ static int tilde_map_2(struct http_conn *hc);
 static int vhost_map(struct http_conn *hc);
 static char *expand_symlinks(char *path, char **trailer, int no_symlink_check, int tildemapped);
 static char *bufgets(struct http_conn *hc);
+static int got_request(struct http_conn *hc);
 static void de_dotdot(char *file);
-static void init_mime(void);
+static int init_mime(struct httpd *hs);
+static void free_mime(struct httpd *hs);
 static void figure_mime(struct http_conn *hc);
 
 #ifdef CGI_TIMELIMIT
@@ -176,8 +187,9 @@ static void cgi_kill2(arg_t arg, struct timeval *now);
 static void cgi_kill(arg_t arg, struct timeval *now);
 #endif
 #ifdef GENERATE_INDEXES
-static int ls(struct http_conn *hc);
+static int ls(struct http_conn *hc, struct timeval *now);
 #endif
+static off_t compress_cached(struct http_conn *hc, off_t length);
 static char *build_env(char *fmt, char *arg);
 
 #ifdef SERVER_NAME_LIST
@@ -185,10 +197,10 @@ static char *hostname_map(char *hostname);
 #endif
 static char **make_envp(struct http_conn *hc);
 static char **make_argp(struct http_conn *hc);
-static void cgi_interpose_input(struct http_conn *hc, int wfd);
-static void post_post_garbage_hack(struct http_conn *hc);
-static void cgi_interpose_output(struct http_conn *hc, int rfd);
-static void cgi_child(struct http_conn *hc);
+static int cgi_status(char *headers, char *br);
+static char *cgi_title(int status);
+static void cgi_child(struct http_conn *hc, int rfd, int wfd);
+static int fcgi(struct http_conn *hc);
 static int cgi(struct http_conn *hc);
 static void make_log_entry(struct http_conn *hc);
 static int check_referer(struct http_conn *hc);
@@ -210,17 +222,25 @@ static long long atoll(const char *str);
 */
 static int sub_process = 0;
 
+/* Listen sockets bound by the supervisor, one set for each worker, before
+** forking the workers.  They outlive the workers and are handed over to
+** the new process on reload, see httpd_listen_export().
+*/
+struct lsock {
+	int fd;
+	int id;			/* worker */
+	int used;
+};
+static struct lsock *lsocks;
+static int num_lsocks, max_lsocks;
+static int lsock_id = -1;
+
 
 static int set_cloexec(int sd)
 {
 	return fcntl(sd, F_SETFD, FD_CLOEXEC);
 }
 
-static int clear_cloexec(int sd)
-{
-	return fcntl(sd, F_SETFD, 0);
-}
-
 /* Set no-delay / non-blocking mode on a socket. */
 int httpd_set_ndelay(int sd)
 {
@@ -266,6 +286,8 @@ static void check_options(void)
 
 static void free_httpd_server(struct httpd *hs)
 {
+	if (hs->root_fd >= 0)
+		close(hs->root_fd);
 	if (hs->binding_hostname)
 		free(hs->binding_hostname);
 	if (hs->cwd)
@@ -276,10 +298,18 @@ static void free_httpd_server(struct httpd *hs)
 		free(hs->cgi_tracker);
 	if (hs->charset)
 		free(hs->charset);
+	free_mime(hs);
 	if (hs->url_pattern)
 		free(hs->url_pattern);
 	if (hs->local_pattern)
 		free(hs->local_pattern);
+	match_free(hs->cgi_match);
+	match_free(hs->php_match);
+	match_free(hs->ssi_match);
+	match_free(hs->fcgi_match);
+	match_free(hs->url_match);
+	match_free(hs->useragent_match);
+	fcgi_pool_exit(hs->fcgi);
 	free(hs);
 }
 
@@ -302,7 +332,7 @@ static void httpd_greeting(struct httpd *hs, sockaddr_t *sav4, sockaddr_t *sav6)
 
 	/* Port and enabled features in this server */
 	snprintf(buf, sizeof(buf), "port: %hu, vhost: %s, ssl: %s, php: %s, ssi: %s",
-		 hs->port, ENA(hs->vhost), ENA(hs->ctx), ENA(hs->php_cgi), ENA(hs->ssi_cgi));
+		 hs->port, ENA(hs->vhost), ENA(hs->ctx), ENA(hs->php_cgi), ENA(hs->ssi_match));
 
 	syslog(LOG_NOTICE, "%s starting on %s%s", PACKAGE_STRING, name, buf);
 }
@@ -342,6 +372,12 @@ int httpd_cgi_init(struct httpd *hs, int enabled, char *cgi_pattern, int cgi_lim
 		/* -2 for the offset, +1 for the '\0' */
 		memmove(cp + 1, cp + 2, strlen(cp) - 1);
 
+	hs->cgi_match = match_compile(hs->cgi_pattern);
+	if (!hs->cgi_match) {
+		syslog(LOG_CRIT, "Failed compiling CGI pattern: %s", strerror(errno));
+		return -1;
+	}
+
 	hs->cgi_tracker = calloc(cgi_limit, sizeof(pid_t));
 	hs->cgi_limit = cgi_limit;
 	hs->cgi_count = 0;
@@ -371,6 +407,17 @@ int httpd_redirect_add(struct httpd *hs, int code, char *pattern, char *location
 
 	LIST_INSERT(redirect, hs->redirect);
 
+	/* Recompile the set, all patterns are matched in a single pass */
+	match_free(hs->redirect_match);
+	hs->redirect_match = match_new();
+	if (!hs->redirect_match)
+		return -1;
+
+	LIST_FOREACH(redirect, hs->redirect) {
+		if (match_add(hs->redirect_match, redirect->pattern) < 0)
+			return -1;
+	}
+
 	return 0;
 }
 
@@ -380,16 +427,17 @@ void httpd_redirect_free(struct httpd *hs)
 
 	LIST_FOREACH(redirect, hs->redirect)
 		free(redirect);
+	match_free(hs->redirect_match);
 }
 
 /*
 ** Initialize HTTP locations
 **/
-int httpd_location_add(struct httpd *hs, char *pattern, char *path)
+int httpd_location_add(struct httpd *hs, char *pattern, char *path, int cache)
 {
 	struct http_location *loc;
 
-	if (!hs || !pattern || !path) {
+	if (!hs || !pattern || (!path && cache <= 0)) {
 		errno = EINVAL;
 		return -1;
 	}
@@ -400,9 +448,21 @@ int httpd_location_add(struct httpd *hs, char *pattern, char *path)
 
 	loc->pattern  = pattern;
 	loc->path     = path;
+	loc->cache    = cache;
 
 	LIST_INSERT(loc, hs->location);
 
+	/* Same as for redirects */
+	match_free(hs->location_match);
+	hs->location_match = match_new();
+	if (!hs->location_match)
+		return -1;
+
+	LIST_FOREACH(loc, hs->location) {
+		if (match_add(hs->location_match, loc->pattern) < 0)
+			return -1;
+	}
+
 	return 0;
 }
 
@@ -412,6 +472,183 @@ void httpd_location_free(struct httpd *hs)
 
 	LIST_FOREACH(loc, hs->location)
 		free(loc);
+	match_free(hs->location_match);
+}
+
+static int sockaddr_equal(sockaddr_t *a, sockaddr_t *b)
+{
+	if (a->sa.sa_family != b->sa.sa_family)
+		return 0;
+
+	switch (a->sa.sa_family) {
+	case AF_INET:
+		return a->sin.sin_port == b->sin.sin_port &&
+			a->sin.sin_addr.s_addr == b->sin.sin_addr.s_addr;
+
+#ifdef USE_IPV6
+	case AF_INET6:
+		return a->sin6.sin6_port == b->sin6.sin6_port &&
+			!memcmp(&a->sin6.sin6_addr, &b->sin6.sin6_addr, sizeof(a->sin6.sin6_addr));
+#endif
+	}
+
+	return 0;
+}
+
+/* Finds an unused listen socket of worker id bound to sa */
+static struct lsock *lsock_find(sockaddr_t *sa, int id)
+{
+	sockaddr_t local;
+	socklen_t len;
+	int i;
+
+	for (i = 0; i < num_lsocks; i++) {
+		if (lsocks[i].used || lsocks[i].id != id)
+			continue;
+
+		memset(&local, 0, sizeof(local));
+		len = sizeof(local);
+		if (getsockname(lsocks[i].fd, &local.sa, &len))
+			continue;
+
+		if (sockaddr_equal(&local, sa))
+			return &lsocks[i];
+	}
+
+	return NULL;
+}
+
+static int lsock_add(int fd, int id, int used)
+{
+	if (num_lsocks == max_lsocks) {
+		max_lsocks = max_lsocks ? max_lsocks * 2 : 8;
+		lsocks = RENEW(lsocks, struct lsock, max_lsocks);
+		if (!lsocks) {
+			syslog(LOG_CRIT, "out of memory allocating listen sockets");
+			exit(1);
+		}
+	}
+
+	lsocks[num_lsocks].fd   = fd;
+	lsocks[num_lsocks].id   = id;
+	lsocks[num_lsocks].used = used;
+	num_lsocks++;
+
+	return 0;
+}
+
+/* In a worker, take over the socket the supervisor bound for us */
+static int listen_socket(sockaddr_t *sa)
+{
+	struct lsock *ls;
+
+	ls = lsock_find(sa, lsock_id);
+	if (!ls)
+		return initialize_listen_socket(sa);
+
+	ls->used = 1;
+	return ls->fd;
+}
+
+int httpd_listen_bind(sockaddr_t *sa, int id)
+{
+	struct lsock *ls;
+	int fd;
+
+	ls = lsock_find(sa, id);
+	if (ls) {
+		ls->used = 1;
+		return 0;
+	}
+
+	fd = initialize_listen_socket(sa);
+	if (fd < 0)
+		return -1;
+
+	return lsock_add(fd, id, 1);
+}
+
+void httpd_listen_prune(int keep)
+{
+	int i, num = 0;
+
+	for (i = 0; i < num_lsocks; i++) {
+		if (!lsocks[i].used)
+			(void)close(lsocks[i].fd);
+		else if (keep)
+			lsocks[num++] = lsocks[i];
+	}
+
+	for (i = 0; i < num; i++)
+		lsocks[i].used = 0;
+	num_lsocks = num;
+}
+
+void httpd_listen_worker(int id)
+{
+	int i;
+
+	for (i = 0; i < num_lsocks; i++) {
+		if (lsocks[i].id != id)
+			lsocks[i].used = 0;
+		else
+			lsocks[i].used = 1;
+	}
+
+	/* Close the others, keep ours unused until claimed in httpd_listen() */
+	httpd_listen_prune(1);
+	lsock_id = id;
+}
+
+int httpd_listen_export(char *buf, size_t len)
+{
+	size_t pos = 0;
+	int i, rc;
+
+	buf[0] = 0;
+	for (i = 0; i < num_lsocks; i++) {
+		rc = snprintf(&buf[pos], len - pos, "%s%d:%d", i ? "," : "", lsocks[i].fd, lsocks[i].id);
+		if (rc < 0 || (size_t)rc >= len - pos)
+			return -1;
+		pos += rc;
+	}
+
+	return num_lsocks;
+}
+
+int httpd_listen_import(const char *str)
+{
+	sockaddr_t local;
+	socklen_t len;
+	int fd, id, num = 0;
+
+	while (str && sscanf(str, "%d:%d", &fd, &id) == 2) {
+		memset(&local, 0, sizeof(local));
+		len = sizeof(local);
+		if (fd >= 0 && !getsockname(fd, &local.sa, &len) && sockaddr_check(&local)) {
+			(void)set_cloexec(fd);
+			lsock_add(fd, id, 0);
+			num++;
+		}
+
+		str = strchr(str, ',');
+		if (str)
+			str++;
+	}
+
+	return num;
+}
+
+void httpd_listen_inherit(int on)
+{
+	int i;
+
+	for (i = 0; i < num_lsocks; i++) {
+		if (on)
+			(void)fcntl(lsocks[i].fd, F_SETFD, 0);
+		else
+			(void)set_cloexec(lsocks[i].fd);
+	}
 }
 
 /* Initialize listen sockets.  Try v6 first because of a Linux peculiarity;
@@ -423,11 +660,11 @@ int httpd_listen(struct httpd *hs, sockaddr_t *sav4, sockaddr_t *sav6)
 	if (!sav6)
 		hs->listen6_fd = -1;
 	else
-		hs->listen6_fd = initialize_listen_socket(sav6);
+		hs->listen6_fd = listen_socket(sav6);
 	if (!sav4)
 		hs->listen4_fd = -1;
 	else
-		hs->listen4_fd = initialize_listen_socket(sav4);
+		hs->listen4_fd = listen_socket(sav4);
 
 	/* If we didn't get any valid sockets, fail. */
 	if (hs->listen4_fd == -1 && hs->listen6_fd == -1)
@@ -454,6 +691,11 @@ struct httpd *httpd_init(char *hostname, unsigned short port, void *ssl_ctx, cha
 		return NULL;
 	}
 
+	/* Already in the document root, or the chroot */
+	hs->root_fd = file_root();
+	if (hs->root_fd < 0)
+		hs->root_fd = AT_FDCWD;
+
 	if (hostname) {
 		hs->binding_hostname = strdup(hostname);
 		if (!hs->binding_hostname) {
@@ -489,6 +731,23 @@ struct httpd *httpd_init(char *hostname, unsigned short port, void *ssl_ctx, cha
 
 	hs->charset = strdup(charset);
 	hs->max_age = max_age;
+	if (max_age == 0)
+		snprintf(hs->cache_hdr, sizeof(hs->cache_hdr), "Cache-Control: no-cache,no-stored\r\n");
+	else
+		snprintf(hs->cache_hdr, sizeof(hs->cache_hdr), "Cache-Control: max-age=%d\r\n", max_age);
+
+	/* Sent as is when shedding load, see httpd_shed_conn() */
+	hs->shed_len = snprintf(hs->shed_rsp, sizeof(hs->shed_rsp),
+				"\r\nServer: " EXPOSED_SERVER_SOFTWARE "\r\n"
+				"Retry-After: %d\r\n"
+				"Content-Type: text/plain; charset=%s\r\n"
+				"Content-Length: %zu\r\n"
+				"Connection: close\r\n"
+				"\r\n"
+				"%s\n", SHED_RETRY_AFTER, hs->charset,
+				strlen(httpd_err503title) + 1, httpd_err503title);
+	if (hs->shed_len >= sizeof(hs->shed_rsp))
+		hs->shed_len = sizeof(hs->shed_rsp) - 1;
 
 	hs->cwd = strdup(cwd);
 	if (!hs->cwd) {
@@ -520,6 +779,7 @@ struct httpd *httpd_init(char *hostname, unsigned short port, void *ssl_ctx, cha
 	}
 
 	hs->no_log = no_log;
+	hs->access_log = NULL;
 	hs->no_symlink_check = no_symlink_check;
 	hs->vhost = vhost;
 	hs->global_passwd = global_passwd;
@@ -528,11 +788,19 @@ struct httpd *httpd_init(char *hostname, unsigned short port, void *ssl_ctx, cha
 
 	hs->php_cgi = php_cgi;
 	hs->php_pattern = php_pattern;
+	hs->php_match = match_compile(php_pattern);
 
-	hs->ssi_cgi = ssi_cgi;
 	hs->ssi_pattern = ssi_pattern;
+	hs->ssi_match = match_compile(ssi_pattern);
+
+	hs->url_match = match_compile(hs->url_pattern);
+	hs->useragent_match = match_compile(useragent_deny);
 
-	init_mime();
+	if (!hs->charset || init_mime(hs)) {
+		syslog(LOG_CRIT, "out of memory formatting MIME types");
+		free_httpd_server(hs);
+		return NULL;
+	}
 
 	hs->listen4_fd = -1;
 	hs->listen6_fd = -1;
@@ -590,6 +858,26 @@ static int initialize_listen_socket(sockaddr_t *sa)
 		return -1;
 	}
 
+	/* Don't wake up until there is a request to read, then accept()
+	** and the first read() are all it takes to get started.
+	*/
+#if defined(TCP_DEFER_ACCEPT) && LISTEN_DEFER_ACCEPT > 0
+	{
+		int val = LISTEN_DEFER_ACCEPT;
+
+		if (setsockopt(listen_fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &val, sizeof(val)) < 0)
+			syslog(LOG_WARNING, "Failed enabling TCP_DEFER_ACCEPT: %s", strerror(errno));
+	}
+#endif
+#if defined(TCP_FASTOPEN) && LISTEN_FASTOPEN > 0
+	{
+		int val = LISTEN_FASTOPEN;
+
+		if (setsockopt(listen_fd, IPPROTO_TCP, TCP_FASTOPEN, &val, sizeof(val)) < 0)
+			syslog(LOG_WARNING, "Failed enabling TCP_FASTOPEN: %s", strerror(errno));
+	}
+#endif
+
 	/* Use accept filtering, if available. */
 #ifdef SO_ACCEPTFILTER
 	{
@@ -682,25 +970,31 @@ static char *err404form = "The requested URL '%s' was not found on this server.\
 char *httpd_err408title = "Request Timeout";
 char *httpd_err408form = "No request appeared within a reasonable time period.\n";
 
-static char *err500title = "Internal Error";
-static char *err500form = "There was an unusual problem serving the requested URL '%s'.\n";
+char *httpd_err500title = "Internal Error";
+char *httpd_err500form = "There was an unusual problem serving the requested URL '%s'.\n";
 
 static char *err501title = "Not Implemented";
 static char *err501form = "The requested method '%s' is not implemented by this server.\n";
 
+char *httpd_err502title = "Bad Gateway";
+char *httpd_err502form = "The requested URL '%s' could not be served, the backend is not responding.\n";
+
 char *httpd_err503title = "Service Temporarily Overloaded";
 char *httpd_err503form = "The requested URL '%s' is temporarily overloaded.  Please try again later.\n";
 
 
-/* Append a string to the buffer waiting to be sent as response. */
-static void add_response(struct http_conn *hc, const char *str)
+void httpd_add_response(struct http_conn *hc, const char *buf, size_t len)
 {
-	size_t len;
-
-	len = strlen(str);
 	httpd_realloc_str(&hc->response, &hc->maxresponse, hc->responselen + len);
-	memmove(&(hc->response[hc->responselen]), str, len + 1);
+	memmove(&(hc->response[hc->responselen]), buf, len);
 	hc->responselen += len;
+	hc->response[hc->responselen] = '\0';
+}
+
+/* Append a string to the buffer waiting to be sent as response. */
+static void add_response(struct http_conn *hc, const char *str)
+{
+	httpd_add_response(hc, str, strlen(str));
 }
 
 /* Send the buffered response. */
@@ -718,17 +1012,56 @@ void httpd_send_response(struct http_conn *hc)
 	}
 }
 
+/* Send a response generated in memory, e.g., the server status page. */
+void httpd_send_buf(struct http_conn *hc, const char *type, const char *buf, size_t len)
+{
+	struct iovec iov = { (void *)buf, len };
+
+	httpd_send_iov(hc, type, &iov, 1);
+}
+
+void httpd_send_iov(struct http_conn *hc, const char *type, struct iovec *iov, int num)
+{
+	size_t len = 0;
+	int i;
+
+	for (i = 0; i < num; i++)
+		len += iov[i].iov_len;
+
+	hc->compression_type = COMPRESSION_NONE;
+	hc->got_range = 0;
+	send_mime(hc, 200, ok200title, "", "", type, (off_t)len, (time_t)0);
+	if (hc->method == METHOD_HEAD)
+		return;
+
+	for (i = 0; i < num; i++)
+		httpd_add_response(hc, iov[i].iov_base, iov[i].iov_len);
+	hc->bytes_sent = len;
+}
+
+static const char *compression_name(int type)
+{
+	switch (type) {
+	case COMPRESSION_GZIP:
+		return "gzip";
+	case COMPRESSION_ZSTD:
+		return "zstd";
+	}
+
+	return NULL;
+}
+
 static int content_encoding(struct http_conn *hc, char *encodings, char *buf, size_t len)
 {
 	char *skip[] = {	/* Sorted in order of most likely */
 		"x-tar",
 		"octet-stream",
 	};
+	const char *name;
 	size_t i;
 	int hasenc = 0;
-	int addgz = 0;
+	int addenc = 0;
 	int ret = 0;
-	int gz;
 
 	/* Skip Content-Encoding for Content-Type intended for download */
 	for (i = 0; i < NELEMS(skip); i++) {
@@ -736,26 +1069,65 @@ static int content_encoding(struct http_conn *hc, char *encodings, char *buf, si
 			return 0;
 	}
 
-	gz = hc->compression_type == COMPRESSION_GZIP;
+	name = compression_name(hc->compression_type);
 	if (encodings && encodings[0]) {
 		hasenc = 1;
-		addgz  = gz && !strstr(encodings, "gzip");
+		addenc = name && !strstr(encodings, name);
 	}
 
 	if (hasenc)
-		ret = snprintf(buf, len, "Content-Encoding: %s%s\r\n", encodings, addgz ? ", gzip" : "");
-	else if (gz)
-		ret = snprintf(buf, len, "Content-Encoding: gzip\r\n");
+		ret = snprintf(buf, len, "Content-Encoding: %s%s%s\r\n", encodings,
+			       addenc ? ", " : "", addenc ? name : "");
+	else if (name)
+		ret = snprintf(buf, len, "Content-Encoding: %s\r\n", name);
 
 	return ret;
 }
 
+/* Appends a string literal, its length known at compile time */
+#define add_literal(hc, str) httpd_add_response(hc, str, sizeof(str) - 1)
+
+/* The current time as an RFC 1123 date, for Date: and Last-Modified: of
+** generated content.  Only reformatted when the second changes, so all
+** the responses within one second share the same strftime().
+*/
+static const char *http_date(time_t *now)
+{
+	static char date[32];
+	static time_t cached = (time_t)-1;
+	time_t t;
+
+	t = time(NULL);
+	if (t != cached) {
+		strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", gmtime(&t));
+		cached = t;
+	}
+	*now = t;
+
+	return date;
+}
+
+/* The status line, without the snprintf() */
+static void add_status(struct http_conn *hc, int status, const char *title)
+{
+	char code[5];
+
+	httpd_add_response(hc, hc->protocol, strnlen(hc->protocol, 20));
+	code[0] = ' ';
+	code[1] = '0' + (status / 100) % 10;
+	code[2] = '0' + (status / 10) % 10;
+	code[3] = '0' + status % 10;
+	code[4] = ' ';
+	httpd_add_response(hc, code, sizeof(code));
+	add_response(hc, title);
+	add_literal(hc, "\r\n");
+}
+
 static void
 send_mime(struct http_conn *hc, int status, char *title, char *encodings,
 	  const char *extraheads, const char *type, off_t length, time_t mod)
 {
 	time_t now;
-	const char *rfc1123fmt = "%a, %d %b %Y %H:%M:%S GMT";
 	char fixed_type[500];
 	char buf[1000];
 	int partial_content;
@@ -767,9 +1139,9 @@ send_mime(struct http_conn *hc, int status, char *title, char *encodings,
 	hc->status = status;
 	hc->bytes_to_send = length;
 	if (hc->mime_flag) {
-		char nowbuf[100];
-		char modbuf[100];
-		char etagbuf[45] = { 0 };
+		const char *date, *lastmod = NULL;
+		size_t len;
+		char etagbuf[80] = { 0 };
 
 		if (status == 200 && hc->got_range &&
 		    (hc->last_byte_index >= hc->first_byte_index) &&
@@ -784,30 +1156,37 @@ send_mime(struct http_conn *hc, int status, char *title, char *encodings,
 			hc->got_range = 0;
 		}
 
-		now = time(NULL);
-		if (!mod)
-			mod = now;
-		strftime(nowbuf, sizeof(nowbuf), rfc1123fmt, gmtime(&now));
-		strftime(modbuf, sizeof(modbuf), rfc1123fmt, gmtime(&mod));
-		snprintf(fixed_type, sizeof(fixed_type), type, hc->hs->charset);
-
-		/* Match Apache as close as possible, but follow RFC 2616, section 4.2 */
-		snprintf(buf, sizeof(buf),
-			 "%.20s %d %s\r\n"
-			 "Date: %s\r\n"
-			 "Server: %s\r\n"
-			 "Last-Modified: %s\r\n"
-			 "Accept-Ranges: bytes\r\n",
-			 hc->protocol, status, title, nowbuf, EXPOSED_SERVER_SOFTWARE, modbuf);
-		add_response(hc, buf);
+		/*
+		 * Match Apache as close as possible, but follow RFC 2616,
+		 * section 4.2.  The lines that do not change per request
+		 * are copied from formatted fragments: the date of this
+		 * second, and Last-Modified: kept with the mmc entry.
+		 */
+		date = http_date(&now);
+		add_status(hc, status, title);
+		add_literal(hc, "Date: ");
+		httpd_add_response(hc, date, strlen(date));
+		add_literal(hc, "\r\nServer: " EXPOSED_SERVER_SOFTWARE "\r\n");
+
+		if (hc->file_address && mod == hc->sb.st_mtime)
+			lastmod = mmc_lastmod(hc->file_address, &hc->sb, &len);
+		if (lastmod) {
+			httpd_add_response(hc, lastmod, len);
+		} else if (!mod || mod == now) {
+			add_literal(hc, "Last-Modified: ");
+			httpd_add_response(hc, date, strlen(date));
+			add_literal(hc, "\r\n");
+		} else {
+			len = strftime(buf, sizeof(buf), "Last-Modified: %a, %d %b %Y %H:%M:%S GMT\r\n", gmtime(&mod));
+			httpd_add_response(hc, buf, len);
+		}
+		add_literal(hc, "Accept-Ranges: bytes\r\n");
 
 		/* HTTP Strict Transport Security: https://www.chromium.org/hsts */
-		if (hc->ssl) {
-			snprintf(buf, sizeof(buf), "Strict-Transport-Security: "
-				 "max-age=31536000; includeSubDomains; "
-				 "preload\r\n");
-			add_response(hc, buf);
-		}
+		if (hc->ssl)
+			add_literal(hc, "Strict-Transport-Security: "
+				    "max-age=31536000; includeSubDomains; "
+				    "preload\r\n");
 
 		if (partial_content) {
 			snprintf(buf, sizeof(buf),
@@ -826,14 +1205,25 @@ send_mime(struct http_conn *hc, int status, char *title, char *encodings,
 				snprintf(buf, sizeof(buf), "Content-Length: %" PRId64 "\r\n", (int64_t)length);
 				add_response(hc, buf);
 			}
-		} else {
-// Experimental: Allow keep-alive also for dir listings etc.
-//			hc->do_keep_alive = 0;
 		}
 
-		snprintf(buf, sizeof(buf), "Content-Type: %s\r\n", fixed_type);
-		add_response(hc, buf);
-		if (strstr(fixed_type, "application/pdf")) {
+		/* Without a length the body ends when the connection does,
+		** anything after it, e.g. the response to a pipelined request,
+		** would be taken for more of the body.
+		*/
+		if (!partial_content && (length < 0 || hc->compression_type != COMPRESSION_NONE) &&
+		    status != 204 && status != 304 && hc->method != METHOD_HEAD)
+			hc->do_keep_alive = 0;
+
+		/* Preformatted by init_mime(), for the type of the file */
+		if (type == hc->type && hc->type_idx >= 0) {
+			add_response(hc, hc->hs->type_hdr[hc->type_idx]);
+		} else {
+			snprintf(fixed_type, sizeof(fixed_type), type, hc->hs->charset);
+			snprintf(buf, sizeof(buf), "Content-Type: %s\r\n", fixed_type);
+			add_response(hc, buf);
+		}
+		if (strstr(type, "application/pdf")) {
 			char *ptr = strrchr(hc->expnfilename, '/');
 
 			if (ptr)
@@ -848,31 +1238,38 @@ send_mime(struct http_conn *hc, int status, char *title, char *encodings,
 			add_response(hc, buf);
 
 		s100 = status / 100;
-		if (s100 != 2 && s100 != 3) {
-			snprintf(buf, sizeof(buf), "Cache-Control: no-cache,no-store\r\n");
-			add_response(hc, buf);
-		}
+		if (s100 != 2 && s100 != 3)
+			add_literal(hc, "Cache-Control: no-cache,no-store\r\n");
 
 		/* EntityTag -- https://en.wikipedia.org/wiki/HTTP_ETag */
 		if (hc->file_address) {
-			uint8_t dig[MD5_DIGEST_LENGTH];
-			MD5_CTX ctx;
-
-			MD5Init(&ctx);
-			MD5Update(&ctx, (const u_int8_t *)hc->file_address, length);
-			MD5Final(dig, &ctx);
-			snprintf(etagbuf, sizeof(etagbuf),
-				 "ETag: \"%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x\"\r\n",
-				 dig[0], dig[1], dig[2], dig[3], dig[4], dig[5], dig[6], dig[7],
-				 dig[8], dig[9], dig[10], dig[11], dig[12], dig[13], dig[14], dig[15]);
+			const char *tag;
+
+			switch (etag_mode) {
+			case ETAG_STRONG:
+				/* Digest is computed once per mmc entry */
+				tag = mmc_etag(hc->file_address, &hc->sb);
+				if (tag)
+					snprintf(etagbuf, sizeof(etagbuf), "ETag: %s\r\n", tag);
+				break;
+
+			case ETAG_WEAK:
+				/* Never touches the file contents, only stat() */
+				snprintf(etagbuf, sizeof(etagbuf), "ETag: W/\"%jx-%jx-%jx\"\r\n",
+					 (uintmax_t)hc->sb.st_ino, (uintmax_t)hc->sb.st_size,
+					 (uintmax_t)hc->sb.st_mtime);
+				break;
+
+			default:
+				break;
+			}
 		}
 
 		if (hc->hs->max_age >= 0) {
-			if (hc->hs->max_age == 0)
-				snprintf(buf, sizeof(buf), "Cache-Control: no-cache,no-stored\r\n");
-			else
-				snprintf(buf, sizeof(buf), "Cache-Control: max-age=%d\r\n%s", hc->hs->max_age, etagbuf);
-			add_response(hc, buf);
+			/* Preformatted by httpd_init() */
+			add_response(hc, hc->hs->cache_hdr);
+			if (hc->hs->max_age > 0)
+				add_response(hc, etagbuf);
 
 			/* Expires was superseded by Cache-Control in HTTP/1.1 */
 #ifdef USE_SUPERSEDED_EXPIRES
@@ -884,25 +1281,28 @@ send_mime(struct http_conn *hc, int status, char *title, char *encodings,
 			**       or embedded systems.
 			*/
 			expires = now + hc->hs->max_age;
-			strftime(expbuf, sizeof(expbuf), rfc1123fmt, gmtime(&expires));
+			strftime(expbuf, sizeof(expbuf), "%a, %d %b %Y %H:%M:%S GMT", gmtime(&expires));
 			snprintf(buf, sizeof(buf), "Expires: %s\r\n", expbuf);
 			add_response(hc, buf);
 #endif
 		}
 
 		if (hc->do_keep_alive)
-			snprintf(buf, sizeof(buf), "Connection: keep-alive\r\n");
+			add_literal(hc, "Connection: keep-alive\r\n");
 		else
-			snprintf(buf, sizeof(buf), "Connection: close\r\n");
-		add_response(hc, buf);
+			add_literal(hc, "Connection: close\r\n");
 
 		if (extraheads[0] != '\0')
 			add_response(hc, extraheads);
-		add_response(hc, "\r\n");
+		add_literal(hc, "\r\n");
 	}
 }
 
 
+#ifndef CONN_STR_MIN
+#define CONN_STR_MIN 64
+#endif
+
 static int str_alloc_count = 0;
 static size_t str_alloc_size = 0;
 
@@ -931,11 +1331,150 @@ void httpd_realloc_str(char **str, size_t *curr_len, size_t new_len)
 }
 
 
+/* The per-request strings of a connection, allocated from its arena */
+#define CONN_STR(name) { offsetof(struct http_conn, name), offsetof(struct http_conn, max##name) }
+static const struct {
+	size_t str, max;
+} conn_str[] = {
+	CONN_STR(decodedurl),
+	CONN_STR(origfilename),
+	CONN_STR(indexname),
+	CONN_STR(expnfilename),
+	CONN_STR(encodings),
+	CONN_STR(pathinfo),
+	CONN_STR(query),
+	CONN_STR(accept),
+	CONN_STR(accepte),
+	CONN_STR(reqhost),
+	CONN_STR(hostdir),
+	CONN_STR(remoteuser),
+#ifdef TILDE_MAP_2
+	CONN_STR(altdir),
+#endif
+#ifdef ACCESS_FILE
+	CONN_STR(accesspath),
+#endif
+#ifdef AUTH_FILE
+	CONN_STR(authpath),
+#endif
+};
+
+static int arena_spill_count = 0;
+
+static int in_arena(struct http_conn *hc, char *str)
+{
+	return str >= hc->arena && str < hc->arena + hc->arena_size;
+}
+
+/* Like httpd_realloc_str(), for one of the per-request strings.  Carved
+** out of the connection's arena, the last one allocated grows in place.
+** Strings that do not fit spill over to malloc(), until the next reset.
+*/
+void httpd_conn_str(struct http_conn *hc, char **str, size_t *curr_len, size_t new_len)
+{
+	size_t len, used;
+	char *ptr;
+
+	if (*curr_len > 0 && new_len <= *curr_len)
+		return;
+
+	if (*curr_len == 0)
+		len = MAX(CONN_STR_MIN, new_len + CONN_STR_MIN / 2);
+	else
+		len = MAX(*curr_len * 2, new_len * 5 / 4);
+
+	if (*str && in_arena(hc, *str)) {
+		/* Last one out of the arena, and room to grow? */
+		used = *str - hc->arena + *curr_len + 1;
+		if (used == hc->arena_used && hc->arena_used + len - *curr_len <= hc->arena_size) {
+			hc->arena_used += len - *curr_len;
+			*curr_len = len;
+			return;
+		}
+	}
+
+	if (hc->arena_used + len + 1 <= hc->arena_size) {
+		ptr = &hc->arena[hc->arena_used];
+		hc->arena_used += len + 1;
+	} else if (*str && !in_arena(hc, *str)) {
+		ptr = RENEW(*str, char, len + 1);
+		if (ptr) {
+			*str = ptr;
+			*curr_len = len;
+			return;
+		}
+	} else {
+		ptr = NEW(char, len + 1);
+		++arena_spill_count;
+	}
+
+	if (!ptr) {
+		syslog(LOG_ERR, "out of memory reallocating a string to %zu bytes", len);
+		exit(1);
+	}
+
+	if (*curr_len > 0)
+		memcpy(ptr, *str, *curr_len + 1);
+	*str = ptr;
+	*curr_len = len;
+}
+
+/* Free the strings that spilled over from the arena */
+static void arena_free(struct http_conn *hc)
+{
+	size_t i;
+
+	for (i = 0; i < NELEMS(conn_str); i++) {
+		char **str = (char **)((char *)hc + conn_str[i].str);
+		size_t *len = (size_t *)((char *)hc + conn_str[i].max);
+
+		if (*str && !in_arena(hc, *str))
+			free(*str);
+		*str = NULL;
+		*len = 0;
+	}
+	hc->arena_used = 0;
+}
+
+/* Start over with an empty arena, with room in each string for a short one */
+static void arena_reset(struct http_conn *hc)
+{
+	size_t i;
+
+	arena_free(hc);
+	for (i = 0; i < NELEMS(conn_str); i++) {
+		char **str = (char **)((char *)hc + conn_str[i].str);
+		size_t *len = (size_t *)((char *)hc + conn_str[i].max);
+
+		httpd_conn_str(hc, str, len, 0);
+	}
+}
+
+
+/* Error pages and redirects are rendered at the end of the response
+** buffer, from start, and then moved behind their headers, which need
+** the length.  Anything before start is held for earlier requests.
+*/
+static void send_page(struct http_conn *hc, int status, char *title, const char *extraheads, size_t start)
+{
+	static char *page;
+	static size_t maxpage = 0;
+	size_t len = hc->responselen - start;
+
+	httpd_realloc_str(&page, &maxpage, len);
+	memcpy(page, &hc->response[start], len);
+	hc->responselen = start;
+
+	send_mime(hc, status, title, "", extraheads, "text/html; charset=%s", (off_t)len, (time_t)0);
+	if (hc->method != METHOD_HEAD)
+		httpd_add_response(hc, page, len);
+}
+
 static void send_response(struct http_conn *hc, int status, char *title, const char *extraheads, char *form, char *arg)
 {
 	char defanged_arg[1000], buf[2000];
+	size_t start = hc->responselen;
 
-	send_mime(hc, status, title, "", extraheads, "text/html; charset=%s", (off_t) - 1, (time_t)0);
 	snprintf(buf, sizeof(buf), "<!DOCTYPE html>\n"
 		 "<html>\n"
 		 " <head>\n"
@@ -966,6 +1505,7 @@ static void send_response(struct http_conn *hc, int status, char *title, const c
 #endif
 	add_response(hc, "</p>");
 	send_response_tail(hc);
+	send_page(hc, status, title, extraheads, start);
 }
 
 static char *get_hostname(struct http_conn *hc)
@@ -1087,6 +1627,7 @@ void httpd_send_err(struct http_conn *hc, int status, char *title, const char *e
 #ifdef ERR_DIR
 static int send_err_file(struct http_conn *hc, int status, char *title, const char *extraheads, char *filename)
 {
+	size_t start = hc->responselen;
 	FILE *fp;
 	char buf[1000];
 	size_t r;
@@ -1095,7 +1636,6 @@ static int send_err_file(struct http_conn *hc, int status, char *title, const ch
 	if (!fp)
 		return 0;
 
-	send_mime(hc, status, title, "", extraheads, "text/html; charset=%s", (off_t) - 1, (time_t)0);
 	for (;;) {
 		r = fread(buf, 1, sizeof(buf) - 1, fp);
 		if (r == 0)
@@ -1108,6 +1648,7 @@ static int send_err_file(struct http_conn *hc, int status, char *title, const ch
 #ifdef ERR_APPEND_SERVER_INFO
 	send_response_tail(hc);
 #endif
+	send_page(hc, status, title, extraheads, start);
 
 	return 1;
 }
@@ -1131,7 +1672,7 @@ static char *find_htfile(char *topdir, char *dir, char *htfile)
 		char *ptr, *slash;
 		struct stat st;
 
-		rc = lstat(path, &st);
+		rc = stc_lstat(path, &st);
 
 		ptr = strstr(path, htfile);
 		if (!ptr)
@@ -1228,26 +1769,29 @@ static int access_check(struct http_conn *hc, char *dir)
 /* Returns -1 == unauthorized, 0 == no access file, 1 = authorized. */
 static int access_check2(struct http_conn *hc, char *dir)
 {
-	struct in_addr ipv4_addr, ipv4_mask = { 0xffffffff };
-	FILE *fp;
-	char line[500];
 	struct stat sb;
-	char *addr, *addr1, *addr2, *mask;
-	size_t l;
+	const char *line = NULL;
 
 	/* Construct access filename. */
-	httpd_realloc_str(&hc->accesspath, &hc->maxaccesspath, strlen(dir) + 1 + sizeof(ACCESS_FILE));
+	httpd_conn_str(hc, &hc->accesspath, &hc->maxaccesspath, strlen(dir) + 1 + sizeof(ACCESS_FILE));
 	snprintf(hc->accesspath, hc->maxaccesspath, "%s/%s", dir, ACCESS_FILE);
 
 	/* Does this directory have an access file? */
-	if (lstat(hc->accesspath, &sb) < 0) {
+	if (stc_lstat(hc->accesspath, &sb) < 0) {
 		/* Nope, let the request go through. */
 		return 0;
 	}
 
-	/* Open the access file. */
-	fp = fopen(hc->accesspath, "r");
-	if (!fp) {
+	/* The parsed file is cached, on the stat info of the target */
+	if (S_ISLNK(sb.st_mode) && stc_stat(hc->accesspath, &sb) < 0)
+		goto eopen;
+
+	switch (htc_access(hc->accesspath, &sb, &hc->client.sin.sin_addr, &line)) {
+	case HTC_ALLOW:
+		return 1;
+
+	case HTC_EOPEN:
+	eopen:
 		/* The file exists but we can't open it? Disallow access. */
 		syslog(LOG_ERR, "%.80s access file %.80s could not be opened: %s",
 		       httpd_client(hc), hc->accesspath, strerror(errno));
@@ -1257,84 +1801,20 @@ static int access_check2(struct http_conn *hc, char *dir)
 					  "The requested URL '%.80s' is protected by an access file. (2)"),
 			       hc->encodedurl);
 		return -1;
-	}
-
-	/* Read it. */
-	while (fgets(line, sizeof(line), fp)) {
-		/* Nuke newline. */
-		l = strlen(line);
-		if (line[l - 1] == '\n') line[l - 1] = '\0';
-
-		addr1 = strrchr(line, ' ');
-		addr2 = strrchr(line, '\t');
-		if (addr1 > addr2)
-			addr = addr1;
-		else
-			addr = addr2;
-
-		if (!addr) {
-		err:
-			(void)fclose(fp);
-			syslog(LOG_ERR, "%.80s access file %.80s: invalid line: %s",
-			       httpd_client(hc), hc->accesspath, line);
-			httpd_send_err(hc, 403, err403title, "",
-				       ERROR_FORM(err403form,
-						  "The requested URL '%.80s' is protected by an access file. (1)"),
-				       hc->encodedurl);
-			return -1;
-		}
-
-		mask = strchr(++addr, '/');
-		if (mask) {
-			*mask++ = '\0';
-			if (!*mask)
-				goto err;
 
-			if (!strchr(mask, '.')) {
-				long l = atol(mask);
-
-				if ((l < 0) || (l > 32))
-					goto err;
-
-				for (l = 32 - l; l > 0; --l)
-					ipv4_mask.s_addr ^= 1 << (l - 1);
-				ipv4_mask.s_addr = htonl(ipv4_mask.s_addr);
-			} else {
-				if (!inet_aton(mask, &ipv4_mask))
-					goto err;
-			}
-		}
-
-		if (!inet_aton(addr, &ipv4_addr))
-			goto err;
-
-		/*
-		 * Does client addr match this rule?
-		 * TODO: Generalize and add IPv6 support
-		 */
-		if ((hc->client.sin.sin_addr.s_addr & ipv4_mask.s_addr) ==
-		    (ipv4_addr.s_addr & ipv4_mask.s_addr)) {
-			/* Yes. */
-			switch (line[0]) {
-			case 'd':
-			case 'D':
-				break;
-
-			case 'a':
-			case 'A':
-				(void)fclose(fp);
-				return 1;
-
-			default:
-				goto err;
-			}
-		}
+	case HTC_EINVAL:
+		syslog(LOG_ERR, "%.80s access file %.80s: invalid line: %s",
+		       httpd_client(hc), hc->accesspath, line);
+		httpd_send_err(hc, 403, err403title, "",
+			       ERROR_FORM(err403form,
+					  "The requested URL '%.80s' is protected by an access file. (1)"),
+			       hc->encodedurl);
+		return -1;
 	}
 
 	httpd_send_err(hc, 403, err403title, "",
 		       ERROR_FORM(err403form, "The requested URL '%.80s' is protected by an address restriction."),
 		       hc->encodedurl);
-	(void)fclose(fp);
 
 	return -1;
 }
@@ -1427,23 +1907,18 @@ static int auth_check2(struct http_conn *hc, char *dir)
 	char *authpass;
 	char *colon;
 	int l;
-	FILE *fp;
-	char line[500];
-	char *cryp;
-	static time_t prevmtime;
-	char *crypt_result;
 
 	/* Construct auth filename. */
-	httpd_realloc_str(&hc->authpath, &hc->maxauthpath, strlen(dir) + 1 + sizeof(AUTH_FILE));
+	httpd_conn_str(hc, &hc->authpath, &hc->maxauthpath, strlen(dir) + 1 + sizeof(AUTH_FILE));
 	snprintf(hc->authpath, hc->maxauthpath, "%s/%s", dir, AUTH_FILE);
 
 	/* Does this directory have an auth file? */
-	if (lstat(hc->authpath, &sb) < 0)
+	if (stc_lstat(hc->authpath, &sb) < 0)
 		/* Nope, let the request go through. */
 		return 0;
 
 	/* If it was a symlink, check that the target exists */
-	if (stat(hc->authpath, &sb) < 0)
+	if (stc_stat(hc->authpath, &sb) < 0)
 		goto enoent;
 
 	/* Does this request contain basic authorization info? */
@@ -1470,29 +1945,14 @@ static int auth_check2(struct http_conn *hc, char *dir)
 	if (colon)
 		*colon = '\0';
 
-	/* See if we have a cached entry and can use it. */
-	if (hc->maxprevauthpath != 0 &&
-	    strcmp(hc->authpath, hc->prevauthpath) == 0 && sb.st_mtime == prevmtime && strcmp(authinfo, hc->prevuser) == 0) {
-		/* Yes.  Check against the cached encrypted password. */
-		crypt_result = crypt(authpass, hc->prevcryp);
-		if (!crypt_result)
-			return -1;
-
-		if (strcmp(crypt_result, hc->prevcryp) == 0) {
-			/* Ok! */
-			httpd_realloc_str(&hc->remoteuser, &hc->maxremoteuser, strlen(authinfo) + 1);
-			strcpy(hc->remoteuser, authinfo);
-			return 1;
-		}
-
-		/* No. */
-		send_authenticate(hc, dir);
-		return -1;
-	}
+	/* Parsed file and verified credentials are cached, see htcache.c */
+	switch (htc_auth(hc->authpath, &sb, authinfo, authpass, time(NULL))) {
+	case HTC_ALLOW:
+		httpd_conn_str(hc, &hc->remoteuser, &hc->maxremoteuser, strlen(authinfo) + 1);
+		strcpy(hc->remoteuser, authinfo);
+		return 1;
 
-	/* Open the password file. */
-	fp = fopen(hc->authpath, "r");
-	if (!fp) {
+	case HTC_EOPEN:
 	enoent:
 		/* The file exists but we can't open it?  Disallow access. */
 		syslog(LOG_ERR, "%.80s auth file %s could not be opened: %s",
@@ -1503,57 +1963,7 @@ static int auth_check2(struct http_conn *hc, char *dir)
 		return -1;
 	}
 
-	/* Read it. */
-	while (fgets(line, sizeof(line), fp)) {
-		/* Nuke newline. */
-		l = strlen(line);
-		if (line[l - 1] == '\n')
-			line[l - 1] = '\0';
-
-		/* Split into user and encrypted password. */
-		cryp = strchr(line, ':');
-		if (!cryp)
-			continue;
-		*cryp++ = '\0';
-
-		/* Is this the right user? */
-		if (strcmp(line, authinfo) == 0) {
-			/* Yes. */
-			(void)fclose(fp);
-
-			/* So is the password right? */
-			crypt_result = crypt(authpass, cryp);
-			if (!crypt_result)
-				return -1;
-
-			if (strcmp(crypt_result, cryp) == 0) {
-				/* Ok! */
-				httpd_realloc_str(&hc->remoteuser, &hc->maxremoteuser, strlen(line) + 1);
-				strcpy(hc->remoteuser, line);
-
-				/* And cache this user's info for next time. */
-				prevmtime = sb.st_mtime;
-
-				httpd_realloc_str(&hc->prevauthpath, &hc->maxprevauthpath, strlen(hc->authpath) + 1);
-				strcpy(hc->prevauthpath, hc->authpath);
-
-				httpd_realloc_str(&hc->prevuser, &hc->maxprevuser, strlen(authinfo) + 1);
-				strcpy(hc->prevuser, authinfo);
-
-				httpd_realloc_str(&hc->prevcryp, &hc->maxprevcryp, strlen(cryp) + 1);
-				strcpy(hc->prevcryp, cryp);
-
-				return 1;
-			}
-
-			/* No. */
-			send_authenticate(hc, dir);
-			return -1;
-		}
-	}
-
-	/* Didn't find that user.  Access denied. */
-	(void)fclose(fp);
+	/* Wrong password, or no such user.  Access denied. */
 	send_authenticate(hc, dir);
 
 	return -1;
@@ -1628,9 +2038,14 @@ static int send_redirect(struct http_conn *hc, struct http_redir *redirect)
 int httpd_redirect(struct http_conn *hc)
 {
 	struct http_redir *redirect;
+	int i;
+
+	i = match_find(hc->hs->redirect_match, hc->encodedurl, NULL);
+	if (i < 0)
+		return 0;
 
 	LIST_FOREACH(redirect, hc->hs->redirect) {
-		if (!match(redirect->pattern, hc->encodedurl))
+		if (i-- > 0)
 			continue;
 
 		/* If redirection fails we should drop the connection anyway */
@@ -1650,15 +2065,19 @@ int httpd_redirect(struct http_conn *hc)
 int httpd_location(struct http_conn *hc, char **url)
 {
 	struct http_location *loc;
+	int i, rc;
 
-	LIST_FOREACH(loc, hc->hs->location) {
-		int rc;
+	hc->cgc_ttl = 0;
+	i = match_find(hc->hs->location_match, hc->encodedurl, &rc);
+	if (i < 0)
+		return 0;
 
-		if (!loc->path)
+	LIST_FOREACH(loc, hc->hs->location) {
+		if (i-- > 0)
 			continue;
 
-		rc = match(loc->pattern, hc->encodedurl);
-		if (rc) {
+		hc->cgc_ttl = loc->cache;
+		if (loc->path) {
 			char *ptr = &hc->encodedurl[rc];
 			size_t plen, len;
 
@@ -1677,6 +2096,7 @@ int httpd_location(struct http_conn *hc, char **url)
 
 			return 1;
 		}
+		break;
 	}
 
 	return 0;
@@ -1807,7 +2227,7 @@ static int tilde_map_1(struct http_conn *hc)
 	strlcpy(temp, &hc->expnfilename[1], maxtemp);
 
 	len = strlen(prefix) + 2 + maxtemp;
-	httpd_realloc_str(&hc->expnfilename, &hc->maxexpnfilename, len);
+	httpd_conn_str(hc, &hc->expnfilename, &hc->maxexpnfilename, len);
 	strlcpy(hc->expnfilename, prefix, hc->maxexpnfilename);
 	if (prefix[0] != '\0')
 		strlcat(hc->expnfilename, "/", hc->maxexpnfilename);
@@ -1847,7 +2267,7 @@ static int tilde_map_2(struct http_conn *hc)
 
 	/* Set up altdir. */
 	len = strlen(pw->pw_dir) + 2 + strlen(postfix);
-	httpd_realloc_str(&hc->altdir, &hc->maxaltdir, len);
+	httpd_conn_str(hc, &hc->altdir, &hc->maxaltdir, len);
 	strlcpy(hc->altdir, pw->pw_dir, hc->maxaltdir);
 	if (postfix[0] != '\0') {
 		strlcat(hc->altdir, "/", hc->maxaltdir);
@@ -1858,12 +2278,12 @@ static int tilde_map_2(struct http_conn *hc)
 	if (rest[0] != '\0')
 		return 0;
 
-	httpd_realloc_str(&hc->altdir, &hc->maxaltdir, strlen(alt) + 1);
+	httpd_conn_str(hc, &hc->altdir, &hc->maxaltdir, strlen(alt) + 1);
 	strlcpy(hc->altdir, alt, hc->maxaltdir);
 
 	/* And the filename becomes altdir plus the post-~ part of the original. */
 	len = strlen(hc->altdir) + 2 + strlen(cp);
-	httpd_realloc_str(&hc->expnfilename, &hc->maxexpnfilename, len);
+	httpd_conn_str(hc, &hc->expnfilename, &hc->maxexpnfilename, len);
 	snprintf(hc->expnfilename, hc->maxexpnfilename, "%s/%s", hc->altdir, cp);
 
 	/* For this type of tilde mapping, we want to defeat vhost mapping. */
@@ -1933,7 +2353,7 @@ static int vhost_map(struct http_conn *hc)
 
 	/* Figure out the host directory. */
 #ifdef VHOST_DIRLEVELS
-	httpd_realloc_str(&hc->hostdir, &hc->maxhostdir, strlen(hc->hostname) + 2 * VHOST_DIRLEVELS);
+	httpd_conn_str(hc, &hc->hostdir, &hc->maxhostdir, strlen(hc->hostname) + 2 * VHOST_DIRLEVELS);
 	if (strncmp(hc->hostname, "www.", 4) == 0)
 		cp1 = &hc->hostname[4];
 	else
@@ -1960,14 +2380,14 @@ static int vhost_map(struct http_conn *hc)
 	}
 	strcpy(cp2, hc->hostname);
 #else /* VHOST_DIRLEVELS */
-	httpd_realloc_str(&hc->hostdir, &hc->maxhostdir, strlen(hc->hostname) + 1);
+	httpd_conn_str(hc, &hc->hostdir, &hc->maxhostdir, strlen(hc->hostname) + 1);
 	strlcpy(hc->hostdir, hc->hostname, hc->maxhostdir);
 #endif /* VHOST_DIRLEVELS */
 
 	/* Prepend hostdir to the filename. */
 	len  = strlen(hc->expnfilename);
 	temp = strdup(hc->expnfilename);
-	httpd_realloc_str(&hc->expnfilename, &hc->maxexpnfilename, strlen(hc->hostdir) + 2 + len);
+	httpd_conn_str(hc, &hc->expnfilename, &hc->maxexpnfilename, strlen(hc->hostdir) + 2 + len);
 	strlcpy(hc->expnfilename, hc->hostdir, hc->maxexpnfilename);
 
 	/* Skip any port number */
@@ -2019,7 +2439,7 @@ static char *expand_symlinks(char *path, char **trailer, int no_symlink_check, i
 		*/
 		struct stat sb;
 
-		if (stat(path, &sb) != -1) {
+		if (stc_stat(path, &sb) != -1) {
 			checkedlen = strlen(path) + 1;
 			httpd_realloc_str(&checked, &maxchecked, checkedlen);
 			strlcpy(checked, path, maxchecked);
@@ -2124,7 +2544,7 @@ static char *expand_symlinks(char *path, char **trailer, int no_symlink_check, i
 		if (checked[0] == '\0')
 			continue;
 
-		linklen = readlink(checked, link, sizeof(link) - 1);
+		linklen = stc_readlink(checked, link, sizeof(link) - 1);
 		if (linklen == -1) {
 			if (errno == EINVAL)
 				continue;	/* not a symlink */
@@ -2191,12 +2611,64 @@ static char *expand_symlinks(char *path, char **trailer, int no_symlink_check, i
 	return checked;
 }
 
+/* Without the stat cache expand_symlinks() costs a readlink() for each
+** component, and then the file is looked up again to stat and open it.
+** So first try opening the whole path in one go, below the document
+** root.  It fails on any symlink, unless they are not checked, and on
+** missing components, e.g. pathinfo, those take the long way.  The file
+** is kept open for mmc_map().
+*/
+static int resolve_open(struct http_conn *hc)
+{
+	char *path = hc->expnfilename;
+	size_t len;
+	int fd;
+
+	if (stat_cache || hc->tildemapped || path[0] == '/')
+		return 0;
+
+	fd = file_open(hc->hs->root_fd, path, !hc->hs->no_symlink_check);
+	if (fd < 0)
+		return 0;
+
+	if (fstat(fd, &hc->sb)) {
+		(void)close(fd);
+		return 0;
+	}
+	hc->open_fd = fd;
+
+	/* As expand_symlinks() would have it */
+	len = strlen(path);
+	while (len && path[len - 1] == '/')
+		path[--len] = '\0';
+	if (!len) {
+		httpd_conn_str(hc, &hc->expnfilename, &hc->maxexpnfilename, 2);
+		strcpy(hc->expnfilename, ".");
+	}
+
+	return 1;
+}
+
+
+/* The file opened by resolve_open() is only kept for the request */
+static void close_open(struct http_conn *hc)
+{
+	if (hc->open_fd >= 0) {
+		(void)close(hc->open_fd);
+		hc->open_fd = -1;
+	}
+}
 
 void httpd_close_conn(struct http_conn *hc, struct timeval *now)
 {
+	httpd_fcgi_close(hc);
+	httpd_cgi_close(hc);
+	close_open(hc);
+
 	if (hc->file_address) {
 		mmc_unmap(hc->file_address, &(hc->sb), now);
 		hc->file_address = NULL;
+		hc->file_fd = -1;
 	}
 
 	if (hc->conn_fd >= 0) {
@@ -2207,37 +2679,34 @@ void httpd_close_conn(struct http_conn *hc, struct timeval *now)
 }
 
 
+/* Releases all buffers of a connection, e.g., when it has been idle for
+** a while.  They are allocated again by httpd_init_conn_mem().
+*/
+void httpd_release_conn(struct http_conn *hc)
+{
+	if (!hc->initialized)
+		return;
+
+	free(hc->read_buf);
+	hc->read_buf = NULL;
+	hc->read_size = hc->read_idx = 0;
+	free(hc->response);
+	hc->response = NULL;
+	hc->maxresponse = hc->responselen = 0;
+
+	arena_free(hc);
+	free(hc->arena);
+	hc->arena = NULL;
+	hc->arena_size = 0;
+
+	hc->initialized = 0;
+}
+
 void httpd_destroy_conn(struct http_conn *hc)
 {
 	if (hc->initialized) {
-		free(hc->read_buf);
-		free(hc->decodedurl);
-		free(hc->origfilename);
-		free(hc->indexname);
-		free(hc->expnfilename);
-		free(hc->encodings);
-		free(hc->pathinfo);
-		free(hc->query);
-		free(hc->accept);
-		free(hc->accepte);
-		free(hc->reqhost);
-		free(hc->hostdir);
-		free(hc->remoteuser);
-		free(hc->response);
-#ifdef TILDE_MAP_2
-		free(hc->altdir);
-#endif
-#ifdef ACCESS_FILE
-		free(hc->accesspath);
-#endif
-#ifdef AUTH_FILE
-		free(hc->authpath);
-		free(hc->prevauthpath);
-		free(hc->prevuser);
-		free(hc->prevcryp);
-#endif
+		httpd_release_conn(hc);
 		httpd_ssl_shutdown(hc);
-		hc->initialized = 0;
 	}
 }
 
@@ -2248,52 +2717,34 @@ void httpd_init_conn_mem(struct http_conn *hc)
 
 	hc->read_size = 0;
 	httpd_realloc_str(&hc->read_buf, &hc->read_size, 16384);
-	hc->maxdecodedurl = hc->maxorigfilename =  hc->maxindexname =
-		hc->maxexpnfilename = hc->maxencodings = hc->maxpathinfo = hc->maxquery = hc->maxaccept =
-		hc->maxaccepte = hc->maxreqhost = hc->maxhostdir = hc->maxremoteuser = hc->maxresponse = 0;
-
-	httpd_realloc_str(&hc->decodedurl, &hc->maxdecodedurl, 1);
-	httpd_realloc_str(&hc->origfilename, &hc->maxorigfilename, 1);
-	httpd_realloc_str(&hc->indexname,  &hc->maxindexname, 1);
-	httpd_realloc_str(&hc->expnfilename, &hc->maxexpnfilename, 0);
-	httpd_realloc_str(&hc->encodings, &hc->maxencodings, 1);
-	httpd_realloc_str(&hc->pathinfo, &hc->maxpathinfo, 0);
-	httpd_realloc_str(&hc->query, &hc->maxquery, 0);
-	httpd_realloc_str(&hc->accept, &hc->maxaccept, 0);
-	httpd_realloc_str(&hc->accepte, &hc->maxaccepte, 0);
-	httpd_realloc_str(&hc->reqhost, &hc->maxreqhost, 0);
-	httpd_realloc_str(&hc->hostdir, &hc->maxhostdir, 0);
-	httpd_realloc_str(&hc->remoteuser, &hc->maxremoteuser, 0);
+	hc->maxresponse = 0;
 	httpd_realloc_str(&hc->response, &hc->maxresponse, 0);
+	hc->read_idx = hc->responselen = 0;
+	hc->response[0] = '\0';
 
-#ifdef TILDE_MAP_2
-	hc->maxaltdir = 0;
-	httpd_realloc_str(&hc->altdir, &hc->maxaltdir, 0);
-#endif
-
-#ifdef ACCESS_FILE
-	hc->maxaccesspath = 0;
-	httpd_realloc_str(&hc->accesspath, &hc->maxaccesspath, 0);
-#endif
-#ifdef AUTH_FILE
-	hc->maxauthpath = 0;
-	hc->maxprevauthpath = 0;
-	hc->maxprevuser = 0;
-	hc->maxprevcryp = 0;
-	httpd_realloc_str(&hc->authpath, &hc->maxauthpath, 0);
-	httpd_realloc_str(&hc->prevauthpath, &hc->maxprevauthpath, 0);
-	httpd_realloc_str(&hc->prevuser, &hc->maxprevuser, 0);
-	httpd_realloc_str(&hc->prevcryp, &hc->maxprevcryp, 0);
-#endif
+	hc->arena = NEW(char, CONN_ARENA_SIZE);
+	if (!hc->arena) {
+		syslog(LOG_ERR, "out of memory allocating a connection arena");
+		exit(1);
+	}
+	hc->arena_size = CONN_ARENA_SIZE;
+	hc->arena_used = 0;
 
 	hc->initialized = 1;
+	hc->open_fd = -1;
+	httpd_init_conn_content(hc);
 }
 
 
+/* Resets the per-request state, and the arena of its strings.  The read
+** buffer and any response not sent yet belong to the connection.
+*/
 void httpd_init_conn_content(struct http_conn *hc)
 {
+	arena_reset(hc);
+
 	hc->skip_redirect = 0;
-	hc->read_idx = 0;
+	hc->status_page = 0;
 	hc->checked_idx = 0;
 	hc->checked_state = CHST_FIRSTWORD;
 	hc->method = METHOD_UNKNOWN;
@@ -2320,15 +2771,14 @@ void httpd_init_conn_content(struct http_conn *hc)
 	hc->hostdir[0] = '\0';
 	hc->authorization = "";
 	hc->remoteuser[0] = '\0';
-	hc->response[0] = '\0';
 #ifdef TILDE_MAP_2
 	hc->altdir[0] = '\0';
 #endif
-	hc->responselen = 0;
 	hc->if_modified_since = (time_t)-1;
 	hc->range_if = (time_t)-1;
 	hc->contentlength = 0;
 	hc->type = "";
+	hc->type_idx = -1;
 	hc->hostname = NULL;
 	hc->mime_flag = 1;
 	hc->one_one = 0;
@@ -2340,7 +2790,59 @@ void httpd_init_conn_content(struct http_conn *hc)
 	hc->do_keep_alive = 0;
 	hc->should_linger = 0;
 	hc->file_address = NULL;
+	hc->file_fd = -1;
+	close_open(hc);
 	hc->compression_type = COMPRESSION_NONE;
+	hc->cgi_nph = 0;
+}
+
+/* Reinitialize a keep-alive connection for the next request.  Any bytes
+** read past the end of this request are pipelined requests, those are
+** moved to the front of the read buffer, unless they are the body of
+** this request.  Any response not sent yet is kept as well, it goes out
+** along with the response to the next request.
+*/
+size_t httpd_reset_conn(struct http_conn *hc)
+{
+	size_t len = 0;
+
+	if (hc->contentlength == 0 && hc->checked_idx < hc->read_idx) {
+		len = hc->read_idx - hc->checked_idx;
+		memmove(hc->read_buf, &hc->read_buf[hc->checked_idx], len);
+	}
+	hc->read_idx = len;
+	httpd_init_conn_content(hc);
+
+	return len;
+}
+
+/* Check for a complete request pipelined after this one in read_buf.  If
+** there is one, the response to this request is held back, and logged,
+** so it can be sent along with the next one in a single write.
+*/
+int httpd_hold_response(struct http_conn *hc)
+{
+	size_t idx;
+	int state, rc;
+
+	if (!hc->do_keep_alive || hc->contentlength > 0)
+		return 0;
+	if (hc->checked_idx >= hc->read_idx || hc->responselen >= PIPELINE_HOLD)
+		return 0;
+
+	idx   = hc->checked_idx;
+	state = hc->checked_state;
+	hc->checked_state = CHST_FIRSTWORD;
+	rc = got_request(hc);
+	hc->checked_idx   = idx;
+	hc->checked_state = state;
+	if (rc != GR_GOT_REQUEST)
+		return 0;
+
+	if (hc->responselen > 0)
+		make_log_entry(hc);
+
+	return 1;
 }
 
 
@@ -2351,10 +2853,15 @@ int httpd_get_conn(struct httpd *hs, int listen_fd, struct http_conn *hc)
 	char *address;
 
 	httpd_init_conn_mem(hc);
+	hc->read_idx = hc->responselen = 0;
 
-	/* Accept the new connection. */
+	/* Accept the new connection, non-blocking and close-on-exec. */
 	sz = sizeof(sa);
+#ifdef HAVE_ACCEPT4
+	hc->conn_fd = accept4(listen_fd, &sa.sa, &sz, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
 	hc->conn_fd = accept(listen_fd, &sa.sa, &sz);
+#endif
 	if (hc->conn_fd < 0) {
 		if (errno == EWOULDBLOCK)
 			return GC_NO_MORE;
@@ -2368,9 +2875,14 @@ int httpd_get_conn(struct httpd *hs, int listen_fd, struct http_conn *hc)
 		goto error;
 	}
 
+#ifndef HAVE_ACCEPT4
 	if (-1 == set_cloexec(hc->conn_fd))
 		syslog(LOG_ERR, "failed setting CLOEXEC on client socket: %s",
 		       strerror(errno));
+	if (-1 == httpd_set_ndelay(hc->conn_fd))
+		syslog(LOG_ERR, "failed setting client socket non-blocking: %s",
+		       strerror(errno));
+#endif
 
 	hc->hs = hs;
 	memset(&hc->client, 0, sizeof(hc->client));
@@ -2390,6 +2902,7 @@ int httpd_get_conn(struct httpd *hs, int listen_fd, struct http_conn *hc)
 			       httpd_client(hc), hc->errmsg);
 		goto error;
 	}
+	hc->cgi_rfd = hc->cgi_wfd = -1;
 	httpd_init_conn_content(hc);
 
 	return GC_OK;
@@ -2401,6 +2914,54 @@ error:
 	return GC_FAIL;
 }
 
+/* Accepts a connection only to turn it away, cheap enough to keep up with
+** a flood: no connection struct, no parsing, a canned 503 with Retry-After
+** and the connection is closed.  HTTPS connections are just closed, there
+** is no handshake to spend on them.
+*/
+int httpd_shed_conn(struct httpd *hs, int listen_fd)
+{
+	static const char status[] = "HTTP/1.1 503 Service Unavailable\r\nDate: ";
+	struct iovec iov[3];
+	char buf[4096];
+	time_t now;
+	int fd;
+
+#ifdef HAVE_ACCEPT4
+	fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+	fd = accept(listen_fd, NULL, NULL);
+#endif
+	if (fd < 0) {
+		if (errno == EWOULDBLOCK)
+			return GC_NO_MORE;
+
+		syslog(LOG_ERR, "accept: %s", strerror(errno));
+		return GC_FAIL;
+	}
+
+	if (!hs->ctx) {
+		/* The request, usually here already with TCP_DEFER_ACCEPT,
+		** must be read or close() sends a reset instead of the 503.
+		*/
+#ifndef HAVE_ACCEPT4
+		(void)httpd_set_ndelay(fd);
+#endif
+		(void)read(fd, buf, sizeof(buf));
+
+		iov[0].iov_base = (char *)status;
+		iov[0].iov_len  = sizeof(status) - 1;
+		iov[1].iov_base = (char *)http_date(&now);
+		iov[1].iov_len  = strlen(iov[1].iov_base);
+		iov[2].iov_base = hs->shed_rsp;
+		iov[2].iov_len  = hs->shed_len;
+		(void)writev(fd, iov, NELEMS(iov));
+	}
+	(void)close(fd);
+
+	return GC_OK;
+}
+
 
 /* Checks hc->read_buf to see whether a complete request has been read so far;
 ** either the first line has two words (an HTTP/0.9 request), or the first
@@ -2410,11 +2971,29 @@ error:
 ** have checked so far; and hc->checked_state is the current state of the
 ** finite state machine.
 */
-int httpd_got_request(struct http_conn *hc)
+static int got_request(struct http_conn *hc)
 {
+	const char *end = &hc->read_buf[hc->read_idx];
 	char c;
 
 	for (; hc->checked_idx < hc->read_idx; ++hc->checked_idx) {
+		/* Within a word or a header line only whitespace and line
+		** ends change state, skip to the next one a vector at a time.
+		*/
+		switch (hc->checked_state) {
+		case CHST_FIRSTWORD:
+		case CHST_SECONDWORD:
+		case CHST_THIRDWORD:
+			hc->checked_idx = scan_word(&hc->read_buf[hc->checked_idx], end) - hc->read_buf;
+			break;
+
+		case CHST_LINE:
+			hc->checked_idx = scan_eol(&hc->read_buf[hc->checked_idx], end) - hc->read_buf;
+			break;
+		}
+		if (hc->checked_idx >= hc->read_idx)
+			break;
+
 		c = hc->read_buf[hc->checked_idx];
 		switch (hc->checked_state) {
 		case CHST_FIRSTWORD:
@@ -2597,10 +3176,167 @@ int httpd_got_request(struct http_conn *hc)
 	return GR_NO_REQUEST;
 }
 
+int httpd_got_request(struct http_conn *hc)
+{
+	static unsigned long req_count = 0;
+	int rc;
+
+	rc = got_request(hc);
+	if (rc == GR_GOT_REQUEST) {
+		hc->req_id = ++req_count;
+		PROBE3(request, hc->conn_fd, hc->req_id, hc->checked_idx);
+	}
+
+	return rc;
+}
+
+
+/* A q-value, "0" .. "1.000", in 1/1000 */
+static int qvalue(const char *cp)
+{
+	int val, scale;
+
+	if (*cp != '0' && *cp != '1')
+		return 0;
+
+	val = (*cp++ - '0') * 1000;
+	if (*cp == '.') {
+		for (cp++, scale = 100; scale && isdigit((unsigned char)*cp); cp++, scale /= 10)
+			val += (*cp - '0') * scale;
+	}
+
+	return MIN(val, 1000);
+}
+
+/* Parses Accept-Encoding into hc->accept_q[] for the codings we know.
+** Codings not listed get the q-value of "*", or are not acceptable.
+** Neither are codings the client wants less than no coding, identity,
+** which is as good as any unless listed, or "*" is.
+*/
+static void accept_encoding(struct http_conn *hc)
+{
+	static const char *name[ENCODING_NUM] = { "gzip", "br", "zstd" };
+	int q[ENCODING_NUM] = { -1, -1, -1 };
+	int identity = -1;
+	int any = -1;
+	char *cp, *end, *param;
+	size_t len;
+	int i, val;
+
+	for (cp = hc->accepte; *cp; cp = end) {
+		cp += strspn(cp, " \t,");
+		end = cp + strcspn(cp, ",");
+		len = strcspn(cp, " \t,;");
+
+		val = 1000;
+		param = memchr(cp, ';', end - cp);
+		while (param) {
+			param++;
+			param += strspn(param, " \t");
+			if ((*param == 'q' || *param == 'Q') && param[1] == '=')
+				val = qvalue(param + 2);
+			param = memchr(param, ';', end - param);
+		}
+
+		if (len == 1 && *cp == '*') {
+			any = val;
+			continue;
+		}
+		if (len == 8 && !strncasecmp(cp, "identity", len)) {
+			identity = val;
+			continue;
+		}
+		if (len == 6 && !strncasecmp(cp, "x-gzip", len))
+			cp += 2, len -= 2;
+
+		for (i = 0; i < ENCODING_NUM; i++) {
+			if (len == strlen(name[i]) && !strncasecmp(cp, name[i], len))
+				q[i] = val;
+		}
+	}
+
+	if (identity < 0)
+		identity = any < 0 ? 1000 : any;
+	for (i = 0; i < ENCODING_NUM; i++) {
+		hc->accept_q[i] = q[i] < 0 ? MAX(any, 0) : q[i];
+		if (hc->accept_q[i] < identity)
+			hc->accept_q[i] = 0;
+	}
+}
+
+/* The request headers we look at, see header_id() */
+enum {
+	HDR_UNKNOWN = 0,
+	HDR_ACCEPT,
+	HDR_ACCEPT_ENCODING,
+	HDR_ACCEPT_LANGUAGE,
+	HDR_AUTHORIZATION,
+	HDR_CONNECTION,
+	HDR_CONTENT_LENGTH,
+	HDR_CONTENT_TYPE,
+	HDR_COOKIE,
+	HDR_HOST,
+	HDR_IF_MODIFIED_SINCE,
+	HDR_IF_RANGE,
+	HDR_RANGE,
+	HDR_REFERER,
+	HDR_USER_AGENT,
+	HDR_X_FORWARDED_FOR,
+};
+
+#define HDR_KEY(len, c)       ((len) << 8 | (c))
+#define HDR_MATCH(str, id)    (strncasecmp(name, str, len) ? HDR_UNKNOWN : id)
+
+/* Returns the HDR_* of a header name, len bytes up to the colon.  The
+** length and first letter leave at most two candidates to compare.
+*/
+static int header_id(const char *name, size_t len)
+{
+	if (len > 0xff)
+		return HDR_UNKNOWN;
+
+	switch (HDR_KEY(len, tolower((unsigned char)name[0]))) {
+	case HDR_KEY(4, 'h'):
+		return HDR_MATCH("Host", HDR_HOST);
+	case HDR_KEY(5, 'r'):
+		return HDR_MATCH("Range", HDR_RANGE);
+	case HDR_KEY(6, 'a'):
+		return HDR_MATCH("Accept", HDR_ACCEPT);
+	case HDR_KEY(6, 'c'):
+		return HDR_MATCH("Cookie", HDR_COOKIE);
+	case HDR_KEY(7, 'r'):
+		return HDR_MATCH("Referer", HDR_REFERER);
+	case HDR_KEY(8, 'i'):
+		return HDR_MATCH("If-Range", HDR_IF_RANGE);
+	case HDR_KEY(8, 'r'):	/* Old name of If-Range */
+		return HDR_MATCH("Range-If", HDR_IF_RANGE);
+	case HDR_KEY(10, 'c'):
+		return HDR_MATCH("Connection", HDR_CONNECTION);
+	case HDR_KEY(10, 'u'):
+		return HDR_MATCH("User-Agent", HDR_USER_AGENT);
+	case HDR_KEY(12, 'c'):
+		return HDR_MATCH("Content-Type", HDR_CONTENT_TYPE);
+	case HDR_KEY(13, 'a'):
+		return HDR_MATCH("Authorization", HDR_AUTHORIZATION);
+	case HDR_KEY(14, 'c'):
+		return HDR_MATCH("Content-Length", HDR_CONTENT_LENGTH);
+	case HDR_KEY(15, 'a'):
+		if (tolower((unsigned char)name[7]) == 'e')
+			return HDR_MATCH("Accept-Encoding", HDR_ACCEPT_ENCODING);
+		return HDR_MATCH("Accept-Language", HDR_ACCEPT_LANGUAGE);
+	case HDR_KEY(15, 'x'):
+		return HDR_MATCH("X-Forwarded-For", HDR_X_FORWARDED_FOR);
+	case HDR_KEY(17, 'i'):
+		return HDR_MATCH("If-Modified-Since", HDR_IF_MODIFIED_SINCE);
+	}
+
+	return HDR_UNKNOWN;
+}
 
 int httpd_parse_request(struct http_conn *hc)
 {
 	size_t len;
+	int hdr;
 	char *buf;
 	char *method_str;
 	char *url, *url_proto;
@@ -2664,7 +3400,7 @@ int httpd_parse_request(struct http_conn *hc)
 			return -1;
 		}
 
-		httpd_realloc_str(&hc->reqhost, &hc->maxreqhost, strlen(reqhost));
+		httpd_conn_str(hc, &hc->reqhost, &hc->maxreqhost, strlen(reqhost));
 		strlcpy(hc->reqhost, reqhost, hc->maxreqhost);
 		*url = '/';
 	}
@@ -2699,16 +3435,16 @@ int httpd_parse_request(struct http_conn *hc)
 	if (httpd_location(hc, &cp)) {
 		hc->skip_redirect = 1;
 
-		httpd_realloc_str(&hc->decodedurl, &hc->maxdecodedurl, strlen(cp) + 1);
+		httpd_conn_str(hc, &hc->decodedurl, &hc->maxdecodedurl, strlen(cp) + 1);
 		strdecode(hc->decodedurl, cp);
 
 		free(cp);
 	} else {
-		httpd_realloc_str(&hc->decodedurl, &hc->maxdecodedurl, strlen(hc->encodedurl) + 1);
+		httpd_conn_str(hc, &hc->decodedurl, &hc->maxdecodedurl, strlen(hc->encodedurl) + 1);
 		strdecode(hc->decodedurl, hc->encodedurl);
 	}
 
-	httpd_realloc_str(&hc->origfilename, &hc->maxorigfilename, strlen(hc->decodedurl));
+	httpd_conn_str(hc, &hc->origfilename, &hc->maxorigfilename, strlen(hc->decodedurl));
 	strlcpy(hc->origfilename, &hc->decodedurl[1], hc->maxorigfilename);
 	/* Special case for top-level URL. */
 	if (hc->origfilename[0] == '\0')
@@ -2718,7 +3454,7 @@ int httpd_parse_request(struct http_conn *hc)
 	cp = strchr(hc->encodedurl, '?');
 	if (cp) {
 		++cp;
-		httpd_realloc_str(&hc->query, &hc->maxquery, strlen(cp) + 1);
+		httpd_conn_str(hc, &hc->query, &hc->maxquery, strlen(cp) + 1);
 		strlcpy(hc->query, cp, hc->maxquery);
 		/* Remove query from (decoded) origfilename. */
 		cp = strchr(hc->origfilename, '?');
@@ -2740,24 +3476,33 @@ int httpd_parse_request(struct http_conn *hc)
 			if (buf[0] == '\0')
 				break;
 
-			if (strncasecmp(buf, "Referer:", 8) == 0) {
-				cp = &buf[8];
+			/* The value starts after the colon, name dispatched by length and first letter */
+			cp = strchr(buf, ':');
+			hdr = cp ? header_id(buf, cp - buf) : HDR_UNKNOWN;
+			if (cp)
+				cp++;
+
+			switch (hdr) {
+			case HDR_REFERER:
 				cp += strspn(cp, " \t");
 				hc->referer = cp;
-			} else if (strncasecmp(buf, "User-Agent:", 11) == 0) {
-				cp = &buf[11];
+				break;
+
+			case HDR_USER_AGENT:
 				cp += strspn(cp, " \t");
 				hc->useragent = cp;
-			} else if (strncasecmp(buf, "Host:", 5) == 0) {
-				cp = &buf[5];
+				break;
+
+			case HDR_HOST:
 				cp += strspn(cp, " \t");
 				hc->hdrhost = cp;
 				if (strchr(hc->hdrhost, '/') || hc->hdrhost[0] == '.') {
 					httpd_send_err(hc, 400, httpd_err400title, "", httpd_err400form, "7");
 					return -1;
 				}
-			} else if (strncasecmp(buf, "Accept:", 7) == 0) {
-				cp = &buf[7];
+				break;
+
+			case HDR_ACCEPT:
 				cp += strspn(cp, " \t");
 				if (hc->accept[0] != '\0') {
 					if (strlen(hc->accept) > 5000) {
@@ -2765,13 +3510,14 @@ int httpd_parse_request(struct http_conn *hc)
 						continue;
 					}
 					len = strlen(hc->accept) + 2 + strlen(cp);
-					httpd_realloc_str(&hc->accept, &hc->maxaccept, len);
+					httpd_conn_str(hc, &hc->accept, &hc->maxaccept, len);
 					strlcat(hc->accept, ", ", hc->maxaccept);
 				} else
-					httpd_realloc_str(&hc->accept, &hc->maxaccept, strlen(cp) + 1);
+					httpd_conn_str(hc, &hc->accept, &hc->maxaccept, strlen(cp) + 1);
 				strlcat(hc->accept, cp, hc->maxaccept);
-			} else if (strncasecmp(buf, "Accept-Encoding:", 16) == 0) {
-				cp = &buf[16];
+				break;
+
+			case HDR_ACCEPT_ENCODING:
 				cp += strspn(cp, " \t");
 				if (hc->accepte[0] != '\0') {
 					if (strlen(hc->accepte) > 5000) {
@@ -2780,26 +3526,31 @@ int httpd_parse_request(struct http_conn *hc)
 						continue;
 					}
 					len = strlen(hc->accepte) + 2 + strlen(cp);
-					httpd_realloc_str(&hc->accepte, &hc->maxaccepte, len);
+					httpd_conn_str(hc, &hc->accepte, &hc->maxaccepte, len);
 					strlcat(hc->accepte, ", ", hc->maxaccepte);
 				} else {
-					httpd_realloc_str(&hc->accepte, &hc->maxaccepte, strlen(cp) + 1);
+					httpd_conn_str(hc, &hc->accepte, &hc->maxaccepte, strlen(cp) + 1);
 				}
-				strlcpy(hc->accepte, cp, hc->maxaccepte);
-			} else if (strncasecmp(buf, "Accept-Language:", 16) == 0) {
-				cp = &buf[16];
+				strlcat(hc->accepte, cp, hc->maxaccepte);
+				break;
+
+			case HDR_ACCEPT_LANGUAGE:
 				cp += strspn(cp, " \t");
 				hc->acceptl = cp;
-			} else if (strncasecmp(buf, "If-Modified-Since:", 18) == 0) {
-				cp = &buf[18];
+				break;
+
+			case HDR_IF_MODIFIED_SINCE:
 				hc->if_modified_since = tdate_parse(cp);
 				if (hc->if_modified_since == (time_t)-1)
 					syslog(LOG_DEBUG, "unparsable time: %s", cp);
-			} else if (strncasecmp(buf, "Cookie:", 7) == 0) {
-				cp = &buf[7];
+				break;
+
+			case HDR_COOKIE:
 				cp += strspn(cp, " \t");
 				hc->cookie = cp;
-			} else if (strncasecmp(buf, "Range:", 6) == 0) {
+				break;
+
+			case HDR_RANGE:
 				/* Only support %d- and %d-%d, not %d-%d,%d-%d or -%d. */
 				if (!strchr(buf, ',')) {
 					char *cp_dash;
@@ -2821,35 +3572,41 @@ int httpd_parse_request(struct http_conn *hc)
 						}
 					}
 				}
-			} else if (strncasecmp(buf, "Range-If:", 9) == 0 || strncasecmp(buf, "If-Range:", 9) == 0) {
-				cp = &buf[9];
+				break;
+
+			case HDR_IF_RANGE:
 				hc->range_if = tdate_parse(cp);
 				if (hc->range_if == (time_t)-1)
 					syslog(LOG_DEBUG, "unparsable time: %s", cp);
-			} else if (strncasecmp(buf, "Content-Type:", 13) == 0) {
-				cp = &buf[13];
+				break;
+
+			case HDR_CONTENT_TYPE:
 				cp += strspn(cp, " \t");
 				hc->contenttype = cp;
-			} else if (strncasecmp(buf, "Content-Length:", 15) == 0) {
-				cp = &buf[15];
+				break;
+
+			case HDR_CONTENT_LENGTH:
 				hc->contentlength = (size_t)atol(cp);
-			} else if (strncasecmp(buf, "Authorization:", 14) == 0) {
-				cp = &buf[14];
+				break;
+
+			case HDR_AUTHORIZATION:
 				cp += strspn(cp, " \t");
 				hc->authorization = cp;
-			} else if (strncasecmp(buf, "Connection:", 11) == 0) {
-				cp = &buf[11];
+				break;
+
+			case HDR_CONNECTION:
 				cp += strspn(cp, " \t");
 				if (strcasecmp(cp, "keep-alive") == 0) {
 					hc->keep_alive = 1;     /* Client signaling */
 					hc->do_keep_alive = 10; /* Our intention, which might change later */
 				}
-			} else if (strncasecmp(buf, "X-Forwarded-For:", 16) == 0) {
+				break;
+
+			case HDR_X_FORWARDED_FOR: {
 				sockaddr_t sa;
 				char *client;
 
 				/* Syntax: X-Forwarded-For: client[, proxy1, proxy2, ...] */
-				cp  = &buf[16];
 				cp += strspn(cp, " \t");
 
 				client = cp;
@@ -2876,50 +3633,53 @@ int httpd_parse_request(struct http_conn *hc)
 				}
 
 				strlcpy(hc->client.address, sa.address, sizeof(hc->client.address));
+				break;
 			}
+
 			/*
 			 * Possibly add support for X-Real-IP: here?
 			 * http://distinctplace.com/infrastructure/2014/04/23/story-behind-x-forwarded-for-and-x-real-ip-headers/
 			 */
+			default:
 #ifdef LOG_UNKNOWN_HEADERS
-			else if (strncasecmp(buf, "Accept-Charset:", 15)   == 0 ||
-				 strncasecmp(buf, "Accept-Language:", 16)  == 0 ||
-				 strncasecmp(buf, "Agent:", 6)             == 0 ||
-				 strncasecmp(buf, "Cache-Control:", 14)    == 0 ||
-				 strncasecmp(buf, "Cache-Info:", 11)       == 0 ||
-				 strncasecmp(buf, "Charge-To:", 10)        == 0 ||
-				 strncasecmp(buf, "Client-IP:", 10)        == 0 ||
-				 strncasecmp(buf, "Date:", 5)              == 0 ||
-				 strncasecmp(buf, "Extension:", 10)        == 0 ||
-				 strncasecmp(buf, "Forwarded:", 10)        == 0 ||
-				 strncasecmp(buf, "From:", 5)              == 0 ||
-				 strncasecmp(buf, "HTTP-Version:", 13)     == 0 ||
-				 strncasecmp(buf, "Max-Forwards:", 13)     == 0 ||
-				 strncasecmp(buf, "Message-Id:", 11)       == 0 ||
-				 strncasecmp(buf, "MIME-Version:", 13)     == 0 ||
-				 strncasecmp(buf, "Negotiate:", 10)        == 0 ||
-				 strncasecmp(buf, "Pragma:", 7)            == 0 ||
-				 strncasecmp(buf, "Proxy-Agent:", 12)      == 0 ||
-				 strncasecmp(buf, "Proxy-Connection:", 17) == 0 ||
-				 strncasecmp(buf, "Security-Scheme:", 16)  == 0 ||
-				 strncasecmp(buf, "Session-Id:", 11)       == 0 ||
-				 strncasecmp(buf, "UA-Color:", 9)          == 0 ||
-				 strncasecmp(buf, "UA-CPU:", 7)            == 0 ||
-				 strncasecmp(buf, "UA-Disp:", 8)           == 0 ||
-				 strncasecmp(buf, "UA-OS:", 6)             == 0 ||
-				 strncasecmp(buf, "UA-Pixels:", 10)        == 0 ||
-				 strncasecmp(buf, "User:", 5)              == 0 ||
-				 strncasecmp(buf, "Via:", 4)               == 0 ||
-				 strncasecmp(buf, "X-", 2)                 == 0) {
-				; /* ignore */
-			} else {
-				syslog(LOG_DEBUG, "unknown request header: %s", buf);
-			}
+				if (strncasecmp(buf, "Accept-Charset:", 15)   == 0 ||
+				    strncasecmp(buf, "Agent:", 6)             == 0 ||
+				    strncasecmp(buf, "Cache-Control:", 14)    == 0 ||
+				    strncasecmp(buf, "Cache-Info:", 11)       == 0 ||
+				    strncasecmp(buf, "Charge-To:", 10)        == 0 ||
+				    strncasecmp(buf, "Client-IP:", 10)        == 0 ||
+				    strncasecmp(buf, "Date:", 5)              == 0 ||
+				    strncasecmp(buf, "Extension:", 10)        == 0 ||
+				    strncasecmp(buf, "Forwarded:", 10)        == 0 ||
+				    strncasecmp(buf, "From:", 5)              == 0 ||
+				    strncasecmp(buf, "HTTP-Version:", 13)     == 0 ||
+				    strncasecmp(buf, "Max-Forwards:", 13)     == 0 ||
+				    strncasecmp(buf, "Message-Id:", 11)       == 0 ||
+				    strncasecmp(buf, "MIME-Version:", 13)     == 0 ||
+				    strncasecmp(buf, "Negotiate:", 10)        == 0 ||
+				    strncasecmp(buf, "Pragma:", 7)            == 0 ||
+				    strncasecmp(buf, "Proxy-Agent:", 12)      == 0 ||
+				    strncasecmp(buf, "Proxy-Connection:", 17) == 0 ||
+				    strncasecmp(buf, "Security-Scheme:", 16)  == 0 ||
+				    strncasecmp(buf, "Session-Id:", 11)       == 0 ||
+				    strncasecmp(buf, "UA-Color:", 9)          == 0 ||
+				    strncasecmp(buf, "UA-CPU:", 7)            == 0 ||
+				    strncasecmp(buf, "UA-Disp:", 8)           == 0 ||
+				    strncasecmp(buf, "UA-OS:", 6)             == 0 ||
+				    strncasecmp(buf, "UA-Pixels:", 10)        == 0 ||
+				    strncasecmp(buf, "User:", 5)              == 0 ||
+				    strncasecmp(buf, "Via:", 4)               == 0 ||
+				    strncasecmp(buf, "X-", 2)                 == 0)
+					; /* ignore */
+				else
+					syslog(LOG_DEBUG, "unknown request header: %s", buf);
 #endif /* LOG_UNKNOWN_HEADERS */
+				break;
+			}
 		}
 	}
 
-	if (match(useragent_deny, hc->useragent)) {
+	if (match_exec(hc->hs->useragent_match, hc->useragent)) {
 		syslog(LOG_INFO, "%s matches pattern, denied!", hc->useragent);
 		httpd_send_err(hc, 403, err403title, "",
 			       ERROR_FORM(err403form,
@@ -2939,33 +3699,26 @@ int httpd_parse_request(struct http_conn *hc)
 		}
 
 		/* If the client wants to do keep-alives, it might also be doing
-		** pipelining.  There's no way for us to tell.  Since we don't
-		** implement keep-alives yet, if we close such a connection there
-		** might be unread pipelined requests waiting.  So, we have to
-		** do a lingering close.
+		** pipelining.  Pipelined requests already read are kept across
+		** requests, see httpd_reset_conn(), but if we end up closing such
+		** a connection there might be unread requests waiting.  So, we
+		** have to do a lingering close.
 		*/
 		if (hc->keep_alive)
 			hc->should_linger = 1;
 	}
 
-	/* Look for a gzip accept-encoding */
-	if (hc->accepte[0] != '\0') {
-		char *gz;
-
-		gz = strstr(hc->accepte, "gzip");
-		if (gz) {
-			char *c, *q;
-			float qval = 0.0f;
-
-			c = strstr(gz, ",");
-			q = strstr(gz, "q=");
-			if (q)
-				qval = strtof(q + 2, 0);
-
-			if (!q || c < q || ((!c || q < c) && qval > 0.0f))
-				hc->compression_type = COMPRESSION_GZIP;
-		}
-	}
+	/* Negotiate on-the-fly compression, zstd is cheaper if accepted
+	** at least as much.  Precompressed files, see mod_headers().
+	*/
+	accept_encoding(hc);
+	if (hc->accept_q[ENCODING_GZIP] > 0)
+		hc->compression_type = COMPRESSION_GZIP;
+#ifdef HAVE_ZSTD
+	if (hc->accept_q[ENCODING_ZSTD] > 0 &&
+	    hc->accept_q[ENCODING_ZSTD] >= hc->accept_q[ENCODING_GZIP])
+		hc->compression_type = COMPRESSION_ZSTD;
+#endif
 
 	/*
 	**  Disable keep alive support for bad browsers,
@@ -2976,12 +3729,18 @@ int httpd_parse_request(struct http_conn *hc)
 	     strstr(hc->useragent, "MSIE 4.0b2;")))
 		hc->do_keep_alive = 0;
 
+	/* The built-in status page has no file to resolve */
+	if (status_path && !strcmp(hc->origfilename, &status_path[1])) {
+		hc->status_page = 1;
+		return 0;
+	}
+
 	/* Ok, the request has been parsed.  Now we resolve stuff that
 	** may require the entire request.
 	*/
 
 	/* Copy original filename to expanded filename. */
-	httpd_realloc_str(&hc->expnfilename, &hc->maxexpnfilename, strlen(hc->origfilename) + 1);
+	httpd_conn_str(hc, &hc->expnfilename, &hc->maxexpnfilename, strlen(hc->origfilename) + 1);
 	strlcpy(hc->expnfilename, hc->origfilename, hc->maxexpnfilename);
 
 	/* Tilde mapping. */
@@ -3004,7 +3763,7 @@ int httpd_parse_request(struct http_conn *hc)
 	if (!hc->skip_redirect && hc->hs->vhost) {
 		if (!vhost_map(hc)) {
 			/* If we get here vhost_map() has logged the error */
-			httpd_send_err(hc, 500, err500title, "", err500form, hc->encodedurl);
+			httpd_send_err(hc, 500, httpd_err500title, "", httpd_err500form, hc->encodedurl);
 			return -1;
 		}
 	}
@@ -3012,23 +3771,25 @@ int httpd_parse_request(struct http_conn *hc)
 	/* Expand all symbolic links in the filename.  This also gives us
 	** any trailing non-existing components, for pathinfo.
 	*/
+	if (resolve_open(hc))
+		goto resolved;
 	cp = expand_symlinks(hc->expnfilename, &pi, hc->hs->no_symlink_check, hc->tildemapped);
 	if (!cp) {
 		/* If we get here expand_symlinks() has logged the error */
-		httpd_send_err(hc, 500, err500title, "", err500form, hc->encodedurl);
+		httpd_send_err(hc, 500, httpd_err500title, "", httpd_err500form, hc->encodedurl);
 		return -1;
 	}
 
 	/* Fall back to shared (restricted) top-level directory for missing files */
 	if (!hc->skip_redirect && hc->hs->vhost && is_vhost_shared(pi)) {
-		httpd_realloc_str(&hc->expnfilename, &hc->maxexpnfilename, strlen(pi) + 1);
+		httpd_conn_str(hc, &hc->expnfilename, &hc->maxexpnfilename, strlen(pi) + 1);
 		strlcpy(hc->expnfilename, pi, hc->maxexpnfilename);
-		httpd_realloc_str(&hc->pathinfo, &hc->maxpathinfo, 1);
+		httpd_conn_str(hc, &hc->pathinfo, &hc->maxpathinfo, 1);
 		strlcpy(hc->pathinfo, "", hc->maxpathinfo);
 	} else {
-		httpd_realloc_str(&hc->expnfilename, &hc->maxexpnfilename, strlen(cp) + 1);
+		httpd_conn_str(hc, &hc->expnfilename, &hc->maxexpnfilename, strlen(cp) + 1);
 		strlcpy(hc->expnfilename, cp, hc->maxexpnfilename);
-		httpd_realloc_str(&hc->pathinfo, &hc->maxpathinfo, strlen(pi) + 1);
+		httpd_conn_str(hc, &hc->pathinfo, &hc->maxpathinfo, strlen(pi) + 1);
 		strlcpy(hc->pathinfo, pi, hc->maxpathinfo);
 	}
 
@@ -3075,30 +3836,32 @@ int httpd_parse_request(struct http_conn *hc)
 		}
 	}
 
+resolved:
 	return 0;
 }
 
 
 static char *bufgets(struct http_conn *hc)
 {
-	int i;
+	const char *eol;
+	size_t i;
 	char c;
 
-	for (i = hc->checked_idx; hc->checked_idx < hc->read_idx; ++hc->checked_idx) {
-		c = hc->read_buf[hc->checked_idx];
-		if (c == '\n' || c == '\r') {
-			hc->read_buf[hc->checked_idx] = '\0';
-			++hc->checked_idx;
-			if (c == '\r' && hc->checked_idx < hc->read_idx && hc->read_buf[hc->checked_idx] == '\n') {
-				hc->read_buf[hc->checked_idx] = '\0';
-				++hc->checked_idx;
-			}
+	i = hc->checked_idx;
+	eol = scan_eol(&hc->read_buf[i], &hc->read_buf[hc->read_idx]);
+	hc->checked_idx = eol - hc->read_buf;
+	if (hc->checked_idx >= hc->read_idx)
+		return NULL;
 
-			return &(hc->read_buf[i]);
-		}
+	c = hc->read_buf[hc->checked_idx];
+	hc->read_buf[hc->checked_idx] = '\0';
+	++hc->checked_idx;
+	if (c == '\r' && hc->checked_idx < hc->read_idx && hc->read_buf[hc->checked_idx] == '\n') {
+		hc->read_buf[hc->checked_idx] = '\0';
+		++hc->checked_idx;
 	}
 
-	return NULL;
+	return &(hc->read_buf[i]);
 }
 
 
@@ -3152,77 +3915,114 @@ static void de_dotdot(char *file)
 
 
 struct mime_entry {
-	char *ext;
-	size_t ext_len;
-	char *val;
-	size_t val_len;
+	const char *ext;	/* lowercase */
+	size_t      ext_len;
+	const char *val;
+	size_t      val_len;
+	const char *hdr;	/* Content-Type header, for the type table */
+	int         charset;	/* val and hdr have a %s for the charset */
 };
 
-static struct mime_entry enc_tab[] = {
+/* Perfect hash tables, generated by make_mime.pl */
 #include "mime_encodings.h"
-};
+#include "mime_types.h"
 
-static const int n_enc_tab = sizeof(enc_tab) / sizeof(*enc_tab);
+#define MIME_EXT_MAX MAX(ENC_EXT_MAX, TYP_EXT_MAX)
+#define MIME_DEFAULT "text/plain; charset=%s"
 
-static struct mime_entry typ_tab[] = {
-#include "mime_types.h"
-};
+/* FNV-1a of the extension, which is also copied lowercase to key */
+static uint32_t mime_hash(const char *ext, size_t len, char *key)
+{
+	uint32_t h = 2166136261U;
+	size_t i;
 
-static const int n_typ_tab = sizeof(typ_tab) / sizeof(*typ_tab);
+	for (i = 0; i < len; i++) {
+		key[i] = tolower((unsigned char)ext[i]);
+		h = (h ^ (uint8_t)key[i]) * 16777619U;
+	}
 
+	return h;
+}
 
-/* qsort comparison routine - declared old-style on purpose, for portability. */
-static int ext_compare(a, b)
-struct mime_entry *a;
-struct mime_entry *b;
+/* Must match mime_slot() in make_mime.pl */
+static const struct mime_entry *mime_find(const struct mime_entry *tab, size_t size,
+					  const uint16_t *disp, size_t buckets,
+					  const char *key, size_t len, uint32_t h)
 {
-	return strcmp(a->ext, b->ext);
+	const struct mime_entry *me;
+	uint32_t slot;
+
+	slot = ((h >> 16) | (h << 16)) + disp[h % buckets] * ((h >> 7) | 1);
+	me = &tab[slot & (size - 1)];
+	if (me->ext_len != len || memcmp(me->ext, key, len))
+		return NULL;
+
+	return me;
 }
 
-static int mime_bsearch(struct http_conn *hc, char *ext, size_t ext_len)
+static const struct mime_entry *enc_find(const char *key, size_t len, uint32_t h)
 {
-	int top, bot, mid;
-	int r;
+	return mime_find(enc_tab, ENC_TAB_SIZE, enc_disp, ENC_TAB_BUCKETS, key, len, h);
+}
+
+static int typ_find(struct http_conn *hc, const char *key, size_t len, uint32_t h)
+{
+	const struct mime_entry *me;
+
+	me = mime_find(typ_tab, TYP_TAB_SIZE, typ_disp, TYP_TAB_BUCKETS, key, len, h);
+	if (!me)
+		return 0;
+
+	hc->type = me->val;
+	hc->type_idx = me - typ_tab;
+
+	return 1; /* found */
+}
 
-	top = n_typ_tab - 1;
-	bot = 0;
-	while (top >= bot) {
-		mid = (top + bot) / 2;
-		r = strncasecmp(ext, typ_tab[mid].ext, ext_len);
-		if (r < 0)
-			top = mid - 1;
-		else if (r > 0)
-			bot = mid + 1;
-		else if (ext_len < typ_tab[mid].ext_len)
-			top = mid - 1;
-		else if (ext_len > typ_tab[mid].ext_len)
-			bot = mid + 1;
-		else {
-			hc->type = typ_tab[mid].val;
-			return 1; /* found */
+/* The Content-Type headers of a server, with its charset, so send_mime()
+** only has to copy them.  The last one is for the default type.
+*/
+static int init_mime(struct httpd *hs)
+{
+	char buf[256];
+	int i;
+
+	hs->type_hdr = calloc(TYP_TAB_SIZE + 1, sizeof(char *));
+	if (!hs->type_hdr)
+		return -1;
+
+	for (i = 0; i < TYP_TAB_SIZE; i++) {
+		if (!typ_tab[i].charset) {
+			hs->type_hdr[i] = (char *)typ_tab[i].hdr;
+			continue;
 		}
+
+		snprintf(buf, sizeof(buf), typ_tab[i].hdr, hs->charset);
+		hs->type_hdr[i] = strdup(buf);
+		if (!hs->type_hdr[i])
+			return -1;
 	}
 
+	snprintf(buf, sizeof(buf), "Content-Type: " MIME_DEFAULT "\r\n", hs->charset);
+	hs->type_hdr[TYP_TAB_SIZE] = strdup(buf);
+	if (!hs->type_hdr[TYP_TAB_SIZE])
+		return -1;
+
 	return 0;
 }
 
-static void init_mime(void)
+static void free_mime(struct httpd *hs)
 {
 	int i;
 
-	/* Sort the tables so we can do binary search. */
-	qsort(enc_tab, n_enc_tab, sizeof(*enc_tab), ext_compare);
-	qsort(typ_tab, n_typ_tab, sizeof(*typ_tab), ext_compare);
+	if (!hs->type_hdr)
+		return;
 
-	/* Fill in the lengths. */
-	for (i = 0; i < n_enc_tab; ++i) {
-		enc_tab[i].ext_len = strlen(enc_tab[i].ext);
-		enc_tab[i].val_len = strlen(enc_tab[i].val);
-	}
-	for (i = 0; i < n_typ_tab; ++i) {
-		typ_tab[i].ext_len = strlen(typ_tab[i].ext);
-		typ_tab[i].val_len = strlen(typ_tab[i].val);
+	for (i = 0; i <= TYP_TAB_SIZE; i++) {
+		if (i == TYP_TAB_SIZE || typ_tab[i].charset)
+			free(hs->type_hdr[i]);
 	}
+	free(hs->type_hdr);
 }
 
 
@@ -3232,20 +4032,20 @@ static void init_mime(void)
 */
 static void figure_mime(struct http_conn *hc)
 {
-	const char *default_type = "text/plain; charset=%s";
-	size_t ext_len, n_me_indexes;
+	const struct mime_entry *me[100], *enc;
+	char key[MIME_EXT_MAX];
+	size_t ext_len, n_me;
 	char *prev_dot;
 	char *dot;
 	char *ext;
-	int me_indexes[100];
+	uint32_t h;
 	int i;
 
 	/* Peel off encoding extensions until there aren't any more. */
-	n_me_indexes = 0;
-	hc->type = default_type;
+	n_me = 0;
+	hc->type = MIME_DEFAULT;
+	hc->type_idx = TYP_TAB_SIZE;
 	for (prev_dot = &hc->expnfilename[strlen(hc->expnfilename)];; prev_dot = dot) {
-		int candidate = 0;
-
 		for (dot = prev_dot - 1; dot >= hc->expnfilename && *dot != '.'; --dot)
 			;
 
@@ -3255,48 +4055,43 @@ static void figure_mime(struct http_conn *hc)
 
 		ext = dot + 1;
 		ext_len = prev_dot - ext;
+		if (ext_len == 0 || ext_len > MIME_EXT_MAX)
+			continue;
 
-		/* Search encodings table.  Linear search is fine here,
-		** there are only a few entries.
-		*/
-		for (i = 0; i < n_enc_tab; ++i) {
-			if (ext_len == enc_tab[i].ext_len && strncasecmp(ext, enc_tab[i].ext, ext_len) == 0) {
-				if (n_me_indexes < NELEMS(me_indexes)) {
-					me_indexes[n_me_indexes++] = i;
-				}
-
-				if (mime_bsearch(hc, ext, ext_len))
-					candidate = 1;
-				break;
-			}
-		}
-
-		/* We have a candidate for Content-Type, no go see if we
-		** can do better.  I.e., if encodings mechanism found a
-		** .gz we have application/gzip, but the actual file may
-		** be a tar.gz that we want to have application/x-tar.
-		**
-		** If it turns out the file is something like .html.gz
-		** we fall back to the candidate Content-Type.
-		*/
-		if (candidate)
+		/* One hash for both tables */
+		h = mime_hash(ext, ext_len, key);
+		enc = enc_find(key, ext_len, h);
+		if (enc) {
+			if (n_me < NELEMS(me))
+				me[n_me++] = enc;
+
+			/* We have a candidate for Content-Type, no go see if
+			** we can do better.  I.e., if encodings mechanism
+			** found a .gz we have application/gzip, but the
+			** actual file may be a tar.gz that we want to have
+			** application/x-tar.
+			**
+			** If it turns out the file is something like
+			** .html.gz we fall back to the candidate.
+			*/
+			(void)typ_find(hc, key, ext_len, h);
 			continue;
+		}
 
-		/* Binary search for a matching type extension. */
-		if (mime_bsearch(hc, ext, ext_len))
+		if (typ_find(hc, key, ext_len, h))
 			break;
 	}
 
 	/* The last thing we do is actually generate the mime-encoding header. */
 	hc->encodings[0] = '\0';
-	for (i = n_me_indexes - 1; i >= 0; --i) {
+	for (i = n_me - 1; i >= 0; --i) {
 		size_t len;
 
-		len = strlen(hc->encodings) + enc_tab[me_indexes[i]].val_len + 2;
-		httpd_realloc_str(&hc->encodings, &hc->maxencodings, len);
+		len = strlen(hc->encodings) + me[i]->val_len + 2;
+		httpd_conn_str(hc, &hc->encodings, &hc->maxencodings, len);
 		if (hc->encodings[0] != '\0')
 			strlcat(hc->encodings, ",", hc->maxencodings);
-		strlcat(hc->encodings, enc_tab[me_indexes[i]].val, hc->maxencodings);
+		strlcat(hc->encodings, me[i]->val, hc->maxencodings);
 	}
 }
 
@@ -3380,195 +4175,137 @@ static int is_reserved_htfile(const char *fn)
 	return 0;
 }
 
-/* qsort comparison routine - declared old-style on purpose, for portability. */
-static int name_compare(a, b)
-char **a;
-char **b;
+/* A directory entry to list, name points into the names pool */
+struct ls_entry {
+	char       *name;
+	size_t      off;
+	int         isdir;
+	struct stat sb;		/* follows symlinks, for type and access */
+	struct stat lsb;	/* the entry itself, for size and mtime */
+};
+
+/* Directories first, then by name */
+static int ls_compare(const void *a, const void *b)
 {
-	return strcmp(*a, *b);
+	const struct ls_entry *ea = a, *eb = b;
+
+	if (ea->isdir != eb->isdir)
+		return eb->isdir - ea->isdir;
+
+	return strcmp(ea->name, eb->name);
 }
 
-static int child_ls_read_names(struct http_conn *hc, DIR *dirp, FILE *fp, int onlydir)
+/* Read all entries in one pass, one or two fstatat() each relative to
+** the directory, no realpath().  Stops at LISTING_MAX_ENTRIES, setting
+** moreP.  Returns the number of entries, or -1.
+*/
+static int ls_read_names(struct http_conn *hc, DIR *dirp, struct ls_entry **entriesP, char **namesP,
+			 time_t *mtimeP, int *moreP)
 {
-	int i, nnames = 0;
-	static int maxnames = 0;
+	struct ls_entry *entries = NULL, *e;
+	size_t maxentries = 0, nentries = 0;
+	size_t maxnames = 0, namelen = 0;
+	char *names = NULL;
 	struct dirent *de;
-	static char *names;
-	static char **nameptrs;
-	static char *name;
-	static size_t maxname = 0;
-	static char *rname;
-	static size_t maxrname = 0;
-	static char *encrname;
-	static size_t maxencrname = 0;
+	int dfd;
 
+	dfd = dirfd(dirp);
 	while ((de = readdir(dirp))) {
-		char *path;
+		size_t len;
 
-		if (!strcmp(".", de->d_name))
-			continue;
-		if (!strcmp("..", de->d_name))
+		if (!strcmp(".", de->d_name) || !strcmp("..", de->d_name))
 			continue;
 
-		path = realpath(de->d_name, NULL);
-		if (!path) {
-			struct stat st;
-
-			httpd_realloc_str(&name, &maxname, strlen(hc->expnfilename) + 1 + strlen(de->d_name));
-			snprintf(name, maxname, "%s/%s", hc->expnfilename, de->d_name);
-
-			if (stat(name, &st))
-				continue;
-			if (!(st.st_mode & (S_IROTH | S_IXOTH)))
-				continue;
-
-		fallback:
-			if (onlydir && de->d_type != DT_DIR)
-				continue;
-			if (!onlydir && de->d_type == DT_DIR)
-				continue;
-		} else {
-			struct stat st;
-
-			if (stat(path, &st)) {
-				free(path);
-				goto fallback;
-			}
+		/* Skip listing dotfiles unless enabled in .conf file */
+		if (!hc->hs->list_dotfiles && de->d_name[0] == '.' && strlen(de->d_name) > 2)
+			continue;
 
-			if (!(st.st_mode & (S_IROTH | S_IXOTH)))
-				continue;
+		/* Do not show .htpasswd and .htaccess files */
+		if (is_reserved_htfile(de->d_name))
+			continue;
 
-			free(path);
-			if (onlydir && !S_ISDIR(st.st_mode))
-				continue;
-			if (!onlydir && S_ISDIR(st.st_mode))
-				continue;
+		if (nentries >= LISTING_MAX_ENTRIES) {
+			*moreP = 1;
+			break;
 		}
-			
-		if (nnames >= maxnames) {
-			if (maxnames == 0) {
-				maxnames = 100;
-				names = NEW(char, maxnames * (MAXPATHLEN + 1));
-				nameptrs = NEW(char *, maxnames);
-			} else {
-				maxnames *= 2;
-				names = RENEW(names, char, maxnames * (MAXPATHLEN + 1));
-				nameptrs = RENEW(nameptrs, char *, maxnames);
-			}
 
-			if (!names || !nameptrs) {
-				syslog(LOG_ERR, "out of memory reallocating directory names");
-				return 1;
-			}
-
-			for (i = 0; i < maxnames; ++i)
-				nameptrs[i] = &names[i * (MAXPATHLEN + 1)];
+		if (nentries >= maxentries) {
+			maxentries = maxentries ? maxentries * 2 : 100;
+			entries = RENEW(entries, struct ls_entry, maxentries);
+			if (!entries)
+				goto nomem;
 		}
 
-		if (nameptrs && nnames < maxnames)
-			strlcpy(nameptrs[nnames++], de->d_name, MAXPATHLEN + 1);
-	}
-
-	/* Sort the names. */
-	if (nameptrs)
-		qsort(nameptrs, nnames, sizeof(*nameptrs), name_compare);
-
-	/* Generate output. */
-	for (i = 0; i < nnames; ++i) {
-		struct stat sb;
-		struct stat lsb;
-		char buf[256];
-		char timestr[42];
-		char *icon, *alt;
-
-		if (!strcmp(nameptrs[i], "."))
+		e = &entries[nentries];
+		if (fstatat(dfd, de->d_name, &e->lsb, AT_SYMLINK_NOFOLLOW))
 			continue;
-		if (!strcmp(nameptrs[i], "..")) {
-			if (!strcmp(hc->encodedurl, "/"))
-				continue;
-
-			fprintf(fp,
-				" <tr>\n"
-				"  <td class=\"icon\"><img src=\"/icons/back.gif\" alt=\"&#8617;\" width=\"20\" height=\"22\"></td>\n"
-				"  <td><a href=\"..\">Parent Directory</a></td>\n"
-				"  <td class=\"right\">&nbsp;</td>\n"
-				"  <td>&nbsp;</td>\n"
-				" </tr>\n");
+		if (!S_ISLNK(e->lsb.st_mode))
+			e->sb = e->lsb;
+		else if (fstatat(dfd, de->d_name, &e->sb, 0))
 			continue;
-		}
 
-		/* Skip listing dotfiles unless enabled in .conf file */
-		if (!hc->hs->list_dotfiles && nameptrs[i][0] == '.' && strlen(nameptrs[i]) > 2)
-			continue;
-
-		/* Do not show .htpasswd and .htaccess files */
-		if (is_reserved_htfile(nameptrs[i]))
+		if (!(e->sb.st_mode & (S_IROTH | S_IXOTH)))
 			continue;
 
-		httpd_realloc_str(&name, &maxname, strlen(hc->expnfilename) + 2 + strlen(nameptrs[i]));
-		httpd_realloc_str(&rname, &maxrname, strlen(hc->origfilename) + 2 + strlen(nameptrs[i]));
-		if (hc->expnfilename[0] == '\0' || strcmp(hc->expnfilename, ".") == 0) {
-			strlcpy(name, nameptrs[i], maxname);
-			strlcpy(rname, nameptrs[i], maxrname);
-		} else {
-			snprintf(name, maxname, "%s/%s", hc->expnfilename, nameptrs[i]);
-			if (strcmp(hc->origfilename, ".") == 0)
-				snprintf(rname, maxrname, "%s", nameptrs[i]);
-			else
-				snprintf(rname, maxrname, "%s%s", hc->origfilename, nameptrs[i]);
+		len = strlen(de->d_name) + 1;
+		if (namelen + len > maxnames) {
+			maxnames = MAX(maxnames * 2, namelen + len + 4096);
+			names = RENEW(names, char, maxnames);
+			if (!names)
+				goto nomem;
 		}
-		httpd_realloc_str(&encrname, &maxencrname, 3 * strlen(rname) + 1);
-		strencode(encrname, maxencrname, rname);
+		memcpy(&names[namelen], de->d_name, len);
 
-		if (stat(name, &sb) < 0 || lstat(name, &lsb) < 0)
-			continue;
+		e->off   = namelen;
+		e->isdir = S_ISDIR(e->sb.st_mode);
+		namelen += len;
+		nentries++;
 
-		/* Get time string. */
-		strftime(timestr, sizeof(timestr), "%F&nbsp;&nbsp;%R", localtime(&lsb.st_mtime));
+		if (e->lsb.st_mtime > *mtimeP)
+			*mtimeP = e->lsb.st_mtime;
+	}
 
-		/* The ls -F file class. */
-		switch (sb.st_mode & S_IFMT) {
-		case S_IFDIR:
-			icon = "/icons/folder.gif";
-			alt  = "&#128193;";
-			break;
+	/* The pool may have moved while growing, so resolve names last */
+	for (e = entries; e < &entries[nentries]; e++)
+		e->name = &names[e->off];
+	qsort(entries, nentries, sizeof(*entries), ls_compare);
 
-		default:
-			icon = "/icons/generic.gif";
-			alt  = "&#128196;";
-			break;
-		}
+	*entriesP = entries;
+	*namesP   = names;
 
-		defang(nameptrs[i], buf, sizeof(buf));
-		fprintf(fp,
-			" <tr>\n"
-			"  <td class=\"icon\"><img src=\"%s\" alt=\"%s\" width=\"20\" height=\"22\"></td>\n"
-			"  <td><a href=\"/%s%s\">%s</a></td>\n"
-			"  <td class=\"right\">%s</td>\n"
-			"  <td>%s</td>\n"
-			" </tr>\n", icon, alt,
-			encrname, S_ISDIR(sb.st_mode) ? "/" : "", buf,
-			humane_size(&lsb), timestr);
-	}
+	return (int)nentries;
+nomem:
+	syslog(LOG_ERR, "out of memory reading directory names");
+	free(entries);
+	free(names);
 
-	return 0;
+	return -1;
 }
 
-/* Forked child process from ls() */
-static int child_ls(struct http_conn *hc, DIR *dirp)
+/* Render the listing into a malloc()ed buffer, in-process */
+static char *ls_render(struct http_conn *hc, DIR *dirp, size_t *lenP, time_t *mtimeP)
 {
-	FILE *fp;
-	long len;
+	struct ls_entry *entries;
+	char *encrname = NULL;
+	size_t maxencrname = 0;
+	char *rname = NULL;
+	size_t maxrname = 0;
 	char *proto;
-	char *buf;
+	char *names;
+	char *buf = NULL;
+	FILE *fp;
+	int i, num, more = 0;
 
-	fp = tempfile();
+	num = ls_read_names(hc, dirp, &entries, &names, mtimeP, &more);
+	if (num < 0)
+		return NULL;
+
+	fp = open_memstream(&buf, lenP);
 	if (!fp) {
-		syslog(LOG_ERR, "tmpfile: %s", strerror(errno));
-error:
-		httpd_send_err(hc, 500, err500title, "", err500form, hc->encodedurl);
-		httpd_send_response(hc);
-		return 1;
+		syslog(LOG_ERR, "open_memstream: %s", strerror(errno));
+		free(entries);
+		free(names);
+		return NULL;
 	}
 
 	if (hc->ssl)
@@ -3600,75 +4337,138 @@ error:
 		httpd_css_default(),
 		proto, get_hostname(hc), hc->encodedurl);
 
-	/* Read in names. */
-	child_ls_read_names(hc, dirp, fp, 1);
-	rewinddir(dirp);
-	child_ls_read_names(hc, dirp, fp, 0);
+	for (i = 0; i < num; i++) {
+		struct ls_entry *e = &entries[i];
+		char *name = e->name;
+		char dfname[256];
+		char timestr[42];
+		char *icon, *alt;
 
-	fprintf(fp, " </table></div>\n");
-	fprintf(fp, " <address>%s httpd at %s port %d</address>\n", EXPOSED_SERVER_SOFTWARE, get_hostname(hc), (int)hc->hs->port);
-	fprintf(fp, "</div></body>\n</html>\n");
+		httpd_realloc_str(&rname, &maxrname, strlen(hc->origfilename) + 2 + strlen(name));
+		if (hc->expnfilename[0] == '\0' || strcmp(hc->expnfilename, ".") == 0 ||
+		    strcmp(hc->origfilename, ".") == 0)
+			strlcpy(rname, name, maxrname);
+		else
+			snprintf(rname, maxrname, "%s%s", hc->origfilename, name);
+		httpd_realloc_str(&encrname, &maxencrname, 3 * strlen(rname) + 1);
+		strencode(encrname, maxencrname, rname);
 
-	len = ftell(fp);
-	if (len == -1) {
-		syslog(LOG_ERR, "ftell: %s", strerror(errno));
-		(void)fclose(fp);
-		goto error;
-	}
+		/* Get time string. */
+		strftime(timestr, sizeof(timestr), "%F&nbsp;&nbsp;%R", localtime(&e->lsb.st_mtime));
 
-	buf = malloc((size_t)len);
-	if (!buf) {
-		syslog(LOG_ERR, "Failed allocating %ld bytes in child_ls(): %s", len, strerror(errno));
-		(void)fclose(fp);
-		goto error;
+		/* The ls -F file class. */
+		if (e->isdir) {
+			icon = "/icons/folder.gif";
+			alt  = "&#128193;";
+		} else {
+			icon = "/icons/generic.gif";
+			alt  = "&#128196;";
+		}
+
+		defang(name, dfname, sizeof(dfname));
+		fprintf(fp,
+			" <tr>\n"
+			"  <td class=\"icon\"><img src=\"%s\" alt=\"%s\" width=\"20\" height=\"22\"></td>\n"
+			"  <td><a href=\"/%s%s\">%s</a></td>\n"
+			"  <td class=\"right\">%s</td>\n"
+			"  <td>%s</td>\n"
+			" </tr>\n", icon, alt,
+			encrname, e->isdir ? "/" : "", dfname,
+			humane_size(&e->lsb), timestr);
 	}
 
-	send_mime(hc, 200, ok200title, "", "", "text/html; charset=%s", (off_t) - 1, hc->sb.st_mtime);
-	httpd_send_response(hc);
+	if (more)
+		fprintf(fp,
+			" <tr>\n"
+			"  <td class=\"icon\"></td>\n"
+			"  <td colspan=\"3\">More than %d entries, the rest are not listed</td>\n"
+			" </tr>\n", LISTING_MAX_ENTRIES);
 
-	rewind(fp);
-	fread(buf, (size_t)len, 1, fp);
-	if (httpd_write(hc, buf, (size_t)len) <= 0) {
-		if (hc->errmsg)
-			syslog(LOG_ERR, "Failed sending dirlisting to client: %s", hc->errmsg);
-	}
+	fprintf(fp, " </table></div>\n");
+	fprintf(fp, " <address>%s httpd at %s port %d</address>\n", EXPOSED_SERVER_SOFTWARE, get_hostname(hc), (int)hc->hs->port);
+	fprintf(fp, "</div></body>\n</html>\n");
 
-	free(buf);
-	(void)fclose(fp);
+	free(encrname);
+	free(rname);
+	free(entries);
+	free(names);
 
-	return 0;
+	if (ferror(fp)) {
+		syslog(LOG_ERR, "Failed rendering directory listing of %s", hc->expnfilename);
+		fclose(fp);
+		free(buf);
+		return NULL;
+	}
+	fclose(fp);
+
+	return buf;
 }
 
-static int ls(struct http_conn *hc)
+/* Directory listings are rendered once per directory and variant, then
+** served from the mmc package like any other file, until the directory
+** changes.  The cached copy has its own stat info: st_size is the length
+** of the HTML and st_mtime the newest of the directory and its entries.
+*/
+static int ls(struct http_conn *hc, struct timeval *now)
 {
-	DIR *dirp;
-
-	hc->compression_type = COMPRESSION_NONE;
+	char *extra = "Vary: Accept-Encoding\r\n";
+	char key[MAXPATHLEN + 200];
+	off_t length;
+	char *addr;
 
-	dirp = opendir(hc->expnfilename);
-	if (!dirp) {
-		syslog(LOG_ERR, "opendir %s: %s", hc->expnfilename, strerror(errno));
-		httpd_send_err(hc, 404, err404title, "", err404form, hc->encodedurl);
+	if (hc->method != METHOD_GET && hc->method != METHOD_HEAD) {
+		httpd_send_err(hc, 501, err501title, "", err501form, httpd_method_str(hc->method));
 		return -1;
 	}
 
-	if (hc->method == METHOD_HEAD) {
-		closedir(dirp);
-		send_mime(hc, 200, ok200title, "", "", "text/html; charset=%s", (off_t) - 1, hc->sb.st_mtime);
-	} else if (hc->method == METHOD_GET) {
-		child_ls(hc, dirp);
+	/* The rendered HTML depends on more than the directory */
+	snprintf(key, sizeof(key), "%s://%s:%d%s%s", hc->ssl ? "https" : "http", get_hostname(hc),
+		 (int)hc->hs->port, hc->encodedurl, hc->hs->list_dotfiles ? " dotfiles" : "");
+
+	addr = mmc_listing(&hc->sb, key, now);
+	if (!addr) {
+		time_t mtime = hc->sb.st_mtime;
+		size_t len = 0;
+		char *buf;
+		DIR *dirp;
 
+		dirp = opendir(hc->expnfilename);
+		if (!dirp) {
+			syslog(LOG_ERR, "opendir %s: %s", hc->expnfilename, strerror(errno));
+			httpd_send_err(hc, 404, err404title, "", err404form, hc->encodedurl);
+			return -1;
+		}
+
+		buf = ls_render(hc, dirp, &len, &mtime);
 		closedir(dirp);
+		if (buf)
+			addr = mmc_listing_add(&hc->sb, key, buf, (off_t)len, mtime, now);
+		if (!addr) {
+			httpd_send_err(hc, 500, httpd_err500title, "", httpd_err500form, hc->encodedurl);
+			return -1;
+		}
+
 		syslog(LOG_INFO, "%.80s: LST /%.200s \"%s\" \"%s\"",
 		       httpd_client(hc), hc->expnfilename, hc->referer, hc->useragent);
+	}
 
-		hc->status = 200;
-		hc->bytes_sent = CGI_BYTECOUNT;
-		hc->should_linger = 0;
+	length = hc->sb.st_size;
+	if (hc->got_range && (hc->last_byte_index == -1 || hc->last_byte_index >= length))
+		hc->last_byte_index = length - 1;
+
+	if (!hc->has_deflate || length < 256)
+		hc->compression_type = COMPRESSION_NONE;
+
+	if (hc->method == METHOD_HEAD) {
+		mmc_unmap(addr, &hc->sb, now);
+		send_mime(hc, 200, ok200title, "", extra, "text/html; charset=%s", length, hc->sb.st_mtime);
+	} else if (hc->if_modified_since != (time_t)-1 && hc->if_modified_since >= hc->sb.st_mtime) {
+		mmc_unmap(addr, &hc->sb, now);
+		send_mime(hc, 304, err304title, "", "", "text/html; charset=%s", (off_t)-1, hc->sb.st_mtime);
 	} else {
-		closedir(dirp);
-		httpd_send_err(hc, 501, err501title, "", err501form, httpd_method_str(hc->method));
-		return -1;
+		hc->file_address = addr;
+		length = compress_cached(hc, length);
+		send_mime(hc, 200, ok200title, hc->encodings, extra, "text/html; charset=%s", length, hc->sb.st_mtime);
 	}
 
 	return 0;
@@ -3684,7 +4484,7 @@ static int is_php(struct http_conn *hc, char *fn)
 	if (!fn)
 		fn = hc->expnfilename;
 
-	if (hc->hs->php_pattern && match(hc->hs->php_pattern, fn))
+	if (match_exec(hc->hs->php_match, fn))
 		return 1;
 
 	return 0;
@@ -3698,7 +4498,21 @@ static int is_ssi(struct http_conn *hc, char *fn)
 	if (!fn)
 		fn = hc->expnfilename;
 
-	if (hc->hs->ssi_pattern && match(hc->hs->ssi_pattern, fn))
+	if (match_exec(hc->hs->ssi_match, fn))
+		return 1;
+
+	return 0;
+}
+
+static int is_fcgi(struct http_conn *hc, char *fn)
+{
+	assert(hc);
+	assert(hc->hs);
+
+	if (!fn)
+		fn = hc->expnfilename;
+
+	if (hc->hs->fcgi && match_exec(hc->hs->fcgi_match, fn))
 		return 1;
 
 	return 0;
@@ -3746,8 +4560,9 @@ static char *hostname_map(char *hostname)
 
 
 /* Set up environment variables. Be real careful here to avoid
-** letting malicious clients overrun a buffer.  We don't have
-** to worry about freeing stuff since we're a sub-process.
+** letting malicious clients overrun a buffer.  All strings are
+** malloc()ed, for FastCGI the caller frees them, a CGI sub-process
+** does not have to worry about it.
 */
 static char **make_envp(struct http_conn *hc)
 {
@@ -3766,7 +4581,7 @@ static char **make_envp(struct http_conn *hc)
 	cp = get_hostname(hc);
 	if (cp[0])
 		envp[envn++] = build_env("SERVER_NAME=%s", cp);
-	envp[envn++] = "GATEWAY_INTERFACE=CGI/1.1";
+	envp[envn++] = build_env("GATEWAY_INTERFACE=%s", "CGI/1.1");
 	envp[envn++] = build_env("SERVER_PROTOCOL=%s", hc->protocol);
 	snprintf(buf, sizeof(buf), "%d", (int)hc->hs->port);
 	envp[envn++] = build_env("SERVER_PORT=%s", buf);
@@ -3783,38 +4598,17 @@ static char **make_envp(struct http_conn *hc)
 		if (cp2) {
 			snprintf(cp2, l, "%s%s", hc->hs->cwd, hc->pathinfo);
 			envp[envn++] = build_env("PATH_TRANSLATED=%s", cp2);
+			free(cp2);
 		}
-	} else if (is_ssi(hc, NULL)) {
-		char buf[4];
-		char *cp2;
-		size_t l;
-
-		snprintf(buf, sizeof(buf), "%d", loglevel);
-		envp[envn++] = build_env("IDENT=%s", ident);
-		envp[envn++] = build_env("LOG_LEVEL=%s", buf);
-
-		/* Fake PATH_INFO and PATH_TRANSLATED for cgi-bin/ssi
-		** since it uses them to determinte include paths for
-		** virtual/config SSI directives.
-		*/
-		envp[envn++] = build_env("PATH_INFO=/%s", hc->expnfilename);
-		l = strlen(hc->hs->cwd) + strlen(hc->expnfilename) + 1;
-		cp2 = NEW(char, l);
-		if (cp2) {
-			snprintf(cp2, l, "%s%s", hc->hs->cwd, hc->expnfilename);
-			envp[envn++] = build_env("PATH_TRANSLATED=%s", cp2);
-		}
-
-		if (ssi_silent)
-			envp[envn++] = build_env("SILENT_ERRORS=%s", "true");
 	}
 
 	envp[envn++] = build_env("SCRIPT_NAME=/%s", strcmp(hc->origfilename, ".") == 0 ? "" : hc->origfilename);
 
 	/* php-cgi needs non-std SCRIPT_FILENAME to be defined to detect
-	** it was invoked as CGI script.
+	** it was invoked as CGI script.  FastCGI servers, e.g. php-fpm,
+	** use it to find the script to run.
 	*/
-	if (is_php(hc, NULL)) {
+	if (is_php(hc, NULL) || is_fcgi(hc, NULL)) {
 		char *dedot;
 
 		if (strcmp(hc->expnfilename, ".") == 0)
@@ -3900,10 +4694,6 @@ static char **make_argp(struct http_conn *hc)
 		cgi = hc->hs->php_cgi;
 		num++;
 	}
-	if (is_ssi(hc, NULL)) {
-		cgi = hc->hs->ssi_cgi;
-		num++;
-	}
 
 	/* By allocating an arg slot for every character in the query, plus
 	** one for the filename and one for the NULL, we are guaranteed to
@@ -3953,65 +4743,6 @@ static char **make_argp(struct http_conn *hc)
 }
 
 
-/* This routine is used only for POST requests.  It reads the data
-** from the request and sends it to the child process.  The only reason
-** we need to do it this way instead of just letting the child read
-** directly is that we have already read part of the data into our
-** buffer.
-*/
-static void cgi_interpose_input(struct http_conn *hc, int wfd)
-{
-	size_t c;
-	ssize_t r;
-	char buf[1024];
-
-	c = hc->read_idx - hc->checked_idx;
-	if (c > 0) {
-		r = file_write(wfd, &(hc->read_buf[hc->checked_idx]), c);
-		if ((size_t)r != c)
-			return;
-	}
-
-	while (c < hc->contentlength) {
-		r = httpd_read(hc, buf, MIN(sizeof(buf), hc->contentlength - c));
-		if (r < 0 && (errno == EINTR || errno == EAGAIN)) {
-			sleep(1);
-			continue;
-		}
-
-		if (r <= 0)
-			return;
-
-		if (file_write(wfd, buf, r) != r)
-			return;
-		c += r;
-	}
-	post_post_garbage_hack(hc);
-}
-
-
-/* Special hack to deal with broken browsers that send a LF or CRLF
-** after POST data, causing TCP resets - we just read and discard up
-** to 2 bytes.  Unfortunately this doesn't fix the problem for CGIs
-** which avoid the interposer process due to their POST data being
-** short.  Creating an interposer process for all POST CGIs is
-** unacceptably expensive.  The eventual fix will come when interposing
-** gets integrated into the main loop as a tasklet instead of a process.
-*/
-static void post_post_garbage_hack(struct http_conn *hc)
-{
-	char buf[2];
-
-	/* If we are in a sub-process, turn on no-delay mode in case we
-	** previously cleared it.
-	*/
-	if (sub_process)
-		(void)httpd_set_ndelay(hc->conn_fd);
-
-	/* And read up to 2 bytes. */
-	httpd_read(hc, buf, sizeof(buf));
-}
-
 /* Normalize newlines from CGI to RFC3875 \r\n format, for details see
 ** https://datatracker.ietf.org/doc/html/rfc3875#section-6.3.4
 */
@@ -4079,59 +4810,19 @@ static void cgi_normalize_newline(char **headers, size_t *headers_len, size_t *h
 	*headers = buf;
 }
 
-/* This routine is used for parsed-header CGIs.  The idea here is that the
-** CGI can return special headers such as "Status:" and "Location:" which
-** change the return status of the response.  Since the return status has to
-** be the very first line written out, we have to accumulate all the headers
-** and check for the special ones before writing the status.  Then we write
-** out the saved headers and proceed to echo the rest of the response.
+#ifndef CGI_HEADERS_MAX
+#define CGI_HEADERS_MAX 16384
+#endif
+
+/* Figure out the status.  Look for a Status: or Location: header;
+** else if there's an HTTP header line, get it from there; else
+** default to 200.  The headers end at br.
 */
-static void cgi_interpose_output(struct http_conn *hc, int rfd)
+static int cgi_status(char *headers, char *br)
 {
-	ssize_t r;
-	char buf[1024];
-	size_t headers_size, headers_len;
-	char *headers;
-	char *br;
-	int status;
-	char *title;
+	int status = 200;
 	char *cp;
 
-	/* Make sure the connection is in blocking mode.  It should already
-	** be blocking, but we might as well be sure.
-	*/
-	(void)httpd_clear_ndelay(hc->conn_fd);
-
-	/* Slurp in all headers. */
-	headers_size = 0;
-	httpd_realloc_str(&headers, &headers_size, 500);
-	headers_len = 0;
-	for (;;) {
-		r = file_read(rfd, buf, sizeof(buf));
-		if (r <= 0) {
-			br = &(headers[headers_len]);
-			break;
-		}
-
-		httpd_realloc_str(&headers, &headers_size, headers_len + r);
-		memmove(&(headers[headers_len]), buf, r);
-		headers_len += r;
-		headers[headers_len] = '\0';
-		if ((br = strstr(headers, "\r\n\r\n")) || (br = strstr(headers, "\n\n")))
-			break;
-	}
-
-	/* If there were no headers, bail. */
-	if (headers[0] == '\0') {
-		free(headers);
-		return;
-	}
-
-	/* Figure out the status.  Look for a Status: or Location: header;
-	** else if there's an HTTP header line, get it from there; else
-	** default to 200.
-	*/
-	status = 200;
 	if (strncmp(headers, "HTTP/", 5) == 0) {
 		cp = headers;
 		cp += strcspn(cp, " \t");
@@ -4145,204 +4836,141 @@ static void cgi_interpose_output(struct http_conn *hc, int rfd)
 		status = 302;
 	}
 
-	/* Ensure newlines are RFC style \r\n, not just UNIX \n */
-	cgi_normalize_newline(&headers, &headers_len, &headers_size, br - headers);
+	return status;
+}
+
+/* Looks for a header, by name with the colon, in headers ending at br */
+static int cgi_header(char *headers, char *br, const char *name)
+{
+	size_t len = strlen(name);
+	char *cp = headers;
+
+	while (cp && cp < br) {
+		if (!strncasecmp(cp, name, len))
+			return 1;
+		cp = strchr(cp, '\n');
+		if (cp)
+			cp++;
+	}
+
+	return 0;
+}
 
-	/* Write the status line. */
+static char *cgi_title(int status)
+{
 	switch (status) {
 	case 200:
-		title = ok200title;
-		break;
+		return ok200title;
 	case 302:
-		title = err302title;
-		break;
+		return err302title;
 	case 304:
-		title = err304title;
-		break;
+		return err304title;
 	case 400:
-		title = httpd_err400title;
-		break;
+		return httpd_err400title;
 #ifdef AUTH_FILE
 	case 401:
-		title = err401title;
-		break;
+		return err401title;
 #endif
 	case 403:
-		title = err403title;
-		break;
+		return err403title;
 	case 404:
-		title = err404title;
-		break;
+		return err404title;
 	case 408:
-		title = httpd_err408title;
-		break;
+		return httpd_err408title;
 	case 500:
-		title = err500title;
-		break;
+		return httpd_err500title;
 	case 501:
-		title = err501title;
-		break;
+		return err501title;
+	case 502:
+		return httpd_err502title;
 	case 503:
-		title = httpd_err503title;
-		break;
-	default:
-		title = "Something";
-		break;
+		return httpd_err503title;
 	}
 
-	snprintf(buf, sizeof(buf), "HTTP/1.0 %d %s\r\n", status, title);
-	httpd_write(hc, buf, strlen(buf));
-
-	/* Write the saved headers. */
-	httpd_write(hc, headers, headers_len);
+	return "Something";
+}
 
-	/* Echo the rest of the output. */
-	for (;;) {
-		r = file_read(rfd, buf, sizeof(buf));
-		if (r <= 0)
-			break;
+int httpd_cgi_headers(struct http_conn *hc, size_t off)
+{
+	size_t headers_size, headers_len;
+	char *headers = NULL, *br;
+	char buf[100];
+	int status;
 
-		if (httpd_write(hc, buf, r) != r)
-			break;
+	hc->response[hc->responselen] = '\0';
+	if (!(br = strstr(&hc->response[off], "\r\n\r\n")) && !(br = strstr(&hc->response[off], "\n\n"))) {
+		if (hc->responselen - off > CGI_HEADERS_MAX)
+			return -1;
+		return 0;
 	}
 
+	headers_size = 0;
+	headers_len = hc->responselen - off;
+	httpd_realloc_str(&headers, &headers_size, headers_len);
+	memcpy(headers, &hc->response[off], headers_len + 1);
+	br = headers + (br - &hc->response[off]);
+
+	/* The connection can only be kept if the client can tell where the
+	** response ends, and the script has no say in it.
+	*/
+	status = cgi_status(headers, br);
+	if (!cgi_header(headers, br, "Content-Length:") ||
+	    cgi_header(headers, br, "Transfer-Encoding:") ||
+	    cgi_header(headers, br, "Connection:"))
+		hc->do_keep_alive = 0;
+	cgi_normalize_newline(&headers, &headers_len, &headers_size, br - headers);
+
+	snprintf(buf, sizeof(buf), "HTTP/1.0 %d %s\r\n", status, cgi_title(status));
+	hc->responselen = off;
+	add_response(hc, buf);
+	if (hc->do_keep_alive)
+		add_literal(hc, "Connection: keep-alive\r\n");
+	httpd_add_response(hc, headers, headers_len);
 	free(headers);
-	shutdown(hc->conn_fd, SHUT_WR);
-}
+	hc->status = status;
 
+	return 1;
+}
 
-/* CGI child process. */
-static void cgi_child(struct http_conn *hc)
+/* CGI child process.  The request body, if any, is read from rfd, and
+** the output written to wfd, both relayed by the server.  Headers such
+** as "Status:" and "Location:" are parsed by httpd_cgi_headers() there,
+** unless this is an NPH script.
+*/
+static void cgi_child(struct http_conn *hc, int rfd, int wfd)
 {
-	int r;
 	char **argp;
 	char **envp;
 	char *binary;
 	char *directory;
 
-	/* Unset close-on-exec flag for this socket.  This actually shouldn't
-	** be necessary, according to POSIX a dup()'d file descriptor does
-	** *not* inherit the close-on-exec flag, its flag is always clear.
-	** However, Linux messes this up and does copy the flag to the
-	** dup()'d descriptor, so we have to clear it.  This could be
-	** ifdeffed for Linux only.
-	*/
-	(void)clear_cloexec(hc->conn_fd);
-
-	/* If the connection happens to be using one of the stdio
-	** descriptors move it to another descriptor so that the
-	** dup2() calls below don't screw things up.
-	*/
-	if (hc->conn_fd == STDIN_FILENO || hc->conn_fd == STDOUT_FILENO || hc->conn_fd == STDERR_FILENO) {
-		int newfd = dup(hc->conn_fd);
-
-		if (newfd >= 0)
-			hc->conn_fd = newfd;
-		/* If the dup() fails, shrug.  We'll just take our
-		** chances.  Shouldn't happen though.
-		*/
-	}
-
 	/* Make the environment vector. */
 	envp = make_envp(hc);
 
 	/* Make the argument vector. */
 	argp = make_argp(hc);
 
-	/* Set up stdin.  For POSTs we may have to set up a pipe from an
-	** interposer process, depending on if we've read some of the data
-	** into our buffer.
+	/* Set up stdin, stdout, and stderr.  If the pipes happen to be
+	** using one of the stdio descriptors move them out of the way
+	** first, so that the dup2() calls below don't screw things up.
+	** The connection is close-on-exec, the program never sees it.
 	*/
-	if ((hc->method == METHOD_POST || hc->method == METHOD_PUT) && hc->read_idx >= hc->checked_idx) {
-		int p[2];
-
-		if (pipe(p) < 0) {
-			syslog(LOG_ERR, "pipe: %s", strerror(errno));
-			httpd_send_err(hc, 500, err500title, "", err500form, hc->encodedurl);
-			httpd_send_response(hc);
-			exit(1);
-		}
-		r = fork();
-		if (r < 0) {
-			syslog(LOG_ERR, "fork: %s", strerror(errno));
-			httpd_send_err(hc, 500, err500title, "", err500form, hc->encodedurl);
-			httpd_send_response(hc);
-			exit(1);
-		}
-		if (r == 0) {
-			/* Interposer process. */
-			sub_process = 1;
-			(void)close(p[0]);
-			cgi_interpose_input(hc, p[1]);
-			exit(0);
-		}
-
-		/* Need to schedule a kill for process r; but in the main process! */
-		(void)close(p[1]);
-		if (p[0] != STDIN_FILENO) {
-			dup2(p[0], STDIN_FILENO);
-			(void)close(p[0]);
-		}
-	} else {
-		/* Otherwise, the request socket is stdin. */
-		if (hc->conn_fd != STDIN_FILENO)
-			dup2(hc->conn_fd, STDIN_FILENO);
+	if (rfd < 0)
+		rfd = open("/dev/null", O_RDONLY);
+	if (rfd >= 0 && rfd <= STDERR_FILENO)
+		rfd = fcntl(rfd, F_DUPFD, STDERR_FILENO + 1);
+	if (wfd <= STDERR_FILENO)
+		wfd = fcntl(wfd, F_DUPFD, STDERR_FILENO + 1);
+	if (rfd < 0 || wfd < 0) {
+		syslog(LOG_ERR, "Failed setting up CGI stdio: %s", strerror(errno));
+		exit(1);
 	}
 
-	/* Set up stdout/stderr.  If we're doing CGI header parsing,
-	** we need an output interposer too.
-	*/
-	if (strncmp(argp[0], "nph-", 4) != 0 && hc->mime_flag) {
-		int p[2];
-
-		if (pipe(p) < 0) {
-			syslog(LOG_ERR, "pipe: %s", strerror(errno));
-			httpd_send_err(hc, 500, err500title, "", err500form, hc->encodedurl);
-			httpd_send_response(hc);
-			exit(1);
-		}
-		r = fork();
-		if (r < 0) {
-			syslog(LOG_ERR, "fork: %s", strerror(errno));
-			httpd_send_err(hc, 500, err500title, "", err500form, hc->encodedurl);
-			httpd_send_response(hc);
-			exit(1);
-		}
-		if (r == 0) {
-			/* Interposer process. */
-			sub_process = 1;
-			(void)close(p[1]);
-			cgi_interpose_output(hc, p[0]);
-			exit(0);
-		}
-		/* Need to schedule a kill for process r; but in the main process! */
-		(void)close(p[0]);
-		if (p[1] != STDOUT_FILENO)
-			dup2(p[1], STDOUT_FILENO);
-		if (p[1] != STDERR_FILENO)
-			dup2(p[1], STDERR_FILENO);
-		if (p[1] != STDOUT_FILENO && p[1] != STDERR_FILENO)
-			(void)close(p[1]);
-	} else {
-		/* Otherwise, the request socket is stdout/stderr. */
-		if (hc->conn_fd != STDOUT_FILENO)
-			dup2(hc->conn_fd, STDOUT_FILENO);
-		if (hc->conn_fd != STDERR_FILENO)
-			dup2(hc->conn_fd, STDERR_FILENO);
-	}
-
-	/* At this point we would like to set close-on-exec again for hc->conn_fd
-	** (see previous comments on Linux's broken behavior re: close-on-exec
-	** and dup.)  Unfortunately there seems to be another Linux problem, or
-	** perhaps a different aspect of the same problem - if we do this
-	** close-on-exec in Linux, the socket stays open but stderr gets
-	** closed - the last fd duped from the socket.  What a mess.  So we'll
-	** just leave the socket as is, which under other OSs means an extra
-	** file descriptor gets passed to the child process.  Since the child
-	** probably already has that file open via stdin stdout and/or stderr,
-	** this is not a problem.
-	*/
-	/* (void)set_cloexec(hc->conn_fd); */
+	dup2(rfd, STDIN_FILENO);
+	dup2(wfd, STDOUT_FILENO);
+	dup2(wfd, STDERR_FILENO);
+	(void)close(rfd);
+	(void)close(wfd);
 
 #ifdef CGI_NICE
 	/* Set priority. */
@@ -4352,8 +4980,6 @@ static void cgi_child(struct http_conn *hc)
 	/* argp[0] is already set up with the basename of php_cgi */
 	if (is_php(hc, NULL))
 		binary = hc->hs->php_cgi;
-	else if (is_ssi(hc, NULL))
-		binary = hc->hs->ssi_cgi;
 	else {
 		/* Split the program into directory and binary, so we can chdir()
 		** to the program's own directory.  This isn't in the CGI 1.1
@@ -4384,19 +5010,19 @@ static void cgi_child(struct http_conn *hc)
 
 	/* Close the syslog descriptor so that the CGI program can't
 	** mess with it.  All other open descriptors should be either
-	** the listen socket(s), sockets from accept(), or the file-logging
-	** fd, and all of those are set to close-on-exec, so we don't
-	** have to close anything else.
+	** the listen socket(s), sockets from accept(), pipes to other
+	** CGIs, or the file-logging fd, and all of those are set to
+	** close-on-exec, so we don't have to close anything else.
 	*/
 	closelog();
 
 	/* Run the program. */
 	execve(binary, argp, envp);
 
-	/* Something went wrong, in a chroot() we may not get this syslog() msg. */
+	/* Something went wrong, in a chroot() we may not get this syslog() msg.
+	** No output at all, the server responds with an error for us.
+	*/
 	syslog(LOG_ERR, "execve %s(%s): %s", binary, hc->expnfilename, strerror(errno));
-	httpd_send_err(hc, 500, err500title, "", err500form, hc->encodedurl);
-	httpd_send_response(hc);
 	exit(1);
 }
 
@@ -4434,40 +5060,144 @@ int httpd_cgi_untrack(struct httpd *hs, pid_t pid)
 	return 1;		/* Not found in this server */
 }
 
+int httpd_fcgi_init(struct httpd *hs, char *pattern, char *server[], int num)
+{
+	hs->fcgi = fcgi_pool_init(server, num);
+	if (!hs->fcgi)
+		return -1;
+
+	hs->fcgi_pattern = pattern;
+	hs->fcgi_match = match_compile(pattern);
+
+	return 0;
+}
+
+void httpd_fcgi_close(struct http_conn *hc)
+{
+	if (!hc->fcgi)
+		return;
+
+	fcgi_close(hc->fcgi);
+	hc->fcgi = NULL;
+	hc->hs->cgi_count--;
+}
+
+void httpd_cgi_close(struct http_conn *hc)
+{
+	if (hc->cgi_rfd >= 0)
+		(void)close(hc->cgi_rfd);
+	if (hc->cgi_wfd >= 0)
+		(void)close(hc->cgi_wfd);
+	hc->cgi_rfd = hc->cgi_wfd = -1;
+}
+
+/* Starts a FastCGI request, the caller relays the request body, from
+** hc->checked_idx in the read buffer, and the response.
+*/
+static int fcgi(struct http_conn *hc)
+{
+	char **envp;
+	int i;
+
+	envp = make_envp(hc);
+	hc->fcgi = fcgi_open(hc->hs->fcgi, envp);
+	for (i = 0; envp[i]; i++)
+		free(envp[i]);
+
+	if (!hc->fcgi) {
+		httpd_send_err(hc, 502, httpd_err502title, "", httpd_err502form, hc->encodedurl);
+		return -1;
+	}
+
+	syslog(LOG_INFO, "%.80s: FastCGI /%.200s%s \"%s\" \"%s\"",
+	       httpd_client(hc), hc->expnfilename, hc->encodedurl, hc->referer, hc->useragent);
+
+	hc->hs->cgi_count++;
+	hc->status = 200;
+	hc->bytes_sent = 0;
+	hc->should_linger = 0;
+
+	return 0;
+}
+
 static int cgi(struct http_conn *hc)
 {
+	int in[2] = { -1, -1 }, out[2] = { -1, -1 };
 	arg_t arg;
-	int pid;
+	char *cp;
+	int pid, i;
+
+	/* CGI owns the socket, there is none on an HTTP/2 stream */
+	if (hc->h2_stream) {
+		hc->http1_required = 1;
+		return -1;
+	}
+
+	if (hc->hs->cgi_limit != 0 && hc->hs->cgi_count >= hc->hs->cgi_limit) {
+		hc->do_keep_alive = 0;
+		httpd_send_err(hc, 503, httpd_err503title, "", httpd_err503form, hc->encodedurl);
+		return -1;
+	}
+
+	/* Kept alive if the response has a length, see httpd_cgi_headers() */
+	if (is_fcgi(hc, NULL))
+		return fcgi(hc);
 
 	/*
 	** We are not going to leave the socket open after a CGI ... too difficult
 	*/
 	hc->do_keep_alive = 0;
 
-	if (hc->hs->cgi_limit != 0 && hc->hs->cgi_count >= hc->hs->cgi_limit) {
-		httpd_send_err(hc, 503, httpd_err503title, "", httpd_err503form, hc->encodedurl);
-		return -1;
+	/* The request body is relayed to the program's stdin, and its
+	** output back to the client, by the caller.  Our ends of the
+	** pipes must not leak into other CGI programs.
+	*/
+	if (hc->method == METHOD_POST || hc->method == METHOD_PUT) {
+		if (pipe(in) < 0)
+			goto fail;
+		(void)set_cloexec(in[1]);
 	}
+	if (pipe(out) < 0)
+		goto fail;
+	(void)set_cloexec(out[0]);
+
+	/* Don't let the child inherit, and write out, our buffered log lines */
+	alog_flush();
 
-	(void)httpd_clear_ndelay(hc->conn_fd);
 	pid = fork();
-	if (pid < 0) {
-		syslog(LOG_ERR, "fork: %s", strerror(errno));
-		httpd_send_err(hc, 500, err500title, "", err500form, hc->encodedurl);
-		return -1;
-	}
+	if (pid < 0)
+		goto fail;
 	if (pid == 0) {
 		/* Child process. */
 		sub_process = 1;
 		httpd_unlisten(hc->hs);
-		cgi_child(hc);
-	}
+		if (in[1] >= 0)
+			(void)close(in[1]);
+		(void)close(out[0]);
+		cgi_child(hc, in[0], out[1]);
+	}
+
+	if (in[0] >= 0)
+		(void)close(in[0]);
+	(void)close(out[1]);
+	hc->cgi_rfd = out[0];
+	hc->cgi_wfd = in[1];
+	(void)httpd_set_ndelay(hc->cgi_rfd);
+	if (hc->cgi_wfd >= 0)
+		(void)httpd_set_ndelay(hc->cgi_wfd);
+
+	/* NPH scripts, and HTTP/0.9 clients, get the output as is */
+	cp = strrchr(hc->expnfilename, '/');
+	cp = cp ? cp + 1 : hc->expnfilename;
+	hc->cgi_nph = !hc->mime_flag ||
+		(!is_php(hc, NULL) && !strncmp(cp, "nph-", 4));
 
 	/* Parent process spawned CGI process PID. */
 	syslog(LOG_INFO, "%.80s: CGI[%d] /%.200s%s \"%s\" \"%s\"",
 	       httpd_client(hc), pid, hc->expnfilename, hc->encodedurl, hc->referer, hc->useragent);
 
 	httpd_cgi_track(hc->hs, pid);
+	PROBE3(cgi_fork, hc->conn_fd, hc->req_id, pid);
 
 #ifdef CGI_TIMELIMIT
 	/* Schedule a kill for the child process, in case it runs too long */
@@ -4479,10 +5209,43 @@ static int cgi(struct http_conn *hc)
 #endif
 
 	hc->status = 200;
-	hc->bytes_sent = CGI_BYTECOUNT;
+	hc->bytes_sent = 0;
 	hc->should_linger = 0;
 
 	return 0;
+fail:
+	syslog(LOG_ERR, "Failed starting CGI %s: %s", hc->expnfilename, strerror(errno));
+	for (i = 0; i < 2; i++) {
+		if (in[i] >= 0)
+			(void)close(in[i]);
+		if (out[i] >= 0)
+			(void)close(out[i]);
+	}
+	httpd_send_err(hc, 500, httpd_err500title, "", httpd_err500form, hc->encodedurl);
+
+	return -1;
+}
+
+/* Scripts, unless the response is in the CGI micro-cache, or is being
+** made for another connection, then the caller waits for it.
+*/
+static int cgi_cached(struct http_conn *hc, struct timeval *now)
+{
+	switch (cgc_lookup(hc, now->tv_sec, 1)) {
+	case CGC_HIT:
+	case CGC_BUSY:
+		return 0;
+	}
+
+	return cgi(hc);
+}
+
+int httpd_cgi_resume(struct http_conn *hc, struct timeval *now)
+{
+	if (cgc_lookup(hc, now->tv_sec, 0) == CGC_HIT)
+		return 0;
+
+	return cgi(hc);
 }
 
 
@@ -4500,16 +5263,14 @@ static int is_cgi(struct http_conn *hc)
 
 	fn = hc->expnfilename;
 	if (hc->hs->vhost) {
-		int len;
-		char buf[256];
+		size_t len = strlen(hc->hostdir);
 
-		len = snprintf(buf, sizeof(buf), "%s/**", hc->hostdir) - 2;
-		if (match(buf, fn))
-			fn += len;
+		if (!strncmp(fn, hc->hostdir, len) && fn[len] == '/')
+			fn += len + 1;
 	}
 
 	/* With the vhost prefix out of the way we can match CGI patterns */
-	if (hc->hs->cgi_pattern && match(hc->hs->cgi_pattern, fn))
+	if (match_exec(hc->hs->cgi_match, fn))
 		return 1;
 
 	if (is_php(hc, fn))
@@ -4518,65 +5279,98 @@ static int is_cgi(struct http_conn *hc)
 	if (is_ssi(hc, fn))
 		return 1;
 
+	if (is_fcgi(hc, fn))
+		return 1;
+
 	return 0;
 }
 
 /*
-** Adds Vary: Accept-Encoding to relevant files.  For details, see
+** Decides on on-the-fly compression, then serves a precompressed sibling,
+** file.br, file.zst, or file.gz, instead if the client accepts it at least
+** as much, in the order of the client's q-values, preferring the smallest
+** on ties.  The sibling must be world-readable and not older than the
+** original.  Also adds Vary: Accept-Encoding to relevant files.  For details, see
 ** https://www.maxcdn.com/blog/accept-encoding-its-vary-important/
-** TODO: Refactor, too much focus on finding .gz files
 */
 static char *mod_headers(struct http_conn *hc)
 {
-	int serve_dotgz = 0;
-	char *fn = NULL;
+	static const struct {
+		int         enc;
+		const char *ext;
+		const char *name;
+	} sibling[] = {		/* Sorted in order of preference */
+		{ ENCODING_BR,   ".br",  "br"   },
+		{ ENCODING_ZSTD, ".zst", "zstd" },
+		{ ENCODING_GZIP, ".gz",  "gzip" },
+	};
+	char *match[] = { ".js", ".css", ".xml", ".gz", ".br", ".zst", ".html" };
+	char fn[MAXPATHLEN];
 	char *header = "";
-	char *match[] = { ".js", ".css", ".xml", ".gz", ".html" };
+	char *ext;
 	size_t i, len;
-	struct stat st;
+	struct stat st, sb;
+	int best = -1;
+	int q = 0;
+
+	/* no zlib */
+	if (!hc->has_deflate)
+		hc->compression_type = COMPRESSION_NONE;
+	/* don't try to compress non-text files unless it's javascript */
+	else if (strncmp(hc->type, "text/", 5) && strcmp(hc->type, "application/javascript"))
+		hc->compression_type = COMPRESSION_NONE;
+        /* don't try to compress really small things */
+	else if (hc->sb.st_size < 256)
+		hc->compression_type = COMPRESSION_NONE;
 
-	if (hc->compression_type != COMPRESSION_GZIP)
+	/* Only if there are no previous encodings, e.g. .tar.gz */
+	len = strlen(hc->expnfilename);
+	if (hc->encodings[0] != 0 || len + 5 > sizeof(fn))
 		goto done;
 
-	/* construct .gz filename, remember NUL */
-	len = strlen(hc->expnfilename) + 4;
-	fn = malloc(len);
-	snprintf(fn, len, "%s.gz", hc->expnfilename);
+	/* A sibling must be accepted at least as much as on-the-fly */
+	if (hc->compression_type == COMPRESSION_GZIP)
+		q = hc->accept_q[ENCODING_GZIP];
+	else if (hc->compression_type == COMPRESSION_ZSTD)
+		q = hc->accept_q[ENCODING_ZSTD];
+
+	memcpy(fn, hc->expnfilename, len);
+	for (i = 0; i < NELEMS(sibling); i++) {
+		int sq = hc->accept_q[sibling[i].enc];
+
+		if (sq <= 0 || sq < q)
+			continue;
 
-	/* is there a .gz file */
-	if (!stat(fn, &st)) {
 		/* Is it world-readable or world-executable? and newer than original */
-		if (st.st_mode & (S_IROTH | S_IXOTH) && st.st_mtime >= hc->sb.st_mtime)
-			serve_dotgz = 1;
+		strcpy(&fn[len], sibling[i].ext);
+		if (stc_stat(fn, &st) || !(st.st_mode & (S_IROTH | S_IXOTH)) || st.st_mtime < hc->sb.st_mtime)
+			continue;
+
+		/* Equally accepted, the smaller one wins */
+		if (best >= 0 && sq == q && st.st_size >= sb.st_size)
+			continue;
+
+		q    = sq;
+		best = i;
+		sb   = st;
 	}
 
-	/* can serve .gz file and there is no previous encodings */
-	if (serve_dotgz && hc->encodings[0] == 0) {
-		httpd_realloc_str(&hc->expnfilename, &hc->maxexpnfilename, strlen(fn) + 2);
+	if (best >= 0) {
+		strcpy(&fn[len], sibling[best].ext);
+		httpd_conn_str(hc, &hc->expnfilename, &hc->maxexpnfilename, strlen(fn) + 2);
 		strlcpy(hc->expnfilename, fn, hc->maxexpnfilename);
+		hc->sb = sb;
 
-		hc->sb.st_size = st.st_size;
 		hc->compression_type = COMPRESSION_NONE; /* Compressed already, do not call zlib */
-		httpd_realloc_str(&hc->encodings, &hc->maxencodings, 5);
-		strncpy(hc->encodings, "gzip", hc->maxencodings);
+		httpd_conn_str(hc, &hc->encodings, &hc->maxencodings, strlen(sibling[best].name) + 1);
+		strlcpy(hc->encodings, sibling[best].name, hc->maxencodings);
 	}
 
-	free(fn);
 done:
-	/* no zlib */
-	if (!hc->has_deflate)
-		hc->compression_type = COMPRESSION_NONE;
-	/* don't try to compress non-text files unless it's javascript */
-	else if (strncmp(hc->type, "text/", 5) && strcmp(hc->type, "application/javascript"))
-		hc->compression_type = COMPRESSION_NONE;
-        /* don't try to compress really small things */
-	else if (hc->sb.st_size < 256)
-		hc->compression_type = COMPRESSION_NONE;
-
-	fn = strrchr(hc->expnfilename, '.');
-	if (fn || strstr(hc->encodings, "gzip")) {
+	ext = strrchr(hc->expnfilename, '.');
+	if (ext) {
 		for (i = 0; i < NELEMS(match); i++) {
-			if (strcmp(fn, match[i]))
+			if (strcmp(ext, match[i]))
 				continue;
 
 			header = "Vary: Accept-Encoding\r\n";
@@ -4587,11 +5381,50 @@ done:
 	return header;
 }
 
-int httpd_start_request(struct http_conn *hc, struct timeval *now)
+/* Swap hc->file_address for its cached compressed copy, if possible,
+** and pick up the descriptor for zero-copy sends.  Returns the length
+** of what is to be sent.
+*/
+static off_t compress_cached(struct http_conn *hc, off_t length)
+{
+	if (hc->compression_type != COMPRESSION_NONE && hc->encodings[0] == 0) {
+		const char *name = compression_name(hc->compression_type);
+		char *gz;
+		off_t len;
+
+		/* Serve from compressed cache, with Content-Length and Range */
+		gz = mmc_compress(hc->file_address, &hc->sb, hc->compression_type, compression_level, &len);
+		if (gz) {
+			hc->file_address = gz;
+			hc->compression_type = COMPRESSION_NONE;
+			httpd_conn_str(hc, &hc->encodings, &hc->maxencodings, strlen(name) + 1);
+			strlcpy(hc->encodings, name, hc->maxencodings);
+
+			length = len;
+			if (hc->got_range && hc->last_byte_index >= length)
+				hc->last_byte_index = length - 1;
+		}
+	}
+
+	/* HTTP/2 frames DATA from memory, and large files are mapped in
+	** windows, there is no on-the-fly encoding of either
+	*/
+	if (hc->h2_stream || mmc_windowed(hc->file_address, &hc->sb))
+		hc->compression_type = COMPRESSION_NONE;
+
+	/* Plain HTTP, or kernel TLS, and uncompressed, stream from page cache */
+	if ((!hc->ssl || httpd_ssl_ktls_send(hc)) && hc->compression_type == COMPRESSION_NONE)
+		hc->file_fd = mmc_fd(hc->file_address, &hc->sb);
+
+	return length;
+}
+
+static int start_request(struct http_conn *hc, struct timeval *now)
 {
 	static const char *index_names[] = { INDEX_NAMES };
 	size_t expnlen, indxlen, i;
 	char *cp, *pi;
+	off_t length;
 	int is_icon;
 
 	is_icon = mmc_icon_check(hc->decodedurl, &hc->sb);
@@ -4601,12 +5434,12 @@ int httpd_start_request(struct http_conn *hc, struct timeval *now)
 		goto sneaky;
 	}
 
-	/* Stat the file. */
-	if (stat(hc->expnfilename, &hc->sb) < 0) {
+	/* Stat the file, unless resolve_open() has. */
+	if (hc->open_fd < 0 && stc_stat(hc->expnfilename, &hc->sb) < 0) {
 		if (ENOENT == errno)
 			httpd_send_err(hc, 404, err404title, "", err404form, hc->encodedurl);
 		else
-			httpd_send_err(hc, 500, err500title, "", err500form, hc->encodedurl);
+			httpd_send_err(hc, 500, httpd_err500title, "", httpd_err500form, hc->encodedurl);
 		return -1;
 	}
 
@@ -4628,6 +5461,8 @@ int httpd_start_request(struct http_conn *hc, struct timeval *now)
 
 	/* Is it a directory? */
 	if (S_ISDIR(hc->sb.st_mode)) {
+		close_open(hc);
+
 		/* If there's pathinfo, it's just a non-existent file. */
 		if (hc->pathinfo[0] != '\0') {
 			httpd_send_err(hc, 404, err404title, "", err404form, hc->encodedurl);
@@ -4647,7 +5482,7 @@ int httpd_start_request(struct http_conn *hc, struct timeval *now)
 		/* Check for an index file. */
 		for (i = 0; i < NELEMS(index_names); ++i) {
 			/* +2 = extra slash plus \0, strlen() returns length without \0 */
-			httpd_realloc_str(&hc->indexname, &hc->maxindexname, expnlen + 2 + strlen(index_names[i]));
+			httpd_conn_str(hc, &hc->indexname, &hc->maxindexname, expnlen + 2 + strlen(index_names[i]));
 			strcpy(hc->indexname, hc->expnfilename);
 			indxlen = strlen(hc->indexname);
 			if (indxlen == 0 || hc->indexname[indxlen - 1] != '/')
@@ -4655,7 +5490,7 @@ int httpd_start_request(struct http_conn *hc, struct timeval *now)
 			if (strcmp(hc->indexname, "./") == 0)
 				hc->indexname[0] = '\0';
 			strcat(hc->indexname, index_names[i]);
-			if (stat(hc->indexname, &hc->sb) >= 0)
+			if (stc_stat(hc->indexname, &hc->sb) >= 0)
 				goto got_one;
 		}
 
@@ -4688,7 +5523,7 @@ int httpd_start_request(struct http_conn *hc, struct timeval *now)
 		if (!check_referer(hc))
 			return -1;
 		/* Ok, generate an index. */
-		return ls(hc);
+		return ls(hc, now);
 #else /* GENERATE_INDEXES */
 		syslog(LOG_INFO, "%.80s URL \"%s\" tried to index a directory",
 		       httpd_client(hc), hc->encodedurl);
@@ -4705,12 +5540,12 @@ int httpd_start_request(struct http_conn *hc, struct timeval *now)
 		*/
 		cp = expand_symlinks(hc->indexname, &pi, hc->hs->no_symlink_check, hc->tildemapped);
 		if (!cp || pi[0] != '\0') {
-			httpd_send_err(hc, 500, err500title, "", err500form, hc->encodedurl);
+			httpd_send_err(hc, 500, httpd_err500title, "", httpd_err500form, hc->encodedurl);
 			return -1;
 		}
 
 		expnlen = strlen(cp);
-		httpd_realloc_str(&hc->expnfilename, &hc->maxexpnfilename, expnlen + 1);
+		httpd_conn_str(hc, &hc->expnfilename, &hc->maxexpnfilename, expnlen + 1);
 		strlcpy(hc->expnfilename, cp, hc->maxexpnfilename);
 
 		/* Now, is the index version world-readable or world-executable? */
@@ -4749,12 +5584,9 @@ sneaky:
 	if (hc->method == METHOD_OPTIONS) {
 		time_t now;
 		char buf[1000];
-		char nowbuf[100];
-		const char *rfc1123fmt = "%a, %d %b %Y %H:%M:%S GMT";
-
-		now = time(NULL);
-		strftime(nowbuf, sizeof(nowbuf), rfc1123fmt, gmtime(&now));
+		const char *nowbuf;
 
+		nowbuf = http_date(&now);
 		snprintf(buf, sizeof(buf),
 			 "%.20s %d %s\r\n"
 			 "Date: %s\r\n"
@@ -4776,12 +5608,6 @@ sneaky:
 			add_response(hc, buf);
 		}
 
-		snprintf(buf, sizeof(buf),
-			 "Content-Length: 0\r\n"
-			 "Content-Type: text/html\r\n"
-			 "\r\n");
-		add_response(hc, buf);
-
 		/* HTTP Strict Transport Security: https://www.chromium.org/hsts */
 		if (hc->ssl) {
 			snprintf(buf, sizeof(buf), "Strict-Transport-Security: "
@@ -4791,16 +5617,30 @@ sneaky:
 			add_response(hc, buf);
 		}
 
+		snprintf(buf, sizeof(buf),
+			 "Content-Length: 0\r\n"
+			 "Content-Type: text/html\r\n"
+			 "\r\n");
+		add_response(hc, buf);
+
 		return 0;
 	}
 
 	/* Is it world-executable and in the CGI area? */
 	if (is_cgi(hc)) {
 		if (hc->sb.st_mode & S_IXOTH && hc->hs->cgi_enabled)
-			return cgi(hc);
+			return cgi_cached(hc, now);
+
+		if (is_ssi(hc, NULL)) {
+			if (hc->method != METHOD_GET && hc->method != METHOD_HEAD) {
+				httpd_send_err(hc, 501, err501title, "", err501form, httpd_method_str(hc->method));
+				return -1;
+			}
+			return ssi_send(hc, now);
+		}
 
-		if (is_php(hc, NULL) || is_ssi(hc, NULL))
-			return cgi(hc);
+		if (is_php(hc, NULL) || is_fcgi(hc, NULL))
+			return cgi_cached(hc, now);
 
 		syslog(LOG_DEBUG, "%.80s URL \"%s\" is a CGI but not executable, "
 		       "or CGI is disabled, rejecting.",
@@ -4839,28 +5679,81 @@ sneaky:
 	} else {
 		char *extra = mod_headers(hc);
 
-		hc->file_address = mmc_map(hc->expnfilename, &(hc->sb), now);
+		/* Not mapped yet, so open it below the document root, and
+		** without following symlinks, the file expand_symlinks()
+		** checked, not something swapped in since.
+		*/
+		if (hc->open_fd < 0 && !is_icon && !mmc_mapped(&hc->sb)) {
+			hc->open_fd = file_open(hc->hs->root_fd, hc->expnfilename,
+						!hc->hs->no_symlink_check && hc->expnfilename[0] != '/');
+			if (hc->open_fd < 0) {
+				syslog(LOG_INFO, "%.80s URL \"%s\" cannot open %s: %s", httpd_client(hc),
+				       hc->encodedurl, hc->expnfilename, strerror(errno));
+				httpd_send_err(hc, 404, err404title, "", err404form, hc->encodedurl);
+				return -1;
+			}
+		}
+
+		hc->file_address = mmc_map(hc->expnfilename, hc->open_fd, &(hc->sb), now);
+		hc->open_fd = -1;	/* consumed */
 		if (!hc->file_address) {
 			syslog(LOG_ERR, "mmc_map(%s): cannot find %s", hc->expnfilename, is_icon ? "icon" : "file");
 			if (is_icon)
 				httpd_send_err(hc, 404, err404title, "", err404form, hc->encodedurl);
 			else
-				httpd_send_err(hc, 500, err500title, "", err500form, hc->encodedurl);
+				httpd_send_err(hc, 500, httpd_err500title, "", httpd_err500form, hc->encodedurl);
 			return -1;
 		}
 
-		send_mime(hc, 200, ok200title, hc->encodings, extra, hc->type, hc->sb.st_size, hc->sb.st_mtime);
+		length = compress_cached(hc, hc->sb.st_size);
+		send_mime(hc, 200, ok200title, hc->encodings, extra, hc->type, length, hc->sb.st_mtime);
 	}
 
 	return 0;
 }
 
+int httpd_start_request(struct http_conn *hc, struct timeval *now)
+{
+	int rc;
+
+	PROBE3(start, hc->conn_fd, hc->req_id, hc->encodedurl);
+	rc = start_request(hc, now);
+	close_open(hc);
+	PROBE4(start_done, hc->conn_fd, hc->req_id, hc->status, rc);
+
+	return rc;
+}
+
+
+/* Common Log Format date, only changes once a second */
+static const char *log_date(void)
+{
+	static char buf[40];
+	static time_t prev = 0;
+	time_t now;
+
+	now = time(NULL);
+	if (now != prev) {
+		strftime(buf, sizeof(buf), "%d/%b/%Y:%H:%M:%S +0000", gmtime(&now));
+		prev = now;
+	}
+
+	return buf;
+}
+
+/* For responses not sent by httpd_send_response(), e.g., HTTP/2 streams */
+void httpd_log_request(struct http_conn *hc)
+{
+	make_log_entry(hc);
+}
 
 static void make_log_entry(struct http_conn *hc)
 {
 	char *ru;
 	char url[305];
 	char bytes[40];
+	char line[1024];
+	int len;
 
 	if (hc->hs->no_log)
 		return;
@@ -4892,6 +5785,24 @@ static void make_log_entry(struct http_conn *hc)
 	else
 		strcpy(bytes, "-");
 
+	/* Log files get the date as well, buffered and written in batches */
+	if (hc->hs->access_log) {
+		len = snprintf(line, sizeof(line), "%.80s - %.80s [%s] \"%s %.200s %.20s\" %d %s \"%.200s\" \"%.200s\"\n",
+			       httpd_client(hc), ru, log_date(), httpd_method_str(hc->method), url,
+			       hc->protocol, hc->status, bytes, hc->referer, hc->useragent);
+		if (len < 0)
+			return;
+		if ((size_t)len >= sizeof(line)) {
+			len = sizeof(line) - 1;
+			line[len - 1] = '\n';
+		}
+
+		alog_write(hc->hs->access_log, line, len);
+		if (sub_process)
+			alog_flush();
+		return;
+	}
+
 	syslog(LOG_INFO, "%.80s: %s \"%s %.200s %s\" %d %s \"%.200s\" \"%.200s\"",
 	       httpd_client(hc), ru, httpd_method_str(hc->method), url, hc->protocol,
 	       hc->status, bytes, hc->referer, hc->useragent);
@@ -4936,7 +5847,7 @@ static int really_check_referer(struct http_conn *hc)
 	/* Check for an empty referer. */
 	if (!hc->referer || hc->referer[0] == '\0' || (cp1 = strstr(hc->referer, "//")) == NULL) {
 		/* Disallow if we require a referer and the url matches. */
-		if (hs->no_empty_referers && match(hs->url_pattern, hc->origfilename))
+		if (hs->no_empty_referers && match_exec(hs->url_match, hc->origfilename))
 			return 0;
 
 		/* Otherwise ok. */
@@ -4982,7 +5893,7 @@ static int really_check_referer(struct http_conn *hc)
 	/* If the referer host doesn't match the local host pattern, and
 	** the filename does match the url pattern, it's an illegal reference.
 	*/
-	if (!match(lp, refhost) && match(hs->url_pattern, hc->origfilename))
+	if (!match(lp, refhost) && match_exec(hs->url_match, hc->origfilename))
 		return 0;
 
 	/* Otherwise ok. */
@@ -5174,12 +6085,57 @@ ssize_t httpd_writev(struct http_conn *hc, struct iovec *iov, int num)
 }
 
 
+#ifndef MSG_MORE
+#define MSG_MORE 0
+#endif
+
+ssize_t httpd_sendfile(struct http_conn *hc, int fd, off_t offset, size_t len)
+{
+	if (hc->ssl)
+		return httpd_ssl_sendfile(hc, fd, offset, len);
+
+#if defined(HAVE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+	ssize_t hlen = 0;
+	ssize_t rc;
+
+	/* Headers first, MSG_MORE tells the stack more is on its way */
+	if (hc->responselen > 0) {
+		hlen = send(hc->conn_fd, hc->response, hc->responselen, MSG_MORE);
+		if (hlen == -1) {
+			hc->errmsg = strerror(errno);
+			return -1;
+		}
+		if ((size_t)hlen < hc->responselen)
+			return hlen;
+	}
+
+	rc = sendfile(hc->conn_fd, fd, &offset, len);
+	if (rc == -1) {
+		/* Report the headers, next call gets the error again */
+		if (hlen > 0)
+			return hlen;
+
+		hc->errmsg = strerror(errno);
+		return -1;
+	}
+
+	return hlen + rc;
+#else
+	errno = ENOSYS;
+	hc->errmsg = strerror(errno);
+
+	return -1;
+#endif
+}
+
+
 /* Generate debugging statistics syslog message. */
 void httpd_logstats(long secs)
 {
 	if (str_alloc_count <= 0)
 		return;
 
-	syslog(LOG_INFO, "  libhttpd - %d strings allocated, %lu bytes (%g bytes/str)",
-	       str_alloc_count, (unsigned long)str_alloc_size, (float)str_alloc_size / str_alloc_count);
+	syslog(LOG_INFO, "  libhttpd - %d strings allocated, %lu bytes (%g bytes/str), %d spilled from arenas",
+	       str_alloc_count, (unsigned long)str_alloc_size, (float)str_alloc_size / str_alloc_count,
+	       arena_spill_count);
 }
@@ -90,6 +90,21 @@
 		list = next;			\
 } while (0)
 
+/* Content codings from Accept-Encoding, see http_conn.accept_q[] */
+#define ENCODING_GZIP 0
+#define ENCODING_BR   1
+#define ENCODING_ZSTD 2
+#define ENCODING_NUM  3
+
+/* On-the-fly zstd shares the streaming path with gzip, so needs zlib
+** too.  The compression-level, -1 .. 9, is used as is, except the zlib
+** default which maps to the zstd default.
+*/
+#if defined(HAVE_ZLIB_H) && defined(HAVE_ZSTD_H)
+#define HAVE_ZSTD
+#endif
+#define ZSTD_LEVEL(level) ((level) < 0 ? 3 : (level))
+
 
 /* The httpd structs. */
 
@@ -120,6 +135,7 @@ struct http_location {
 
 	char  *pattern;
 	char  *path;
+	int    cache;	/* CGI micro-cache TTL, seconds, see cgicache.h */
 };
 
 /* A server. */
@@ -133,23 +149,37 @@ struct httpd {
 	int    cgi_enabled;
 	pid_t *cgi_tracker;
 	char  *cgi_pattern;
+	struct match *cgi_match;	/* compiled patterns, see match_compile() */
 	int    cgi_limit;
 	int    cgi_count;
 
 	char *php_cgi;
 	char *php_pattern;
+	struct match *php_match;
 
-	char *ssi_cgi;
 	char *ssi_pattern;
+	struct match *ssi_match;
+
+	char *fcgi_pattern;
+	struct match *fcgi_match;
+	struct fcgi_pool *fcgi;	/* FastCGI backends, see httpd_fcgi_init() */
 
 	char *charset;
+	char **type_hdr;	/* Content-Type headers with charset, see init_mime() */
 	int   max_age;
+	char  cache_hdr[48];	/* Cache-Control: header for max_age */
+	char  shed_rsp[512];	/* canned 503, after Date:, see httpd_shed_conn() */
+	size_t shed_len;
 	char *cwd;
+	int   root_fd;		/* cwd, to open files below, see file_open() */
 
 	int listen4_fd;
 	int listen6_fd;
+	int max_conns;		/* Per server limit, 0 for none */
+	int num_conns;
 
 	int no_log;
+	struct alog *access_log;	/* or syslog, if not set */
 	int no_symlink_check;
 	int no_empty_referers;
 	int list_dotfiles;
@@ -158,9 +188,13 @@ struct httpd {
 
 	char *url_pattern;
 	char *local_pattern;
+	struct match *url_match;
+	struct match *useragent_match;	/* user-agent-deny */
 
 	struct http_redir *redirect;
 	struct http_location *location;
+	struct match *redirect_match;	/* all patterns, in list order */
+	struct match *location_match;
 
 	void *ctx;		/* Opaque SSL_CTX* */
 };
@@ -211,16 +245,16 @@ struct http_conn {
 	char *accesspath;
 #endif
 #ifdef AUTH_FILE
-	size_t maxauthpath, maxprevauthpath, maxprevuser, maxprevcryp;
+	size_t maxauthpath;
 	char *authpath;
-	char *prevauthpath;
-	char *prevuser;
-	char *prevcryp;
 #endif
 	size_t responselen;
+	char *arena;		/* Per-request strings above, see httpd_conn_str() */
+	size_t arena_size, arena_used;
 	time_t if_modified_since, range_if;
 	size_t contentlength;
 	const char *type;	/* not malloc()ed */
+	int type_idx;		/* in hs->type_hdr[], or -1 */
 	char *hostname;		/* not malloc()ed */
 	int mime_flag;
 	int one_one;		/* HTTP/1.1 or better */
@@ -232,12 +266,24 @@ struct http_conn {
 	int should_linger;
 	struct stat sb;
 	int conn_fd;
+	unsigned long req_id;	/* Set per request, for the tracepoints */
 	int has_deflate;	/* Built with zlib:deflate() and enabled */
 	int compression_type;
+	int accept_q[ENCODING_NUM]; /* q-values, in 1/1000, 0 if not acceptable */
 	char *file_address;
+	int file_fd;		/* For sendfile(), owned by mmc, or -1 */
+	int open_fd;		/* The file, opened while resolving, or -1 */
 
 	void *ssl;		/* Opaque SSL* */
 	int skip_redirect;	/* On location match, skip redirect */
+	int status_page;	/* Request for the built-in status page */
+	struct fcgi *fcgi;	/* FastCGI request in progress, relayed by the caller */
+	int cgi_rfd, cgi_wfd;	/* CGI output and stdin pipes, relayed, or -1 */
+	int cgi_nph;		/* CGI output is sent as is, no headers to parse */
+	struct cgc *cgc;	/* Cached response being made, or waited for */
+	int cgc_ttl;		/* For responses that don't say, from the location */
+	int h2_stream;		/* HTTP/2 stream id, no socket, or 0 */
+	int http1_required;	/* Cannot be served on an HTTP/2 stream */
 };
 
 /* Methods. */
@@ -265,9 +311,10 @@ struct http_conn {
 #define CHST_CRLFCR 10
 #define CHST_BOGUS 11
 
-/* For content-encoding: gzip */
+/* For on-the-fly content-encoding: gzip or zstd */
 #define COMPRESSION_NONE 0
 #define COMPRESSION_GZIP 1
+#define COMPRESSION_ZSTD 2
 
 /* Initializes main HTTPD server. Returns NULL on error. */
 extern struct httpd *httpd_init(char *hostname, unsigned short port, void *ssl_ctx,
@@ -282,26 +329,66 @@ extern int httpd_cgi_init(struct httpd *hs, int enabled, char *cgi_pattern, int
 /* Enable HTTP redirect -- Note: O(n) lookup per HTTP request */
 extern int httpd_redirect_add(struct httpd *hs, int code, char *pattern, char *location);
 
-/* Server location matching, overrides httpd cwd on match  */
-extern int httpd_location_add(struct httpd *hs, char *pattern, char *path);
+/* Server location matching, overrides httpd cwd on match, and sets the
+** time CGI responses are cached, if the cache is enabled.
+*/
+extern int httpd_location_add(struct httpd *hs, char *pattern, char *path, int cache);
 
 /* Start httpd */
 extern int httpd_listen(struct httpd *hs, sockaddr_t *sav4, sockaddr_t *sav6);
 
+/* Binds a listen socket to sa for worker id, in the supervisor, unless
+** one is left over from before a reload.  Returns -1 on error.
+*/
+extern int httpd_listen_bind(sockaddr_t *sa, int id);
+
+/* Closes the listen sockets not bound, or claimed, since last time.  With
+** keep the others are kept, otherwise they now belong to their httpd.
+*/
+extern void httpd_listen_prune(int keep);
+
+/* In a new worker, closes the listen sockets of all other workers */
+extern void httpd_listen_worker(int id);
+
+/* Listen sockets as "fd:id,..." to hand over across execve(), returns
+** the number of sockets, or -1 if buf is too small.  The other end
+** picks them up with httpd_listen_import().
+*/
+extern int httpd_listen_export(char *buf, size_t len);
+extern int httpd_listen_import(const char *str);
+
+/* Clears close-on-exec on all listen sockets, or sets it again */
+extern void httpd_listen_inherit(int on);
+
 /* Call to shut down. */
 extern void httpd_exit(struct httpd *hs);
 
 /* Call to unlisten/close socket(s) listening for new connections. */
 extern void httpd_unlisten(struct httpd *hs);
 
-/* Used to reinitialize the connection for pipelined keep-alive requets */
+/* Used to reinitialize the connection for pipelined keep-alive requets,
+** or to allocate its buffers again after httpd_release_conn().
+*/
 extern void httpd_init_conn_mem(struct http_conn *hc);
 extern void httpd_init_conn_content(struct http_conn *hc);
 
+/* Reinitialize a keep-alive connection for the next request, keeping any
+** pipelined requests already read and any response not yet sent.  Returns
+** the number of pipelined bytes now at the front of hc->read_buf.
+*/
+extern size_t httpd_reset_conn(struct http_conn *hc);
+
+/* Returns 1 if a complete pipelined request follows the current one, in
+** which case the buffered response is held back, to be sent with the next
+** response, instead of calling httpd_send_response().
+*/
+extern int httpd_hold_response(struct http_conn *hc);
+
 /* When a listen fd is ready to be read, call this.  It does the accept() and
 ** returns a struct http_conn* which includes the fd to read the request from
 ** and write the response to.  Returns an indication of whether the accept()
 ** failed, succeeded, or if there were no more connections to accept.
+** The connection fd is in non-blocking mode and closed on exec().
 **
 ** In order to minimize malloc()s, the caller passes in the struct http_conn.
 ** The caller is also responsible for setting initialized to zero before the
@@ -313,12 +400,19 @@ extern int httpd_get_conn(struct httpd *hs, int listen_fd, struct http_conn *hc)
 #define GC_OK 1
 #define GC_NO_MORE 2
 
+/* Accepts a connection on listen_fd only to answer it with a canned 503,
+** for admission control.  Returns GC_OK, GC_FAIL, or GC_NO_MORE like
+** httpd_get_conn().
+*/
+extern int httpd_shed_conn(struct httpd *hs, int listen_fd);
+
 /* Checks whether the data in hc->read_buf constitutes a complete request
 ** yet.  The caller reads data into hc->read_buf[hc->read_idx] and advances
 ** hc->read_idx.  This routine checks what has been read so far, using
 ** hc->checked_idx and hc->checked_state to keep track, and returns an
 ** indication of whether there is no complete request yet, there is a
 ** complete request, or there won't be a valid request due to a syntax error.
+** A complete request is given the next hc->req_id.
 */
 extern int httpd_got_request(struct http_conn *hc);
 
@@ -346,6 +440,29 @@ extern int httpd_start_request(struct http_conn *hc, struct timeval *now);
 /* Actually sends any buffered response text. */
 extern void httpd_send_response(struct http_conn *hc);
 
+/* Writes the access log entry for a response sent some other way. */
+extern void httpd_log_request(struct http_conn *hc);
+
+/* Queues a complete 200 response with a body generated in memory, of the
+** given content type, to be sent with httpd_send_response().
+*/
+extern void httpd_send_buf(struct http_conn *hc, const char *type, const char *buf, size_t len);
+
+/* Same as httpd_send_buf(), with the body gathered from num pieces. */
+extern void httpd_send_iov(struct http_conn *hc, const char *type, struct iovec *iov, int num);
+
+/* Append len bytes to the buffered response text. */
+extern void httpd_add_response(struct http_conn *hc, const char *buf, size_t len);
+
+/* For CGI output relayed by the caller, accumulated in the response
+** buffer from off, after responses held for earlier pipelined requests.
+** Once all the headers are in they are replaced with a status line, from
+** Status: or Location:, and the headers with normalized line endings,
+** followed by what we have of the body.  Returns 1 when done, 0 if more
+** output is needed, or -1 if the headers are too big.
+*/
+extern int httpd_cgi_headers(struct http_conn *hc, size_t off);
+
 /* Call this to close down a connection and free the data.  A fine point,
 ** if you fork() with a connection open you should still call this in the
 ** parent process - the connection will stay open in the child.
@@ -358,6 +475,11 @@ extern void httpd_close_conn(struct http_conn *hc, struct timeval *now);
 */
 extern void httpd_destroy_conn(struct http_conn *hc);
 
+/* Free the buffers of an idle connection, it stays open.  Call this only
+** when nothing has been read, or is left to send.
+*/
+extern void httpd_release_conn(struct http_conn *hc);
+
 /* Client IP addresses can be overridden by a proxy using X-Forwarded-For */
 extern char *httpd_client(struct http_conn *hc);
 
@@ -373,6 +495,10 @@ extern char *httpd_err400title;
 extern char *httpd_err400form;
 extern char *httpd_err408title;
 extern char *httpd_err408form;
+extern char *httpd_err500title;
+extern char *httpd_err500form;
+extern char *httpd_err502title;
+extern char *httpd_err502form;
 extern char *httpd_err503title;
 extern char *httpd_err503form;
 
@@ -382,6 +508,9 @@ extern char *httpd_method_str(int method);
 /* Reallocate a string. */
 extern void httpd_realloc_str(char **str, size_t *curr_len, size_t new_len);
 
+/* Reallocate one of the per-request strings of a connection. */
+extern void httpd_conn_str(struct http_conn *hc, char **str, size_t *curr_len, size_t new_len);
+
 /* Format a network socket to a string representation. */
 extern char *httpd_ntoa(sockaddr_t *sa);
 
@@ -404,6 +533,11 @@ extern ssize_t httpd_read(struct http_conn *hc, void *buf, size_t len);
 extern ssize_t httpd_write(struct http_conn *hc, void *buf, size_t len);
 extern ssize_t httpd_writev(struct http_conn *hc, struct iovec *iov, int num);
 
+/* Zero-copy send len bytes at offset of fd, any pending response headers
+** are sent first.  Returns the total, like httpd_writev().
+*/
+extern ssize_t httpd_sendfile(struct http_conn *hc, int fd, off_t offset, size_t len);
+
 /* Generate debugging statistics syslog message. */
 extern void httpd_logstats(long secs);
 
@@ -411,6 +545,27 @@ extern void httpd_logstats(long secs);
 extern int httpd_cgi_track(struct httpd *hs, pid_t pid);
 extern int httpd_cgi_untrack(struct httpd *hs, pid_t pid);
 
+/* A started CGI program, or FastCGI request below, is relayed by the
+** caller, from hc->cgi_rfd to the client, with the request body from
+** hc->checked_idx written to hc->cgi_wfd, if set.  Ends it by closing
+** the pipes, the program is reaped as usual.
+*/
+extern void httpd_cgi_close(struct http_conn *hc);
+
+/* Serve a request that waited for the same response to be made for
+** another, see cgc_wait(), from the cache or by starting the script.
+** Same return value as httpd_start_request().
+*/
+extern int httpd_cgi_resume(struct http_conn *hc, struct timeval *now);
+
+/* Serve files matching pattern from a pool of FastCGI servers, instead
+** of forking a CGI.  Requests still count towards the CGI limit.  The
+** caller relays hc->fcgi, if set after httpd_start_request(), and ends
+** it with httpd_fcgi_close().
+*/
+extern int httpd_fcgi_init(struct httpd *hs, char *pattern, char *server[], int num);
+extern void httpd_fcgi_close(struct http_conn *hc);
+
 /*
 ** Default CSS used in error pages
 */
@@ -2,36 +2,158 @@
 
 #Run this on developer side, whenever you update
 #your mime encodings, or mime types.
+#
+#Each table is emitted as a perfect hash, hash and displace: the FNV-1a
+#hash of the lowercase extension picks a bucket, the bucket's displace
+#value then moves all its keys to free slots.  A lookup is one hash and
+#one memcmp(), see mime_hash() and mime_find() in libhttpd.c, which must
+#match mime_hash() and mime_slot() below.
 
-open(ENCODINGS, '<', "mime_encodings.txt");
-@encoding=<ENCODINGS>;
-close(ENCODINGS);
+use strict;
+use integer;
 
-open(ENCHEADER, '>', "mime_encodings.h");
-foreach (@encoding)
+sub mime_hash
 {
-	chomp($_);
-	@element = split(/\t+/,$_);
-	next if $element[0] =~ /#/ ;
-	next if $element[1] =~ /#/ ;
-	next if length($element[0]) == 0 || length($element[1]) == 0 ;
-	print ENCHEADER '{ "', $element[0], '", 0, "', $element[1], '", 0 },', "\n";
+	my ($key) = @_;
+	my $h = 2166136261;
+
+	foreach my $c (unpack("C*", $key)) {
+		$h = (($h ^ $c) * 16777619) & 0xffffffff;
+	}
+
+	return $h;
+}
+
+sub mime_slot
+{
+	my ($h, $d, $mask) = @_;
+
+	return (((($h >> 16) | ($h << 16)) & 0xffffffff) + $d * (($h >> 7) | 1)) & $mask;
+}
+
+sub read_table
+{
+	my ($file) = @_;
+	my @table;
+	my %seen;
+
+	open(my $fh, '<', $file) or die "$file: $!";
+	foreach (<$fh>) {
+		chomp($_);
+		my @element = split(/\t+/, $_);
+		next if $element[0] =~ /#/ ;
+		next if $element[1] =~ /#/ ;
+		next if length($element[0]) == 0 || length($element[1]) == 0 ;
+
+		my $ext = lc($element[0]);
+		die "$file: duplicate extension $ext\n" if $seen{$ext}++;
+		push(@table, [ $ext, $element[1] ]);
+	}
+	close($fh);
+
+	return @table;
+}
+
+# Returns the table size, the displace value for each bucket, and the
+# entry in each slot.  Grows the table until every bucket fits.
+sub perfect_hash
+{
+	my @table = @_;
+	my $n = scalar(@table);
+	my $size = 8;
+
+	$size *= 2 while $size < $n * 5 / 4;
+	for (;; $size *= 2) {
+		my $nb = $n / 4 + 1;
+		my (@bucket, @disp, @slot);
+
+		foreach my $e (@table) {
+			push(@{$bucket[mime_hash($e->[0]) % $nb]}, $e);
+		}
+
+		my $ok = 1;
+		my @order = sort { scalar(@{$bucket[$b] || []}) <=> scalar(@{$bucket[$a] || []}) } (0 .. $nb - 1);
+		foreach my $i (@order) {
+			my @keys = @{$bucket[$i] || []};
+
+			$disp[$i] = 0;
+			next unless @keys;
+
+			my $found = 0;
+			for (my $d = 0; $d < $size && !$found; $d++) {
+				my %taken;
+
+				$found = 1;
+				foreach my $e (@keys) {
+					my $s = mime_slot(mime_hash($e->[0]), $d, $size - 1);
+					if ($slot[$s] || $taken{$s}++) {
+						$found = 0;
+						last;
+					}
+				}
+				next unless $found;
+
+				$disp[$i] = $d;
+				foreach my $e (@keys) {
+					$slot[mime_slot(mime_hash($e->[0]), $d, $size - 1)] = $e;
+				}
+			}
+
+			unless ($found) {
+				$ok = 0;
+				last;
+			}
+		}
+
+		return ($size, \@disp, \@slot) if $ok;
+	}
 }
-close(ENCHEADER);
 
+sub quote
+{
+	my ($str) = @_;
 
-open(TYPES, '<', "mime_types.txt");
-@type=<TYPES>;
-close(TYPES);
+	$str =~ s/(["\\])/\\$1/g;
+	return $str;
+}
 
-open(TYPEHEADER, '>', "mime_types.h");
-foreach (@type)
+sub write_table
 {
-	chomp($_);
-	@element = split(/\t+/,$_);
-	next if $element[0] =~ /#/ ;
-	next if $element[1] =~ /#/ ;
-	next if length($element[0]) == 0 || length($element[1]) == 0 ;
-	print TYPEHEADER '{ "', $element[0], '", 0, "', $element[1], '", 0 },', "\n";
+	my ($file, $src, $name, $hdr, @table) = @_;
+	my ($size, $disp, $slot) = perfect_hash(@table);
+	my $max = 0;
+	my $NAME = uc($name);
+
+	foreach my $e (@table) {
+		$max = length($e->[0]) if length($e->[0]) > $max;
+	}
+
+	open(my $fh, '>', $file) or die "$file: $!";
+	print $fh "/* Generated by make_mime.pl from $src, do not edit */\n";
+	print $fh "#define ${NAME}_TAB_SIZE    $size\n";
+	print $fh "#define ${NAME}_TAB_BUCKETS ", scalar(@$disp), "\n";
+	print $fh "#define ${NAME}_EXT_MAX     $max\n\n";
+
+	print $fh "static const uint16_t ${name}_disp[${NAME}_TAB_BUCKETS] = {";
+	for (my $i = 0; $i < @$disp; $i++) {
+		print $fh ($i % 12 ? " " : "\n\t"), $disp->[$i], ",";
+	}
+	print $fh "\n};\n\n";
+
+	print $fh "static const struct mime_entry ${name}_tab[${NAME}_TAB_SIZE] = {\n";
+	for (my $i = 0; $i < $size; $i++) {
+		my $e = $slot->[$i] or next;
+		my ($ext, $val) = @$e;
+
+		printf $fh "\t[%d] = { \"%s\", %d, \"%s\", %d", $i, quote($ext), length($ext), quote($val), length($val);
+		if ($hdr) {
+			printf $fh ", \"Content-Type: %s\\r\\n\", %d", quote($val), $val =~ /%s/ ? 1 : 0;
+		}
+		print $fh " },\n";
+	}
+	print $fh "};\n";
+	close($fh);
 }
-close(TYPEHEADER);
+
+write_table("mime_encodings.h", "mime_encodings.txt", "enc", 0, read_table("mime_encodings.txt"));
+write_table("mime_types.h", "mime_types.txt", "typ", 1, read_table("mime_types.txt"));
@@ -1,6 +1,10 @@
 /* match.c - simple shell-style filename matcher
 **
-** Only does ? * and **, and multiple patterns separated by |.  Returns 1 or 0.
+** Only does ? * and **, and multiple patterns separated by |.  Patterns are
+** compiled to a small NFA, which is run over the string in a single pass,
+** keeping all possible positions in the pattern at once.  So there is no
+** backtracking, the cost is at most the string length times the pattern
+** length, and any number of patterns can be matched in the same pass.
 **
 ** Copyright (C) 1995-2015  Jef Poskanzer <jef@mail.acme.com>
 ** All rights reserved.
@@ -28,72 +32,328 @@
 */
 
 #include <config.h>
+#include <stdlib.h>
 #include <string.h>
 #include "match.h"
 
-static int match_one(const char *pattern, int patternlen, const char *string);
+/* Pattern items, each literal or ? consumes exactly one character */
+#define OP_END   0		/* end of an alternative, accept */
+#define OP_CHAR  1
+#define OP_ANY   2		/* ? */
+#define OP_STAR  3		/* *, anything but slash */
+#define OP_DSTAR 4		/* **, anything */
 
-int match(const char *pattern, const char *string)
+struct alt {
+	int pattern;		/* index, in the order added */
+	int first;		/* first item */
+	int end;		/* OP_END item */
+	int len;		/* value returned by match() */
+};
+
+struct item {
+	unsigned char op;
+	unsigned char ch;
+};
+
+struct match {
+	int            num;	/* patterns */
+
+	struct alt    *alt;
+	int            nalt, maxalt;
+
+	struct item   *item;
+	int            nitem, maxitem;
+
+	/* Scratch space for match_run(), sized to nitem */
+	int           *cur, *next;
+	unsigned      *mark;
+	unsigned       gen;
+	int            nscratch;
+};
+
+static int grow(void **ptr, int *max, int need, size_t size)
 {
-	if (!pattern)
+	void *p;
+	int n;
+
+	if (need <= *max)
 		return 0;
 
-	for (;;) {
-		const char *or;
-		int rc;
+	n = *max ? *max * 2 : 16;
+	while (n < need)
+		n *= 2;
+
+	p = realloc(*ptr, n * size);
+	if (!p)
+		return -1;
+
+	*ptr = p;
+	*max = n;
+
+	return 0;
+}
+
+static int add_item(struct match *m, int op, int ch)
+{
+	if (grow((void **)&m->item, &m->maxitem, m->nitem + 1, sizeof(struct item)))
+		return -1;
+
+	m->item[m->nitem].op = op;
+	m->item[m->nitem].ch = ch;
+
+	return m->nitem++;
+}
+
+static int add_alt(struct match *m, const char *pattern, int len)
+{
+	struct alt *a;
+	int i, pos = 0, star = 0;
+
+	if (grow((void **)&m->alt, &m->maxalt, m->nalt + 1, sizeof(struct alt)))
+		return -1;
+
+	a = &m->alt[m->nalt];
+	a->pattern = m->num;
+	a->first = m->nitem;
+
+	for (i = 0; i < len; i++) {
+		int op = OP_CHAR;
+
+		if (pattern[i] == '?') {
+			op = OP_ANY;
+		} else if (pattern[i] == '*') {
+			op = OP_STAR;
+			if (i + 1 < len && pattern[i + 1] == '*') {
+				op = OP_DSTAR;
+				i++;
+			}
+			star = 1;
+		}
 
+		if (add_item(m, op, pattern[i]) < 0)
+			return -1;
+		if (!star)
+			pos++;
+	}
+
+	a->end = add_item(m, OP_END, 0);
+	if (a->end < 0)
+		return -1;
+
+	/* Length of the fixed prefix before the first wildcard, if any */
+	a->len = star && pos > 1 ? pos : 1;
+	m->nalt++;
+
+	return 0;
+}
+
+struct match *match_new(void)
+{
+	return calloc(1, sizeof(struct match));
+}
+
+int match_add(struct match *m, const char *pattern)
+{
+	const char *or;
+
+	if (!m || !pattern)
+		return -1;
+
+	for (;;) {
 		or = strchr(pattern, '|');
 		if (!or)
-			return match_one(pattern, strlen(pattern), string);
-
-		rc = match_one(pattern, or - pattern, string);
-		if (rc)
-			return rc;
+			break;
 
+		if (add_alt(m, pattern, or - pattern))
+			return -1;
 		pattern = or + 1;
 	}
+	if (add_alt(m, pattern, strlen(pattern)))
+		return -1;
+
+	return m->num++;
 }
 
+struct match *match_compile(const char *pattern)
+{
+	struct match *m;
+
+	if (!pattern)
+		return NULL;
+
+	m = match_new();
+	if (!m)
+		return NULL;
+
+	if (match_add(m, pattern) < 0) {
+		match_free(m);
+		return NULL;
+	}
+
+	return m;
+}
 
-static int match_one(const char *pattern, int patternlen, const char *string)
+void match_free(struct match *m)
 {
-	const char *p, *s;
+	if (!m)
+		return;
 
-	for (p = pattern, s = string; p - pattern < patternlen; ++p, ++s) {
-		if (*p == '?' && *s != '\0')
-			continue;
+	free(m->alt);
+	free(m->item);
+	free(m->cur);
+	free(m->next);
+	free(m->mark);
+	free(m);
+}
 
-		if (*p == '*') {
-			int i, pl;
-
-			++p;
-			if (*p == '*') {
-				/* Double-wildcard matches anything. */
-				++p;
-				i = strlen(s);
-			} else {
-				/* Single-wildcard matches anything but slash. */
-				i = strcspn(s, "/");
-			}
+/* Add position i, and the ones reachable without consuming anything */
+static void follow(struct match *m, int *list, int *num, int i)
+{
+	for (;;) {
+		if (m->mark[i] == m->gen)
+			return;
 
-			pl = patternlen - (p - pattern);
-			for (; i >= 0; --i) {
-				if (match_one(p, pl, &(s[i]))) {
-					int len = s - string;
+		m->mark[i] = m->gen;
+		list[(*num)++] = i;
+		if (m->item[i].op != OP_STAR && m->item[i].op != OP_DSTAR)
+			return;
+		i++;		/* a wildcard may match nothing */
+	}
+}
 
-					return len > 1 ? len : 1;
-				}
-			}
+static void next_gen(struct match *m)
+{
+	if (++m->gen == 0) {
+		memset(m->mark, 0, m->nitem * sizeof(unsigned));
+		m->gen = 1;
+	}
+}
 
-			return 0;
-		}
+/* Run all patterns over the string, afterwards the OP_END items of the
+** alternatives that match are marked with the current generation.
+*/
+static int match_run(struct match *m, const char *string)
+{
+	const unsigned char *s = (const unsigned char *)string;
+	int ncur = 0, nnext, i, *tmp;
 
-		if (*p != *s)
-			return 0;
+	if (m->nscratch < m->nitem) {
+		free(m->cur);
+		free(m->next);
+		free(m->mark);
+		m->cur  = malloc(m->nitem * sizeof(int));
+		m->next = malloc(m->nitem * sizeof(int));
+		m->mark = calloc(m->nitem, sizeof(unsigned));
+		m->gen  = 0;
+		if (!m->cur || !m->next || !m->mark) {
+			m->nscratch = 0;
+			return -1;
+		}
+		m->nscratch = m->nitem;
 	}
 
-	if (*s == '\0')
-		return 1;
+	next_gen(m);
+	for (i = 0; i < m->nalt; i++)
+		follow(m, m->cur, &ncur, m->alt[i].first);
+
+	for (; *s && ncur > 0; s++) {
+		next_gen(m);
+		nnext = 0;
+
+		for (i = 0; i < ncur; i++) {
+			int pos = m->cur[i];
+
+			switch (m->item[pos].op) {
+			case OP_CHAR:
+				if (m->item[pos].ch == *s)
+					follow(m, m->next, &nnext, pos + 1);
+				break;
+
+			case OP_ANY:
+				follow(m, m->next, &nnext, pos + 1);
+				break;
+
+			case OP_STAR:
+				if (*s != '/')
+					follow(m, m->next, &nnext, pos);
+				break;
+
+			case OP_DSTAR:
+				follow(m, m->next, &nnext, pos);
+				break;
+			}
+		}
+
+		tmp = m->cur;
+		m->cur = m->next;
+		m->next = tmp;
+		ncur = nnext;
+	}
 
 	return 0;
 }
+
+int match_find(struct match *m, const char *string, int *len)
+{
+	int i;
+
+	if (!m || !string || match_run(m, string))
+		return -1;
+
+	for (i = 0; i < m->nalt; i++) {
+		if (m->mark[m->alt[i].end] != m->gen)
+			continue;
+
+		if (len)
+			*len = m->alt[i].len;
+		return m->alt[i].pattern;
+	}
+
+	return -1;
+}
+
+int match_exec(struct match *m, const char *string)
+{
+	int len;
+
+	if (match_find(m, string, &len) < 0)
+		return 0;
+
+	return len;
+}
+
+int match_all(struct match *m, const char *string, int idx[], int num)
+{
+	int i, n = 0;
+
+	if (!m || !string || match_run(m, string))
+		return 0;
+
+	for (i = 0; i < m->nalt && n < num; i++) {
+		if (m->mark[m->alt[i].end] != m->gen)
+			continue;
+
+		/* Several alternatives of the same pattern may match */
+		if (n > 0 && idx[n - 1] == m->alt[i].pattern)
+			continue;
+
+		idx[n++] = m->alt[i].pattern;
+	}
+
+	return n;
+}
+
+int match(const char *pattern, const char *string)
+{
+	struct match *m;
+	int rc;
+
+	m = match_compile(pattern);
+	if (!m)
+		return 0;
+
+	rc = match_exec(m, string);
+	match_free(m);
+
+	return rc;
+}
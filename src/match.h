@@ -28,9 +28,43 @@
 #ifndef MATCH_H_
 #define MATCH_H_
 
+struct match;
+
 /* Simple shell-style filename pattern matcher.  Only does ? * and **, and
-** multiple patterns separated by |.  Returns 1 or 0.
+** multiple patterns separated by |.  Returns 0 for no match, otherwise the
+** length of the fixed part of the pattern before the first wildcard, or 1.
+** Patterns used more than once should be compiled with match_compile().
 */
 extern int match(const char *pattern, const char *string);
 
+/* Compile a pattern for use with match_exec(), returns (struct match*) 0
+** on errors, or if the pattern is (char*) 0.
+*/
+extern struct match *match_compile(const char *pattern);
+
+/* Same as match() but with a compiled pattern, a (struct match*) 0 never
+** matches.  With a set, the value is that of the first pattern matching.
+*/
+extern int match_exec(struct match *m, const char *string);
+
+/* A set of patterns, matched all at once in a single pass over the
+** string.  match_add() returns the index of the pattern in the set, or
+** -1 on errors.
+*/
+extern struct match *match_new(void);
+extern int match_add(struct match *m, const char *pattern);
+
+/* Returns the index of the first pattern in the set that matches the
+** string, or -1.  The match() value is returned in lenP, if set.
+*/
+extern int match_find(struct match *m, const char *string, int *lenP);
+
+/* Finds up to num patterns in the set that match the string, returns how
+** many, with their indexes in ascending order in idx[].
+*/
+extern int match_all(struct match *m, const char *string, int idx[], int num);
+
+/* Free a compiled pattern, or set. */
+extern void match_free(struct match *m);
+
 #endif /* MATCH_H_ */
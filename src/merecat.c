@@ -28,6 +28,7 @@
 
 #include <config.h>
 
+#include <fcntl.h>
 #include <getopt.h>
 #include <pwd.h>
 #ifdef HAVE_GRP_H
@@ -41,6 +42,7 @@
 
 #include <sys/param.h>
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <sys/uio.h>
@@ -48,14 +50,25 @@
 #ifdef HAVE_ZLIB_H
 #include <zlib.h>
 #endif
+#ifdef HAVE_ZSTD_H
+#include <zstd.h>
+#endif
 
+#include "accesslog.h"
+#include "cgicache.h"
 #include "conf.h"
+#include "fcgi.h"
 #include "fdwatch.h"
+#include "h2.h"
+#include "htcache.h"
 #include "libhttpd.h"
 #include "match.h"
 #include "mmc.h"
 #include "merecat.h"
+#include "metrics.h"
+#include "probe.h"
 #include "srv.h"
+#include "statcache.h"
 #include "ssl.h"
 #include "timers.h"
 
@@ -65,7 +78,9 @@
 
 /* For content-encoding: gzip */
 #ifdef HAVE_ZLIB_H
-#define ZLIB_OUTPUT_BUF_SIZE 262136
+#define ZLIB_OUTPUT_BUF_SIZE 262136	/* max, sized by the socket send buffer */
+#define ZLIB_OUTPUT_BUF_MIN  16384
+#define ZLIB_POOL_SIZE       16		/* idle deflate streams kept for reuse */
 #define DEFAULT_COMPRESSION  Z_DEFAULT_COMPRESSION
 #else
 #define DEFAULT_COMPRESSION  0
@@ -81,6 +96,14 @@ char         path[MAXPATHLEN + 1];
 uint16_t     port              = 0;
 int          max_age           = 0;		      /* Disabled globally since v2.32 */
 int          compression_level = DEFAULT_COMPRESSION; /* For content-encoding: gzip */
+int          etag_mode         = DEFAULT_ETAG;
+int          workers           = DEFAULT_WORKERS;
+int          io_uring          = 0;
+int          do_http2          = 1;
+int          stat_cache        = DEFAULT_STAT_CACHE;
+int          cache_size        = DESIRED_MAX_MAPPED_BYTES / (1024 * 1024); /* MiB */
+int          cache_files       = DESIRED_MAX_MAPPED_FILES;
+int          cgi_cache         = 0;		      /* MiB, CGI micro-cache disabled */
 int          do_chroot         = 0;
 int          do_vhost          = 0;
 int          do_global_passwd  = 0;
@@ -93,9 +116,11 @@ char        *cgi_pattern       = CGI_PATTERN;
 char        *local_pattern     = NULL;
 char        *php_cgi           = NULL;
 char        *php_pattern       = NULL;
-char        *ssi_cgi           = NULL;
 int          ssi_silent        = 0;
 char        *ssi_pattern       = NULL;
+char        *fcgi_pattern      = NULL;
+char        *fcgi_server[FCGI_MAX_SERVERS];
+int          fcgi_num_servers  = 0;
 char        *url_pattern       = NULL;
 char        *dir               = NULL;
 char        *data_dir          = NULL;
@@ -103,6 +128,10 @@ char        *hostname          = NULL;
 char        *user              = DEFAULT_USER;    /* Usually www-data or nobody */
 char        *charset           = DEFAULT_CHARSET;
 char        *useragent_deny    = NULL;
+char        *status_path       = NULL;
+char        *cache_manifest    = NULL;
+char        *access_log        = NULL;
+int          access_log_block  = 0;
 
 /* Global options */
 static char *throttlefile      = NULL;
@@ -113,45 +142,125 @@ typedef struct {
 	long rate;
 	off_t bytes_since_avg;
 	int num_sending;
+	off_t credit;		/* token bucket, in 1/1000 bytes */
+	uint64_t refill_at;	/* msec, see throttle_refill() */
 } throttletab;
 
 static throttletab *throttles;
 static int numthrottles, maxthrottles;
+static struct match *throttle_match;	/* all patterns, in table order */
+static int throttles_shared;
 
 #define THROTTLE_NOLIMIT -1
 
+/* With worker processes the throttle table lives in shared memory */
+#ifdef __GNUC__
+#define THROTTLE_ADD(var, val)  __atomic_add_fetch(&(var), (val), __ATOMIC_RELAXED)
+#define THROTTLE_SWAP(var, val) __atomic_exchange_n(&(var), (val), __ATOMIC_RELAXED)
+#define THROTTLE_CAS(var, old, val) \
+	__atomic_compare_exchange_n(&(var), &(old), (val), 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+#else
+#define THROTTLE_ADD(var, val)  ((var) += (val))
+#define THROTTLE_SWAP(var, val) throttle_swap(&(var), (val))
+#define THROTTLE_CAS(var, old, val) ((var) = (val), 1)
+static off_t throttle_swap(off_t *var, off_t val)
+{
+	off_t old = *var;
 
-typedef struct {
+	*var = val;
+	return old;
+}
+#endif
+
+
+typedef struct connecttab {
 	int conn_state;
 	int next_free_connect;
 	struct http_conn *hc;
 	int tnums[MAXTHROTTLENUMS];	/* throttle indexes */
 	int numtnums;
-	long max_limit, min_limit;
-	time_t started_at, active_at;
+	long max_limit, min_limit;	/* max_limit is the fair share */
+	off_t credit;			/* ... and its token bucket */
+	uint64_t refill_at;
+	time_t active_at;
+	struct connecttab *idle_prev, *idle_next;	/* see idle_link() */
 	struct timer *wakeup_timer;
 	struct timer *linger_timer;
-	long wouldblock_delay;
 	off_t bytes;
 	off_t end_byte_index;
 	off_t next_byte_index;
+	uint64_t req_at, first_at;	/* for metrics, see metrics_now() */
+
+	/* CGI and FastCGI relay, see handle_relay() */
+	int    relay_rw, relay_wrw;	/* what backend fds are watched for, or -1 */
+	int    client_rw;
+	size_t body_left;		/* request body still to read */
+	char  *body;			/* ... and for CGI, buffered for stdin */
+	size_t body_len;
+	int    relay_headers;		/* still reading the response headers */
+	int    relay_done;		/* response read completely */
+	size_t relay_held;		/* responses held for earlier pipelined requests */
+
+	struct h2_conn *h2;		/* HTTP/2, see handle_h2() */
+	int    h2_rw;			/* what the socket is watched for */
 
 #ifdef HAVE_ZLIB_H
-	z_stream zs;
+	struct deflater *zd;		/* while compressing, see zd_get() */
 	int      zs_state;
-	void    *zs_output_head;
+	int      zs_trailer;		/* gzip trailer still to add */
+	uLong    zs_crc;		/* ... and the CRC of the input so far */
+	size_t   zs_head, zs_len;	/* output pending in the ring zd->buf */
 #endif
 } connecttab;
 static connecttab *connects;
 static int num_connects, max_connects, first_free_connect;
+
+#ifdef HAVE_ZLIB_H
+/* A deflate stream with its output ring buffer, pooled when not in use.
+** A zstd context is added the first time it is used for zstd.
+*/
+struct deflater {
+	z_stream zs;
+#ifdef HAVE_ZSTD
+	ZSTD_CCtx     *zc;
+	ZSTD_inBuffer  zin;
+#endif
+	char    *buf;
+	size_t   size;
+};
+
+static struct deflater *zd_pool[ZLIB_POOL_SIZE];
+static int zd_pooled;
+
+static void zd_destroy(void);
+#endif
 static int httpd_conn_count;
 
+/* The http_conn structs, allocated HTTP_CONN_SLAB at a time */
+static struct http_conn **hc_slab;
+static int num_hc_slabs, hc_slab_left;
+
 /* The connection states. */
 #define CNST_FREE 0
 #define CNST_READING 1
 #define CNST_SENDING 2
 #define CNST_PAUSING 3
 #define CNST_LINGERING 4
+#define CNST_RELAYING 5
+#define CNST_H2 6
+
+/* Connections by the idle timeout that applies, oldest active_at first,
+** so idle() finds the ones that are due at the head of each list.  Free
+** slots are listed only while they still have memory to give back.
+*/
+#define IDLE_FREE    0
+#define IDLE_READING 1
+#define IDLE_SENDING 2		/* also pausing and relaying */
+#define IDLE_LISTS   3
+
+static struct {
+	connecttab *head, *tail;
+} idle_lists[IDLE_LISTS];
 
 static struct httpd *server_list = NULL;
 int terminate = 0;
@@ -163,7 +272,30 @@ int stats_simultaneous;
 /* Configured by conf_srv(), or globals if no .conf support */
 static struct srv srvtab[2];
 
-static volatile int got_hup, got_bus, got_usr1, watchdog_flag;
+/* Worker processes, the first worker also runs the throttle averages */
+static int   worker_id;
+
+/* Hottest files of the map cache, kept over restarts */
+static int   manifest_fd = -1;
+static struct timer *warmup_timer;
+static void manifest_save(void);
+
+static pid_t worker_pid[MAX_WORKERS];
+static volatile int got_chld, got_reload, got_alrm;
+
+/* On reload: to re-exec, and the workers of the previous generation */
+#define RELOAD_LISTEN_ENV  "MERECAT_LISTEN_FDS"
+#define RELOAD_WORKERS_ENV "MERECAT_RETIRE_PIDS"
+#define RELOAD_CHECK_ENV   "MERECAT_RELOAD_CHECK"
+#define RELOAD_TICKET_ENV  "MERECAT_TICKET_FD"
+
+static char **args;
+static int    start_fd = -1;
+static int    reloaded, checking, supervised;
+static pid_t  retire_pid[MAX_WORKERS];
+static int    num_retire;
+
+static volatile int got_hup, got_bus, got_usr1, got_quit, watchdog_flag;
 
 /* External functions */
 extern int pidfile(const char *basename);
@@ -243,17 +375,52 @@ static void read_throttlefile(char *throttlefile)
 			exit(1);
 		}
 
+		/* Matched all at once by check_throttles() */
+		if (!throttle_match)
+			throttle_match = match_new();
+		if (!throttle_match || match_add(throttle_match, pattern) != numthrottles) {
+			syslog(LOG_CRIT, "Failed compiling throttle pattern: %s", strerror(errno));
+			exit(1);
+		}
+
 		throttles[numthrottles].max_limit = max_limit;
 		throttles[numthrottles].min_limit = min_limit;
 		throttles[numthrottles].rate = 0;
 		throttles[numthrottles].bytes_since_avg = 0;
 		throttles[numthrottles].num_sending = 0;
+		throttles[numthrottles].credit = 0;
+		throttles[numthrottles].refill_at = 0;
 
 		++numthrottles;
 	}
 	(void)fclose(fp);
 }
 
+/* Move the throttle table to memory shared by all worker processes, so
+** the rates and sending counts are aggregated across the workers.
+*/
+static void share_throttles(void)
+{
+	throttletab *shared;
+	size_t len;
+
+	if (numthrottles == 0)
+		return;
+
+	len = numthrottles * sizeof(throttletab);
+	shared = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shared == MAP_FAILED) {
+		syslog(LOG_CRIT, "Failed sharing throttle table: %s", strerror(errno));
+		exit(1);
+	}
+
+	memcpy(shared, throttles, len);
+	free(throttles);
+	throttles = shared;
+	maxthrottles = numthrottles;
+	throttles_shared = 1;
+}
+
 
 /* Generate debugging statistics syslog message. */
 static void merecat_logstats(long secs)
@@ -292,6 +459,12 @@ static void logstats(struct timeval *now)
 	merecat_logstats(stats_secs);
 	httpd_logstats(stats_secs);
 	mmc_logstats(stats_secs);
+	htc_logstats(stats_secs);
+	cgc_logstats(stats_secs);
+	stc_logstats(stats_secs);
+	alog_logstats(stats_secs);
+	fcgi_logstats(stats_secs);
+	h2_logstats(stats_secs);
 	fdwatch_logstats(stats_secs);
 	tmr_logstats(stats_secs);
 }
@@ -306,68 +479,201 @@ static void shut_down(void)
 	gettimeofday(&tv, NULL);
 	logstats(&tv);
 	for (i = 0; i < max_connects; ++i) {
+		if (connects[i].h2) {
+			h2_close(connects[i].h2, &tv);
+			connects[i].h2 = NULL;
+		}
 		if (connects[i].conn_state != CNST_FREE)
 			httpd_close_conn(connects[i].hc, &tv);
 
 		if (connects[i].hc) {
 			httpd_destroy_conn(connects[i].hc);
-			free(connects[i].hc);
 			connects[i].hc = NULL;
 			--httpd_conn_count;
 		}
 	}
+	for (i = 0; i < num_hc_slabs; i++)
+		free(hc_slab[i]);
+	free(hc_slab);
 
 	LIST_FOREACH(server, server_list) {
 		LIST_REMOVE(server, server_list);
 		srv_exit(server);
 	}
 
+	manifest_save();
 	conf_exit();
 	fdwatch_put_nfiles();
 	mmc_destroy();
+	htc_destroy();
+	cgc_destroy();
+	stc_destroy();
+	alog_destroy();
+	metrics_destroy();
 	tmr_destroy();
+#ifdef HAVE_ZLIB_H
+	zd_destroy();
+#endif
 	free(connects);
-	if (throttles)
+	match_free(throttle_match);
+	if (throttles_shared)
+		munmap(throttles, maxthrottles * sizeof(throttletab));
+	else if (throttles)
 		free(throttles);
 }
 
 
-static int check_throttles(connecttab *c)
+static uint64_t throttle_msec(struct timeval *tv)
 {
-	int tnum;
+	return (uint64_t)tv->tv_sec * 1000 + tv->tv_usec / 1000;
+}
+
+/* Size of a bucket filled at rate, in 1/1000 bytes like the credit */
+static off_t throttle_burst(long rate)
+{
+	return (off_t)MAX(rate * THROTTLE_BURST / 1000, THROTTLE_MINSEND) * 1000;
+}
+
+/* Credit earned at rate in msec, no more than fills an empty bucket */
+static off_t throttle_fill(long rate, uint64_t msec)
+{
+	off_t burst = throttle_burst(rate);
+
+	rate = MAX(rate, 1);
+	if (msec >= (uint64_t)(burst / rate))
+		return burst;
+
+	return (off_t)rate * (off_t)msec;
+}
+
+/* Tops up a throttle's bucket for the time since it was last done.  The
+** credit is kept in 1/1000 bytes, so a rate in bytes per second adds up
+** exactly however often this is called.  With worker processes the
+** table is shared, so the interval is claimed with a compare-and-swap
+** and only one of them adds each millisecond.
+*/
+static void throttle_refill(throttletab *t, uint64_t now)
+{
+	uint64_t last = t->refill_at;
+	off_t burst, credit;
+
+	if (now <= last || !THROTTLE_CAS(t->refill_at, last, now))
+		return;
+
+	burst  = throttle_burst(t->max_limit);
+	credit = THROTTLE_ADD(t->credit, throttle_fill(t->max_limit, now - last));
+	if (credit > burst)
+		THROTTLE_ADD(t->credit, burst - credit);
+}
+
+/* Same for a connection, at its fair share of the tightest throttle it is
+** in, which follows the number of connections sending in that throttle.
+*/
+static void throttle_refill_conn(connecttab *c, uint64_t now)
+{
+	int tind, tnum, n;
+	off_t burst;
+	long l;
+
+	c->max_limit = THROTTLE_NOLIMIT;
+	for (tind = 0; tind < c->numtnums; ++tind) {
+		tnum = c->tnums[tind];
+		n = MAX(throttles[tnum].num_sending, 1);
+		l = MAX(throttles[tnum].max_limit / n, 1);
+		if (c->max_limit == THROTTLE_NOLIMIT)
+			c->max_limit = l;
+		else
+			c->max_limit = MIN(c->max_limit, l);
+
+		throttle_refill(&throttles[tnum], now);
+	}
+
+	if (now > c->refill_at) {
+		burst = throttle_burst(c->max_limit);
+		c->credit += throttle_fill(c->max_limit, now - c->refill_at);
+		c->credit = MIN(c->credit, burst);
+		c->refill_at = now;
+	}
+}
+
+/* Returns how many bytes a connection may send now, the least of its own
+** credit and that of its throttles, or THROTTLE_NOLIMIT if not throttled.
+*/
+static off_t throttle_room(connecttab *c, struct timeval *tv)
+{
+	off_t room;
+	int tind;
+
+	if (c->numtnums == 0)
+		return THROTTLE_NOLIMIT;
+
+	throttle_refill_conn(c, throttle_msec(tv));
+	room = c->credit;
+	for (tind = 0; tind < c->numtnums; ++tind)
+		room = MIN(room, throttles[c->tnums[tind]].credit);
+
+	return room > 0 ? room / 1000 : 0;
+}
+
+/* Charges sz bytes sent to the connection and its throttles */
+static void throttle_spend(connecttab *c, off_t sz)
+{
+	int tind;
+
+	if (sz <= 0)
+		return;
+
+	c->credit -= sz * 1000;
+	for (tind = 0; tind < c->numtnums; ++tind) {
+		THROTTLE_ADD(throttles[c->tnums[tind]].credit, -sz * 1000);
+		THROTTLE_ADD(throttles[c->tnums[tind]].bytes_since_avg, sz);
+	}
+}
+
+static int check_throttles(connecttab *c, struct timeval *tv)
+{
+	int idx[MAXTHROTTLENUMS];
+	int i, num, tnum, n;
 	long l;
 
 	c->numtnums = 0;
 	c->max_limit = c->min_limit = THROTTLE_NOLIMIT;
-	for (tnum = 0; tnum < numthrottles && c->numtnums < MAXTHROTTLENUMS; ++tnum) {
-		if (match(throttles[tnum].pattern, c->hc->expnfilename)) {
-			/* If we're way over the limit, don't even start. */
-			if (throttles[tnum].rate > throttles[tnum].max_limit * 2)
-				return 0;
-
-			/* Also don't start if we're under the minimum. */
-			if (throttles[tnum].rate < throttles[tnum].min_limit)
-				return 0;
+	num = match_all(throttle_match, c->hc->expnfilename, idx, MAXTHROTTLENUMS);
+	for (i = 0; i < num; ++i) {
+		tnum = idx[i];
 
-			if (throttles[tnum].num_sending < 0) {
-				syslog(LOG_ERR, "throttle sending count was negative - shouldn't happen!");
-				throttles[tnum].num_sending = 0;
-			}
-			c->tnums[c->numtnums++] = tnum;
-			++throttles[tnum].num_sending;
+		/* If we're way over the limit, don't even start. */
+		if (throttles[tnum].rate > throttles[tnum].max_limit * 2)
+			return 0;
 
-			l = throttles[tnum].max_limit / throttles[tnum].num_sending;
-			if (c->max_limit == THROTTLE_NOLIMIT)
-				c->max_limit = l;
-			else
-				c->max_limit = MIN(c->max_limit, l);
+		/* Also don't start if we're under the minimum. */
+		if (throttles[tnum].rate < throttles[tnum].min_limit)
+			return 0;
 
-			l = throttles[tnum].min_limit;
-			if (c->min_limit == THROTTLE_NOLIMIT)
-				c->min_limit = l;
-			else
-				c->min_limit = MAX(c->min_limit, l);
+		if (throttles[tnum].num_sending < 0) {
+			syslog(LOG_ERR, "throttle sending count was negative - shouldn't happen!");
+			throttles[tnum].num_sending = 0;
 		}
+		c->tnums[c->numtnums++] = tnum;
+		n = THROTTLE_ADD(throttles[tnum].num_sending, 1);
+
+		l = throttles[tnum].max_limit / n;
+		if (c->max_limit == THROTTLE_NOLIMIT)
+			c->max_limit = l;
+		else
+			c->max_limit = MIN(c->max_limit, l);
+
+		l = throttles[tnum].min_limit;
+		if (c->min_limit == THROTTLE_NOLIMIT)
+			c->min_limit = l;
+		else
+			c->min_limit = MAX(c->min_limit, l);
+	}
+
+	/* Start with a full bucket, so small responses go out at once */
+	if (c->numtnums) {
+		c->credit = throttle_burst(c->max_limit);
+		c->refill_at = throttle_msec(tv);
 	}
 
 	return 1;
@@ -379,23 +685,26 @@ static void clear_throttles(connecttab *c, struct timeval *tv)
 	int tind;
 
 	for (tind = 0; tind < c->numtnums; ++tind)
-		--throttles[c->tnums[tind]].num_sending;
+		THROTTLE_ADD(throttles[c->tnums[tind]].num_sending, -1);
+	c->numtnums = 0;
 }
 
 
 static void update_throttles(arg_t arg, struct timeval *now)
 {
-	int tnum, tind;
-	int cnum;
-	connecttab *c;
-	long l;
+	off_t bytes;
+	int tnum;
 
-	/* Update the average sending rate for each throttle.
-	** This is only used when new connections start up.
+	/* Update the average sending rate for each throttle.  This is only
+	** used when new connections start up, and for the log messages.
+	** The fair share of each sending connection follows num_sending
+	** as it goes, see throttle_refill_conn().
+	** With worker processes the table is shared, so this
+	** is done by the first worker only.
 	*/
-	for (tnum = 0; tnum < numthrottles; ++tnum) {
-		throttles[tnum].rate = (2 * throttles[tnum].rate + throttles[tnum].bytes_since_avg / THROTTLE_TIME) / 3;
-		throttles[tnum].bytes_since_avg = 0;
+	for (tnum = 0; worker_id == 0 && tnum < numthrottles; ++tnum) {
+		bytes = THROTTLE_SWAP(throttles[tnum].bytes_since_avg, 0);
+		throttles[tnum].rate = (2 * throttles[tnum].rate + bytes / THROTTLE_TIME) / 3;
 
 		/* Log a warning message if necessary. */
 		if (throttles[tnum].rate > throttles[tnum].max_limit && throttles[tnum].num_sending != 0) {
@@ -415,35 +724,407 @@ static void update_throttles(arg_t arg, struct timeval *now)
 			       throttles[tnum].num_sending);
 		}
 	}
+}
 
-	/* Now update the sending rate on all the currently-sending
-	** connections, redistributing it evenly.
-	*/
-	for (cnum = 0; cnum < max_connects; ++cnum) {
-		c = &connects[cnum];
-		if (c->conn_state == CNST_SENDING || c->conn_state == CNST_PAUSING) {
-			c->max_limit = THROTTLE_NOLIMIT;
 
-			for (tind = 0; tind < c->numtnums; ++tind) {
-				tnum = c->tnums[tind];
-				l = throttles[tnum].max_limit / throttles[tnum].num_sending;
+/* Admission control keeps the least event loop lag, the time a round
+** takes from fdwatch() to fdwatch(), and the least time to first byte
+** of the static files sent, over each second.  A spike does not count,
+** only a standing queue, when even the quickest of a whole second was
+** over budget.  CGI is left out, a slow script is not an overload.
+*/
+static struct {
+	time_t   at;		/* start of this interval */
+	uint64_t lag;		/* least seen this interval, usec */
+	uint64_t delay;
+	int      shed;		/* verdict of the last interval */
+} admit = { 0, UINT64_MAX, UINT64_MAX, 0 };
+
+static void admit_sample(uint64_t *least, uint64_t usec)
+{
+	if (usec < *least)
+		*least = usec;
+}
+
+/* Decided once a second, so it recovers also when shedding leaves
+** nothing to sample.
+*/
+static int admit_shed(struct timeval *tv)
+{
+	int shed;
+
+	if (tv->tv_sec == admit.at)
+		return admit.shed;
+
+	shed = (SHED_LAG   && admit.lag   != UINT64_MAX && admit.lag   > SHED_LAG * 1000ULL) ||
+	       (SHED_DELAY && admit.delay != UINT64_MAX && admit.delay > SHED_DELAY * 1000ULL);
+	if (shed && !admit.shed)
+		syslog(LOG_WARNING, "Overloaded, loop lag %llu msec, first byte after %llu msec, "
+		       "turning new connections away.",
+		       admit.lag == UINT64_MAX ? 0 : (unsigned long long)admit.lag / 1000,
+		       admit.delay == UINT64_MAX ? 0 : (unsigned long long)admit.delay / 1000);
+	else if (!shed && admit.shed)
+		syslog(LOG_NOTICE, "No longer overloaded, accepting new connections.");
+
+	admit.at    = tv->tv_sec;
+	admit.lag   = UINT64_MAX;
+	admit.delay = UINT64_MAX;
+	admit.shed  = shed;
+
+	return shed;
+}
+
 
-				if (c->max_limit == THROTTLE_NOLIMIT)
-					c->max_limit = l;
-				else
-					c->max_limit = MIN(c->max_limit, l);
-			}
+#ifdef HAVE_ZLIB_H
+static void zd_free(struct deflater *zd)
+{
+	deflateEnd(&zd->zs);
+#ifdef HAVE_ZSTD
+	ZSTD_freeCCtx(zd->zc);
+#endif
+	free(zd->buf);
+	free(zd);
+}
+
+/* Returns a deflate stream, reset for a new response, with an output
+** buffer of at least size bytes.  From the pool if there is one, which
+** saves deflateInit2() from allocating its window and hash tables for
+** every response.  Returns NULL on errors.
+*/
+static struct deflater *zd_get(size_t size)
+{
+	struct deflater *zd;
+	char *buf;
+
+	while (zd_pooled > 0) {
+		zd = zd_pool[--zd_pooled];
+		if (deflateReset(&zd->zs) == Z_OK)
+			goto done;
+		zd_free(zd);
+	}
+
+	zd = NEW(struct deflater, 1);
+	if (!zd)
+		return NULL;
+
+	/* A negative window size omits the zlib header and trailer */
+	if (deflateInit2(&zd->zs, compression_level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		syslog(LOG_ERR, "zlib deflateInit2() failed: %s", zd->zs.msg ? zd->zs.msg : "unknown error");
+		free(zd);
+		return NULL;
+	}
+done:
+	if (zd->size < size) {
+		buf = realloc(zd->buf, size);
+		if (!buf) {
+			zd_free(zd);
+			return NULL;
+		}
+		zd->buf  = buf;
+		zd->size = size;
+	}
+
+	return zd;
+}
+
+static void zd_put(struct deflater *zd)
+{
+	if (zd_pooled < ZLIB_POOL_SIZE)
+		zd_pool[zd_pooled++] = zd;
+	else
+		zd_free(zd);
+}
+
+static void zd_destroy(void)
+{
+	while (zd_pooled > 0)
+		zd_free(zd_pool[--zd_pooled]);
+}
+
+/* Output buffer for a connection, as big as its socket send buffer so
+** each write can fill it, but no bigger since the rest would only wait.
+*/
+static size_t zd_bufsize(int fd)
+{
+	socklen_t len = sizeof(int);
+	int sndbuf;
+
+	if (getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &len) < 0 || sndbuf <= 0)
+		return ZLIB_OUTPUT_BUF_SIZE;
+
+	return MIN(MAX((size_t)sndbuf, ZLIB_OUTPUT_BUF_MIN), ZLIB_OUTPUT_BUF_SIZE);
+}
+
+/* Appends to the output ring, there must be room */
+static void zd_append(connecttab *c, const void *data, size_t len)
+{
+	struct deflater *zd = c->zd;
+	size_t tail, n;
+
+	tail = (c->zs_head + c->zs_len) % zd->size;
+	n = MIN(len, zd->size - tail);
+	memcpy(zd->buf + tail, data, n);
+	memcpy(zd->buf, (const char *)data + n, len - n);
+	c->zs_len += len;
+}
+
+#ifdef HAVE_ZSTD
+/* Sets up the zstd context for compressing the whole mmap()ed file */
+static int zd_zstd_start(connecttab *c)
+{
+	struct deflater *zd = c->zd;
+	struct http_conn *hc = c->hc;
+
+	if (!zd->zc) {
+		zd->zc = ZSTD_createCCtx();
+		if (!zd->zc)
+			return -1;
+	}
+
+	ZSTD_CCtx_reset(zd->zc, ZSTD_reset_session_only);
+	if (ZSTD_isError(ZSTD_CCtx_setParameter(zd->zc, ZSTD_c_compressionLevel, ZSTD_LEVEL(compression_level))))
+		return -1;
+	ZSTD_CCtx_setPledgedSrcSize(zd->zc, hc->sb.st_size);
+
+	zd->zin.src  = hc->file_address;
+	zd->zin.size = hc->sb.st_size;
+	zd->zin.pos  = 0;
+
+	return 0;
+}
+
+/* Same as zd_deflate(), for zstd, which has no trailer to add */
+static void zd_zstd(connecttab *c)
+{
+	struct deflater *zd = c->zd;
+	ZSTD_outBuffer out;
+	uint64_t cpu;
+	size_t tail, room, rc;
+
+	cpu = metrics_cpu();
+	while (c->zs_state == Z_OK && c->zs_len < zd->size) {
+		tail = (c->zs_head + c->zs_len) % zd->size;
+		room = tail >= c->zs_head ? zd->size - tail : c->zs_head - tail;
+
+		out.dst  = zd->buf + tail;
+		out.size = room;
+		out.pos  = 0;
+		rc = ZSTD_compressStream2(zd->zc, &out, &zd->zin, ZSTD_e_end);
+		c->zs_len += out.pos;
+		if (ZSTD_isError(rc))
+			c->zs_state = Z_STREAM_ERROR;
+		else if (rc == 0)
+			c->zs_state = Z_STREAM_END;
+		else if (out.pos < room)
+			break;
+	}
+	METRIC_ADD(METRIC_GZIP_USEC, metrics_cpu() - cpu);
+}
+#endif /* HAVE_ZSTD */
+
+/* Compresses into the free space of the ring, which may wrap, and adds
+** the gzip trailer when done.  The input is the whole mmap()ed file, its
+** CRC is computed as it goes while the pages are still in the cache.
+*/
+static void zd_deflate(connecttab *c)
+{
+	struct deflater *zd = c->zd;
+	struct http_conn *hc = c->hc;
+	unsigned char trailer[8];
+	Bytef *in;
+	uint64_t cpu;
+	size_t tail, room;
+	int i;
+
+	if (c->zs_len == 0)
+		c->zs_head = 0;		/* all of it in one piece */
+#ifdef HAVE_ZSTD
+	if (hc->compression_type == COMPRESSION_ZSTD) {
+		zd_zstd(c);
+		return;
+	}
+#endif
+
+	cpu = metrics_cpu();
+	while (c->zs_state == Z_OK && c->zs_len < zd->size) {
+		tail = (c->zs_head + c->zs_len) % zd->size;
+		room = tail >= c->zs_head ? zd->size - tail : c->zs_head - tail;
+
+		in = zd->zs.next_in;
+		zd->zs.next_out  = (Bytef *)zd->buf + tail;
+		zd->zs.avail_out = room;
+		c->zs_state = deflate(&zd->zs, Z_FINISH);
+		c->zs_len += room - zd->zs.avail_out;
+		c->zs_crc  = crc32(c->zs_crc, in, zd->zs.next_in - in);
+		if (c->zs_state == Z_BUF_ERROR)
+			c->zs_state = Z_OK;	/* no progress, wait for room */
+		if (zd->zs.avail_out > 0 && c->zs_state == Z_OK)
+			break;
+	}
+	METRIC_ADD(METRIC_GZIP_USEC, metrics_cpu() - cpu);
+
+	/* When zlib is done add the CRC and length, in little endian */
+	if (c->zs_state == Z_STREAM_END && c->zs_trailer && zd->size - c->zs_len >= sizeof(trailer)) {
+		for (i = 0; i < 4; i++) {
+			trailer[i]     = (c->zs_crc >> (8 * i)) & 0xff;
+			trailer[i + 4] = ((uint64_t)hc->sb.st_size >> (8 * i)) & 0xff;
 		}
+		zd_append(c, trailer, sizeof(trailer));
+		c->zs_trailer = 0;
+	}
+}
+
+/* Done compressing, the stream goes back to the pool */
+static void zd_release(connecttab *c)
+{
+	if (!c->zd)
+		return;
+
+	zd_put(c->zd);
+	c->zd = NULL;
+}
+#endif /* HAVE_ZLIB_H */
+
+
+/* Connection structs stay with their connects[] slot, so are never freed
+** one by one.  Allocating them in slabs saves on malloc() overhead.
+*/
+static struct http_conn *new_conn(void)
+{
+	struct http_conn **slab;
+
+	if (hc_slab_left == 0) {
+		slab = RENEW(hc_slab, struct http_conn *, num_hc_slabs + 1);
+		if (!slab)
+			return NULL;
+		hc_slab = slab;
+
+		hc_slab[num_hc_slabs] = NEW(struct http_conn, HTTP_CONN_SLAB);
+		if (!hc_slab[num_hc_slabs])
+			return NULL;
+		num_hc_slabs++;
+		hc_slab_left = HTTP_CONN_SLAB;
+	}
+
+	return &hc_slab[num_hc_slabs - 1][--hc_slab_left];
+}
+
+
+/* Which idle list a connection in state goes on, or -1 for none */
+static int idle_list(int state)
+{
+	switch (state) {
+	case CNST_FREE:
+		return IDLE_FREE;
+
+	case CNST_READING:
+	case CNST_H2:
+		return IDLE_READING;
+
+	case CNST_SENDING:
+	case CNST_PAUSING:
+	case CNST_RELAYING:
+		return IDLE_SENDING;
+	}
+
+	return -1;	/* lingering has its own timer */
+}
+
+static void idle_unlink(connecttab *c)
+{
+	int i = idle_list(c->conn_state);
+
+	if (i < 0 || (!c->idle_prev && idle_lists[i].head != c))
+		return;		/* not listed */
+
+	if (c->idle_prev)
+		c->idle_prev->idle_next = c->idle_next;
+	else
+		idle_lists[i].head = c->idle_next;
+	if (c->idle_next)
+		c->idle_next->idle_prev = c->idle_prev;
+	else
+		idle_lists[i].tail = c->idle_prev;
+	c->idle_prev = c->idle_next = NULL;
+}
+
+/* Lists a connection by its active_at.  That is almost always the most
+** recent, so the search from the tail stops at once.
+*/
+static void idle_link(connecttab *c)
+{
+	connecttab *p;
+	int i = idle_list(c->conn_state);
+
+	if (i < 0)
+		return;
+
+	for (p = idle_lists[i].tail; p && p->active_at > c->active_at; p = p->idle_prev)
+		;
+
+	c->idle_prev = p;
+	c->idle_next = p ? p->idle_next : idle_lists[i].head;
+	if (c->idle_next)
+		c->idle_next->idle_prev = c;
+	else
+		idle_lists[i].tail = c;
+	if (p)
+		p->idle_next = c;
+	else
+		idle_lists[i].head = c;
+}
+
+static void conn_set_state(connecttab *c, int state)
+{
+	if (idle_list(c->conn_state) == idle_list(state)) {
+		c->conn_state = state;
+		return;
+	}
+
+	idle_unlink(c);
+	c->conn_state = state;
+	idle_link(c);
+}
+
+/* Something happened on the connection, moves it to the tail of its list */
+static void conn_active(connecttab *c, struct timeval *tv)
+{
+	c->active_at = tv->tv_sec;
+	if (c->idle_next) {
+		idle_unlink(c);
+		idle_link(c);
 	}
 }
 
+static void relay_end(connecttab *c);
+static void cgc_woken(void *arg);
+static void handle_pipelined(connecttab *c, struct timeval *tv);
+static void handle_read(connecttab *c, struct timeval *tv);
+static void h2_start(connecttab *c, struct timeval *tv);
+
+/* A request waiting for the same response to be made for another,
+** parked without watching the socket until cgc_woken().
+*/
+static void cgc_leave(connecttab *c)
+{
+	if (c->hc->cgc && c->conn_state == CNST_PAUSING)
+		cgc_unwait(c->hc, c);
+}
 
 static void really_clear_connection(connecttab *c, struct timeval *tv)
 {
+	if (c->conn_state == CNST_RELAYING)
+		relay_end(c);
+	cgc_leave(c);
+
 	stats_bytes += c->hc->bytes_sent;
 	if (c->conn_state != CNST_PAUSING)
 		fdwatch_del_fd(c->hc->conn_fd);
 
+	if (c->h2) {
+		h2_close(c->h2, tv);
+		c->h2 = NULL;
+	}
 	httpd_close_conn(c->hc, tv);
 	clear_throttles(c, tv);
 	if (c->linger_timer) {
@@ -451,17 +1132,12 @@ static void really_clear_connection(connecttab *c, struct timeval *tv)
 		c->linger_timer = 0;
 	}
 
-#ifdef HAVE_ZLIB_H
-	if (c->zs_output_head) {
-		free(c->zs_output_head);
-		c->zs_output_head = NULL;
-		deflateEnd(&c->zs);
-	}
-#endif
-	c->conn_state = CNST_FREE;
+	conn_set_state(c, CNST_FREE);
 	c->next_free_connect = first_free_connect;
 	first_free_connect = c - connects;	/* division by sizeof is implied */
 	--num_connects;
+	--c->hc->hs->num_conns;
+	METRIC_DEC(METRIC_OPEN);
 }
 
 
@@ -472,7 +1148,7 @@ static void wakeup_connection(arg_t arg, struct timeval *now)
 	c = (connecttab *)arg.p;
 	c->wakeup_timer = NULL;
 	if (c->conn_state == CNST_PAUSING) {
-		c->conn_state = CNST_SENDING;
+		conn_set_state(c, CNST_SENDING);
 		fdwatch_add_fd(c->hc->conn_fd, c, FDW_WRITE);
 	}
 }
@@ -492,6 +1168,25 @@ static void clear_connection(connecttab *c, struct timeval *tv)
 {
 	arg_t arg;
 
+	PROBE2(close, c->hc->conn_fd, c->hc->req_id);
+
+	/* Account for the request just done, only once if lingering */
+	if (c->req_at && c->hc->status) {
+		metrics_request(c->hc->status, c->hc->bytes_sent, c->req_at, c->first_at, metrics_now());
+		if (c->first_at && (c->hc->file_address || c->hc->file_fd != -1))
+			admit_sample(&admit.delay, c->first_at - c->req_at);
+	}
+	c->req_at = c->first_at = 0;
+	clear_throttles(c, tv);
+	cgc_leave(c);
+
+	/* Draining, see drain(), no more requests on this connection */
+	if (terminate)
+		c->hc->do_keep_alive = 0;
+#ifdef HAVE_ZLIB_H
+	zd_release(c);
+#endif
+
 	if (c->wakeup_timer) {
 		tmr_cancel(c->wakeup_timer);
 		c->wakeup_timer = 0;
@@ -522,7 +1217,12 @@ static void clear_connection(connecttab *c, struct timeval *tv)
 			fdwatch_del_fd(c->hc->conn_fd);
 		fdwatch_add_fd(c->hc->conn_fd, c, FDW_READ);
 
-		c->conn_state = CNST_READING;
+		/* The keep-alive wait starts now, so at the tail of the list,
+		** idle() stops at the first connection that is too young.
+		*/
+		c->active_at = tv->tv_sec;
+		conn_set_state(c, CNST_READING);
+		conn_active(c, tv);
 		c->next_byte_index = 0;
 
 		arg.p = c;
@@ -533,14 +1233,11 @@ static void clear_connection(connecttab *c, struct timeval *tv)
 		if (c->hc->file_address) {
 			mmc_unmap(c->hc->file_address, &c->hc->sb, tv);
 			c->hc->file_address = NULL;
+			c->hc->file_fd = -1;
 		}
 
-		/* release httpd_conn auxiliary memory */
-		httpd_destroy_conn(c->hc);
-
-		/* reinitialize httpd_conn */
-		httpd_init_conn_mem(c->hc);
-		httpd_init_conn_content(c->hc);
+		/* reinitialize httpd_conn, keeping any pipelined requests */
+		httpd_reset_conn(c->hc);
 
 		/* Reset the connection file descriptor to no-delay mode. */
 		(void)httpd_set_ndelay(c->hc->conn_fd);
@@ -554,7 +1251,7 @@ static void clear_connection(connecttab *c, struct timeval *tv)
 		if (c->conn_state != CNST_PAUSING)
 			fdwatch_del_fd(c->hc->conn_fd);
 
-		c->conn_state = CNST_LINGERING;
+		conn_set_state(c, CNST_LINGERING);
 		shutdown(c->hc->conn_fd, SHUT_WR);
 		fdwatch_add_fd(c->hc->conn_fd, c, FDW_READ);
 
@@ -576,32 +1273,536 @@ static void clear_connection(connecttab *c, struct timeval *tv)
 
 static void finish_connection(connecttab *c, struct timeval *tv)
 {
-	/* If we haven't actually sent the buffered response yet, do so now. */
-	httpd_send_response(c->hc);
+	/* If we haven't actually sent the buffered response yet, do so now,
+	** unless there's another pipelined request waiting.  Then we keep it
+	** and send both responses together.
+	*/
+	if (!c->first_at)
+		c->first_at = metrics_now();
+	if (!httpd_hold_response(c->hc))
+		httpd_send_response(c->hc);
 
 	/* And clear. */
 	clear_connection(c, tv);
 }
 
 
-int handle_newconnect(struct httpd *hs, struct timeval *tv, int fd)
+/* Has cb called when all buckets of a throttled connection hold at least
+** want bytes again, up to THROTTLE_MINSEND.  Each fills at its own rate,
+** so the slowest decides.  Returns 1 if paused, 0 if there is room now.
+*/
+static int throttle_pause(connecttab *c, struct timeval *tv, off_t want, void (*cb)(arg_t, struct timeval *))
 {
-	connecttab *c;
-
+	throttletab *t;
+	off_t room, need;
+	long msec = 0;
+	arg_t arg;
+	int tind;
+
+	room = throttle_room(c, tv);
+	want = MIN(want, THROTTLE_MINSEND);
+	if (room == THROTTLE_NOLIMIT || room >= MAX(want, 1))
+		return 0;
+
+	METRIC_INC(METRIC_THROTTLE_PAUSES);
+
+	need = MAX(want, 1) * 1000;
+	if (c->credit < need)
+		msec = (need - c->credit) / MAX(c->max_limit, 1) + 1;
+	for (tind = 0; tind < c->numtnums; ++tind) {
+		t = &throttles[c->tnums[tind]];
+		if (t->credit < need)
+			msec = MAX(msec, (long)((need - t->credit) / MAX(t->max_limit, 1) + 1));
+	}
+
+	arg.p = c;
+	if (c->wakeup_timer)
+		syslog(LOG_ERR, "replacing non-null wakeup_timer!");
+	c->wakeup_timer = tmr_create(tv, cb, arg, MAX(msec, 1), 0);
+	if (!c->wakeup_timer) {
+		syslog(LOG_CRIT, "tmr_create(wakeup_connection) failed");
+		exit(1);
+	}
+
+	return 1;
+}
+
+
+/* Change what a relayed fd is watched for, -1 for nothing */
+static void relay_watch(connecttab *c, int fd, int *rw, int want)
+{
+	if (*rw == want)
+		return;
+
+	if (*rw != -1)
+		fdwatch_del_fd(fd);
+	if (want != -1)
+		fdwatch_add_fd(fd, c, want);
+	*rw = want;
+}
+
+/* The backend fd we read the response from */
+static int relay_fd(struct http_conn *hc)
+{
+	if (hc->fcgi)
+		return fcgi_fd(hc->fcgi);
+
+	return hc->cgi_rfd;
+}
+
+/* Room for more of the request body, a CGI program that has stopped
+** reading its stdin has all the room in the world.
+*/
+static size_t relay_room(connecttab *c)
+{
+	struct http_conn *hc = c->hc;
+
+	if (hc->fcgi)
+		return fcgi_room(hc->fcgi);
+	if (hc->cgi_wfd < 0)
+		return RELAY_BODYSIZE;
+
+	return RELAY_BODYSIZE - c->body_len;
+}
+
+static void relay_stdin_close(connecttab *c)
+{
+	struct http_conn *hc = c->hc;
+
+	if (hc->cgi_wfd < 0)
+		return;
+
+	relay_watch(c, hc->cgi_wfd, &c->relay_wrw, -1);
+	(void)close(hc->cgi_wfd);
+	hc->cgi_wfd = -1;
+	c->body_len = 0;
+}
+
+/* Request body to the CGI program's stdin, closed when all of it is
+** written.  A program is free to not read it, the rest is dropped.
+*/
+static void relay_stdin(connecttab *c)
+{
+	struct http_conn *hc = c->hc;
+	ssize_t sz;
+
+	if (hc->cgi_wfd < 0)
+		return;
+
+	if (c->body_len > 0) {
+		sz = write(hc->cgi_wfd, c->body, c->body_len);
+		if (sz < 0) {
+			if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+				return;
+
+			relay_stdin_close(c);
+			return;
+		}
+
+		memmove(c->body, &c->body[sz], c->body_len - sz);
+		c->body_len -= sz;
+	}
+
+	if (!c->body_len && !c->body_left)
+		relay_stdin_close(c);
+}
+
+/* Request body for the backend, at most relay_room(), len 0 ends it */
+static void relay_body(connecttab *c, char *buf, size_t len)
+{
+	struct http_conn *hc = c->hc;
+
+	if (hc->fcgi) {
+		fcgi_write(hc->fcgi, buf, len);
+		return;
+	}
+
+	if (hc->cgi_wfd >= 0 && len > 0) {
+		memcpy(&c->body[c->body_len], buf, len);
+		c->body_len += len;
+	}
+	relay_stdin(c);
+}
+
+/* Request body read along with the headers, or pipelined after them */
+static void relay_pull(connecttab *c)
+{
+	struct http_conn *hc = c->hc;
+	size_t len;
+
+	if (!c->body_left || hc->read_idx <= hc->checked_idx)
+		return;
+
+	len = MIN(hc->read_idx - hc->checked_idx, c->body_left);
+	len = MIN(len, relay_room(c));
+	if (!len)
+		return;
+
+	relay_body(c, &hc->read_buf[hc->checked_idx], len);
+	hc->checked_idx += len;
+	c->body_left -= len;
+	if (!c->body_left)
+		relay_body(c, NULL, 0);
+}
+
+/* Response from the backend, same semantics as read() */
+static ssize_t relay_recv(struct http_conn *hc, char *buf, size_t len)
+{
+	if (hc->fcgi)
+		return fcgi_read(hc->fcgi, buf, len);
+
+	return read(hc->cgi_rfd, buf, len);
+}
+
+static void relay_update(connecttab *c)
+{
+	struct http_conn *hc = c->hc;
+	int brw = -1, wrw = -1, crw = -1;
+
+	if (hc->fcgi && fcgi_pending(hc->fcgi))
+		brw = FDW_WRITE;
+	else if (!c->relay_done && hc->responselen < RELAY_BUFSIZE)
+		brw = FDW_READ;
+
+	if (!hc->fcgi && c->body_len > 0)
+		wrw = FDW_WRITE;
+
+	/* Stop reading the request body while the backend is behind, and
+	** the client while paused by a throttle.  Once all of the body is
+	** in, the rest is left for the next request on the connection.
+	*/
+	if (c->relay_held > 0 || (!c->relay_headers && hc->responselen > 0)) {
+		if (!c->wakeup_timer)
+			crw = FDW_WRITE;
+	} else if (c->body_left > 0 && relay_room(c) > 0)
+		crw = FDW_READ;
+
+	relay_watch(c, relay_fd(hc), &c->relay_rw, brw);
+	if (hc->cgi_wfd >= 0)
+		relay_watch(c, hc->cgi_wfd, &c->relay_wrw, wrw);
+	relay_watch(c, hc->conn_fd, &c->client_rw, crw);
+}
+
+/* Done with the backend, the client fd is left watched for reading */
+static void relay_end(connecttab *c)
+{
+	struct http_conn *hc = c->hc;
+
+	if (hc->fcgi) {
+		relay_watch(c, fcgi_fd(hc->fcgi), &c->relay_rw, -1);
+		httpd_fcgi_close(hc);
+	}
+	if (hc->cgi_rfd >= 0) {
+		relay_stdin_close(c);
+		relay_watch(c, hc->cgi_rfd, &c->relay_rw, -1);
+		httpd_cgi_close(hc);
+	}
+
+	if (c->body) {
+		free(c->body);
+		c->body = NULL;
+	}
+	if (c->wakeup_timer) {
+		tmr_cancel(c->wakeup_timer);
+		c->wakeup_timer = NULL;
+	}
+
+	/* Kept only if all of it made it through */
+	cgc_end(hc, c->relay_done && !c->relay_headers);
+
+	relay_watch(c, hc->conn_fd, &c->client_rw, FDW_READ);
+	conn_set_state(c, CNST_SENDING);
+}
+
+/* The backend failed, tell the client unless we have already started */
+static void relay_error(connecttab *c, struct timeval *tv)
+{
+	struct http_conn *hc = c->hc;
+	int fast = hc->fcgi != NULL;
+
+	syslog(LOG_WARNING, "%.80s: %s request %s failed: %s", httpd_client(hc),
+	       fast ? "FastCGI" : "CGI", hc->encodedurl, strerror(errno));
+	hc->do_keep_alive = 0;
+	relay_end(c);
+
+	if (c->relay_headers) {
+		hc->responselen = c->relay_held;
+		if (fast)
+			httpd_send_err(hc, 502, httpd_err502title, "", httpd_err502form, hc->encodedurl);
+		else
+			httpd_send_err(hc, 500, httpd_err500title, "", httpd_err500form, hc->encodedurl);
+		finish_connection(c, tv);
+		return;
+	}
+
+	clear_connection(c, tv);
+}
+
+static void relay_start(connecttab *c, struct timeval *tv)
+{
+	struct http_conn *hc = c->hc;
+
+	conn_set_state(c, CNST_RELAYING);
+	conn_active(c, tv);
+	c->relay_rw = c->relay_wrw = -1;
+	c->client_rw = FDW_READ;
+	c->relay_headers = !hc->cgi_nph;
+	c->relay_done = 0;
+	c->body_left = hc->contentlength > 0 ? hc->contentlength : 0;
+	c->body_len = 0;
+	c->relay_held = hc->responselen;
+
+	/* Others asking for the same meanwhile wait for this response */
+	if (c->relay_headers)
+		cgc_begin(hc, tv->tv_sec);
+
+	if (hc->cgi_wfd >= 0 && c->body_left > 0) {
+		c->body = malloc(RELAY_BODYSIZE);
+		if (!c->body) {
+			syslog(LOG_ERR, "%.80s: out of memory buffering CGI request body",
+			       httpd_client(hc));
+			relay_stdin_close(c);
+		}
+	}
+
+	/* What we have of the request body already */
+	if (!c->body_left)
+		relay_body(c, NULL, 0);
+	else
+		relay_pull(c);
+
+	relay_update(c);
+}
+
+/* Response from the backend, returns 1 if we got any, or -1 on error */
+static int relay_read(connecttab *c, struct timeval *tv)
+{
+	struct http_conn *hc = c->hc;
+	size_t len = hc->responselen;
+	ssize_t sz;
+
+	/* Room is reserved for the terminating NUL */
+	httpd_realloc_str(&hc->response, &hc->maxresponse, RELAY_BUFSIZE);
+	sz = relay_recv(hc, &hc->response[hc->responselen], RELAY_BUFSIZE - hc->responselen);
+	if (sz < 0) {
+		if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+			return 0;
+		relay_error(c, tv);
+		return -1;
+	}
+
+	if (sz == 0) {
+		c->relay_done = 1;
+
+		/* No blank line, so it is all headers */
+		if (c->relay_headers && hc->responselen > c->relay_held)
+			httpd_add_response(hc, "\r\n\r\n", 4);
+	} else {
+		hc->responselen += sz;
+		conn_active(c, tv);
+	}
+
+	if (c->relay_headers && hc->responselen > c->relay_held) {
+		switch (httpd_cgi_headers(hc, c->relay_held)) {
+		case -1:
+			errno = E2BIG;
+			relay_error(c, tv);
+			return -1;
+
+		case 1:
+			c->relay_headers = 0;
+			if (hc->cgc)
+				cgc_append(hc, &hc->response[c->relay_held],
+					   hc->responselen - c->relay_held, tv->tv_sec);
+			break;
+		}
+	} else if (hc->cgc && sz > 0)
+		cgc_append(hc, &hc->response[len], sz, tv->tv_sec);
+
+	if (c->relay_done && c->relay_headers) {
+		errno = EPROTO;
+		relay_error(c, tv);
+		return -1;
+	}
+
+	return sz > 0;
+}
+
+static void relay_wakeup(arg_t arg, struct timeval *now)
+{
+	connecttab *c;
+
+	c = (connecttab *)arg.p;
+	c->wakeup_timer = NULL;
+	if (c->conn_state == CNST_RELAYING)
+		relay_update(c);
+}
+
+/* Response to the client, returns -1 if the client is gone */
+static int relay_write(connecttab *c, struct timeval *tv)
+{
+	struct http_conn *hc = c->hc;
+	struct iovec iov;
+	size_t len, held;
+	off_t room;
+	ssize_t sz;
+
+	/* Until the backend's headers are in only held responses can go */
+	len = c->relay_headers ? c->relay_held : hc->responselen;
+	if (!len || c->wakeup_timer)
+		return 0;
+
+	/* Unless all of it is in, wait for a full THROTTLE_MINSEND */
+	if (throttle_pause(c, tv, c->relay_done || c->relay_headers ? (off_t)len : THROTTLE_MINSEND, relay_wakeup))
+		return 0;
+
+	if (!c->first_at)
+		c->first_at = metrics_now();
+
+	iov.iov_base = hc->response;
+	iov.iov_len  = len;
+	room = throttle_room(c, tv);
+	if (room != THROTTLE_NOLIMIT)
+		iov.iov_len = MIN(iov.iov_len, (size_t)room);
+
+	sz = httpd_writev(hc, &iov, 1);
+	if (sz < 0) {
+		if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+			return 0;
+
+		hc->do_keep_alive = 0;
+		relay_end(c);
+		clear_connection(c, tv);
+		return -1;
+	}
+
+	held = MIN((size_t)sz, c->relay_held);
+	c->relay_held -= held;
+
+	memmove(hc->response, &hc->response[sz], hc->responselen - sz);
+	hc->responselen -= sz;
+	hc->bytes_sent += sz - held;
+	throttle_spend(c, sz);
+	conn_active(c, tv);
+
+	return 0;
+}
+
+/* Moves a CGI or FastCGI request along: the request body from the client
+** to the backend, and the response the other way, through hc->response.
+** Called when any of the fds is ready.  Everything is non-blocking, so
+** we simply try all directions that are watched.
+*/
+static void handle_relay(connecttab *c, struct timeval *tv)
+{
+	struct http_conn *hc = c->hc;
+	char buf[4096];
+	ssize_t sz;
+
+	/* Request body, what is buffered first, then from the client */
+	relay_pull(c);
+	if (c->client_rw == FDW_READ && c->body_left > 0 && hc->read_idx <= hc->checked_idx) {
+		size_t len = MIN(sizeof(buf), MIN(c->body_left, relay_room(c)));
+
+		sz = len > 0 ? httpd_read(hc, buf, len) : -1;
+		if (len > 0 && (sz == 0 || (sz < 0 && errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK))) {
+			/* Client went away */
+			hc->do_keep_alive = 0;
+			relay_end(c);
+			clear_connection(c, tv);
+			return;
+		}
+
+		if (sz > 0) {
+			relay_body(c, buf, sz);
+			c->body_left -= sz;
+			if (!c->body_left)
+				relay_body(c, NULL, 0);
+			conn_active(c, tv);
+		}
+	}
+
+	/* To the backend */
+	if (hc->fcgi) {
+		if (c->relay_rw == FDW_WRITE && fcgi_flush(hc->fcgi)) {
+			relay_error(c, tv);
+			return;
+		}
+	} else if (c->relay_wrw == FDW_WRITE)
+		relay_stdin(c);
+	relay_pull(c);
+
+	/* And back, records the backend has already sent may be buffered
+	** by fcgi_read(), so keep going while the client keeps up.
+	*/
+	for (;;) {
+		int got = 0;
+
+		if (c->relay_rw == FDW_READ && !c->relay_done && hc->responselen < RELAY_BUFSIZE) {
+			got = relay_read(c, tv);
+			if (got < 0)
+				return;
+		}
+
+		if (relay_write(c, tv))
+			return;
+
+		if (!got || hc->responselen > 0)
+			break;
+	}
+
+	if (c->relay_done && !hc->responselen) {
+		relay_end(c);
+
+		/* With all of the request body read what follows is the next
+		** request, see httpd_reset_conn(), the rest of it is not.
+		*/
+		if (c->body_left > 0)
+			hc->do_keep_alive = 0;
+		else
+			hc->contentlength = 0;
+		clear_connection(c, tv);
+		handle_pipelined(c, tv);
+		return;
+	}
+
+	relay_update(c);
+}
+
+
+int handle_newconnect(struct httpd *hs, struct timeval *tv, int fd)
+{
+	connecttab *c;
+	int num;
+
 	/* This loops until the accept() fails, trying to start new
 	** connections as fast as possible so we don't overrun the
-	** listen queue.
+	** listen queue.  At most MAX_ACCEPTS at a time, the rest are
+	** picked up by the next fdwatch().
 	*/
-	for (;;) {
-		/* Is there room in the connection table? */
-		if (num_connects >= max_connects) {
-			/* Out of connection slots.  Run the timers, then the
-			** existing connections, and maybe we'll free up a slot
-			** by the time we get back here.
-			*/
-			syslog(LOG_WARNING, "Too many connections (%d >) %d)!", num_connects, max_connects);
-			tmr_run(tv);
-			return 0;
+	for (num = 0; num < MAX_ACCEPTS; num++) {
+		/* Is there room in the connection table, for this server,
+		** and time to serve one more?  If not, answer 503 rather
+		** than leave the client waiting in the listen queue.  The
+		** connections already open keep their slots.
+		*/
+		if (num_connects >= max_connects || admit_shed(tv) ||
+		    (hs->max_conns && hs->num_conns >= hs->max_conns)) {
+			switch (httpd_shed_conn(hs, fd)) {
+				/* Out of fds too.  Run the timers, then the
+				** existing connections, and maybe we'll free
+				** up a slot by the time we get back here.
+				*/
+			case GC_FAIL:
+				tmr_run(tv);
+				return 0;
+
+			case GC_NO_MORE:
+				return 1;
+			}
+
+			METRIC_INC(METRIC_SHED);
+			continue;
 		}
 
 		/* Get the first free connection entry off the free list. */
@@ -613,7 +1814,7 @@ int handle_newconnect(struct httpd *hs, struct timeval *tv, int fd)
 		/* Make the httpd_conn if necessary. */
 		c = &connects[first_free_connect];
 		if (!c->hc) {
-			c->hc = NEW(struct http_conn, 1);
+			c->hc = new_conn();
 			if (!c->hc) {
 				syslog(LOG_CRIT, "Out of memory allocating an httpd_conn");
 				exit(1);
@@ -637,74 +1838,48 @@ int handle_newconnect(struct httpd *hs, struct timeval *tv, int fd)
 			return 1;
 		}
 
-		c->conn_state = CNST_READING;
+		PROBE2(accept, c->hc->conn_fd, httpd_client(c->hc));
+		c->active_at = tv->tv_sec;
+		conn_set_state(c, CNST_READING);
 		/* Pop it off the free list. */
 		first_free_connect = c->next_free_connect;
 		c->next_free_connect = -1;
 		++num_connects;
-		c->active_at = tv->tv_sec;
+		++hs->num_conns;
 		c->wakeup_timer = NULL;
 		c->linger_timer = NULL;
 		c->next_byte_index = 0;
 		c->numtnums = 0;
-
-		/* Set the connection file descriptor to no-delay mode. */
-		(void)httpd_set_ndelay(c->hc->conn_fd);
+		c->req_at = metrics_now();
+		c->first_at = 0;
 
 		fdwatch_add_fd(c->hc->conn_fd, c, FDW_READ);
 
 		++stats_connections;
+		METRIC_INC(METRIC_CONNECTIONS);
+		METRIC_INC(METRIC_OPEN);
 		if (num_connects > stats_simultaneous)
 			stats_simultaneous = num_connects;
+
+		/* With TCP_DEFER_ACCEPT the request is usually here already,
+		** so read it now rather than wait for another fdwatch().
+		** Plain HTTP only, HTTPS has already read the handshake,
+		** which may have settled on h2.
+		*/
+		if (!c->hc->ssl)
+			handle_read(c, tv);
+		else if (httpd_ssl_is_h2(c->hc))
+			h2_start(c, tv);
 	}
+
+	return 1;
 }
 
 
-static void handle_read(connecttab *c, struct timeval *tv)
+static void handle_request(connecttab *c, struct timeval *tv)
 {
-	int sz;
 	struct http_conn *hc = c->hc;
 
-	/* Is there room in our buffer to read more bytes? */
-	if (hc->read_idx >= hc->read_size) {
-		if (hc->read_size > 5000) {
-			httpd_send_err(hc, 400, httpd_err400title, "", httpd_err400form, "");
-			finish_connection(c, tv);
-			return;
-		}
-		httpd_realloc_str(&hc->read_buf, &hc->read_size, hc->read_size + 1000);
-	}
-
-	/* Read some more bytes. */
-	sz = httpd_read(hc, &(hc->read_buf[hc->read_idx]), hc->read_size - hc->read_idx);
-	if (sz == 0) {
-//		if (!hc->do_keep_alive)
-//			httpd_send_err(hc, 400, httpd_err400title, "", httpd_err400form, "");
-		if (hc->do_keep_alive)
-			hc->do_keep_alive--;
-
-		c->active_at = tv->tv_sec;
-		finish_connection(c, tv);
-		return;
-	}
-
-	if (sz < 0) {
-		/* Ignore EINTR and EAGAIN.  Also ignore EWOULDBLOCK.  At first glance
-		** you would think that connections returned by fdwatch as readable
-		** should never give an EWOULDBLOCK; however, this apparently can
-		** happen if a packet gets garbled.
-		*/
-		if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
-			return;
-
-//		httpd_send_err(hc, 400, httpd_err400title, "", httpd_err400form, "");
-		finish_connection(c, tv);
-		return;
-	}
-
-	hc->read_idx += sz;
-	c->active_at = tv->tv_sec;
-
 	/* Do we have a complete request yet? */
 	switch (httpd_got_request(hc)) {
 	case GR_NO_REQUEST:
@@ -716,6 +1891,14 @@ static void handle_read(connecttab *c, struct timeval *tv)
 		return;
 	}
 
+	/* Yes, stop the keep-alive timer, it is restarted when done. */
+	if (c->linger_timer) {
+		tmr_cancel(c->linger_timer);
+		c->linger_timer = NULL;
+	}
+	if (!c->req_at)
+		c->req_at = metrics_now();
+
 	/* Must tell libhttpd if we can deflate files */
 #ifdef HAVE_ZLIB_H
 	hc->has_deflate = compression_level != 0;
@@ -729,8 +1912,20 @@ static void handle_read(connecttab *c, struct timeval *tv)
 		return;
 	}
 
+	/* Built-in status page, served straight from the event loop */
+	if (hc->status_page) {
+		const char *buf;
+		size_t len;
+
+		buf = metrics_report(&len);
+		httpd_send_buf(hc, "text/plain; version=0.0.4", buf, len);
+		finish_connection(c, tv);
+		return;
+	}
+
 	/* Check the throttle table */
-	if (!check_throttles(c)) {
+	if (!check_throttles(c, tv)) {
+		METRIC_INC(METRIC_THROTTLE_REJECTS);
 		httpd_send_err(hc, 503, httpd_err503title, "", httpd_err503form, hc->encodedurl);
 		finish_connection(c, tv);
 		return;
@@ -743,6 +1938,21 @@ static void handle_read(connecttab *c, struct timeval *tv)
 		return;
 	}
 
+	/* CGI and FastCGI, relayed from here on */
+	if (hc->fcgi || hc->cgi_rfd >= 0) {
+		relay_start(c, tv);
+		return;
+	}
+
+	/* Same response being made for another, wait for it */
+	if (hc->cgc) {
+		fdwatch_del_fd(hc->conn_fd);
+		conn_set_state(c, CNST_PAUSING);
+		if (cgc_wait(hc, c))
+			cgc_woken(c);
+		return;
+	}
+
 	/* Fill in end_byte_index. */
 	if (hc->got_range) {
 		c->next_byte_index = hc->first_byte_index;
@@ -756,10 +1966,7 @@ static void handle_read(connecttab *c, struct timeval *tv)
 	/* Check if it's already handled. */
 	if (!hc->file_address) {
 		/* No file address means someone else is handling it. */
-		int tind;
-
-		for (tind = 0; tind < c->numtnums; ++tind)
-			throttles[c->tnums[tind]].bytes_since_avg += hc->bytes_sent;
+		throttle_spend(c, hc->bytes_sent);
 		c->next_byte_index = hc->bytes_sent;
 
 		finish_connection(c, tv);
@@ -773,64 +1980,242 @@ static void handle_read(connecttab *c, struct timeval *tv)
 	}
 
 	/* Cool, we have a valid connection and a file to send to it. */
-	c->conn_state = CNST_SENDING;
-	c->started_at = tv->tv_sec;
-	c->wouldblock_delay = 0;
+	conn_set_state(c, CNST_SENDING);
 
 #ifdef HAVE_ZLIB_H
 	if (hc->compression_type != COMPRESSION_NONE) {
-		/* setup default zlib memory allocation routines */
-		c->zs.zalloc = Z_NULL;
-		c->zs.zfree  = Z_NULL;
-		c->zs.opaque = Z_NULL;
-
-		/* setup zlib input file to mmap'ed location */
-		c->zs.next_in  = (Bytef *)c->hc->file_address;
-		c->zs.avail_in = c->hc->sb.st_size;
-
-		/* allocate memory for output buffer, if it's not already allocated */
-		if (!c->zs_output_head) {
-			c->zs_output_head = malloc(ZLIB_OUTPUT_BUF_SIZE + 8);
-			if (!c->zs_output_head) {
-				syslog(LOG_CRIT, "out of memory allocating deflate buffer");
+		/* The gzip header, no mtime, OS unix */
+		static const unsigned char header[10] = {
+			0x1f, 0x8b, Z_DEFLATED, 0, 0, 0, 0, 0, 0, 0x03
+		};
+
+		c->zd = zd_get(zd_bufsize(hc->conn_fd));
+		if (!c->zd) {
+			syslog(LOG_CRIT, "out of memory allocating deflate stream");
+			exit(1);
+		}
+
+		c->zs_state   = Z_OK;
+		c->zs_head    = c->zs_len = 0;
+#ifdef HAVE_ZSTD
+		if (hc->compression_type == COMPRESSION_ZSTD) {
+			if (zd_zstd_start(c)) {
+				syslog(LOG_CRIT, "out of memory allocating zstd stream");
 				exit(1);
 			}
+			c->zs_trailer = 0;
+		} else
+#endif
+		{
+			/* setup zlib input file to mmap'ed location */
+			c->zd->zs.next_in  = (Bytef *)hc->file_address;
+			c->zd->zs.avail_in = hc->sb.st_size;
+			c->zs_trailer = 1;
+			c->zs_crc     = crc32(0L, Z_NULL, 0);
+			zd_append(c, header, sizeof(header));
 		}
+	}
+#endif /* HAVE_ZLIB_H */
+
+	fdwatch_del_fd(hc->conn_fd);
+	fdwatch_add_fd(hc->conn_fd, c, FDW_WRITE);
+}
 
-		if (hc->compression_type == COMPRESSION_GZIP) {
-			/* add gzip header to output file */
-			sprintf(c->zs_output_head, "%c%c%c%c%c%c%c%c%c%c",
-				0x1f, 0x8b,
-				Z_DEFLATED,
-				0 /*flags*/,
-#if 0 /* Seems to be optional according to https://tools.ietf.org/html/rfc1952 */
-				&c->hc->sb.st_mtime, /* XXX: use a more transportable implementation! */
-				&c->hc->sb.st_mtime + 1,
-				&c->hc->sb.st_mtime + 2,
-				&c->hc->sb.st_mtime + 3,
-#else
-				0, 0, 0, 0,
-#endif
-				0 /*xflags*/,
-				0x03);
 
-			c->zs.next_out  = c->zs_output_head + 10;
-			c->zs.avail_out = ZLIB_OUTPUT_BUF_SIZE - 10;
+/* Handle any requests left in the read buffer from a pipelining client.
+** Only bytes that have not been checked yet can make up a new request,
+** and only a connection waiting for its next request can take it.
+*/
+static void handle_pipelined(connecttab *c, struct timeval *tv)
+{
+	while (c->conn_state == CNST_READING && c->hc->checked_idx < c->hc->read_idx)
+		handle_request(c, tv);
+}
+
+/* Serve a parked request, from the cache or by running the script */
+static void cgc_resume(arg_t arg, struct timeval *tv)
+{
+	connecttab *c = (connecttab *)arg.p;
+	struct http_conn *hc = c->hc;
+
+	c->wakeup_timer = NULL;
+	c->active_at = tv->tv_sec;
+	conn_set_state(c, CNST_READING);
+	conn_active(c, tv);
+	fdwatch_add_fd(hc->conn_fd, c, FDW_READ);
+
+	if (httpd_cgi_resume(hc, tv) < 0) {
+		finish_connection(c, tv);
+		return;
+	}
+
+	if (hc->fcgi || hc->cgi_rfd >= 0) {
+		relay_start(c, tv);
+		return;
+	}
+
+	/* From the cache */
+	throttle_spend(c, hc->bytes_sent);
+	finish_connection(c, tv);
+	handle_pipelined(c, tv);
+}
+
+/* The response a parked request waited for is done, or not going to be
+** cached.  Called from the middle of relaying it, so the rest is left
+** for cgc_resume() from the timer queue.
+*/
+static void cgc_woken(void *arg)
+{
+	connecttab *c = (connecttab *)arg;
+	arg_t targ;
+
+	c->hc->cgc = NULL;
+	targ.p = c;
+	c->wakeup_timer = tmr_create(NULL, cgc_resume, targ, 0, 0);
+	if (!c->wakeup_timer) {
+		syslog(LOG_CRIT, "tmr_create(cgc_resume) failed");
+		exit(1);
+	}
+}
+
+
+static void handle_read(connecttab *c, struct timeval *tv)
+{
+	int sz;
+	struct http_conn *hc = c->hc;
+
+	/* Buffers released while idle? */
+	httpd_init_conn_mem(hc);
+
+	/* Is there room in our buffer to read more bytes? */
+	if (hc->read_idx >= hc->read_size) {
+		if (hc->read_size > 5000) {
+			httpd_send_err(hc, 400, httpd_err400title, "", httpd_err400form, "");
+			finish_connection(c, tv);
+			return;
 		}
+		httpd_realloc_str(&hc->read_buf, &hc->read_size, hc->read_size + 1000);
+	}
 
-		/* call the initialization for zlib with negative window
-		** size to omit the "deflate" prefix
+	/* Read some more bytes. */
+	sz = httpd_read(hc, &(hc->read_buf[hc->read_idx]), hc->read_size - hc->read_idx);
+	if (sz == 0) {
+//		if (!hc->do_keep_alive)
+//			httpd_send_err(hc, 400, httpd_err400title, "", httpd_err400form, "");
+		if (hc->do_keep_alive)
+			hc->do_keep_alive--;
+
+		conn_active(c, tv);
+		finish_connection(c, tv);
+		return;
+	}
+
+	if (sz < 0) {
+		/* Ignore EINTR and EAGAIN.  Also ignore EWOULDBLOCK.  At first glance
+		** you would think that connections returned by fdwatch as readable
+		** should never give an EWOULDBLOCK; however, this apparently can
+		** happen if a packet gets garbled.
 		*/
-		c->zs_state = deflateInit2(&c->zs, compression_level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
-		if (c->zs_state != Z_OK) {
-			syslog(LOG_CRIT, "zlib deflateInit2() failed!");
-			exit(1);
+		if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+			return;
+
+//		httpd_send_err(hc, 400, httpd_err400title, "", httpd_err400form, "");
+		finish_connection(c, tv);
+		return;
+	}
+
+	hc->read_idx += sz;
+	conn_active(c, tv);
+	if (!c->req_at)
+		c->req_at = metrics_now();
+
+	/* HTTP/2 with prior knowledge, on plain HTTP */
+	if (do_http2 && !hc->ssl && hc->checked_idx == 0 &&
+	    !memcmp(hc->read_buf, H2_PREFACE, MIN(hc->read_idx, H2_PREFACE_LEN))) {
+		if (hc->read_idx >= H2_PREFACE_LEN)
+			h2_start(c, tv);
+		return;
+	}
+
+	handle_request(c, tv);
+	handle_pipelined(c, tv);
+}
+
+
+/* Watches the socket for writing only while frames are stuck in h2 */
+static void h2_flush(connecttab *c, struct timeval *tv)
+{
+	int rc, rw;
+
+	rc = h2_output(c->h2);
+	if (rc < 0 || h2_done(c->h2)) {
+		c->hc->do_keep_alive = 0;
+		clear_connection(c, tv);
+		return;
+	}
+
+	rw = rc ? FDW_WRITE : FDW_READ;
+	if (rw != c->h2_rw) {
+		fdwatch_del_fd(c->hc->conn_fd);
+		fdwatch_add_fd(c->hc->conn_fd, c, rw);
+		c->h2_rw = rw;
+	}
+}
+
+/* From here on the connection is h2, anything read already is fed to
+** the HTTP/2 layer.  Streams are logged and accounted for one by one.
+*/
+static void h2_start(connecttab *c, struct timeval *tv)
+{
+	struct http_conn *hc = c->hc;
+
+	if (c->linger_timer) {
+		tmr_cancel(c->linger_timer);
+		c->linger_timer = NULL;
+	}
+	hc->do_keep_alive = 0;
+	c->req_at = 0;
+
+	c->h2 = h2_open(hc);
+	if (!c->h2) {
+		clear_connection(c, tv);
+		return;
+	}
+
+	c->h2_rw = FDW_READ;
+	conn_set_state(c, CNST_H2);
+	if (hc->read_idx > 0)
+		(void)h2_input(c->h2, hc->read_buf, hc->read_idx, tv);
+	hc->read_idx = 0;
+
+	h2_flush(c, tv);
+}
+
+static void handle_h2(connecttab *c, struct timeval *tv)
+{
+	char buf[16384];
+	ssize_t sz;
+	int i;
+
+	conn_active(c, tv);
+
+	/* A few reads at most, the rest on the next round */
+	for (i = 0; i < 4; i++) {
+		sz = httpd_read(c->hc, buf, sizeof(buf));
+		if (sz < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		if (sz <= 0) {
+			clear_connection(c, tv);
+			return;
 		}
+
+		if (h2_input(c->h2, buf, sz, tv))
+			break;
+		if ((size_t)sz < sizeof(buf))
+			break;
 	}
-#endif /* HAVE_ZLIB_H */
 
-	fdwatch_del_fd(hc->conn_fd);
-	fdwatch_add_fd(hc->conn_fd, c, FDW_WRITE);
+	h2_flush(c, tv);
 }
 
 
@@ -838,104 +2223,108 @@ static void handle_send(connecttab *c, struct timeval *tv)
 {
 	size_t max_bytes;
 	ssize_t sz = -1;
-	int coast;
-	arg_t arg;
-	time_t elapsed;
 	struct http_conn *hc = c->hc;
-	int tind;
+	off_t room, left;
 
-	if (c->max_limit == THROTTLE_NOLIMIT)
+	/* If we're throttling, wait until there is room for a write, or for
+	** the rest of the file.  A compressed stream has no known length.
+	*/
+	left = THROTTLE_MINSEND;
+	if (hc->compression_type == COMPRESSION_NONE)
+		left = c->end_byte_index - c->next_byte_index + hc->responselen;
+	if (throttle_pause(c, tv, left, wakeup_connection)) {
+		PROBE3(throttle, hc->conn_fd, hc->req_id, left);
+		conn_set_state(c, CNST_PAUSING);
+		fdwatch_del_fd(hc->conn_fd);
+		return;
+	}
+	/* (No check on min_limit here, that only controls connection startups.) */
+
+	room = throttle_room(c, tv);
+	if (room == THROTTLE_NOLIMIT)
 		max_bytes = 1000000000L;
 	else
-		max_bytes = c->max_limit / 4;	/* send at most 1/4 seconds worth */
+		max_bytes = room;
 
 	if (hc->compression_type == COMPRESSION_NONE) {
-		/* Do we need to write the headers first? */
-		if (hc->responselen == 0) {
-			/* No, just write the file. */
-			sz = httpd_write(hc, &(hc->file_address[c->next_byte_index]),
-					 MIN(c->end_byte_index - c->next_byte_index, (off_t)max_bytes));
+		if (hc->file_fd >= 0) {
+			/* Zero-copy, headers (if any) are sent first */
+			sz = httpd_sendfile(hc, hc->file_fd, c->next_byte_index,
+					    MIN(c->end_byte_index - c->next_byte_index, (off_t)max_bytes));
 		} else {
-			/* Yes.  We'll combine headers and file into a single writev(),
-			** hoping that this generates a single packet.
-			*/
-			struct iovec iv[2];
-
-			iv[0].iov_base = hc->response;
-			iv[0].iov_len = hc->responselen;
-			iv[1].iov_base = &(hc->file_address[c->next_byte_index]);
-			iv[1].iov_len = MIN(c->end_byte_index - c->next_byte_index, (off_t)max_bytes);
-			sz = httpd_writev(hc, iv, 2);
+			size_t len = MIN(c->end_byte_index - c->next_byte_index, (off_t)max_bytes);
+			char *data;
+
+			/* Large files are mapped a window at a time */
+			data = mmc_window(hc->file_address, &hc->sb, c->next_byte_index, &len);
+			if (!data) {
+				errno = ENOMEM;
+			} else if (hc->responselen == 0) {
+				/* No, just write the file. */
+				sz = httpd_write(hc, data, len);
+			} else {
+				/* Yes.  We'll combine headers and file into a single writev(),
+				** hoping that this generates a single packet.
+				*/
+				struct iovec iv[2];
+
+				iv[0].iov_base = hc->response;
+				iv[0].iov_len = hc->responselen;
+				iv[1].iov_base = data;
+				iv[1].iov_len = len;
+				sz = httpd_writev(hc, iv, 2);
+			}
 		}
 #ifdef HAVE_ZLIB_H
 	} else {
-		int iv_count;
-		struct iovec iv[2];
-
-		/* call deflate only if necessary */
-		if ((c->zs_state == Z_OK) && (c->zs.avail_out > 0)) {
-			c->zs_state = deflate(&c->zs, Z_FINISH);
-
-			/* when zlib claims to be done, add the suffix info */
-			if (c->zs_state == Z_STREAM_END) {
-				uLong crc = crc32(0L, Z_NULL, 0);
-
-				/* crc32 must not be converted into network byte order */
-				crc = crc32(crc, (Bytef *)c->hc->file_address, c->hc->sb.st_size);
-				memcpy(c->zs.next_out, &crc, sizeof(uLong));
-				memcpy(c->zs.next_out + 4, &(hc->sb.st_size), 4);
-				c->zs.next_out += 8;
-			}
-		}
+		struct deflater *zd = c->zd;
+		struct iovec iv[3];
+		int iv_count = 0;
+		size_t n;
 
-		/* Do we need to write the headers first? */
-		iv_count = 1;
-		iv[0].iov_base = c->zs_output_head;
-		iv[0].iov_len = c->zs.next_out - (Bytef *)c->zs_output_head;
+		/* Keep the ring full, deflate() runs only when there is room */
+		zd_deflate(c);
 
+		/* Headers first, if any, in the same writev() hoping that
+		** this generates a single packet.  Then the ring, which may
+		** wrap around, up to what the throttle allows.
+		*/
 		if (hc->responselen != 0) {
-			/* Yes.  We'll combine headers and file into a single writev(),
-			** hoping that this generates a single packet.
-			*/
-			iv_count = 2;
-			iv[0].iov_base = hc->response;
-			iv[0].iov_len  = hc->responselen;
-			iv[1].iov_base = c->zs_output_head;
-			iv[1].iov_len  = c->zs.next_out - (Bytef *)c->zs_output_head;
+			iv[iv_count].iov_base = hc->response;
+			iv[iv_count].iov_len  = hc->responselen;
+			iv_count++;
+		}
+		n = MIN(c->zs_len, max_bytes);
+		iv[iv_count].iov_base = zd->buf + c->zs_head;
+		iv[iv_count].iov_len  = MIN(n, zd->size - c->zs_head);
+		n -= iv[iv_count++].iov_len;
+		if (n > 0) {
+			iv[iv_count].iov_base = zd->buf;
+			iv[iv_count].iov_len  = n;
+			iv_count++;
 		}
 		sz = httpd_writev(hc, iv, iv_count);
 #endif /* HAVE_ZLIB_H */
 	}
+	PROBE4(send, hc->conn_fd, hc->req_id, sz, sz < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
 
 	if (sz < 0 && errno == EINTR) {
 		clear_connection(c, tv);
 		return;
 	}
 
-	if (sz == 0 || (sz < 0 && (errno == EWOULDBLOCK || errno == EAGAIN))) {
-		/* This shouldn't happen, but some kernels, e.g.
-		 ** SunOS 4.1.x, are broken and select() says that
-		 ** O_NDELAY sockets are always writable even when
-		 ** they're actually not.
-		 **
-		 ** Current workaround is to block sending on this
-		 ** socket for a brief adaptively-tuned period.
-		 ** Fortunately we already have all the necessary
-		 ** blocking code, for use with throttling.
-		 */
-		c->wouldblock_delay += MIN_WOULDBLOCK_DELAY;
-		c->conn_state = CNST_PAUSING;
-		fdwatch_del_fd(hc->conn_fd);
-		arg.p = c;
-
-		if (c->wakeup_timer)
-			syslog(LOG_ERR, "replacing non-null wakeup_timer!");
+	if (sz < 0 && (errno == EWOULDBLOCK || errno == EAGAIN)) {
+		/* The socket buffer is full.  We are still registered for
+		** FDW_WRITE, so just wait until fdwatch() says there is room
+		** again.  Level-triggered, no timer needed.
+		*/
+		METRIC_INC(METRIC_WOULDBLOCKS);
+		return;
+	}
 
-		c->wakeup_timer = tmr_create(tv, wakeup_connection, arg, c->wouldblock_delay, 0);
-		if (!c->wakeup_timer) {
-			syslog(LOG_CRIT, "tmr_create(wakeup_connection) failed");
-			exit(1);
-		}
+	if (sz == 0) {
+		/* No progress possible, e.g. the file shrank while sending */
+		clear_connection(c, tv);
 		return;
 	}
 
@@ -958,7 +2347,9 @@ static void handle_send(connecttab *c, struct timeval *tv)
 	}
 
 	/* Ok, we wrote something. */
-	c->active_at = tv->tv_sec;
+	conn_active(c, tv);
+	if (!c->first_at)
+		c->first_at = metrics_now();
 	/* Was this a headers + file writev()? */
 	if (hc->responselen > 0) {
 		/* Yes; did we write only part of the headers? */
@@ -978,63 +2369,35 @@ static void handle_send(connecttab *c, struct timeval *tv)
 	/* And update how much of the file we wrote. */
 	c->next_byte_index += sz;
 	c->hc->bytes_sent += sz;
-	for (tind = 0; tind < c->numtnums; ++tind)
-		throttles[c->tnums[tind]].bytes_since_avg += sz;
+	throttle_spend(c, sz);
 
 	/* Are we done? */
 	if (c->hc->compression_type == COMPRESSION_NONE) {
 		if (c->next_byte_index >= c->end_byte_index) {
 			/* This connection is finished! */
 			finish_connection(c, tv);
+			handle_pipelined(c, tv);
 			return;
 		}
 #ifdef HAVE_ZLIB_H
 	} else {
-		if ((c->zs_state == Z_STREAM_END) && (c->zs_output_head + sz == c->zs.next_out)) {
+		/* Consumed from the ring, no need to move what is left */
+		c->zs_head = (c->zs_head + sz) % c->zd->size;
+		c->zs_len -= sz;
+		if (c->zs_state != Z_OK && c->zs_state != Z_STREAM_END) {
+			syslog(LOG_ERR, "Compression failed while sending %s", hc->encodedurl);
+			hc->do_keep_alive = 0;
+			clear_connection(c, tv);
+			return;
+		}
+		if (c->zs_state == Z_STREAM_END && !c->zs_trailer && c->zs_len == 0) {
 			/* This conection is finished! */
 			clear_connection(c, tv);
+			handle_pipelined(c, tv);
 			return;
-		} else if (sz > 0) {
-			/* move data to beginning of zlib output buffer
-			** and set up pointers so next zlib output goes
-			** to where we left off */
-			/* this can be optimized by using a looping buffer thing */
-			memcpy(c->zs_output_head, c->zs_output_head + sz, ZLIB_OUTPUT_BUF_SIZE - sz + 8);
-			c->zs.next_out -= sz;
-			c->zs.avail_out = sz;
 		}
 #endif /* HAVE_ZLIB_H */
 	}
-
-	/* Tune the (blockheaded) wouldblock delay. */
-	if (c->wouldblock_delay > MIN_WOULDBLOCK_DELAY)
-		c->wouldblock_delay -= MIN_WOULDBLOCK_DELAY;
-
-	/* If we're throttling, check if we're sending too fast. */
-	if (c->max_limit != THROTTLE_NOLIMIT) {
-		elapsed = tv->tv_sec - c->started_at;
-		if (elapsed == 0)
-			elapsed = 1;	/* count at least one second */
-
-		if (c->hc->bytes_sent / elapsed > c->max_limit) {
-			c->conn_state = CNST_PAUSING;
-			fdwatch_del_fd(hc->conn_fd);
-			/* How long should we wait to get back on schedule?  If less
-			 ** than a second (integer math rounding), use 1/2 second.
-			 */
-			coast = c->hc->bytes_sent / c->max_limit - elapsed;
-			arg.p = c;
-			if (c->wakeup_timer)
-				syslog(LOG_ERR, "replacing non-null wakeup_timer!");
-			c->wakeup_timer = tmr_create(tv, wakeup_connection, arg,
-						     coast > 0 ? (coast * 1000L) : 500L, 0);
-			if (!c->wakeup_timer) {
-				syslog(LOG_CRIT, "tmr_create(wakeup_connection) failed");
-				exit(1);
-			}
-		}
-	}
-	/* (No check on min_limit here, that only controls connection startups.) */
 }
 
 
@@ -1059,42 +2422,123 @@ static void handle_linger(connecttab *c, struct timeval *tv)
 
 static void idle(arg_t arg, struct timeval *now)
 {
-	int cnum;
+	connecttab *c, *next;
+
+	/* Closed, give back the memory if not reused soon */
+	while ((c = idle_lists[IDLE_FREE].head) && now->tv_sec - c->active_at >= IDLE_RELEASE_TIME) {
+		httpd_release_conn(c->hc);
+		idle_unlink(c);
+	}
+
+	for (c = idle_lists[IDLE_READING].head; c; c = next) {
+		next = c->idle_next;
+		if (now->tv_sec - c->active_at < MIN(IDLE_READ_TIMELIMIT, IDLE_RELEASE_TIME))
+			break;
+
+		if (now->tv_sec - c->active_at >= IDLE_READ_TIMELIMIT) {
+			syslog(LOG_INFO, "%.80s: connection timed out reading",
+			       httpd_client(c->hc));
+//			httpd_send_err(c->hc, 408, httpd_err408title, "", httpd_err408form, "");
+			finish_connection(c, now);
+		} else if (c->hc->read_idx == 0 && c->hc->responselen == 0) {
+			/* Keep-alive, waiting for the next request */
+			httpd_release_conn(c->hc);
+		}
+	}
+
+	for (c = idle_lists[IDLE_SENDING].head; c; c = next) {
+		next = c->idle_next;
+		if (now->tv_sec - c->active_at < IDLE_SEND_TIMELIMIT)
+			break;
+
+		syslog(LOG_INFO, "%.80s: connection timed out sending",
+		       httpd_client(c->hc));
+		if (c->conn_state == CNST_RELAYING) {
+			c->hc->do_keep_alive = 0;
+			relay_end(c);
+		}
+		clear_connection(c, now);
+	}
+}
+
+
+/* Stop accepting, close idle keep-alive connections, and let the others
+** finish their current request.  The main loop exits when all are done.
+*/
+static void drain(struct timeval *tv)
+{
+	struct httpd *server;
 	connecttab *c;
+	int cnum;
 
-	for (cnum = 0; cnum < max_connects; ++cnum) {
+	syslog(LOG_NOTICE, "Draining %d connections before exiting.", num_connects);
+	terminate = 1;
+	LIST_FOREACH(server, server_list)
+		srv_stop(server);
+
+	for (cnum = 0; cnum < max_connects; cnum++) {
 		c = &connects[cnum];
+
 		switch (c->conn_state) {
+		case CNST_FREE:
+			break;
+
 		case CNST_READING:
-			if (now->tv_sec - c->active_at >= IDLE_READ_TIMELIMIT) {
-				syslog(LOG_INFO, "%.80s: connection timed out reading",
-				       httpd_client(c->hc));
-//				httpd_send_err(c->hc, 408, httpd_err408title, "", httpd_err408form, "");
-				finish_connection(c, now);
-			}
+			/* Keep-alive, waiting for the next request */
+			if (c->hc->read_idx == 0)
+				clear_connection(c, tv);
 			break;
 
-		case CNST_SENDING:
-		case CNST_PAUSING:
-			if (now->tv_sec - c->active_at >= IDLE_SEND_TIMELIMIT) {
-				syslog(LOG_INFO, "%.80s: connection timed out sending",
-				       httpd_client(c->hc));
-				clear_connection(c, now);
-			}
+		case CNST_H2:
+			h2_shutdown(c->h2);
+			h2_flush(c, tv);
+			break;
+
+		default:
+			c->hc->do_keep_alive = 0;
 			break;
 		}
 	}
 }
 
 
+/* Only one worker keeps the manifest, they all serve the same files */
+static void manifest_save(void)
+{
+	if (manifest_fd < 0 || worker_id != 0)
+		return;
+
+	if (mmc_manifest_save(manifest_fd))
+		syslog(LOG_WARNING, "Failed saving cache manifest %s: %s", cache_manifest, strerror(errno));
+}
+
+/* A few files at a time, so requests are served while warming up */
+static void warmup(arg_t arg, struct timeval *now)
+{
+	if (mmc_warmup(WARMUP_FILES, now) > 0)
+		return;
+
+	tmr_cancel(warmup_timer);
+	warmup_timer = NULL;
+}
+
 static void occasional(arg_t arg, struct timeval *now)
 {
+	manifest_save();
 	mmc_cleanup(now);
+	cgc_cleanup(now->tv_sec);
+	stc_cleanup();
 	tmr_cleanup();
 	watchdog_flag = 1;	/* let the watchdog know that we are alive */
 }
 
 
+static void flush_logs(arg_t arg, struct timeval *now)
+{
+	alog_flush();
+}
+
+
 #ifdef STATS_TIME
 static void show_stats(arg_t arg, struct timeval *now)
 {
@@ -1145,8 +2589,10 @@ static void handle_chld(int signo)
 
 		/* Decrement CGI count.  Ignore PID from any CGI children */
 		LIST_FOREACH(server, server_list) {
-			if (!httpd_cgi_untrack(server, pid))
+			if (!httpd_cgi_untrack(server, pid)) {
+				PROBE2(cgi_exit, pid, status);
 				break;
+			}
 		}
 	}
 
@@ -1181,6 +2627,13 @@ static void handle_hup(int signo)
 }
 
 
+/* SIGQUIT says to stop accepting, finish the connections, and exit. */
+static void handle_quit(int signo)
+{
+	got_quit = 1;
+}
+
+
 /* SIGUSR1 says to toggle debug mode. */
 static void handle_usr1(int signo)
 {
@@ -1236,6 +2689,7 @@ static void init_signals(void)
 		{ SIGTERM,  handle_term },
 		{ SIGTERM,  handle_term },
 		{ SIGINT,   handle_term },
+		{ SIGQUIT,  handle_quit },
 		{ SIGCHLD,  handle_chld },
 		{ SIGPIPE,  SIG_IGN     }, /* get EPIPE instead */
 		{ SIGHUP,   handle_bus  },
@@ -1257,10 +2711,340 @@ static void init_signals(void)
 	got_bus = 0;
 	got_hup = 0;
 	got_usr1 = 0;
+	got_quit = 0;
 	watchdog_flag = 0;
 	alarm(OCCASIONAL_TIME * 3);
 }
 
+/* In the supervisor: reap and restart workers, forward all other signals. */
+static void handle_supervisor(int signo)
+{
+	const int oerrno = errno;
+	int i;
+
+	switch (signo) {
+	case SIGCHLD:
+		got_chld = 1;
+		break;
+
+	case SIGHUP:
+		got_reload = 1;
+		break;
+
+	case SIGALRM:
+		got_alrm = 1;
+		break;
+
+	case SIGTERM:
+	case SIGINT:
+	case SIGQUIT:
+		terminate = 1;
+		/* fallthrough */
+	default:
+		for (i = 0; i < workers; i++) {
+			if (worker_pid[i] > 0)
+				kill(worker_pid[i], signo);
+		}
+		for (i = 0; i < num_retire; i++)
+			kill(retire_pid[i], signo);
+		break;
+	}
+
+	/* Restore previous errno. */
+	errno = oerrno;
+}
+
+static int supervisor_signals[] = { SIGTERM, SIGINT, SIGQUIT, SIGCHLD, SIGHUP, SIGUSR1, SIGUSR2, SIGALRM };
+
+/* Returns 0 in the new worker, otherwise its PID, or -1 on error. */
+static pid_t spawn_worker(int id, sigset_t *omask)
+{
+	struct sigaction sa;
+	pid_t pid;
+	size_t i;
+
+	pid = fork();
+	if (pid != 0)
+		return pid;
+
+	/* The worker sets up its own handlers in init_signals() */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = SIG_DFL;
+	for (i = 0; i < NELEMS(supervisor_signals); i++)
+		sigaction(supervisor_signals[i], &sa, NULL);
+	sigprocmask(SIG_SETMASK, omask, NULL);
+	worker_id = id;
+	metrics_worker(id);
+	httpd_listen_worker(id);
+
+	return 0;
+}
+
+/* Bind the listen sockets of all servers, one set per worker, reusing
+** those handed over on reload.  Sockets of servers no longer configured
+** are closed, the old workers still have their own copies.
+*/
+static void listen_prebind(int num_ids)
+{
+	int i, id, num;
+
+	num = conf_srv(srvtab, NELEMS(srvtab));
+	if (num == -1) {
+		syslog(LOG_CRIT, "No server{} directive in .conf file and no valid global settings ...");
+		exit(1);
+	}
+
+	for (id = 0; id < num_ids; id++) {
+		for (i = 0; i < num; i++) {
+			if (srv_bind(&srvtab[i], id)) {
+				syslog(LOG_CRIT, "Failed initializing server %s", srvtab[i].title);
+				exit(1);
+			}
+		}
+	}
+	httpd_listen_prune(1);
+}
+
+/* Start the new binary with the new .conf, as far as binding the listen
+** sockets, before committing to it in reload().  Once we have re-executed
+** there is no way back, should the new process fail the workers would be
+** left without a supervisor.  Returns 0 if it looks good.
+*/
+static int reload_check(sigset_t *omask)
+{
+	int status;
+	pid_t pid;
+
+	pid = fork();
+	if (pid == -1) {
+		syslog(LOG_ERR, "Failed reloading, cannot fork: %s", strerror(errno));
+		return -1;
+	}
+	if (pid == 0) {
+		setenv(RELOAD_CHECK_ENV, "1", 1);
+		sigprocmask(SIG_SETMASK, omask, NULL);
+		execvp(args[0], args);
+		_exit(1);
+	}
+
+	while (waitpid(pid, &status, 0) == -1) {
+		if (errno != EINTR) {
+			syslog(LOG_ERR, "Failed reloading, lost check process: %s", strerror(errno));
+			return -1;
+		}
+	}
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		syslog(LOG_ERR, "Failed reloading, %s does not start with the new .conf.", args[0]);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Re-exec ourselves, same PID, with the listen sockets and the workers
+** still running.  The new process reads the .conf again and starts new
+** workers, then retires these.  Returns only on error.
+*/
+static void reload(sigset_t *omask)
+{
+	char fds[1024], pids[MAX_WORKERS * 12], tkt[12];
+	sigset_t mask;
+	size_t len = 0;
+	int i, fd = -1;
+
+	if (httpd_listen_export(fds, sizeof(fds)) <= 0) {
+		syslog(LOG_ERR, "Too many listen sockets, cannot reload.");
+		return;
+	}
+
+	pids[0] = 0;
+	for (i = 0; i < workers; i++) {
+		if (worker_pid[i] > 0)
+			len += snprintf(&pids[len], sizeof(pids) - len, "%s%d", len ? "," : "", (int)worker_pid[i]);
+	}
+
+	syslog(LOG_NOTICE, "Reloading, handing over listen sockets %s", fds);
+	setenv(RELOAD_LISTEN_ENV, fds, 1);
+	setenv(RELOAD_WORKERS_ENV, pids, 1);
+	httpd_listen_inherit(1);
+	if (start_fd != -1)
+		(void)fchdir(start_fd);
+
+	if (!reload_check(omask)) {
+		/* After the check, it would otherwise read the secret */
+		fd = httpd_ssl_ticket_export();
+		if (fd != -1) {
+			snprintf(tkt, sizeof(tkt), "%d", fd);
+			setenv(RELOAD_TICKET_ENV, tkt, 1);
+		}
+
+		alarm(0);
+		sigprocmask(SIG_SETMASK, omask, &mask);
+		execvp(args[0], args);
+		syslog(LOG_ERR, "Failed reloading, cannot execute %s: %s", args[0], strerror(errno));
+		sigprocmask(SIG_SETMASK, &mask, NULL);
+	}
+
+	if (fd != -1)
+		(void)close(fd);
+	unsetenv(RELOAD_TICKET_ENV);
+	(void)chdir(path);
+	httpd_listen_inherit(0);
+	unsetenv(RELOAD_LISTEN_ENV);
+	unsetenv(RELOAD_WORKERS_ENV);
+}
+
+/* The new workers are up, tell the old ones to stop accepting and drain */
+static void retire(void)
+{
+	int i;
+
+	syslog(LOG_NOTICE, "Reloaded, retiring %d old workers.", num_retire);
+	for (i = 0; i < num_retire; i++)
+		kill(retire_pid[i], SIGQUIT);
+	num_retire = 0;
+}
+
+/* A new worker failed starting after a reload.  Stop the new ones and
+** keep the old workers, they still serve with the previous .conf.
+*/
+static void reload_failed(time_t *started)
+{
+	int i;
+
+	syslog(LOG_ERR, "Reload failed, keeping the %d old workers.", num_retire);
+	alarm(0);
+	got_alrm = 0;
+
+	for (i = 0; i < workers; i++) {
+		if (worker_pid[i] > 0)
+			kill(worker_pid[i], SIGTERM);
+		worker_pid[i] = 0;
+	}
+
+	for (i = 0; i < num_retire; i++) {
+		worker_pid[i] = retire_pid[i];
+		started[i] = 0;
+	}
+	workers = num_retire;
+	num_retire = 0;
+}
+
+/* Fork the worker processes and watch over them, restarting any worker
+** that dies.  Returns only in the workers, each one then goes on to set
+** up its own connection table, and timers.  The listen sockets are bound
+** here, so they outlive the workers and can be handed over on reload.
+*/
+static void supervise(char *pidfn)
+{
+	struct sigaction sa;
+	sigset_t mask, omask;
+	time_t started[MAX_WORKERS];
+	pid_t pid;
+	size_t i;
+	int status;
+	int id;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_flags   = SA_RESTART;
+	sa.sa_handler = handle_supervisor;
+	sigemptyset(&mask);
+	for (i = 0; i < NELEMS(supervisor_signals); i++) {
+		sigaction(supervisor_signals[i], &sa, NULL);
+		sigaddset(&mask, supervisor_signals[i]);
+	}
+
+	/* Only take signals in sigsuspend(), so we never miss a SIGCHLD */
+	sigprocmask(SIG_BLOCK, &mask, &omask);
+
+	supervised = 1;
+	listen_prebind(workers);
+	for (id = 0; id < workers; id++) {
+		started[id] = time(NULL);
+		pid = spawn_worker(id, &omask);
+		if (pid == 0)
+			return;
+		if (pid < 0) {
+			syslog(LOG_CRIT, "Failed starting worker %d: %s", id, strerror(errno));
+			handle_supervisor(SIGTERM);
+			break;
+		}
+		worker_pid[id] = pid;
+	}
+
+	pidfile(pidfn);
+	if (!terminate)
+		syslog(LOG_NOTICE, "Started %d worker processes.", workers);
+	if (num_retire > 0)
+		alarm(RELOAD_GRACE_TIME);
+
+	while (!terminate) {
+		sigsuspend(&omask);
+		if (got_reload) {
+			got_reload = 0;
+			if (num_retire > 0)
+				syslog(LOG_WARNING, "Reload already in progress, try again later.");
+			else
+				reload(&omask);
+		}
+		if (got_alrm) {
+			got_alrm = 0;
+			if (num_retire > 0)
+				retire();
+		}
+		if (!got_chld)
+			continue;
+		got_chld = 0;
+
+		while ((pid = waitpid((pid_t)-1, &status, WNOHANG)) > 0) {
+			for (id = 0; id < workers; id++) {
+				if (worker_pid[id] == pid)
+					break;
+			}
+			if (id == workers)
+				continue;
+
+			worker_pid[id] = 0;
+			if (terminate)
+				continue;
+
+			/* Failing right at startup, e.g. cannot bind, is fatal */
+			if (WIFEXITED(status) && WEXITSTATUS(status) != 0 && time(NULL) - started[id] < 2) {
+				if (num_retire > 0) {
+					reload_failed(started);
+					break;
+				}
+				syslog(LOG_CRIT, "Worker %d failed starting, exiting.", id);
+				handle_supervisor(SIGTERM);
+				break;
+			}
+
+			syslog(LOG_ERR, "Worker %d, PID %d, died unexpectedly (status %d), restarting.",
+			       id, (int)pid, status);
+			if (time(NULL) - started[id] < 1)
+				sleep(1);	/* don't respawn too fast */
+
+			started[id] = time(NULL);
+			pid = spawn_worker(id, &omask);
+			if (pid == 0)
+				return;
+			if (pid < 0)
+				syslog(LOG_ERR, "Failed restarting worker %d: %s", id, strerror(errno));
+			else
+				worker_pid[id] = pid;
+		}
+	}
+
+	/* Workers have been sent SIGTERM, wait for them to exit. */
+	while ((pid = wait(&status)) > 0 || errno == EINTR)
+		;
+
+	syslog(LOG_NOTICE, "Exiting, all workers stopped.");
+	closelog();
+	exit(0);
+}
+
 static int loglvl(char *level)
 {
 	for (int i = 0; prioritynames[i].c_name; i++) {
@@ -1299,9 +3083,13 @@ static int usage(int code)
 	       "  -t FILE    Throttle file\n"
 #ifndef HAVE_LIBCONFUSE
 	       "  -u USER    Username to drop to, default: nobody\n"
+	       "  -U         Use io_uring instead of epoll, if supported by the kernel\n"
 	       "  -v         Enable virtual hosting with WEBROOT as base\n"
 #endif
 	       "  -V         Show Merecat httpd version\n"
+#ifndef HAVE_LIBCONFUSE
+	       "  -w NUM     Number of worker processes, 0 for one per CPU, default: 1\n"
+#endif
 	       "\n", prognm,
 #ifdef HAVE_LIBCONFUSE
 	       ident,
@@ -1322,6 +3110,45 @@ static int usage(int code)
 	return code;
 }
 
+/* Picks up what the previous process handed over on reload, if any */
+static void reload_import(void)
+{
+	char *fds, *pids, *tkt;
+	pid_t pid;
+
+	fds = getenv(RELOAD_LISTEN_ENV);
+	if (!fds)
+		return;
+
+	reloaded = 1;
+	httpd_listen_import(fds);
+
+	/* Only checking, see reload_check() */
+	if (getenv(RELOAD_CHECK_ENV))
+		checking = 1;
+	unsetenv(RELOAD_CHECK_ENV);
+
+	/* Tickets issued before the reload stay valid */
+	tkt = getenv(RELOAD_TICKET_ENV);
+	if (tkt && httpd_ssl_ticket_import(atoi(tkt)))
+		syslog(LOG_WARNING, "Failed reading TLS session ticket secret, tickets issued before reload are lost.");
+	unsetenv(RELOAD_TICKET_ENV);
+
+	pids = getenv(RELOAD_WORKERS_ENV);
+	while (pids && *pids && num_retire < MAX_WORKERS) {
+		pid = (pid_t)atoi(pids);
+		if (pid > 0)
+			retire_pid[num_retire++] = pid;
+
+		pids = strchr(pids, ',');
+		if (pids)
+			pids++;
+	}
+
+	unsetenv(RELOAD_LISTEN_ENV);
+	unsetenv(RELOAD_WORKERS_ENV);
+}
+
 static int version(void)
 {
 	printf("%s\n", PACKAGE_VERSION);
@@ -1356,12 +3183,15 @@ int main(int argc, char **argv)
 	int log_opts = LOG_PID | LOG_NDELAY;
 	int background = 1;
 	int do_syslog  = 1;
-	int num_ready;
+	int num_ready, shed;
+	uint64_t wait_at, ready_at = 0;
 	int num, cnum;
 	int c;
 
 	ident = prognm = progname(argv[0]);
-	while ((c = getopt(argc, argv, "c:d:f:ghI:l:np:P:rsSu:vV")) != EOF) {
+	args = argv;
+	start_fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	while ((c = getopt(argc, argv, "c:d:f:ghI:l:np:P:rsSt:u:UvVw:")) != EOF) {
 		switch (c) {
 #ifndef HAVE_LIBCONFUSE
 		case 'c':
@@ -1438,9 +3268,17 @@ int main(int argc, char **argv)
 			user = optarg;
 			break;
 
+		case 'U':
+			io_uring = 1;
+			break;
+
 		case 'v':
 			do_vhost = 1;
 			break;
+
+		case 'w':
+			workers = atoi(optarg);
+			break;
 #endif
 
 		case 'V':
@@ -1464,6 +3302,9 @@ int main(int argc, char **argv)
 	openlog(ident, log_opts, LOG_FACILITY);
 	setlogmask(LOG_UPTO(loglevel));
 
+	/* Listen sockets and old workers, when started by a reload */
+	reload_import();
+
 	/* Read merecat.conf, if available */
 	conf_init(config);
 
@@ -1477,6 +3318,32 @@ int main(int argc, char **argv)
 	if (throttlefile)
 		read_throttlefile(throttlefile);
 
+	/* Throttles are per connection, h2 multiplexes many requests */
+	if (numthrottles > 0 && do_http2) {
+		syslog(LOG_NOTICE, "Throttling enabled, disabling HTTP/2.");
+		do_http2 = 0;
+	}
+
+	/* Worker processes share the throttle table. */
+	if (workers < 1) {
+		long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+		workers = ncpu > 0 ? (int)ncpu : 1;
+	}
+	if (workers > MAX_WORKERS)
+		workers = MAX_WORKERS;
+#ifndef SO_REUSEPORT
+	if (workers > 1) {
+		syslog(LOG_WARNING, "No SO_REUSEPORT support, cannot run %d workers.", workers);
+		workers = 1;
+	}
+#endif
+	if (workers > 1)
+		share_throttles();
+	metrics_init(workers);
+	mmc_limits((off_t)cache_size * 1024 * 1024, cache_files);
+	cgc_init((size_t)cgi_cache * 1024 * 1024, cgc_woken);
+
 	/* If we're root and we're going to drop privileges to become another
 	** user, get their uid/gid now.
 	*/
@@ -1515,7 +3382,11 @@ int main(int argc, char **argv)
 	if (path[strlen(path) - 1] != '/')
 		strlcat(path, "/", sizeof(path));
 
-	if (background) {
+	if (reloaded) {
+		/* Same PID as before, already detached, and stdio may be
+		** listen sockets by now.
+		*/
+	} else if (background) {
 		/* We're not going to use stdin stdout or stderr from here on,
 		** so close them to save file descriptors.
 		*/
@@ -1552,9 +3423,30 @@ int main(int argc, char **argv)
 #endif
 	}
 
+	/* Fork worker processes, each runs its own event loop below.  They
+	** share the secret TLS session tickets are encrypted with.
+	*/
+	if (!pidfn)
+		pidfn = ident;
+
+	/* Started by reload_check(), all is good if the sockets bind.  Only
+	** those of the first worker, binding more to an address already in
+	** use would take a share of its connections, dropped when we exit.
+	*/
+	if (checking) {
+		listen_prebind(1);
+		exit(0);
+	}
+
+	if (httpd_ssl_ticket_init())
+		syslog(LOG_WARNING, "Failed creating TLS session ticket secret");
+	if (workers > 1 || reloaded)
+		supervise(pidfn);
+
 	/* Initialize the fdwatch package.  We have to do this before
 	** chrooting, if /dev/poll is used.
 	*/
+	fdwatch_use_uring(io_uring);
 	max_connects = fdwatch_get_nfiles();
 	if (max_connects < 0) {
 		syslog(LOG_CRIT, "fdwatch initialization failure");
@@ -1562,6 +3454,18 @@ int main(int argc, char **argv)
 	}
 	max_connects -= SPARE_FDS;
 
+	/* Files kept open by the mmap cache are not for connections */
+	num = MIN(max_connects / 100 * MMC_FDS_PERCENT, cache_files);
+	mmc_fd_limit(num);
+	max_connects -= num;
+
+	/* Opened now, the manifest may be outside the chroot */
+	if (cache_manifest) {
+		manifest_fd = open(cache_manifest, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+		if (manifest_fd < 0)
+			syslog(LOG_WARNING, "Cannot open cache manifest %s: %s", cache_manifest, strerror(errno));
+	}
+
 	/* Chroot if requested. */
 	if (do_chroot) {
 		if (chroot(path) < 0) {
@@ -1643,8 +3547,9 @@ int main(int argc, char **argv)
 		connects[cnum].conn_state = CNST_FREE;
 		connects[cnum].next_free_connect = cnum + 1;
 		connects[cnum].hc = NULL;
+		connects[cnum].h2 = NULL;
 #ifdef HAVE_ZLIB_H
-		connects[cnum].zs_output_head = NULL;
+		connects[cnum].zd = NULL;
 #endif
 	}
 	connects[max_connects - 1].next_free_connect = -1;	/* end of link list */
@@ -1652,10 +3557,9 @@ int main(int argc, char **argv)
 	num_connects = 0;
 	httpd_conn_count = 0;
 
-	/* Create PID file */
-	if (!pidfn)
-		pidfn = ident;
-	pidfile(pidfn);
+	/* Create PID file, with workers it belongs to the supervisor */
+	if (!supervised)
+		pidfile(pidfn);
 
 	/* Get servers from .conf file */
 	num = conf_srv(srvtab, NELEMS(srvtab));
@@ -1673,12 +3577,24 @@ int main(int argc, char **argv)
 			LIST_INSERT(server, server_list);
 	}
 
+	/* Listen sockets not claimed by any server are closed */
+	httpd_listen_prune(0);
+
 	/* Start socket watchers for all servers */
 	LIST_FOREACH(server, server_list)
 		srv_start(server);
 
+	/* Set up the access log timer. */
+	if (alog_enabled() && !tmr_create(NULL, flush_logs, noarg, ACCESS_LOG_FLUSH_TIME, 1)) {
+		syslog(LOG_CRIT, "tmr_create(flush_logs) failed");
+		exit(1);
+	}
+
 	/* If we're root, try to become someone else. */
 	if (getuid() == 0) {
+		/* Let the new user re-open log files after rotation. */
+		alog_chown(uid, gid);
+
 		/* Set aux groups to null. */
 		if (setgroups(0, NULL) < 0) {
 			syslog(LOG_CRIT, "setgroups: %s", strerror(errno));
@@ -1711,17 +3627,41 @@ int main(int argc, char **argv)
 			syslog(LOG_WARNING, "Started as root without requesting chroot(), warning only");
 	}
 
+	/* Warm up the map cache in the background, the sockets are ready */
+	if (manifest_fd >= 0 && mmc_manifest_load(manifest_fd) > 0) {
+		warmup_timer = tmr_create(NULL, warmup, noarg, WARMUP_TIME, 1);
+		if (!warmup_timer) {
+			syslog(LOG_CRIT, "tmr_create(warmup) failed");
+			exit(1);
+		}
+	}
+
 	/* Main loop. */
 	tmr_prepare_timeval(&tv);
 	while ((!terminate) || num_connects > 0) {
-		int got = 0;
-
 		/* Do we need to re-open the log file? */
-		if (got_hup)
+		if (got_hup) {
+			alog_reopen();
 			got_hup = 0;
+		}
+
+		/* Retired by a reload, or stopping gracefully */
+		if (got_quit) {
+			got_quit = 0;
+			if (!terminate) {
+				drain(&tv);
+				continue;
+			}
+		}
 
 		/* Do the fd watch. */
+		wait_at = metrics_now();
+		if (ready_at)
+			admit_sample(&admit.lag, wait_at - ready_at);
 		num_ready = fdwatch(tmr_mstimeout(&tv));
+		ready_at = metrics_now();
+		METRIC_ADD(METRIC_FDWATCH_USEC, ready_at - wait_at);
+		METRIC_INC(METRIC_FDWATCH_CALLS);
 		if (num_ready < 0) {
 			if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
 				continue;	/* try again */
@@ -1737,18 +3677,18 @@ int main(int argc, char **argv)
 			continue;
 		}
 
-		LIST_FOREACH(server, server_list) {
-			if ((got = srv_connect(server, &tv)))
-				break;
-		}
-
-		/* Go around the loop and do another fdwatch,
-		** rather than dropping through and processing
-		** existing connections.  New connections
-		** always get priority.
+		/* New connections first, they have already had a first
+		** read, then drop through and process existing ones.
+		** The number of accepts is capped, so a storm of new
+		** connections cannot starve those already being served.
+		** When overloaded the existing ones go first, new ones
+		** are only turned away.
 		*/
-		if (got)
-			continue;
+		shed = admit_shed(&tv);
+		if (!shed) {
+			LIST_FOREACH(server, server_list)
+				srv_connect(server, &tv);
+		}
 
 		/* Find the connections that need servicing. */
 		while ((ct = (connecttab *)fdwatch_get_next_arg()) != (connecttab *)-1) {
@@ -1756,7 +3696,10 @@ int main(int argc, char **argv)
 				continue;
 
 			hc = ct->hc;
-			if (!fdwatch_check_fd(hc->conn_fd)) {
+			if (ct->conn_state == CNST_RELAYING) {
+				/* Two fds, handle_relay() sorts it out */
+				handle_relay(ct, &tv);
+			} else if (!fdwatch_check_fd(hc->conn_fd)) {
 				/* Something went wrong. */
 				hc->do_keep_alive = 0;
 				clear_connection(ct, &tv);
@@ -1773,9 +3716,17 @@ int main(int argc, char **argv)
 				case CNST_LINGERING:
 					handle_linger(ct, &tv);
 					break;
+
+				case CNST_H2:
+					handle_h2(ct, &tv);
+					break;
 				}
 			}
 		}
+		if (shed) {
+			LIST_FOREACH(server, server_list)
+				srv_connect(server, &tv);
+		}
 		tmr_run(&tv);
 
 		if (got_usr1) {
@@ -179,6 +179,18 @@
 */
 #define DEFAULT_CHARSET "UTF-8"
 
+/* CONFIGURE: How to generate the ETag header for files.  A strong tag is
+** an MD5 digest of the contents, computed once per mmap cache entry.  A
+** weak tag is derived from inode, size and mtime and never touches the
+** file contents, useful for very large files.
+**
+** You can override this in the config file with the "etag" setting.
+*/
+#define ETAG_NONE   0
+#define ETAG_WEAK   1
+#define ETAG_STRONG 2
+#define DEFAULT_ETAG ETAG_STRONG
+
 /* Most people won't want to change anything below here. */
 
 /* CONFIGURE: This controls the SERVER_NAME environment variable that gets
@@ -291,6 +303,20 @@
 #define CGI_LD_LIBRARY_PATH "/usr/local/lib:/usr/lib:/lib"
 #endif
 
+/* CONFIGURE: Size of the arena each connection allocates the strings of
+** a request from, e.g. the decoded URL and file names.  Strings that do
+** not fit are malloc()ed, and freed again before the next request.
+*/
+#define CONN_ARENA_SIZE 4096
+
+/* CONFIGURE: Seconds a connection can sit idle, waiting for a request,
+** before its buffers are released.  Also for closed connections.
+*/
+#define IDLE_RELEASE_TIME 5
+
+/* CONFIGURE: How many connection structs to allocate at a time. */
+#define HTTP_CONN_SLAB 64
+
 /* CONFIGURE: How often to run the occasional cleanup job.
 */
 #define OCCASIONAL_TIME 120
@@ -306,17 +332,28 @@
 ** If you have reconfigured your kernel to have more descriptors, you can
 ** raise this and merecat will keep more maps cached.  However it's not
 ** a hard limit, merecat will go over it if you really are accessing
-** a whole lot of files.
+** a whole lot of files.  Default for the cache-files .conf setting.
 */
 #define DESIRED_MAX_MAPPED_FILES 1000
 
 /* CONFIGURE: The mmap cache also tries to keep the total mapped bytes
 ** below this number, so you don't run out of address space.  Again
 ** it's not a hard limit, merecat will go over it if you really are
-** accessing a bunch of large files.
+** accessing a bunch of large files.  Rounded down to MiB, the default
+** for the cache-size .conf setting.
 */
 #define DESIRED_MAX_MAPPED_BYTES 1000000000
 
+/* CONFIGURE: Seconds to cache stat(), lstat(), and readlink() results,
+** including failed lookups, used when resolving request paths.  Changes
+** to the file system are noticed within this time.  Zero disables it.
+*/
+#define DEFAULT_STAT_CACHE 1
+
+/* CONFIGURE: Number of slots in the stat cache.
+*/
+#define STAT_CACHE_SIZE 8192
+
 /* CONFIGURE: Minimum and maximum intervals between child-process reaping,
 ** in seconds.
 */
@@ -326,11 +363,12 @@
 
 /* You almost certainly don't want to change anything below here. */
 
-/* CONFIGURE: When throttling CGI programs, we don't know how many bytes
-** they send back to the client because it would be inefficient to
-** interpose a counter.  CGI programs are much more expensive than
-** regular files to serve, so we set an arbitrary and high byte count
-** that gets applied to all CGI programs for throttling purposes.
+/* CONFIGURE: Directory listings are generated in-process and written
+** straight to the client, so we don't know how many bytes they send.
+** They are much more expensive than regular files to serve, so we set
+** an arbitrary and high byte count that gets applied to all listings
+** for throttling purposes.  CGI output is relayed, and counted, by the
+** server itself.
 */
 #define CGI_BYTECOUNT 25000
 
@@ -360,6 +398,12 @@
 #define GENERATE_INDEXES
 #endif
 
+/* CONFIGURE: Index pages are rendered in the event loop, all of it at
+** once, with one or two fstatat() per entry.  To bound the time that
+** takes, at most this many entries are listed, the rest are left out.
+*/
+#define LISTING_MAX_ENTRIES 2000
+
 /* CONFIGURE: Whether to log unknown request headers.  Most sites will not
 ** want to log them, which will save them a bit of CPU time.
 */
@@ -370,6 +414,38 @@
 /* CONFIGURE: Time between updates of the throttle table's rolling averages. */
 #define THROTTLE_TIME 2
 
+/* CONFIGURE: Throttled output is paced by token buckets, one per throttle
+** and one per connection for its fair share.  A bucket holds at most
+** THROTTLE_BURST msec worth of its rate, but never less than
+** THROTTLE_MINSEND bytes, the smallest write made after a pause.
+*/
+#define THROTTLE_BURST   100
+#define THROTTLE_MINSEND 1024
+
+/* CONFIGURE: Admission control.  When the event loop takes longer than
+** SHED_LAG msec per round, or requests wait longer than SHED_DELAY msec
+** for their first byte, for all of a second, new connections are turned
+** away with a canned 503 until it recovers.  Connections already open,
+** e.g. kept alive, are still served.  Zero disables either check.
+*/
+#define SHED_LAG         250
+#define SHED_DELAY       2000
+#define SHED_RETRY_AFTER 5
+
+/* CONFIGURE: Number of worker processes, each with its own event loop
+** and SO_REUSEPORT listen socket, watched over by a supervisor process.
+** The default, one, means the classic single process server, without a
+** supervisor.  Zero means one worker per online CPU.
+*/
+#define DEFAULT_WORKERS 1
+#define MAX_WORKERS     64
+
+/* CONFIGURE: On reload, SIGHUP, the old workers keep serving alongside the
+** new ones for this many seconds before they stop accepting and drain.  If
+** a new worker fails to start in this time the old workers are kept.
+*/
+#define RELOAD_GRACE_TIME 2
+
 /* CONFIGURE: The listen() backlog queue length.  The 1024 doesn't actually
 ** get used, the kernel uses its maximum allowed value.  This is a config
 ** parameter only in case there's some OS where asking for too high a queue
@@ -378,12 +454,43 @@
 */
 #define LISTEN_BACKLOG 1024
 
+/* CONFIGURE: Linux listen socket options, set to 0 to disable.  With
+** LISTEN_DEFER_ACCEPT the kernel holds on to new connections for up to
+** this many seconds, until the client has sent its request, so accept()
+** returns connections with something to read.  LISTEN_FASTOPEN is the
+** TCP Fast Open queue length, which allows clients to send the request
+** already with the SYN.  Disabled by default, since data in the SYN may
+** be replayed by the network.
+*/
+#define LISTEN_DEFER_ACCEPT 5
+#define LISTEN_FASTOPEN     0
+
+/* CONFIGURE: Maximum number of new connections accepted from each listen
+** socket per event loop iteration, so a storm of new connections cannot
+** starve those already being served.
+*/
+#define MAX_ACCEPTS 64
+
+/* CONFIGURE: Cache warm-up from the manifest after a restart, how many
+** files to map per round, and how many milliseconds between rounds.
+*/
+#define WARMUP_FILES 32
+#define WARMUP_TIME  10
+
 /* CONFIGURE: Maximum number of throttle patterns that any single URL can
 ** be included in.  This has nothing to do with the number of throttle
 ** patterns that you can define, which is unlimited.
 */
 #define MAXTHROTTLENUMS 10
 
+/* CONFIGURE: HTTP/2 limits, streams served at the same time on each
+** connection, the size of a request header block, both as sent and as
+** decoded, and how much output is queued before writing it to the socket.
+*/
+#define H2_MAX_STREAMS 100
+#define H2_MAX_HEADERS 16384
+#define H2_OUTBUF      65536
+
 /* CONFIGURE: Number of file descriptors to reserve for uses other than
 ** connections.  Currently this is 10, representing one for the listen fd,
 ** one for dup()ing at connection startup time, one for reading the file,
@@ -392,6 +499,12 @@
 */
 #define SPARE_FDS 10
 
+/* CONFIGURE: Percent of the file descriptors left after SPARE_FDS that
+** the mmap cache may keep open, for sendfile() of larger files, at most
+** one per cache-files.  They are set aside, not used for connections.
+*/
+#define MMC_FDS_PERCENT 10
+
 /* CONFIGURE: How many milliseconds to leave a connection open while doing a
 ** lingering close.
 */
@@ -403,16 +516,38 @@
 */
 #define KEEPALIVE_TIMELIMIT (1 * 1000L)
 
+/* CONFIGURE: Size of the buffer for each access log file, and how often
+** in milliseconds it is written out.  It is also written out early when
+** three quarters full.
+*/
+#define ACCESS_LOG_BUFSIZE    65536
+#define ACCESS_LOG_FLUSH_TIME 1000L
+
+/* CONFIGURE: Responses to pipelined requests on a keep-alive connection
+** are held back and sent together, in a single write, until there are at
+** least this many bytes queued up or there are no more requests waiting.
+*/
+#define PIPELINE_HOLD 16384
+
+/* CONFIGURE: How much of a CGI or FastCGI response to read ahead of a
+** slow client, per connection, how much of a request body to buffer for
+** a CGI program's stdin, and how many servers a fastcgi section can
+** list.  Requests are spread over the servers round-robin.
+*/
+#define RELAY_BUFSIZE    65536
+#define RELAY_BODYSIZE   16384
+#define FCGI_MAX_SERVERS 8
+
+/* CONFIGURE: How many idle connections to keep open to each FastCGI
+** server, for reuse by later requests.
+*/
+#define FCGI_KEEP 16
+
 /* CONFIGURE: Maximum number of symbolic links to follow before
 ** assuming there's a loop.
 */
 #define MAX_LINKS 32
 
-/*
-** CONFIGURE: You don't even want to know.
-*/
-#define MIN_WOULDBLOCK_DELAY 100L
-
 /*
 ** Default SSL/TLS protocol and cipher suites
 */
@@ -426,6 +561,13 @@
 	"!DHE-RSA-AES256-CCM8:!DHE-RSA-AES256-CCM:"			\
 	"!DHE-RSA-AES128-CCM8:!DHE-RSA-AES128-CCM"
 
+/*
+** Default TLS session cache size, in sessions, and session lifetime in
+** seconds.  Session ticket keys are rotated as often as sessions expire.
+*/
+#define SSL_DEFAULT_SESSION_CACHE   20480
+#define SSL_DEFAULT_SESSION_TIMEOUT 300
+
 /*
 ** The minimum age for strict TLS should be > 180 days
 */
@@ -445,6 +587,14 @@ extern char  path[];
 extern uint16_t  port;
 extern int       max_age;
 extern int       compression_level;
+extern int       etag_mode;
+extern int       workers;
+extern int       io_uring;
+extern int       do_http2;
+extern int       stat_cache;
+extern int       cache_size;
+extern int       cache_files;
+extern int       cgi_cache;
 extern int       do_chroot;
 extern int       do_vhost;
 extern int       do_global_passwd;
@@ -457,9 +607,11 @@ extern char     *cgi_pattern;
 extern char     *local_pattern;
 extern char     *php_cgi;
 extern char     *php_pattern;
-extern char     *ssi_cgi;
 extern int       ssi_silent;
 extern char     *ssi_pattern;
+extern char     *fcgi_pattern;
+extern char     *fcgi_server[FCGI_MAX_SERVERS];
+extern int       fcgi_num_servers;
 extern char     *url_pattern;
 extern char     *dir;
 extern char     *data_dir;
@@ -467,6 +619,10 @@ extern char     *hostname;
 extern char     *user;
 extern char     *charset;
 extern char     *useragent_deny;
+extern char     *status_path;
+extern char     *cache_manifest;
+extern char     *access_log;
+extern int       access_log_block;
 
 /* Replacement functions for often missing APIs */
 #ifndef strlcpy
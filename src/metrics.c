@@ -0,0 +1,291 @@
+/* Counters and latency histograms for the built-in status page
+**
+** Copyright (C) 2026  The Merecat contributors
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions
+** are met:
+** 1. Redistributions of source code must retain the above copyright
+**    notice, this list of conditions and the following disclaimer.
+** 2. Redistributions in binary form must reproduce the above copyright
+**    notice, this list of conditions and the following disclaimer in the
+**    documentation and/or other materials provided with the distribution.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNERS OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+** THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <config.h>
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+
+#include "metrics.h"
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/* Upper bounds, in usec, of all buckets but the last */
+static const uint64_t bounds[METRICS_BUCKETS - 1] = {
+	100, 200, 500,
+	1000, 2000, 5000,
+	10000, 20000, 50000,
+	100000, 200000, 500000,
+	1000000, 2000000, 5000000,
+	10000000
+};
+
+static const struct {
+	const char *name;
+	const char *type;
+	const char *help;
+	int         usec;		/* reported in seconds */
+} counters[METRIC_MAX] = {
+	{ "connections_total",         "counter", "Connections accepted.", 0 },
+	{ "connections",               "gauge",   "Connections currently open.", 0 },
+	{ "mmc_hits_total",            "counter", "File lookups served from the map cache.", 0 },
+	{ "mmc_misses_total",          "counter", "File lookups that had to open and map the file.", 0 },
+	{ "mmc_evictions_total",       "counter", "Unused maps released by the map cache.", 0 },
+	{ "gzip_cpu_seconds_total",    "counter", "CPU time spent compressing responses.", 1 },
+	{ "throttle_pauses_total",     "counter", "Times a connection was paused for sending too fast.", 0 },
+	{ "send_wouldblock_total",     "counter", "Times a send found the socket buffer full and waited for it to drain.", 0 },
+	{ "throttle_rejects_total",    "counter", "Requests refused with 503 by the throttle table.", 0 },
+	{ "access_log_drops_total",    "counter", "Access log entries dropped, the log file was not draining.", 0 },
+	{ "fdwatch_calls_total",       "counter", "Times the event loop called fdwatch().", 0 },
+	{ "fdwatch_wait_seconds_total", "counter", "Time the event loop spent waiting in fdwatch().", 1 },
+	{ "shed_connections_total",    "counter", "Connections answered with 503 by admission control.", 0 },
+	{ "mmc_bytes",                 "gauge",   "Bytes mapped by the map cache.", 0 },
+	{ "mmc_maps",                  "gauge",   "Files and listings held by the map cache.", 0 },
+	{ "cgi_cache_hits_total",      "counter", "Script responses served from the CGI micro-cache.", 0 },
+	{ "cgi_cache_misses_total",    "counter", "Scripts run for responses that may be cached.", 0 },
+	{ "cgi_cache_collapsed_total", "counter", "Requests that waited for the same script run for another.", 0 },
+};
+
+static struct metrics  local;
+static struct metrics *slots = &local;
+static int             num_slots = 1;
+static time_t          start_time;
+
+struct metrics        *metrics = &local;
+
+static char           *report;
+static size_t          report_len, report_size;
+
+
+int metrics_init(int workers)
+{
+	struct metrics *shared;
+
+	start_time = time(NULL);
+	if (workers <= 1)
+		return 0;
+
+	shared = mmap(NULL, workers * sizeof(struct metrics), PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shared == MAP_FAILED) {
+		syslog(LOG_ERR, "Failed sharing metrics, status is per worker: %s", strerror(errno));
+		return -1;
+	}
+
+	slots     = shared;
+	num_slots = workers;
+	metrics   = &slots[0];
+
+	return 0;
+}
+
+void metrics_worker(int id)
+{
+	if (id >= 0 && id < num_slots)
+		metrics = &slots[id];
+
+	/* A restarted worker starts out with no connections */
+	metrics->counter[METRIC_OPEN] = 0;
+}
+
+uint64_t metrics_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+uint64_t metrics_cpu(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int bucket(uint64_t usec)
+{
+	int i;
+
+	for (i = 0; i < METRICS_BUCKETS - 1; i++) {
+		if (usec <= bounds[i])
+			break;
+	}
+
+	return i;
+}
+
+void metrics_request(int status, off_t bytes, uint64_t start, uint64_t first, uint64_t done)
+{
+	if (!first || first > done)
+		first = done;
+	if (start > first)
+		start = first;
+
+	metrics->first_byte[bucket(first - start)]++;
+	metrics->first_byte_usec += first - start;
+	metrics->total[bucket(done - start)]++;
+	metrics->total_usec += done - start;
+
+	if (status < 100 || status >= 100 + METRICS_CODES)
+		return;
+
+	metrics->responses[status - 100]++;
+	if (bytes > 0)
+		metrics->bytes[status - 100] += bytes;
+}
+
+static void out(const char *fmt, ...)
+{
+	va_list ap;
+	size_t need = 256, size;
+	char *ptr;
+	int len;
+
+	while (1) {
+		if (report_size - report_len < need) {
+			size = MAX(MAX(report_size * 2, report_len + need), 16384);
+			ptr = realloc(report, size);
+			if (!ptr) {
+				syslog(LOG_ERR, "out of memory generating status report");
+				return;
+			}
+			report = ptr;
+			report_size = size;
+		}
+
+		va_start(ap, fmt);
+		len = vsnprintf(&report[report_len], report_size - report_len, fmt, ap);
+		va_end(ap);
+		if (len < 0)
+			return;
+
+		if ((size_t)len < report_size - report_len) {
+			report_len += len;
+			return;
+		}
+
+		/* Did not fit, grow and retry */
+		need = len + 1;
+	}
+}
+
+static void header(const char *name, const char *type, const char *help)
+{
+	out("# HELP merecat_%s %s\n", name, help);
+	out("# TYPE merecat_%s %s\n", name, type);
+}
+
+static void histogram(const char *name, const char *help, uint64_t *hist, uint64_t usec)
+{
+	uint64_t count = 0;
+	int i;
+
+	header(name, "histogram", help);
+	for (i = 0; i < METRICS_BUCKETS; i++) {
+		count += hist[i];
+		if (i < METRICS_BUCKETS - 1)
+			out("merecat_%s_bucket{le=\"%g\"} %llu\n", name, bounds[i] / 1e6, (unsigned long long)count);
+		else
+			out("merecat_%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)count);
+	}
+	out("merecat_%s_sum %.6f\n", name, usec / 1e6);
+	out("merecat_%s_count %llu\n", name, (unsigned long long)count);
+}
+
+static void codes(const char *name, const char *help, uint64_t *val)
+{
+	int i;
+
+	header(name, "counter", help);
+	for (i = 0; i < METRICS_CODES; i++) {
+		if (val[i])
+			out("merecat_%s{code=\"%d\"} %llu\n", name, i + 100, (unsigned long long)val[i]);
+	}
+}
+
+const char *metrics_report(size_t *len)
+{
+	static struct metrics sum;
+	uint64_t *dst = (uint64_t *)&sum;
+	size_t i, j, n = sizeof(sum) / sizeof(uint64_t);
+
+	memset(&sum, 0, sizeof(sum));
+	for (i = 0; i < (size_t)num_slots; i++) {
+		uint64_t *src = (uint64_t *)&slots[i];
+
+		for (j = 0; j < n; j++)
+			dst[j] += src[j];
+	}
+
+	report_len = 0;
+	header("start_time_seconds", "gauge", "Start time of the server since the Epoch.");
+	out("merecat_start_time_seconds %lld\n", (long long)start_time);
+	header("workers", "gauge", "Worker processes reporting.");
+	out("merecat_workers %d\n", num_slots);
+
+	for (i = 0; i < METRIC_MAX; i++) {
+		header(counters[i].name, counters[i].type, counters[i].help);
+		if (counters[i].usec)
+			out("merecat_%s %.6f\n", counters[i].name, sum.counter[i] / 1e6);
+		else
+			out("merecat_%s %llu\n", counters[i].name, (unsigned long long)sum.counter[i]);
+	}
+
+	histogram("first_byte_seconds", "Time from start of request to first byte of the response.",
+		  sum.first_byte, sum.first_byte_usec);
+	histogram("request_duration_seconds", "Time from start of request to response sent.",
+		  sum.total, sum.total_usec);
+	codes("responses_total", "Responses sent, by status code.", sum.responses);
+	codes("response_bytes_total", "Response body bytes sent, by status code.", sum.bytes);
+
+	*len = report_len;
+	return report ? report : "";
+}
+
+void metrics_destroy(void)
+{
+	if (slots != &local)
+		munmap(slots, num_slots * sizeof(struct metrics));
+	slots = metrics = &local;
+	num_slots = 1;
+
+	free(report);
+	report = NULL;
+	report_len = report_size = 0;
+}
@@ -0,0 +1,109 @@
+/* Counters and latency histograms for the built-in status page
+**
+** Copyright (C) 2026  The Merecat contributors
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions
+** are met:
+** 1. Redistributions of source code must retain the above copyright
+**    notice, this list of conditions and the following disclaimer.
+** 2. Redistributions in binary form must reproduce the above copyright
+**    notice, this list of conditions and the following disclaimer in the
+**    documentation and/or other materials provided with the distribution.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNERS OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+** THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Plain counters, bumped in-line by the code that knows about them */
+enum {
+	METRIC_CONNECTIONS,		/* accepted */
+	METRIC_OPEN,			/* currently open, a gauge */
+	METRIC_MMC_HITS,
+	METRIC_MMC_MISSES,
+	METRIC_MMC_EVICTS,
+	METRIC_GZIP_USEC,		/* CPU time in deflate() */
+	METRIC_THROTTLE_PAUSES,
+	METRIC_WOULDBLOCKS,		/* socket full, waiting for FDW_WRITE */
+	METRIC_THROTTLE_REJECTS,
+	METRIC_LOG_DROPS,		/* access log entries dropped */
+	METRIC_FDWATCH_CALLS,
+	METRIC_FDWATCH_USEC,		/* time spent waiting in fdwatch() */
+	METRIC_SHED,			/* connections turned away, overloaded */
+	METRIC_MMC_BYTES,		/* mapped by the map cache, a gauge */
+	METRIC_MMC_MAPS,		/* files and listings cached, a gauge */
+	METRIC_CGC_HITS,
+	METRIC_CGC_MISSES,		/* script run, response may be cached */
+	METRIC_CGC_COLLAPSED,		/* waited for another to run the script */
+	METRIC_MAX
+};
+
+/* Log-linear 1-2-5 buckets from 100 usec to 10 sec, and +Inf */
+#define METRICS_BUCKETS 17
+
+/* Status codes 100-599 */
+#define METRICS_CODES   500
+
+/* One per worker process, only ever written to by its owner.  All
+** members must be uint64_t, the report sums them up as an array.
+*/
+struct metrics {
+	uint64_t counter[METRIC_MAX];
+	uint64_t first_byte[METRICS_BUCKETS];
+	uint64_t first_byte_usec;
+	uint64_t total[METRICS_BUCKETS];
+	uint64_t total_usec;
+	uint64_t responses[METRICS_CODES];
+	uint64_t bytes[METRICS_CODES];
+};
+
+extern struct metrics *metrics;
+
+#define METRIC_INC(id)       (metrics->counter[id]++)
+#define METRIC_DEC(id)       (metrics->counter[id]--)
+#define METRIC_ADD(id, val)  (metrics->counter[id] += (val))
+#define METRIC_SET(id, val)  (metrics->counter[id] = (val))
+
+/* Set up one slot per worker, in shared memory if more than one, so
+** any worker can report for all of them.  Call before forking.
+*/
+extern int         metrics_init(int workers);
+
+/* Select the slot of a worker process, after fork() */
+extern void        metrics_worker(int id);
+
+/* Monotonic wall clock and process CPU time, in microseconds */
+extern uint64_t    metrics_now(void);
+extern uint64_t    metrics_cpu(void);
+
+/* Account for a finished request.  Times are from metrics_now(), start
+** is when the request, or connection for the first one, began.  If no
+** first byte time is known it is taken to be the same as done.
+*/
+extern void        metrics_request(int status, off_t bytes, uint64_t start, uint64_t first, uint64_t done);
+
+/* Returns the metrics of all workers in the Prometheus text exposition
+** format.  The buffer is owned by the metrics package and reused.
+*/
+extern const char *metrics_report(size_t *len);
+
+/* Free all storage, usually in preparation for exitting. */
+extern void        metrics_destroy(void);
+
+#endif /* METRICS_H_ */
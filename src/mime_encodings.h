@@ -1,6 +1,19 @@
-{ "gz", 0, "gzip", 0 },
-{ "xz", 0, "xz", 0 },
-{ "bz2", 0, "bzip2", 0 },
-{ "svgz", 0, "gzip", 0 },
-{ "Z", 0, "compress", 0 },
-{ "uu", 0, "x-uuencode", 0 },
+/* Generated by make_mime.pl from mime_encodings.txt, do not edit */
+#define ENC_TAB_SIZE    16
+#define ENC_TAB_BUCKETS 3
+#define ENC_EXT_MAX     4
+
+static const uint16_t enc_disp[ENC_TAB_BUCKETS] = {
+	0, 0, 2,
+};
+
+static const struct mime_entry enc_tab[ENC_TAB_SIZE] = {
+	[0] = { "gz", 2, "gzip", 4 },
+	[1] = { "zst", 3, "zstd", 4 },
+	[3] = { "uu", 2, "x-uuencode", 10 },
+	[10] = { "bz2", 3, "bzip2", 5 },
+	[11] = { "br", 2, "br", 2 },
+	[12] = { "z", 1, "compress", 8 },
+	[13] = { "xz", 2, "xz", 2 },
+	[15] = { "svgz", 4, "gzip", 4 },
+};
@@ -1,222 +1,237 @@
-{ "7z", 0, "application/x-7z-compressed", 0 },
-{ "a", 0, "application/octet-stream", 0 },
-{ "aab", 0, "application/x-authorware-bin", 0 },
-{ "aam", 0, "application/x-authorware-map", 0 },
-{ "aas", 0, "application/x-authorware-seg", 0 },
-{ "ai", 0, "application/postscript", 0 },
-{ "aif", 0, "audio/x-aiff", 0 },
-{ "aifc", 0, "audio/x-aiff", 0 },
-{ "aiff", 0, "audio/x-aiff", 0 },
-{ "arc", 0, "application/octet-stream", 0 },
-{ "arj", 0, "application/octet-stream", 0 },
-{ "asc", 0, "text/plain; charset=%s", 0 },
-{ "asf", 0, "video/x-ms-asf", 0 },
-{ "asx", 0, "video/x-ms-asf", 0 },
-{ "au", 0, "audio/basic", 0 },
-{ "avi", 0, "video/x-msvideo", 0 },
-{ "avif", 0, "image/avif", 0 },
-{ "bcpio", 0, "application/x-bcpio", 0 },
-{ "bin", 0, "application/octet-stream", 0 },
-{ "bmp", 0, "image/bmp", 0 },
-{ "bz2", 0, "application/x-bzip2", 0 },
-{ "cdf", 0, "application/x-netcdf", 0 },
-{ "class", 0, "application/x-java-vm", 0 },
-{ "cpio", 0, "application/x-cpio", 0 },
-{ "cpt", 0, "application/mac-compactpro", 0 },
-{ "crl", 0, "application/x-pkcs7-crl", 0 },
-{ "cer", 0, "application/x-x509-ca-cert", 0 },
-{ "crt", 0, "application/x-x509-ca-cert", 0 },
-{ "csh", 0, "application/x-csh", 0 },
-{ "css", 0, "text/css; charset=%s", 0 },
-{ "dcr", 0, "application/x-director", 0 },
-{ "der", 0, "application/x-x509-ca-cert", 0 },
-{ "dir", 0, "application/x-director", 0 },
-{ "disco", 0, "text/xml", 0 },
-{ "djv", 0, "image/vnd.djvu", 0 },
-{ "djvu", 0, "image/vnd.djvu", 0 },
-{ "dll", 0, "application/octet-stream", 0 },
-{ "dms", 0, "application/octet-stream", 0 },
-{ "doc", 0, "application/msword", 0 },
-{ "dtd", 0, "text/xml; charset=%s", 0 },
-{ "dump", 0, "application/octet-stream", 0 },
-{ "dvi", 0, "application/x-dvi", 0 },
-{ "dxr", 0, "application/x-director", 0 },
-{ "eps", 0, "application/postscript", 0 },
-{ "etx", 0, "text/x-setext", 0 },
-{ "exe", 0, "application/octet-stream", 0 },
-{ "ez", 0, "application/andrew-inset", 0 },
-{ "fgd", 0, "application/x-director", 0 },
-{ "fh", 0, "image/x-freehand", 0 },
-{ "fh4", 0, "image/x-freehand", 0 },
-{ "fh5", 0, "image/x-freehand", 0 },
-{ "fh7", 0, "image/x-freehand", 0 },
-{ "fhc", 0, "image/x-freehand", 0 },
-{ "gif", 0, "image/gif", 0 },
-{ "gtar", 0, "application/x-gtar", 0 },
-{ "gz", 0, "application/gzip", 0 },
-{ "hdf", 0, "application/x-hdf", 0 },
-{ "hqx", 0, "application/mac-binhex40", 0 },
-{ "htm", 0, "text/html; charset=%s", 0 },
-{ "html", 0, "text/html; charset=%s", 0 },
-{ "ice", 0, "x-conference/x-cooltalk", 0 },
-{ "ico", 0, "image/x-icon", 0 },
-{ "ief", 0, "image/ief", 0 },
-{ "iges", 0, "model/iges", 0 },
-{ "igs", 0, "model/iges", 0 },
-{ "iv", 0, "application/x-inventor", 0 },
-{ "jar", 0, "application/x-java-archive", 0 },
-{ "jfif", 0, "image/jpeg", 0 },
-{ "jpe", 0, "image/jpeg", 0 },
-{ "jpeg", 0, "image/jpeg", 0 },
-{ "jpg", 0, "image/jpeg", 0 },
-{ "js", 0, "application/javascript", 0 },
-{ "kar", 0, "audio/midi", 0 },
-{ "kml", 0, "application/vnd.google-earth.kml+xml", 0 },
-{ "kmz", 0, "application/vnd.google-earth.kmz", 0 },
-{ "latex", 0, "application/x-latex", 0 },
-{ "lha", 0, "application/octet-stream", 0 },
-{ "loc", 0, "application/xml-loc", 0 },
-{ "lzh", 0, "application/octet-stream", 0 },
-{ "m3u", 0, "audio/x-mpegurl", 0 },
-{ "man", 0, "application/x-troff-man", 0 },
-{ "mathml", 0, "application/mathml+xml", 0 },
-{ "me", 0, "application/x-troff-me", 0 },
-{ "mesh", 0, "model/mesh", 0 },
-{ "mid", 0, "audio/midi", 0 },
-{ "midi", 0, "audio/midi", 0 },
-{ "mif", 0, "application/vnd.mif", 0 },
-{ "mime", 0, "message/rfc822", 0 },
-{ "mml", 0, "application/mathml+xml", 0 },
-{ "mov", 0, "video/quicktime", 0 },
-{ "movie", 0, "video/x-sgi-movie", 0 },
-{ "mp2", 0, "audio/mpeg", 0 },
-{ "mp3", 0, "audio/mpeg", 0 },
-{ "mp4", 0, "video/mp4", 0 },
-{ "mpe", 0, "video/mpeg", 0 },
-{ "mpeg", 0, "video/mpeg", 0 },
-{ "mpg", 0, "video/mpeg", 0 },
-{ "mpga", 0, "audio/mpeg", 0 },
-{ "ms", 0, "application/x-troff-ms", 0 },
-{ "msh", 0, "model/mesh", 0 },
-{ "mv", 0, "video/x-sgi-movie", 0 },
-{ "mxu", 0, "video/vnd.mpegurl", 0 },
-{ "nc", 0, "application/x-netcdf", 0 },
-{ "o", 0, "application/octet-stream", 0 },
-{ "oda", 0, "application/oda", 0 },
-{ "ogg", 0, "application/ogg", 0 },
-{ "ogv", 0, "video/ogg", 0 },
-{ "ogx", 0, "application/ogg", 0 },
-{ "pac", 0, "application/x-ns-proxy-autoconfig", 0 },
-{ "pbm", 0, "image/x-portable-bitmap", 0 },
-{ "pdb", 0, "chemical/x-pdb", 0 },
-{ "pdf", 0, "application/pdf", 0 },
-{ "pgm", 0, "image/x-portable-graymap", 0 },
-{ "pgn", 0, "application/x-chess-pgn", 0 },
-{ "png", 0, "image/png", 0 },
-{ "pnm", 0, "image/x-portable-anymap", 0 },
-{ "ppm", 0, "image/x-portable-pixmap", 0 },
-{ "ppt", 0, "application/vnd.ms-powerpoint", 0 },
-{ "ps", 0, "application/postscript", 0 },
-{ "qt", 0, "video/quicktime", 0 },
-{ "ra", 0, "audio/x-realaudio", 0 },
-{ "ram", 0, "audio/x-pn-realaudio", 0 },
-{ "ras", 0, "image/x-cmu-raster", 0 },
-{ "rdf", 0, "application/rdf+xml", 0 },
-{ "rgb", 0, "image/x-rgb", 0 },
-{ "rm", 0, "audio/x-pn-realaudio", 0 },
-{ "roff", 0, "application/x-troff", 0 },
-{ "rpm", 0, "audio/x-pn-realaudio-plugin", 0 },
-{ "rss", 0, "application/rss+xml", 0 },
-{ "rtf", 0, "text/rtf; charset=%s", 0 },
-{ "rtx", 0, "text/richtext; charset=%s", 0 },
-{ "sfx", 0, "application/octet-stream", 0 },
-{ "sgm", 0, "text/sgml; charset=%s", 0 },
-{ "sgml", 0, "text/sgml; charset=%s", 0 },
-{ "sh", 0, "application/x-sh", 0 },
-{ "shar", 0, "application/x-shar", 0 },
-{ "sig", 0, "application/pgp-signature", 0 },
-{ "silo", 0, "model/mesh", 0 },
-{ "sit", 0, "application/x-stuffit", 0 },
-{ "skd", 0, "application/x-koan", 0 },
-{ "skm", 0, "application/x-koan", 0 },
-{ "skp", 0, "application/x-koan", 0 },
-{ "skt", 0, "application/x-koan", 0 },
-{ "smi", 0, "application/smil", 0 },
-{ "smil", 0, "application/smil", 0 },
-{ "snd", 0, "audio/basic", 0 },
-{ "so", 0, "application/octet-stream", 0 },
-{ "spl", 0, "application/x-futuresplash", 0 },
-{ "src", 0, "application/x-wais-source", 0 },
-{ "stc", 0, "application/vnd.sun.xml.calc.template", 0 },
-{ "std", 0, "application/vnd.sun.xml.draw.template", 0 },
-{ "sti", 0, "application/vnd.sun.xml.impress.template", 0 },
-{ "stw", 0, "application/vnd.sun.xml.writer.template", 0 },
-{ "sv4cpio", 0, "application/x-sv4cpio", 0 },
-{ "sv4crc", 0, "application/x-sv4crc", 0 },
-{ "svg", 0, "image/svg+xml", 0 },
-{ "svgx", 0, "image/svg+xml", 0 },
-{ "svgz", 0, "image/svg+xml", 0 },
-{ "swf", 0, "application/x-shockwave-flash", 0 },
-{ "sxc", 0, "application/vnd.sun.xml.calc", 0 },
-{ "sxd", 0, "application/vnd.sun.xml.draw", 0 },
-{ "sxg", 0, "application/vnd.sun.xml.writer.global", 0 },
-{ "sxi", 0, "application/vnd.sun.xml.impress", 0 },
-{ "sxm", 0, "application/vnd.sun.xml.math", 0 },
-{ "sxw", 0, "application/vnd.sun.xml.writer", 0 },
-{ "t", 0, "application/x-troff", 0 },
-{ "tar", 0, "application/x-tar", 0 },
-{ "taz", 0, "application/octet-stream", 0 },
-{ "tgz", 0, "application/gzip", 0 },
-{ "tbz2", 0, "application/x-bzip2", 0 },
-{ "txz", 0, "application/x-xz", 0 },
-{ "tcl", 0, "application/x-tcl", 0 },
-{ "tex", 0, "application/x-tex", 0 },
-{ "texi", 0, "application/x-texinfo", 0 },
-{ "texinfo", 0, "application/x-texinfo", 0 },
-{ "tif", 0, "image/tiff", 0 },
-{ "tiff", 0, "image/tiff", 0 },
-{ "torrent", 0, "application/x-bittorrent", 0 },
-{ "tr", 0, "application/x-troff", 0 },
-{ "tsp", 0, "application/dsptype", 0 },
-{ "tsv", 0, "text/tab-separated-values; charset=%s", 0 },
-{ "txt", 0, "text/plain; charset=%s", 0 },
-{ "tz", 0, "application/octet-stream", 0 },
-{ "ustar", 0, "application/x-ustar", 0 },
-{ "vcd", 0, "application/x-cdlink", 0 },
-{ "vrml", 0, "model/vrml", 0 },
-{ "vx", 0, "video/x-rad-screenplay", 0 },
-{ "wav", 0, "audio/x-wav", 0 },
-{ "wax", 0, "audio/x-ms-wax", 0 },
-{ "wbmp", 0, "image/vnd.wap.wbmp", 0 },
-{ "wbxml", 0, "application/vnd.wap.wbxml", 0 },
-{ "webm", 0, "video/webm", 0 },
-{ "webp", 0, "image/webp", 0 },
-{ "wm", 0, "video/x-ms-wm", 0 },
-{ "wma", 0, "audio/x-ms-wma", 0 },
-{ "wmd", 0, "application/x-ms-wmd", 0 },
-{ "wml", 0, "text/vnd.wap.wml", 0 },
-{ "wmlc", 0, "application/vnd.wap.wmlc", 0 },
-{ "wmls", 0, "text/vnd.wap.wmlscript", 0 },
-{ "wmlsc", 0, "application/vnd.wap.wmlscriptc", 0 },
-{ "wmv", 0, "video/x-ms-wmv", 0 },
-{ "wmx", 0, "video/x-ms-wmx", 0 },
-{ "wmz", 0, "application/x-ms-wmz", 0 },
-{ "wrl", 0, "model/vrml", 0 },
-{ "wsrc", 0, "application/x-wais-source", 0 },
-{ "wvx", 0, "video/x-ms-wvx", 0 },
-{ "xbm", 0, "image/x-xbitmap", 0 },
-{ "xht", 0, "application/xhtml+xml; charset=%s", 0 },
-{ "xhtml", 0, "application/xhtml+xml; charset=%s", 0 },
-{ "xls", 0, "application/vnd.ms-excel", 0 },
-{ "xml", 0, "text/xml; charset=%s", 0 },
-{ "xpi", 0, "application/x-xpinstall", 0 },
-{ "xpm", 0, "image/x-xpixmap", 0 },
-{ "xsd", 0, "text/xml; charset=%s", 0 },
-{ "xsl", 0, "text/xml; charset=%s", 0 },
-{ "xslt", 0, "text/xml; charset=%s", 0 },
-{ "xul", 0, "application/vnd.mozilla.xul+xml", 0 },
-{ "xwd", 0, "image/x-xwindowdump", 0 },
-{ "xz", 0, "application/x-xz", 0 },
-{ "xyz", 0, "chemical/x-xyz", 0 },
-{ "zip", 0, "application/zip", 0 },
-{ "zoo", 0, "application/octet-stream", 0 },
+/* Generated by make_mime.pl from mime_types.txt, do not edit */
+#define TYP_TAB_SIZE    512
+#define TYP_TAB_BUCKETS 56
+#define TYP_EXT_MAX     7
+
+static const uint16_t typ_disp[TYP_TAB_BUCKETS] = {
+	0, 2, 3, 0, 1, 0, 1, 1, 0, 1, 0, 1,
+	0, 0, 2, 4, 0, 2, 1, 1, 2, 1, 0, 0,
+	1, 4, 0, 1, 4, 3, 0, 5, 8, 2, 0, 3,
+	2, 1, 8, 0, 2, 1, 0, 3, 0, 0, 2, 4,
+	1, 3, 0, 3, 2, 1, 0, 10,
+};
+
+static const struct mime_entry typ_tab[TYP_TAB_SIZE] = {
+	[3] = { "txz", 3, "application/x-xz", 16, "Content-Type: application/x-xz\r\n", 0 },
+	[4] = { "jar", 3, "application/x-java-archive", 26, "Content-Type: application/x-java-archive\r\n", 0 },
+	[6] = { "jpeg", 4, "image/jpeg", 10, "Content-Type: image/jpeg\r\n", 0 },
+	[7] = { "crt", 3, "application/x-x509-ca-cert", 26, "Content-Type: application/x-x509-ca-cert\r\n", 0 },
+	[12] = { "a", 1, "application/octet-stream", 24, "Content-Type: application/octet-stream\r\n", 0 },
+	[15] = { "spl", 3, "application/x-futuresplash", 26, "Content-Type: application/x-futuresplash\r\n", 0 },
+	[18] = { "dll", 3, "application/octet-stream", 24, "Content-Type: application/octet-stream\r\n", 0 },
+	[21] = { "tar", 3, "application/x-tar", 17, "Content-Type: application/x-tar\r\n", 0 },
+	[23] = { "stw", 3, "application/vnd.sun.xml.writer.template", 39, "Content-Type: application/vnd.sun.xml.writer.template\r\n", 0 },
+	[25] = { "xwd", 3, "image/x-xwindowdump", 19, "Content-Type: image/x-xwindowdump\r\n", 0 },
+	[27] = { "bcpio", 5, "application/x-bcpio", 19, "Content-Type: application/x-bcpio\r\n", 0 },
+	[29] = { "rdf", 3, "application/rdf+xml", 19, "Content-Type: application/rdf+xml\r\n", 0 },
+	[31] = { "texinfo", 7, "application/x-texinfo", 21, "Content-Type: application/x-texinfo\r\n", 0 },
+	[32] = { "xslt", 4, "text/xml; charset=%s", 20, "Content-Type: text/xml; charset=%s\r\n", 1 },
+	[36] = { "class", 5, "application/x-java-vm", 21, "Content-Type: application/x-java-vm\r\n", 0 },
+	[37] = { "rss", 3, "application/rss+xml", 19, "Content-Type: application/rss+xml\r\n", 0 },
+	[42] = { "xml", 3, "text/xml; charset=%s", 20, "Content-Type: text/xml; charset=%s\r\n", 1 },
+	[43] = { "skd", 3, "application/x-koan", 18, "Content-Type: application/x-koan\r\n", 0 },
+	[44] = { "movie", 5, "video/x-sgi-movie", 17, "Content-Type: video/x-sgi-movie\r\n", 0 },
+	[46] = { "ogg", 3, "application/ogg", 15, "Content-Type: application/ogg\r\n", 0 },
+	[47] = { "svgz", 4, "image/svg+xml", 13, "Content-Type: image/svg+xml\r\n", 0 },
+	[48] = { "fh7", 3, "image/x-freehand", 16, "Content-Type: image/x-freehand\r\n", 0 },
+	[49] = { "cer", 3, "application/x-x509-ca-cert", 26, "Content-Type: application/x-x509-ca-cert\r\n", 0 },
+	[50] = { "ras", 3, "image/x-cmu-raster", 18, "Content-Type: image/x-cmu-raster\r\n", 0 },
+	[51] = { "snd", 3, "audio/basic", 11, "Content-Type: audio/basic\r\n", 0 },
+	[55] = { "dxr", 3, "application/x-director", 22, "Content-Type: application/x-director\r\n", 0 },
+	[57] = { "cpt", 3, "application/mac-compactpro", 26, "Content-Type: application/mac-compactpro\r\n", 0 },
+	[58] = { "latex", 5, "application/x-latex", 19, "Content-Type: application/x-latex\r\n", 0 },
+	[60] = { "sit", 3, "application/x-stuffit", 21, "Content-Type: application/x-stuffit\r\n", 0 },
+	[63] = { "js", 2, "application/javascript", 22, "Content-Type: application/javascript\r\n", 0 },
+	[64] = { "oda", 3, "application/oda", 15, "Content-Type: application/oda\r\n", 0 },
+	[65] = { "dump", 4, "application/octet-stream", 24, "Content-Type: application/octet-stream\r\n", 0 },
+	[66] = { "pac", 3, "application/x-ns-proxy-autoconfig", 33, "Content-Type: application/x-ns-proxy-autoconfig\r\n", 0 },
+	[68] = { "ppt", 3, "application/vnd.ms-powerpoint", 29, "Content-Type: application/vnd.ms-powerpoint\r\n", 0 },
+	[71] = { "hdf", 3, "application/x-hdf", 17, "Content-Type: application/x-hdf\r\n", 0 },
+	[72] = { "src", 3, "application/x-wais-source", 25, "Content-Type: application/x-wais-source\r\n", 0 },
+	[73] = { "tiff", 4, "image/tiff", 10, "Content-Type: image/tiff\r\n", 0 },
+	[74] = { "sh", 2, "application/x-sh", 16, "Content-Type: application/x-sh\r\n", 0 },
+	[75] = { "std", 3, "application/vnd.sun.xml.draw.template", 37, "Content-Type: application/vnd.sun.xml.draw.template\r\n", 0 },
+	[78] = { "ps", 2, "application/postscript", 22, "Content-Type: application/postscript\r\n", 0 },
+	[81] = { "jpe", 3, "image/jpeg", 10, "Content-Type: image/jpeg\r\n", 0 },
+	[82] = { "so", 2, "application/octet-stream", 24, "Content-Type: application/octet-stream\r\n", 0 },
+	[84] = { "ra", 2, "audio/x-realaudio", 17, "Content-Type: audio/x-realaudio\r\n", 0 },
+	[85] = { "sxw", 3, "application/vnd.sun.xml.writer", 30, "Content-Type: application/vnd.sun.xml.writer\r\n", 0 },
+	[87] = { "mov", 3, "video/quicktime", 15, "Content-Type: video/quicktime\r\n", 0 },
+	[90] = { "sfx", 3, "application/octet-stream", 24, "Content-Type: application/octet-stream\r\n", 0 },
+	[96] = { "ogv", 3, "video/ogg", 9, "Content-Type: video/ogg\r\n", 0 },
+	[97] = { "mxu", 3, "video/vnd.mpegurl", 17, "Content-Type: video/vnd.mpegurl\r\n", 0 },
+	[100] = { "svgx", 4, "image/svg+xml", 13, "Content-Type: image/svg+xml\r\n", 0 },
+	[101] = { "fh", 2, "image/x-freehand", 16, "Content-Type: image/x-freehand\r\n", 0 },
+	[103] = { "etx", 3, "text/x-setext", 13, "Content-Type: text/x-setext\r\n", 0 },
+	[104] = { "doc", 3, "application/msword", 18, "Content-Type: application/msword\r\n", 0 },
+	[105] = { "avi", 3, "video/x-msvideo", 15, "Content-Type: video/x-msvideo\r\n", 0 },
+	[106] = { "shar", 4, "application/x-shar", 18, "Content-Type: application/x-shar\r\n", 0 },
+	[108] = { "rm", 2, "audio/x-pn-realaudio", 20, "Content-Type: audio/x-pn-realaudio\r\n", 0 },
+	[112] = { "xul", 3, "application/vnd.mozilla.xul+xml", 31, "Content-Type: application/vnd.mozilla.xul+xml\r\n", 0 },
+	[113] = { "xls", 3, "application/vnd.ms-excel", 24, "Content-Type: application/vnd.ms-excel\r\n", 0 },
+	[114] = { "asc", 3, "text/plain; charset=%s", 22, "Content-Type: text/plain; charset=%s\r\n", 1 },
+	[115] = { "wvx", 3, "video/x-ms-wvx", 14, "Content-Type: video/x-ms-wvx\r\n", 0 },
+	[119] = { "jfif", 4, "image/jpeg", 10, "Content-Type: image/jpeg\r\n", 0 },
+	[121] = { "mpg", 3, "video/mpeg", 10, "Content-Type: video/mpeg\r\n", 0 },
+	[122] = { "midi", 4, "audio/midi", 10, "Content-Type: audio/midi\r\n", 0 },
+	[124] = { "cdf", 3, "application/x-netcdf", 20, "Content-Type: application/x-netcdf\r\n", 0 },
+	[125] = { "t", 1, "application/x-troff", 19, "Content-Type: application/x-troff\r\n", 0 },
+	[127] = { "wml", 3, "text/vnd.wap.wml", 16, "Content-Type: text/vnd.wap.wml\r\n", 0 },
+	[130] = { "wmv", 3, "video/x-ms-wmv", 14, "Content-Type: video/x-ms-wmv\r\n", 0 },
+	[131] = { "rtf", 3, "text/rtf; charset=%s", 20, "Content-Type: text/rtf; charset=%s\r\n", 1 },
+	[133] = { "ms", 2, "application/x-troff-ms", 22, "Content-Type: application/x-troff-ms\r\n", 0 },
+	[135] = { "wmlsc", 5, "application/vnd.wap.wmlscriptc", 30, "Content-Type: application/vnd.wap.wmlscriptc\r\n", 0 },
+	[138] = { "xsd", 3, "text/xml; charset=%s", 20, "Content-Type: text/xml; charset=%s\r\n", 1 },
+	[139] = { "xsl", 3, "text/xml; charset=%s", 20, "Content-Type: text/xml; charset=%s\r\n", 1 },
+	[140] = { "mime", 4, "message/rfc822", 14, "Content-Type: message/rfc822\r\n", 0 },
+	[142] = { "wmz", 3, "application/x-ms-wmz", 20, "Content-Type: application/x-ms-wmz\r\n", 0 },
+	[143] = { "bz2", 3, "application/x-bzip2", 19, "Content-Type: application/x-bzip2\r\n", 0 },
+	[150] = { "vcd", 3, "application/x-cdlink", 20, "Content-Type: application/x-cdlink\r\n", 0 },
+	[161] = { "skp", 3, "application/x-koan", 18, "Content-Type: application/x-koan\r\n", 0 },
+	[165] = { "xhtml", 5, "application/xhtml+xml; charset=%s", 33, "Content-Type: application/xhtml+xml; charset=%s\r\n", 1 },
+	[169] = { "torrent", 7, "application/x-bittorrent", 24, "Content-Type: application/x-bittorrent\r\n", 0 },
+	[171] = { "bmp", 3, "image/bmp", 9, "Content-Type: image/bmp\r\n", 0 },
+	[176] = { "tex", 3, "application/x-tex", 17, "Content-Type: application/x-tex\r\n", 0 },
+	[178] = { "au", 2, "audio/basic", 11, "Content-Type: audio/basic\r\n", 0 },
+	[182] = { "rtx", 3, "text/richtext; charset=%s", 25, "Content-Type: text/richtext; charset=%s\r\n", 1 },
+	[184] = { "ustar", 5, "application/x-ustar", 19, "Content-Type: application/x-ustar\r\n", 0 },
+	[189] = { "avif", 4, "image/avif", 10, "Content-Type: image/avif\r\n", 0 },
+	[192] = { "tsv", 3, "text/tab-separated-values; charset=%s", 37, "Content-Type: text/tab-separated-values; charset=%s\r\n", 1 },
+	[194] = { "sxc", 3, "application/vnd.sun.xml.calc", 28, "Content-Type: application/vnd.sun.xml.calc\r\n", 0 },
+	[197] = { "dir", 3, "application/x-director", 22, "Content-Type: application/x-director\r\n", 0 },
+	[199] = { "jpg", 3, "image/jpeg", 10, "Content-Type: image/jpeg\r\n", 0 },
+	[202] = { "bin", 3, "application/octet-stream", 24, "Content-Type: application/octet-stream\r\n", 0 },
+	[207] = { "djvu", 4, "image/vnd.djvu", 14, "Content-Type: image/vnd.djvu\r\n", 0 },
+	[214] = { "o", 1, "application/octet-stream", 24, "Content-Type: application/octet-stream\r\n", 0 },
+	[216] = { "wav", 3, "audio/x-wav", 11, "Content-Type: audio/x-wav\r\n", 0 },
+	[222] = { "wbxml", 5, "application/vnd.wap.wbxml", 25, "Content-Type: application/vnd.wap.wbxml\r\n", 0 },
+	[224] = { "ice", 3, "x-conference/x-cooltalk", 23, "Content-Type: x-conference/x-cooltalk\r\n", 0 },
+	[230] = { "texi", 4, "application/x-texinfo", 21, "Content-Type: application/x-texinfo\r\n", 0 },
+	[231] = { "fh4", 3, "image/x-freehand", 16, "Content-Type: image/x-freehand\r\n", 0 },
+	[232] = { "aab", 3, "application/x-authorware-bin", 28, "Content-Type: application/x-authorware-bin\r\n", 0 },
+	[234] = { "mp3", 3, "audio/mpeg", 10, "Content-Type: audio/mpeg\r\n", 0 },
+	[237] = { "wma", 3, "audio/x-ms-wma", 14, "Content-Type: audio/x-ms-wma\r\n", 0 },
+	[238] = { "gif", 3, "image/gif", 9, "Content-Type: image/gif\r\n", 0 },
+	[239] = { "mml", 3, "application/mathml+xml", 22, "Content-Type: application/mathml+xml\r\n", 0 },
+	[242] = { "tcl", 3, "application/x-tcl", 17, "Content-Type: application/x-tcl\r\n", 0 },
+	[243] = { "pgm", 3, "image/x-portable-graymap", 24, "Content-Type: image/x-portable-graymap\r\n", 0 },
+	[244] = { "mid", 3, "audio/midi", 10, "Content-Type: audio/midi\r\n", 0 },
+	[245] = { "zoo", 3, "application/octet-stream", 24, "Content-Type: application/octet-stream\r\n", 0 },
+	[246] = { "ppm", 3, "image/x-portable-pixmap", 23, "Content-Type: image/x-portable-pixmap\r\n", 0 },
+	[248] = { "tif", 3, "image/tiff", 10, "Content-Type: image/tiff\r\n", 0 },
+	[249] = { "smil", 4, "application/smil", 16, "Content-Type: application/smil\r\n", 0 },
+	[253] = { "tgz", 3, "application/gzip", 16, "Content-Type: application/gzip\r\n", 0 },
+	[258] = { "kmz", 3, "application/vnd.google-earth.kmz", 32, "Content-Type: application/vnd.google-earth.kmz\r\n", 0 },
+	[262] = { "smi", 3, "application/smil", 16, "Content-Type: application/smil\r\n", 0 },
+	[263] = { "fgd", 3, "application/x-director", 22, "Content-Type: application/x-director\r\n", 0 },
+	[267] = { "xpm", 3, "image/x-xpixmap", 15, "Content-Type: image/x-xpixmap\r\n", 0 },
+	[270] = { "roff", 4, "application/x-troff", 19, "Content-Type: application/x-troff\r\n", 0 },
+	[274] = { "vrml", 4, "model/vrml", 10, "Content-Type: model/vrml\r\n", 0 },
+	[276] = { "wmls", 4, "text/vnd.wap.wmlscript", 22, "Content-Type: text/vnd.wap.wmlscript\r\n", 0 },
+	[277] = { "asf", 3, "video/x-ms-asf", 14, "Content-Type: video/x-ms-asf\r\n", 0 },
+	[279] = { "rgb", 3, "image/x-rgb", 11, "Content-Type: image/x-rgb\r\n", 0 },
+	[281] = { "tsp", 3, "application/dsptype", 19, "Content-Type: application/dsptype\r\n", 0 },
+	[282] = { "ez", 2, "application/andrew-inset", 24, "Content-Type: application/andrew-inset\r\n", 0 },
+	[286] = { "zip", 3, "application/zip", 15, "Content-Type: application/zip\r\n", 0 },
+	[287] = { "m3u", 3, "audio/x-mpegurl", 15, "Content-Type: audio/x-mpegurl\r\n", 0 },
+	[289] = { "sgm", 3, "text/sgml; charset=%s", 21, "Content-Type: text/sgml; charset=%s\r\n", 1 },
+	[291] = { "aas", 3, "application/x-authorware-seg", 28, "Content-Type: application/x-authorware-seg\r\n", 0 },
+	[292] = { "pnm", 3, "image/x-portable-anymap", 23, "Content-Type: image/x-portable-anymap\r\n", 0 },
+	[293] = { "lzh", 3, "application/octet-stream", 24, "Content-Type: application/octet-stream\r\n", 0 },
+	[295] = { "cpio", 4, "application/x-cpio", 18, "Content-Type: application/x-cpio\r\n", 0 },
+	[296] = { "tr", 2, "application/x-troff", 19, "Content-Type: application/x-troff\r\n", 0 },
+	[297] = { "xyz", 3, "chemical/x-xyz", 14, "Content-Type: chemical/x-xyz\r\n", 0 },
+	[299] = { "skm", 3, "application/x-koan", 18, "Content-Type: application/x-koan\r\n", 0 },
+	[302] = { "mv", 2, "video/x-sgi-movie", 17, "Content-Type: video/x-sgi-movie\r\n", 0 },
+	[308] = { "dtd", 3, "text/xml; charset=%s", 20, "Content-Type: text/xml; charset=%s\r\n", 1 },
+	[309] = { "asx", 3, "video/x-ms-asf", 14, "Content-Type: video/x-ms-asf\r\n", 0 },
+	[312] = { "iv", 2, "application/x-inventor", 22, "Content-Type: application/x-inventor\r\n", 0 },
+	[314] = { "aiff", 4, "audio/x-aiff", 12, "Content-Type: audio/x-aiff\r\n", 0 },
+	[316] = { "eps", 3, "application/postscript", 22, "Content-Type: application/postscript\r\n", 0 },
+	[317] = { "tbz2", 4, "application/x-bzip2", 19, "Content-Type: application/x-bzip2\r\n", 0 },
+	[319] = { "png", 3, "image/png", 9, "Content-Type: image/png\r\n", 0 },
+	[325] = { "xz", 2, "application/x-xz", 16, "Content-Type: application/x-xz\r\n", 0 },
+	[327] = { "pgn", 3, "application/x-chess-pgn", 23, "Content-Type: application/x-chess-pgn\r\n", 0 },
+	[329] = { "vx", 2, "video/x-rad-screenplay", 22, "Content-Type: video/x-rad-screenplay\r\n", 0 },
+	[330] = { "sv4crc", 6, "application/x-sv4crc", 20, "Content-Type: application/x-sv4crc\r\n", 0 },
+	[331] = { "stc", 3, "application/vnd.sun.xml.calc.template", 37, "Content-Type: application/vnd.sun.xml.calc.template\r\n", 0 },
+	[332] = { "qt", 2, "video/quicktime", 15, "Content-Type: video/quicktime\r\n", 0 },
+	[333] = { "pdf", 3, "application/pdf", 15, "Content-Type: application/pdf\r\n", 0 },
+	[335] = { "lha", 3, "application/octet-stream", 24, "Content-Type: application/octet-stream\r\n", 0 },
+	[336] = { "disco", 5, "text/xml", 8, "Content-Type: text/xml\r\n", 0 },
+	[337] = { "loc", 3, "application/xml-loc", 19, "Content-Type: application/xml-loc\r\n", 0 },
+	[338] = { "exe", 3, "application/octet-stream", 24, "Content-Type: application/octet-stream\r\n", 0 },
+	[339] = { "mif", 3, "application/vnd.mif", 19, "Content-Type: application/vnd.mif\r\n", 0 },
+	[340] = { "mpeg", 4, "video/mpeg", 10, "Content-Type: video/mpeg\r\n", 0 },
+	[341] = { "rpm", 3, "audio/x-pn-realaudio-plugin", 27, "Content-Type: audio/x-pn-realaudio-plugin\r\n", 0 },
+	[342] = { "sxi", 3, "application/vnd.sun.xml.impress", 31, "Content-Type: application/vnd.sun.xml.impress\r\n", 0 },
+	[345] = { "der", 3, "application/x-x509-ca-cert", 26, "Content-Type: application/x-x509-ca-cert\r\n", 0 },
+	[352] = { "djv", 3, "image/vnd.djvu", 14, "Content-Type: image/vnd.djvu\r\n", 0 },
+	[353] = { "wmd", 3, "application/x-ms-wmd", 20, "Content-Type: application/x-ms-wmd\r\n", 0 },
+	[361] = { "ico", 3, "image/x-icon", 12, "Content-Type: image/x-icon\r\n", 0 },
+	[365] = { "csh", 3, "application/x-csh", 17, "Content-Type: application/x-csh\r\n", 0 },
+	[366] = { "arc", 3, "application/octet-stream", 24, "Content-Type: application/octet-stream\r\n", 0 },
+	[369] = { "webp", 4, "image/webp", 10, "Content-Type: image/webp\r\n", 0 },
+	[370] = { "skt", 3, "application/x-koan", 18, "Content-Type: application/x-koan\r\n", 0 },
+	[371] = { "wrl", 3, "model/vrml", 10, "Content-Type: model/vrml\r\n", 0 },
+	[373] = { "html", 4, "text/html; charset=%s", 21, "Content-Type: text/html; charset=%s\r\n", 1 },
+	[374] = { "gz", 2, "application/gzip", 16, "Content-Type: application/gzip\r\n", 0 },
+	[377] = { "mp2", 3, "audio/mpeg", 10, "Content-Type: audio/mpeg\r\n", 0 },
+	[378] = { "ai", 2, "application/postscript", 22, "Content-Type: application/postscript\r\n", 0 },
+	[380] = { "xht", 3, "application/xhtml+xml; charset=%s", 33, "Content-Type: application/xhtml+xml; charset=%s\r\n", 1 },
+	[384] = { "me", 2, "application/x-troff-me", 22, "Content-Type: application/x-troff-me\r\n", 0 },
+	[385] = { "svg", 3, "image/svg+xml", 13, "Content-Type: image/svg+xml\r\n", 0 },
+	[386] = { "swf", 3, "application/x-shockwave-flash", 29, "Content-Type: application/x-shockwave-flash\r\n", 0 },
+	[388] = { "css", 3, "text/css; charset=%s", 20, "Content-Type: text/css; charset=%s\r\n", 1 },
+	[391] = { "sxm", 3, "application/vnd.sun.xml.math", 28, "Content-Type: application/vnd.sun.xml.math\r\n", 0 },
+	[397] = { "hqx", 3, "application/mac-binhex40", 24, "Content-Type: application/mac-binhex40\r\n", 0 },
+	[399] = { "htm", 3, "text/html; charset=%s", 21, "Content-Type: text/html; charset=%s\r\n", 1 },
+	[400] = { "xpi", 3, "application/x-xpinstall", 23, "Content-Type: application/x-xpinstall\r\n", 0 },
+	[403] = { "wsrc", 4, "application/x-wais-source", 25, "Content-Type: application/x-wais-source\r\n", 0 },
+	[406] = { "crl", 3, "application/x-pkcs7-crl", 23, "Content-Type: application/x-pkcs7-crl\r\n", 0 },
+	[407] = { "sti", 3, "application/vnd.sun.xml.impress.template", 40, "Content-Type: application/vnd.sun.xml.impress.template\r\n", 0 },
+	[410] = { "pbm", 3, "image/x-portable-bitmap", 23, "Content-Type: image/x-portable-bitmap\r\n", 0 },
+	[413] = { "wbmp", 4, "image/vnd.wap.wbmp", 18, "Content-Type: image/vnd.wap.wbmp\r\n", 0 },
+	[414] = { "man", 3, "application/x-troff-man", 23, "Content-Type: application/x-troff-man\r\n", 0 },
+	[416] = { "taz", 3, "application/octet-stream", 24, "Content-Type: application/octet-stream\r\n", 0 },
+	[418] = { "dms", 3, "application/octet-stream", 24, "Content-Type: application/octet-stream\r\n", 0 },
+	[419] = { "mpga", 4, "audio/mpeg", 10, "Content-Type: audio/mpeg\r\n", 0 },
+	[421] = { "kar", 3, "audio/midi", 10, "Content-Type: audio/midi\r\n", 0 },
+	[424] = { "arj", 3, "application/octet-stream", 24, "Content-Type: application/octet-stream\r\n", 0 },
+	[427] = { "aam", 3, "application/x-authorware-map", 28, "Content-Type: application/x-authorware-map\r\n", 0 },
+	[428] = { "nc", 2, "application/x-netcdf", 20, "Content-Type: application/x-netcdf\r\n", 0 },
+	[432] = { "igs", 3, "model/iges", 10, "Content-Type: model/iges\r\n", 0 },
+	[434] = { "dcr", 3, "application/x-director", 22, "Content-Type: application/x-director\r\n", 0 },
+	[438] = { "mathml", 6, "application/mathml+xml", 22, "Content-Type: application/mathml+xml\r\n", 0 },
+	[440] = { "mpe", 3, "video/mpeg", 10, "Content-Type: video/mpeg\r\n", 0 },
+	[445] = { "sxg", 3, "application/vnd.sun.xml.writer.global", 37, "Content-Type: application/vnd.sun.xml.writer.global\r\n", 0 },
+	[447] = { "wmlc", 4, "application/vnd.wap.wmlc", 24, "Content-Type: application/vnd.wap.wmlc\r\n", 0 },
+	[448] = { "wm", 2, "video/x-ms-wm", 13, "Content-Type: video/x-ms-wm\r\n", 0 },
+	[452] = { "sgml", 4, "text/sgml; charset=%s", 21, "Content-Type: text/sgml; charset=%s\r\n", 1 },
+	[453] = { "iges", 4, "model/iges", 10, "Content-Type: model/iges\r\n", 0 },
+	[455] = { "sv4cpio", 7, "application/x-sv4cpio", 21, "Content-Type: application/x-sv4cpio\r\n", 0 },
+	[456] = { "webm", 4, "video/webm", 10, "Content-Type: video/webm\r\n", 0 },
+	[461] = { "silo", 4, "model/mesh", 10, "Content-Type: model/mesh\r\n", 0 },
+	[462] = { "aifc", 4, "audio/x-aiff", 12, "Content-Type: audio/x-aiff\r\n", 0 },
+	[465] = { "kml", 3, "application/vnd.google-earth.kml+xml", 36, "Content-Type: application/vnd.google-earth.kml+xml\r\n", 0 },
+	[466] = { "ief", 3, "image/ief", 9, "Content-Type: image/ief\r\n", 0 },
+	[468] = { "txt", 3, "text/plain; charset=%s", 22, "Content-Type: text/plain; charset=%s\r\n", 1 },
+	[469] = { "msh", 3, "model/mesh", 10, "Content-Type: model/mesh\r\n", 0 },
+	[475] = { "sig", 3, "application/pgp-signature", 25, "Content-Type: application/pgp-signature\r\n", 0 },
+	[476] = { "pdb", 3, "chemical/x-pdb", 14, "Content-Type: chemical/x-pdb\r\n", 0 },
+	[482] = { "wax", 3, "audio/x-ms-wax", 14, "Content-Type: audio/x-ms-wax\r\n", 0 },
+	[485] = { "7z", 2, "application/x-7z-compressed", 27, "Content-Type: application/x-7z-compressed\r\n", 0 },
+	[487] = { "fh5", 3, "image/x-freehand", 16, "Content-Type: image/x-freehand\r\n", 0 },
+	[488] = { "ogx", 3, "application/ogg", 15, "Content-Type: application/ogg\r\n", 0 },
+	[491] = { "aif", 3, "audio/x-aiff", 12, "Content-Type: audio/x-aiff\r\n", 0 },
+	[492] = { "mp4", 3, "video/mp4", 9, "Content-Type: video/mp4\r\n", 0 },
+	[493] = { "wmx", 3, "video/x-ms-wmx", 14, "Content-Type: video/x-ms-wmx\r\n", 0 },
+	[494] = { "fhc", 3, "image/x-freehand", 16, "Content-Type: image/x-freehand\r\n", 0 },
+	[497] = { "gtar", 4, "application/x-gtar", 18, "Content-Type: application/x-gtar\r\n", 0 },
+	[501] = { "xbm", 3, "image/x-xbitmap", 15, "Content-Type: image/x-xbitmap\r\n", 0 },
+	[504] = { "sxd", 3, "application/vnd.sun.xml.draw", 28, "Content-Type: application/vnd.sun.xml.draw\r\n", 0 },
+	[506] = { "mesh", 4, "model/mesh", 10, "Content-Type: model/mesh\r\n", 0 },
+	[509] = { "dvi", 3, "application/x-dvi", 17, "Content-Type: application/x-dvi\r\n", 0 },
+	[510] = { "tz", 2, "application/octet-stream", 24, "Content-Type: application/octet-stream\r\n", 0 },
+	[511] = { "ram", 3, "audio/x-pn-realaudio", 20, "Content-Type: audio/x-pn-realaudio\r\n", 0 },
+};
@@ -47,10 +47,19 @@
 # endif
 #endif
 #include <sys/mman.h>
+#ifdef HAVE_ZLIB_H
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD_H
+#include <zstd.h>
+#endif
 
 #include "file.h"
 #include "libhttpd.h"
+#include "md5.h"
+#include "metrics.h"
 #include "mmc.h"
+#include "probe.h"
 
 
 /* Defines. */
@@ -66,9 +75,49 @@
 #ifndef DESIRED_MAX_MAPPED_BYTES
 #define DESIRED_MAX_MAPPED_BYTES 1000000000
 #endif
+#ifndef DESIRED_MAX_GZIP_BYTES
+#define DESIRED_MAX_GZIP_BYTES (64 * 1024 * 1024)
+#endif
+#ifndef MAX_GZIP_FILE_SIZE	/* Compressed in one go, in the event loop, ~1 msec */
+#define MAX_GZIP_FILE_SIZE (128 * 1024)
+#endif
+#ifndef MIN_SENDFILE_SIZE
+#define MIN_SENDFILE_SIZE (64 * 1024)
+#endif
+#ifndef DESIRED_MAX_KEPT_FDS
+#define DESIRED_MAX_KEPT_FDS 100
+#endif
+#ifndef LISTING_CACHE_SIZE
+#define LISTING_CACHE_SIZE 1024
+#endif
+#ifndef LISTING_MAX_AGE
+#define LISTING_MAX_AGE 60
+#endif
+#ifndef MMC_WINDOW_THRESHOLD
+#define MMC_WINDOW_THRESHOLD (64 * 1024 * 1024)
+#endif
+#ifndef MMC_WINDOW_SIZE
+#define MMC_WINDOW_SIZE (4 * 1024 * 1024)
+#endif
+#ifndef MMC_WINDOWS
+#define MMC_WINDOWS 4
+#endif
+#ifndef MANIFEST_MAX_FILES
+#define MANIFEST_MAX_FILES 1000
+#endif
 #ifndef INITIAL_HASH_SIZE
 #define INITIAL_HASH_SIZE (1 << 10)
 #endif
+#ifndef HASH_MIGRATE
+#define HASH_MIGRATE 16
+#endif
+#ifndef PROTECTED_PERCENT
+#define PROTECTED_PERCENT 80
+#endif
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
 
 #ifndef MAX
 #define MAX(a,b) ((a)>(b)?(a):(b))
@@ -77,8 +126,24 @@
 #define MIN(a,b) ((a)<(b)?(a):(b))
 #endif
 
+/* A part of a large file, see mmc_window() */
+struct window {
+	void         *addr;
+	off_t         off;
+	size_t        len;
+	unsigned long used;
+};
+
+/* Segmented LRU, maps start out on probation and are promoted on reuse */
+enum {
+	PROBATION,
+	PROTECTED,
+	SEGMENTS
+};
+
 struct map {
-	struct map   *next;
+	struct map   *prev, *next;	/* LRU list of the segment, most recent first */
+	int           segment;
 
 	ino_t         ino;
 	dev_t         dev;
@@ -86,31 +151,94 @@ struct map {
 
 	void         *addr;
 	off_t         size;
+	int           fd;	/* Kept open for sendfile(), or -1 */
+	struct map   *fd_prev, *fd_next;	/* LRU list, most recent first */
 
 	int           refcount;
 	time_t        reftime;
+	long          hits;
+	char         *path;	/* For the manifest, see mmc_manifest_save() */
 
 	unsigned int  hash;
-	int           hash_idx;
+	struct map   *hnext;	/* Hash chain */
+
+	char          etag[64];	/* "hex", or W/"..." if windowed, lazily set */
+	char          lastmod[48];	/* Last-Modified: header, lazily set */
+	size_t        lastmod_len;
+	time_t        lastmod_time;
+
+	/* Compressed body, content-encoding: gzip or zstd, see mmc_compress() */
+	void         *gz_addr;
+	off_t         gz_size;
+	int           gz_type;
+	int           gz_level;
+	struct map   *gz_prev, *gz_next;	/* LRU list, most recent first */
+	char          gz_etag[2 * MD5_DIGEST_LENGTH + 8];
+
+	/* Rendered directory listing, see mmc_listing() */
+	char         *key;
+	time_t        mtime;
+	time_t        born;
+
+	/* Large file, addr is only a handle, the data is mapped in windows */
+	int           windowed;
+	struct window win[MMC_WINDOWS];
+
+	/* Derived from the contents, e.g. a parsed template, see mmc_attach() */
+	void         *data;
+	void        (*data_free)(void *);
+};
+
+struct lru {
+	struct map   *head, *tail;
+	off_t         bytes;
+	int           count;
 };
 
 /* Globals. */
-static struct map *maps = NULL;
+static struct lru lru[SEGMENTS];
 static struct map *free_maps = NULL;
 static int alloc_count = 0, map_count = 0, free_count = 0;
-static struct map **hash_table = NULL;
-static int hash_size;
+static struct map **hash_table = NULL, **old_table = NULL;
+static int hash_size, old_size, old_next;
 static unsigned int hash_mask;
-static time_t expire_age = DEFAULT_EXPIRE_AGE;
 static off_t mapped_bytes = 0;
+static off_t max_bytes = DESIRED_MAX_MAPPED_BYTES;
+static int max_files = DESIRED_MAX_MAPPED_FILES;
+static long map_hits = 0, map_misses = 0, map_evicts = 0;
+static struct map *gz_head = NULL, *gz_tail = NULL;
+static off_t gz_bytes = 0;
+static int gz_count = 0;
+static struct map *fd_head = NULL, *fd_tail = NULL;
+static int fd_count = 0, max_fds = DESIRED_MAX_KEPT_FDS;
+static long gz_hits = 0, gz_misses = 0, gz_evicts = 0;
+static struct map *ls_table[LISTING_CACHE_SIZE];
+static int ls_count = 0;
+static long ls_hits = 0, ls_misses = 0;
+static unsigned long win_used = 0;
+static long win_maps = 0;
+static char *warm_buf = NULL, *warm_next = NULL;
+static long warm_count = 0;
 
 /* Forwards. */
 static void panic(void);
-static void really_unmap(struct map **mm);
+static void really_unmap(struct map *m);
+static void lru_add(struct map *m, int segment);
+static void lru_touch(struct map *m);
+static void evict(off_t bytes, int files);
+static void account(void);
 static int check_hash_size(void);
-static int add_hash(struct map *m);
+static void add_hash(struct map *m);
+static void del_hash(struct map *m);
 static struct map *find_hash(ino_t ino, dev_t dev, off_t size, time_t ctime);
+static struct map *find_map(void *addr, struct stat *st);
+static void gz_release(struct map *m);
+static void fd_touch(struct map *m);
+static int fd_room(void);
+static void fd_release(struct map *m);
+static void win_release(struct map *m);
 static unsigned int hash(ino_t ino, dev_t dev, off_t size, time_t ctime);
+static unsigned int ls_hash(ino_t ino, dev_t dev, const char *key);
 
 #ifdef BUILTIN_ICONS
 #include "base64.h"
@@ -212,19 +340,20 @@ static off_t mmc_icon_open(char *filename, char **buf, struct stat *st)
 }
 #endif /* BUILTIN_ICONS */
 
-void *mmc_map(char *filename, struct stat *st, struct timeval *tv)
+void *mmc_map(char *filename, int fd, struct stat *st, struct timeval *tv)
 {
-	struct stat sb;
+	struct stat sb, fsb;
 	struct map *m;
 	time_t now;
 	char *buf = NULL;
-	int fd;
 
 	/* Stat the file, if necessary. */
 	if (!st) {
 		st = &sb;
-		if (stat(filename, &sb)) {
+		if (fd >= 0 ? fstat(fd, &sb) : stat(filename, &sb)) {
 			syslog(LOG_ERR, "stat: %s", strerror(errno));
+			if (fd >= 0)
+				close(fd);
 			return NULL;
 		}
 	}
@@ -238,20 +367,34 @@ void *mmc_map(char *filename, struct stat *st, struct timeval *tv)
 	/* See if we have it mapped already, via the hash table. */
 	if (check_hash_size() < 0) {
 		syslog(LOG_ERR, "check_hash_size() failure");
+		if (fd >= 0)
+			close(fd);
 		return NULL;
 	}
 
 	m = find_hash(st->st_ino, st->st_dev, st->st_size, st->st_ctime);
 	if (m) {
 		/* Yep.  Just return the existing map */
+		if (fd >= 0)
+			close(fd);
 		++m->refcount;
+		++m->hits;
 		m->reftime = now;
+		lru_touch(m);
+		fd_touch(m);
+		map_hits++;
+		METRIC_INC(METRIC_MMC_HITS);
+		PROBE2(mmc_hit, filename, st->st_size);
 
 		return m->addr;
 	}
+	map_misses++;
+	METRIC_INC(METRIC_MMC_MISSES);
+	PROBE2(mmc_miss, filename, st->st_size);
 
-	/* Open the file. */
-	fd = open(filename, O_RDONLY);
+	/* Open the file, unless the caller has. */
+	if (fd < 0)
+		fd = open(filename, O_RDONLY | O_CLOEXEC);
 	if (fd < 0) {
 		if (mmc_icon_open(filename, &buf, &sb)) {
 			syslog(LOG_ERR, "open: %s", strerror(errno));
@@ -259,6 +402,25 @@ void *mmc_map(char *filename, struct stat *st, struct timeval *tv)
 		}
 	}
 
+	/* The caller's stat info may be a few seconds old, from the stat
+	** cache, so make sure to map the size the file actually has now.
+	*/
+	if (fd >= 0 && !fstat(fd, &fsb) &&
+	    (fsb.st_ino != st->st_ino || fsb.st_size != st->st_size || fsb.st_ctime != st->st_ctime)) {
+		*st = fsb;
+		m = find_hash(st->st_ino, st->st_dev, st->st_size, st->st_ctime);
+		if (m) {
+			close(fd);
+			++m->refcount;
+			++m->hits;
+			m->reftime = now;
+			lru_touch(m);
+			fd_touch(m);
+
+			return m->addr;
+		}
+	}
+
 	/* Find a free map entry or make a new one. */
 	if (free_maps) {
 		m = free_maps;
@@ -283,6 +445,20 @@ void *mmc_map(char *filename, struct stat *st, struct timeval *tv)
 	m->ctime    = st->st_ctime;
 	m->refcount = 1;
 	m->reftime  = now;
+	m->hits     = 1;
+	m->fd       = -1;
+	m->fd_prev  = m->fd_next = NULL;
+	m->etag[0]  = 0;
+	m->lastmod[0] = 0;
+	m->gz_addr  = NULL;
+	m->gz_size  = 0;
+	m->gz_prev  = m->gz_next = NULL;
+	m->key      = NULL;
+	m->path     = NULL;
+	m->windowed = 0;
+	memset(m->win, 0, sizeof(m->win));
+	m->data     = NULL;
+	m->data_free = NULL;
 
 	/* Avoid doing anything for zero-length files; some systems don't like
 	** to mmap them, other systems dislike mallocing zero bytes.
@@ -290,8 +466,21 @@ void *mmc_map(char *filename, struct stat *st, struct timeval *tv)
 	if (m->size == 0) {
 		/* arbitrary non-NULL address */
 		m->addr = (void *)1;
+	} else if (!buf && m->size >= MMC_WINDOW_THRESHOLD) {
+		/* Too large to map in one piece, sent from the fd or read
+		** through windows mapped on demand.  The map itself is the
+		** handle, never dereferenced by callers.
+		*/
+		m->addr = m;
+		m->windowed = 1;
+		m->fd = fd;
+		(void)fd_room();	/* Needed for the windows, kept anyway */
+#ifdef POSIX_FADV_SEQUENTIAL
+		(void)posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+		goto cont;
 	} else {
-		size_t len = (size_t)m->size;	/* loses on files >2GB */
+		size_t len = (size_t)m->size;
 
 		if (buf) {
 			m->addr = malloc(len);
@@ -309,8 +498,8 @@ void *mmc_map(char *filename, struct stat *st, struct timeval *tv)
 		/* Map the file into memory. */
 		m->addr = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
 		if (m->addr == (void *)-1 && errno == ENOMEM) {
-			/* Ooo, out of address space.  Free all unreferenced maps
-			 ** and try again.
+			/* Ooo, out of address space.  Free the least recently
+			 ** used maps and try again.
 			 */
 			panic();
 			m->addr = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
@@ -325,49 +514,53 @@ void *mmc_map(char *filename, struct stat *st, struct timeval *tv)
 			return NULL;
 		}
 	}
-	close(fd);
+
+	/* Keep larger files open, for zero-copy sends from page cache, as
+	** many as the descriptors set aside for it with mmc_fd_limit()
+	*/
+	if (m->size >= MIN_SENDFILE_SIZE && !fd_room())
+		m->fd = fd;
+	else
+		close(fd);
 cont:
+	if (m->fd >= 0)
+		fd_touch(m);
+
 	/* Put the map into the hash table. */
-	if (add_hash(m) < 0) {
-		syslog(LOG_ERR, "add_hash() failure");
-		free(m);
-		--alloc_count;
+	add_hash(m);
 
-		return NULL;
-	}
+	/* Remembered for the manifest, not needed otherwise */
+	if (!buf)
+		m->path = strdup(filename);
 
-	/* Put the map on the active list. */
-	m->next = maps;
-	maps = m;
-	++map_count;
+	/* Update the total byte count, windows are counted as they are mapped */
+	if (!m->windowed)
+		mapped_bytes += m->size;
 
-	/* Update the total byte count. */
-	mapped_bytes += m->size;
+	/* Put the map on probation, making room for it if need be. */
+	lru_add(m, PROBATION);
+	++map_count;
+	account();
+	evict(max_bytes, max_files);
 
 	/* And return the address. */
 	return m->addr;
 }
 
-
-void mmc_unmap(void *addr, struct stat *st, struct timeval *tv)
+int mmc_mapped(struct stat *st)
 {
-	struct map *m = NULL;
+	if (!hash_table)
+		return 0;
 
-	/* Find the map entry for this address.  First try a hash. */
-	if (st) {
-		m = find_hash(st->st_ino, st->st_dev, st->st_size, st->st_ctime);
-		if (m && m->addr != addr)
-			m = NULL;
-	}
+	return find_hash(st->st_ino, st->st_dev, st->st_size, st->st_ctime) != NULL;
+}
 
-	/* If that didn't work, try a full search. */
-	if (!m) {
-		for (m = maps; m; m = m->next) {
-			if (m->addr == addr)
-				break;
-		}
-	}
 
+void mmc_unmap(void *addr, struct stat *st, struct timeval *tv)
+{
+	struct map *m;
+
+	m = find_map(addr, st);
 	if (!m) {
 		syslog(LOG_ERR, "mmc_unmap failed to find entry!");
 		return;
@@ -382,39 +575,673 @@ void mmc_unmap(void *addr, struct stat *st, struct timeval *tv)
 		m->reftime = tv->tv_sec;
 	else
 		m->reftime = time(NULL);
+
+	if (m->refcount > 0)
+		return;
+
+	/* Cheap to map again from page cache, give back the address space */
+	if (m->windowed)
+		win_release(m);
+
+	/* Over budget while everything was in use, catch up now */
+	if (mapped_bytes > max_bytes || map_count > max_files)
+		evict(max_bytes, max_files);
 }
 
 
-void mmc_cleanup(struct timeval *tv)
+int mmc_windowed(void *addr, struct stat *st)
+{
+	struct map *m;
+
+	m = find_map(addr, st);
+
+	return m && m->windowed && m->addr == addr;
+}
+
+
+void *mmc_window(void *addr, struct stat *st, off_t off, size_t *len)
+{
+	struct window *w, *lru;
+	struct map *m;
+	off_t start;
+	int i;
+
+	m = find_map(addr, st);
+	if (!m || !m->windowed || m->addr != addr)
+		return (char *)addr + off;
+
+	if (off >= m->size)
+		return NULL;
+
+	start = off - off % MMC_WINDOW_SIZE;
+	lru = &m->win[0];
+	for (i = 0; i < MMC_WINDOWS; i++) {
+		w = &m->win[i];
+		if (w->addr && w->off == start)
+			goto done;
+		if (!w->addr || (lru->addr && w->used < lru->used))
+			lru = w;
+	}
+
+	/* Map the window, replacing the least recently used one */
+	w = lru;
+	if (w->addr) {
+		munmap(w->addr, w->len);
+		mapped_bytes -= w->len;
+	}
+
+	w->off = start;
+	w->len = (size_t)MIN(m->size - start, MMC_WINDOW_SIZE);
+	w->addr = mmap(NULL, w->len, PROT_READ, MAP_PRIVATE, m->fd, w->off);
+	if (w->addr == (void *)-1 && errno == ENOMEM) {
+		panic();
+		w->addr = mmap(NULL, w->len, PROT_READ, MAP_PRIVATE, m->fd, w->off);
+	}
+	if (w->addr == (void *)-1) {
+		syslog(LOG_ERR, "mmap window: %s", strerror(errno));
+		w->addr = NULL;
+		return NULL;
+	}
+
+	/* Sent front to back, start reading ahead now */
+	(void)madvise(w->addr, w->len, MADV_SEQUENTIAL);
+	(void)madvise(w->addr, w->len, MADV_WILLNEED);
+	mapped_bytes += w->len;
+	win_maps++;
+	account();
+done:
+	w->used = ++win_used;
+	*len = MIN(*len, w->len - (size_t)(off - w->off));
+
+	return (char *)w->addr + (off - w->off);
+}
+
+
+const char *mmc_etag(void *addr, struct stat *st)
+{
+	static const char hex[] = "0123456789abcdef";
+	u_int8_t dig[MD5_DIGEST_LENGTH];
+	struct map *m;
+	MD5_CTX ctx;
+	size_t i;
+	char *p;
+
+	m = find_map(addr, st);
+	if (!m)
+		return NULL;
+
+	/* Already computed for this mapping, the common case. */
+	if (m->etag[0])
+		goto done;
+
+	/* Reading all of a large file would stall the event loop, use
+	** the same weak tag as etag = weak, from the stat() info.
+	*/
+	if (m->windowed) {
+		snprintf(m->etag, sizeof(m->etag), "W/\"%jx-%jx-%jx\"",
+			 (uintmax_t)st->st_ino, (uintmax_t)st->st_size,
+			 (uintmax_t)st->st_mtime);
+		goto done;
+	}
+
+	MD5Init(&ctx);
+	if (m->size > 0)
+		MD5Update(&ctx, (const u_int8_t *)m->addr, m->size);
+	MD5Final(dig, &ctx);
+
+	p = m->etag;
+	*p++ = '"';
+	for (i = 0; i < sizeof(dig); i++) {
+		*p++ = hex[dig[i] >> 4];
+		*p++ = hex[dig[i] & 0x0f];
+	}
+	*p++ = '"';
+	*p   = 0;
+done:
+	/* The compressed variant is a different representation */
+	if (m->gz_addr && addr == m->gz_addr) {
+		if (!m->gz_etag[0])
+			snprintf(m->gz_etag, sizeof(m->gz_etag), "%.*s-%s\"",
+				 (int)strlen(m->etag) - 1, m->etag,
+				 m->gz_type == COMPRESSION_ZSTD ? "zstd" : "gzip");
+		return m->gz_etag;
+	}
+
+	return m->etag;
+}
+
+
+const char *mmc_lastmod(void *addr, struct stat *st, size_t *lenP)
 {
-	struct map **mm;
+	struct map *m;
+
+	m = find_map(addr, st);
+	if (!m)
+		return NULL;
+
+	/* Listings report the newest of their entries, may differ per hit */
+	if (!m->lastmod[0] || m->lastmod_time != st->st_mtime) {
+		m->lastmod_time = st->st_mtime;
+		m->lastmod_len  = strftime(m->lastmod, sizeof(m->lastmod),
+					   "Last-Modified: %a, %d %b %Y %H:%M:%S GMT\r\n",
+					   gmtime(&m->lastmod_time));
+		if (!m->lastmod_len)
+			return NULL;
+	}
+
+	*lenP = m->lastmod_len;
+	return m->lastmod;
+}
+
+
+void *mmc_attached(void *addr, struct stat *st)
+{
+	struct map *m;
+
+	m = find_map(addr, st);
+	if (!m)
+		return NULL;
+
+	return m->data;
+}
+
+
+int mmc_attach(void *addr, struct stat *st, void *data, void (*release)(void *))
+{
+	struct map *m;
+
+	m = find_map(addr, st);
+	if (!m)
+		return -1;
+
+	if (m->data && m->data_free)
+		m->data_free(m->data);
+	m->data = data;
+	m->data_free = release;
+
+	return 0;
+}
+
+
+#ifdef HAVE_ZLIB_H
+/* Move to, or insert at, the head of the LRU list */
+static void gz_touch(struct map *m)
+{
+	if (gz_head == m)
+		return;
+
+	/* Unlink, if already on the list */
+	if (m->gz_prev)
+		m->gz_prev->gz_next = m->gz_next;
+	if (m->gz_next)
+		m->gz_next->gz_prev = m->gz_prev;
+	if (gz_tail == m)
+		gz_tail = m->gz_prev;
+
+	m->gz_prev = NULL;
+	m->gz_next = gz_head;
+	if (gz_head)
+		gz_head->gz_prev = m;
+	gz_head = m;
+	if (!gz_tail)
+		gz_tail = m;
+}
+
+/* Drop least recently used compressed bodies no longer referenced */
+static void gz_evict(void)
+{
+	struct map *m, *prev;
+
+	for (m = gz_tail; m && gz_bytes > DESIRED_MAX_GZIP_BYTES; m = prev) {
+		prev = m->gz_prev;
+		if (m->refcount > 0)
+			continue;
+
+		gz_release(m);
+		gz_evicts++;
+	}
+}
+
+#ifdef HAVE_ZSTD
+/* One-shot compress of the whole file into a zstd frame */
+static int zs_compress(struct map *m, int level)
+{
+	uint64_t cpu;
+	size_t len;
+	void *buf;
+
+	len = ZSTD_compressBound(m->size);
+	buf = malloc(len);
+	if (!buf) {
+		syslog(LOG_ERR, "out of memory allocating zstd cache entry");
+		return -1;
+	}
+
+	cpu = metrics_cpu();
+	len = ZSTD_compress(buf, len, m->addr, m->size, ZSTD_LEVEL(level));
+	METRIC_ADD(METRIC_GZIP_USEC, metrics_cpu() - cpu);
+	if (ZSTD_isError(len)) {
+		syslog(LOG_ERR, "ZSTD_compress() failed: %s", ZSTD_getErrorName(len));
+		free(buf);
+		return -1;
+	}
+
+	m->gz_addr    = buf;
+	m->gz_size    = len;
+	m->gz_type    = COMPRESSION_ZSTD;
+	m->gz_level   = level;
+	m->gz_etag[0] = 0;
+
+	gz_bytes += m->gz_size;
+	gz_count++;
+
+	return 0;
+}
+#endif /* HAVE_ZSTD */
+
+/* One-shot compress of the whole file, with a gzip header and trailer */
+static int gz_compress(struct map *m, int type, int level)
+{
+	z_stream zs;
+	uint64_t cpu;
+	uLong len;
+	void *buf;
+	int rc;
+
+#ifdef HAVE_ZSTD
+	if (type == COMPRESSION_ZSTD)
+		return zs_compress(m, level);
+#endif
+	if (type != COMPRESSION_GZIP)
+		return -1;
+
+	memset(&zs, 0, sizeof(zs));
+	if (deflateInit2(&zs, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return -1;
+
+	len = deflateBound(&zs, m->size) + 18;
+	buf = malloc(len);
+	if (!buf) {
+		syslog(LOG_ERR, "out of memory allocating gzip cache entry");
+		deflateEnd(&zs);
+		return -1;
+	}
+
+	zs.next_in   = (Bytef *)m->addr;
+	zs.avail_in  = m->size;
+	zs.next_out  = buf;
+	zs.avail_out = len;
+	cpu = metrics_cpu();
+	rc = deflate(&zs, Z_FINISH);
+	METRIC_ADD(METRIC_GZIP_USEC, metrics_cpu() - cpu);
+	if (rc != Z_STREAM_END) {
+		syslog(LOG_ERR, "zlib deflate() failed: %s", zs.msg ? zs.msg : "unknown error");
+		deflateEnd(&zs);
+		free(buf);
+		return -1;
+	}
+
+	m->gz_addr    = buf;
+	m->gz_size    = zs.total_out;
+	m->gz_type    = COMPRESSION_GZIP;
+	m->gz_level   = level;
+	m->gz_etag[0] = 0;
+	deflateEnd(&zs);
+
+	gz_bytes += m->gz_size;
+	gz_count++;
+
+	return 0;
+}
+#endif /* HAVE_ZLIB_H */
+
+
+int mmc_fd(void *addr, struct stat *st)
+{
+	struct map *m;
+
+	m = find_map(addr, st);
+	if (!m || m->addr != addr)
+		return -1;
+
+	return m->fd;
+}
+
+
+void *mmc_compress(void *addr, struct stat *st, int type, int level, off_t *len)
+{
+#ifdef HAVE_ZLIB_H
+	struct map *m;
+
+	m = find_map(addr, st);
+	if (!m || m->size <= 0 || m->size > MAX_GZIP_FILE_SIZE)
+		return NULL;
+
+	/* Other encoding, or level changed on reload, redo unless still in use */
+	if (m->gz_addr && (m->gz_type != type || m->gz_level != level)) {
+		if (m->refcount > 1)
+			return NULL;
+		gz_release(m);
+	}
+
+	if (m->gz_addr) {
+		gz_hits++;
+	} else {
+		gz_misses++;
+		if (gz_compress(m, type, level))
+			return NULL;
+	}
+
+	gz_touch(m);
+	if (gz_bytes > DESIRED_MAX_GZIP_BYTES)
+		gz_evict();
+
+	*len = m->gz_size;
+	return m->gz_addr;
+#else
+	return NULL;
+#endif
+}
+
+
+void *mmc_listing(struct stat *st, const char *key, struct timeval *tv)
+{
+	unsigned int h;
 	struct map *m;
 	time_t now;
 
-	/* Get the current time, if necessary. */
 	if (tv)
 		now = tv->tv_sec;
 	else
 		now = time(NULL);
 
-	/* Really unmap any unreferenced entries older than the age limit. */
-	for (mm = &maps; *mm;) {
-		m = *mm;
-		if (m->refcount == 0 && now - m->reftime >= expire_age)
-			really_unmap(mm);
+	/* Any change to the directory itself moves its ctime */
+	h = ls_hash(st->st_ino, st->st_dev, key);
+	m = ls_table[h];
+	if (!m || m->ino != st->st_ino || m->dev != st->st_dev || m->ctime != st->st_ctime || strcmp(m->key, key)) {
+		ls_misses++;
+		return NULL;
+	}
+
+	/* Entries can change size without touching the directory, re-render now and then */
+	if (now - m->born >= LISTING_MAX_AGE) {
+		ls_table[h] = NULL;
+		ls_count--;
+		if (m->refcount == 0)
+			m->reftime = 0;	/* reap on next mmc_cleanup() */
+		ls_misses++;
+		return NULL;
+	}
+
+	++m->refcount;
+	m->reftime = now;
+	lru_touch(m);
+	ls_hits++;
+
+	st->st_size  = m->size;
+	st->st_mtime = m->mtime;
+
+	return m->addr;
+}
+
+
+void *mmc_listing_add(struct stat *st, const char *key, void *buf, off_t len, time_t mtime, struct timeval *tv)
+{
+	struct map *m, *old;
+	unsigned int h;
+	time_t now;
+
+	if (tv)
+		now = tv->tv_sec;
+	else
+		now = time(NULL);
+
+	if (len <= 0 || check_hash_size() < 0)
+		goto fail;
+
+	if (free_maps) {
+		m = free_maps;
+		free_maps = m->next;
+		--free_count;
+	} else {
+		m = malloc(sizeof(struct map));
+		if (!m) {
+			syslog(LOG_ERR, "out of memory allocating a struct map");
+			goto fail;
+		}
+		++alloc_count;
+	}
+
+	m->key = strdup(key);
+	if (!m->key) {
+		syslog(LOG_ERR, "out of memory allocating a listing key");
+		free(m);
+		--alloc_count;
+		goto fail;
+	}
+
+	m->ino      = st->st_ino;
+	m->dev      = st->st_dev;
+	m->size     = len;
+	m->ctime    = st->st_ctime;
+	m->mtime    = mtime;
+	m->born     = now;
+	m->addr     = buf;
+	m->fd       = -1;
+	m->refcount = 1;
+	m->reftime  = now;
+	m->hits     = 1;
+	m->path     = NULL;
+	m->etag[0]  = 0;
+	m->lastmod[0] = 0;
+	m->gz_addr  = NULL;
+	m->gz_size  = 0;
+	m->gz_prev  = m->gz_next = NULL;
+	m->windowed = 0;
+	m->data     = NULL;
+	m->data_free = NULL;
+
+	add_hash(m);
+	mapped_bytes += m->size;
+	lru_add(m, PROBATION);
+	++map_count;
+	account();
+
+	/* Replace any older rendering, unused ones are reaped on next cleanup */
+	h = ls_hash(m->ino, m->dev, key);
+	old = ls_table[h];
+	if (old) {
+		if (old->refcount == 0)
+			old->reftime = 0;
+	} else
+		ls_count++;
+	ls_table[h] = m;
+
+	st->st_size  = m->size;
+	st->st_mtime = m->mtime;
+	evict(max_bytes, max_files);
+
+	return m->addr;
+fail:
+	free(buf);
+	return NULL;
+}
+
+
+/* Most used first, then most recently used */
+static int manifest_cmp(const void *a, const void *b)
+{
+	const struct map *x = *(const struct map **)a;
+	const struct map *y = *(const struct map **)b;
+
+	if (x->hits != y->hits)
+		return x->hits < y->hits ? 1 : -1;
+	if (x->reftime != y->reftime)
+		return x->reftime < y->reftime ? 1 : -1;
+
+	return 0;
+}
+
+int mmc_manifest_save(int fd)
+{
+	struct map **list, *m;
+	int i, seg, num = 0;
+	FILE *fp;
+
+	list = calloc(map_count + 1, sizeof(struct map *));
+	if (!list)
+		return -1;
+
+	for (seg = 0; seg < SEGMENTS; seg++) {
+		for (m = lru[seg].head; m; m = m->next) {
+			if (m->path && !strchr(m->path, '\n'))
+				list[num++] = m;
+		}
+	}
+	qsort(list, num, sizeof(struct map *), manifest_cmp);
+
+	/* Rewritten in place, the file may be outside a chroot */
+	fd = dup(fd);
+	if (fd < 0 || ftruncate(fd, 0) || lseek(fd, 0, SEEK_SET)) {
+		if (fd >= 0)
+			close(fd);
+		free(list);
+		return -1;
+	}
+
+	fp = fdopen(fd, "w");
+	if (!fp) {
+		close(fd);
+		free(list);
+		return -1;
+	}
+
+	for (i = 0; i < num && i < MANIFEST_MAX_FILES; i++)
+		fprintf(fp, "%s\n", list[i]->path);
+	free(list);
+
+	return fclose(fp) ? -1 : 0;
+}
+
+int mmc_manifest_load(int fd)
+{
+	struct stat st;
+	char *ptr;
+	ssize_t len;
+
+	if (fstat(fd, &st) || st.st_size <= 0)
+		return 0;
+
+	free(warm_buf);
+	warm_buf = malloc(st.st_size + 1);
+	if (!warm_buf)
+		return -1;
+
+	len = pread(fd, warm_buf, st.st_size, 0);
+	if (len < 0) {
+		free(warm_buf);
+		warm_buf = NULL;
+		return -1;
+	}
+	warm_buf[len] = 0;
+	warm_next = warm_buf;
+
+	warm_count = 0;
+	for (ptr = warm_buf; (ptr = strchr(ptr, '\n')); ptr++)
+		warm_count++;
+
+	return warm_count;
+}
+
+int mmc_warmup(int max, struct timeval *tv)
+{
+	struct stat st;
+	char *path, *ptr;
+	void *addr;
+
+	while (warm_next && max-- > 0) {
+		path = warm_next;
+		ptr = strchr(path, '\n');
+		if (!ptr) {
+			warm_next = NULL;
+			break;
+		}
+		*ptr = 0;
+		warm_next = ptr + 1;
+		warm_count--;
+
+		/* Gone, or changed to something else, since it was saved */
+		if (stat(path, &st) || !S_ISREG(st.st_mode) || st.st_size == 0)
+			continue;
+
+		addr = mmc_map(path, -1, &st, tv);
+		if (!addr)
+			continue;
+
+		/* Start read-ahead, without waiting for it.  Windows are
+		** not kept unused, so only the page cache is warmed.
+		*/
+		if (!mmc_windowed(addr, &st))
+			(void)madvise(addr, st.st_size, MADV_WILLNEED);
+#ifdef POSIX_FADV_WILLNEED
 		else
-			mm = &(*mm)->next;
+			(void)posix_fadvise(mmc_fd(addr, &st), 0, MMC_WINDOW_SIZE, POSIX_FADV_WILLNEED);
+#endif
+		mmc_unmap(addr, &st, tv);
 	}
 
-	/* Adjust the age limit if there are too many bytes mapped, or
-	 ** too many or too few files mapped.
-	 */
-	if (mapped_bytes > DESIRED_MAX_MAPPED_BYTES)
-		expire_age = MAX((expire_age * 2) / 3, DEFAULT_EXPIRE_AGE / 10);
-	else if (map_count > DESIRED_MAX_MAPPED_FILES)
-		expire_age = MAX((expire_age * 2) / 3, DEFAULT_EXPIRE_AGE / 10);
-	else if (map_count < DESIRED_MAX_MAPPED_FILES / 2)
-		expire_age = MIN((expire_age * 5) / 4, DEFAULT_EXPIRE_AGE * 3);
+	if (!warm_next || !*warm_next) {
+		free(warm_buf);
+		warm_buf = warm_next = NULL;
+		warm_count = 0;
+	}
+
+	return warm_count;
+}
+
+
+void mmc_limits(off_t bytes, int files)
+{
+	if (bytes > 0)
+		max_bytes = bytes;
+	if (files > 0)
+		max_files = files;
+}
+
+void mmc_fd_limit(int fds)
+{
+	max_fds = fds > 0 ? fds : 0;
+}
+
+
+void mmc_cleanup(struct timeval *tv)
+{
+	struct map *m, *prev;
+	time_t now;
+	int seg;
+
+	/* Get the current time, if necessary. */
+	if (tv)
+		now = tv->tv_sec;
+	else
+		now = time(NULL);
+
+	/* Really unmap any unreferenced entries older than the age limit,
+	** they still hold a descriptor and address space.
+	*/
+	for (seg = 0; seg < SEGMENTS; seg++) {
+		for (m = lru[seg].tail; m; m = prev) {
+			prev = m->prev;
+			if (m->refcount == 0 && now - m->reftime >= DEFAULT_EXPIRE_AGE) {
+				really_unmap(m);
+				map_evicts++;
+				METRIC_INC(METRIC_MMC_EVICTS);
+			}
+		}
+	}
+
+	/* Back within budget, in case maps in use kept us above it. */
+	evict(max_bytes, max_files);
 
 	/* Really free excess blocks on the free list. */
 	while (free_count > DESIRED_FREE_COUNT) {
@@ -429,58 +1256,175 @@ void mmc_cleanup(struct timeval *tv)
 
 static void panic(void)
 {
-	struct map **mm;
-	struct map *m;
+	syslog(LOG_ERR, "mmc panic - freeing least recently used maps");
 
-	syslog(LOG_ERR, "mmc panic - freeing all unreferenced maps");
+	/* Give back at least half the address space, if unreferenced. */
+	evict(mapped_bytes / 2, map_count);
+}
 
-	/* Really unmap all unreferenced entries. */
-	for (mm = &maps; *mm;) {
-		m = *mm;
-		if (m->refcount == 0)
-			really_unmap(mm);
-		else
-			mm = &(*mm)->next;
+
+/* Bytes a map holds on its segment, windows come and go with use */
+static off_t lru_cost(struct map *m)
+{
+	return m->windowed ? 0 : m->size;
+}
+
+/* Insert at the head, most recently used, of a segment */
+static void lru_add(struct map *m, int segment)
+{
+	struct lru *l = &lru[segment];
+
+	m->segment = segment;
+	m->prev = NULL;
+	m->next = l->head;
+	if (l->head)
+		l->head->prev = m;
+	l->head = m;
+	if (!l->tail)
+		l->tail = m;
+
+	l->bytes += lru_cost(m);
+	l->count++;
+}
+
+static void lru_del(struct map *m)
+{
+	struct lru *l = &lru[m->segment];
+
+	if (m->prev)
+		m->prev->next = m->next;
+	else
+		l->head = m->next;
+	if (m->next)
+		m->next->prev = m->prev;
+	else
+		l->tail = m->prev;
+	m->prev = m->next = NULL;
+
+	l->bytes -= lru_cost(m);
+	l->count--;
+}
+
+/* Reused, move to the head of the protected segment.  Maps falling
+** off its tail, when it grows over its share of the byte budget, get
+** another chance on probation.  So a sweep of once-used files, e.g.
+** a crawler, only ever churns the probation segment.
+*/
+static void lru_touch(struct map *m)
+{
+	struct lru *l = &lru[PROTECTED];
+	off_t limit = max_bytes / 100 * PROTECTED_PERCENT;
+	struct map *old;
+
+	if (l->head == m)
+		return;
+
+	lru_del(m);
+	lru_add(m, PROTECTED);
+
+	while (l->bytes > limit && l->tail != m) {
+		old = l->tail;
+		lru_del(old);
+		lru_add(old, PROBATION);
 	}
 }
 
+/* Release unreferenced maps, least recently used first, probation
+** before protected, until no more than bytes are mapped in files maps.
+*/
+static void evict(off_t bytes, int files)
+{
+	struct map *m, *prev;
+	int seg;
+
+	for (seg = PROBATION; seg < SEGMENTS; seg++) {
+		for (m = lru[seg].tail; m; m = prev) {
+			if (mapped_bytes <= bytes && map_count <= files)
+				return;
 
-static void really_unmap(struct map **mm)
+			prev = m->prev;
+			if (m->refcount > 0)
+				continue;
+
+			really_unmap(m);
+			map_evicts++;
+			METRIC_INC(METRIC_MMC_EVICTS);
+		}
+	}
+}
+
+/* Size of the cache, for the status page */
+static void account(void)
 {
-	struct map *m;
+	METRIC_SET(METRIC_MMC_BYTES, mapped_bytes);
+	METRIC_SET(METRIC_MMC_MAPS, map_count);
+}
+
+
+static void really_unmap(struct map *m)
+{
+	if (m->gz_addr)
+		gz_release(m);
+
+	if (m->data) {
+		if (m->data_free)
+			m->data_free(m->data);
+		m->data = NULL;
+	}
+
+	if (m->fd >= 0)
+		fd_release(m);
 
-	m = *mm;
-	if (m->size > 0) {
-		if (!m->ino)
-			/* Only real files have an inode, free built-in icon data */
+	/* Off the LRU and hash before the size changes meaning */
+	lru_del(m);
+	del_hash(m);
+
+	if (m->windowed) {
+		win_release(m);
+		m->windowed = 0;
+	} else if (m->size > 0) {
+		if (!m->ino || m->key)
+			/* Only real files are mapped, free icon and listing data */
 			free(m->addr);
 		else if (-1 == munmap(m->addr, m->size))
 			syslog(LOG_ERR, "munmap(): %s", strerror(errno));
+		mapped_bytes -= m->size;
+	}
+
+	if (m->path) {
+		free(m->path);
+		m->path = NULL;
 	}
 
-	/* Update the total byte count. */
-	mapped_bytes -= m->size;
+	if (m->key) {
+		unsigned int h = ls_hash(m->ino, m->dev, m->key);
+
+		if (ls_table[h] == m) {
+			ls_table[h] = NULL;
+			ls_count--;
+		}
+		free(m->key);
+		m->key = NULL;
+	}
 
 	/* And move the map to the free list. */
-	*mm = m->next;
 	--map_count;
 	m->next = free_maps;
 	free_maps = m;
 	++free_count;
-
-	/* This will sometimes break hash chains, but that's harmless; the
-	 ** unmapping code that searches the hash table knows to keep searching.
-	 */
-	hash_table[m->hash_idx] = NULL;
+	account();
 }
 
 
 void mmc_destroy(void)
 {
 	struct map *m;
+	int seg;
 
-	while (maps)
-		really_unmap(&maps);
+	for (seg = 0; seg < SEGMENTS; seg++) {
+		while (lru[seg].head)
+			really_unmap(lru[seg].head);
+	}
 
 	while (free_maps) {
 		m         = free_maps;
@@ -492,97 +1436,272 @@ void mmc_destroy(void)
 		free(m);
 	}
 
-	if (hash_table)
-		free(hash_table);
+	free(old_table);
+	old_table = NULL;
+	free(hash_table);
+	hash_table = NULL;
 }
 
 
-/* Make sure the hash table is big enough. */
-static int check_hash_size(void)
+/* Move a few chains from the old table, when growing.  Spread out over
+** lookups, so no single request pays for rehashing the whole cache.
+*/
+static void migrate(int buckets)
 {
 	struct map *m;
-	int i;
+	unsigned int i;
 
-	/* At least three times bigger than the number of entries? */
-	if (hash_table && hash_size >= map_count * 3)
-		return 0;
+	while (old_table && buckets-- > 0) {
+		while ((m = old_table[old_next])) {
+			old_table[old_next] = m->hnext;
+
+			i = m->hash & hash_mask;
+			m->hnext = hash_table[i];
+			hash_table[i] = m;
+		}
+
+		if (++old_next == old_size) {
+			free(old_table);
+			old_table = NULL;
+		}
+	}
+}
+
+/* Make sure the hash table is big enough. */
+static int check_hash_size(void)
+{
+	struct map **table;
 
 	/* Are we just starting out? */
 	if (!hash_table) {
-		hash_size = INITIAL_HASH_SIZE;
-		hash_mask = hash_size - 1;
-	} else {
-		/* No, got to expand. */
-		free(hash_table);
-
-		/* Double the hash size until it's big enough. */
-		while (hash_size < map_count * 6)
-			hash_size = hash_size << 1;
+		hash_table = calloc(INITIAL_HASH_SIZE, sizeof(struct map *));
+		if (!hash_table)
+			return -1;
 
+		hash_size = INITIAL_HASH_SIZE;
 		hash_mask = hash_size - 1;
+		return 0;
 	}
 
-	/* Make the new table. */
-	hash_table = malloc(hash_size * sizeof(struct map *));
-	if (!hash_table)
-		return -1;
+	/* Grow to twice the size when the chains get long, unless still
+	** moving over from the last time.  Lookups check both tables until
+	** all chains of the old one are moved.
+	*/
+	if (!old_table && map_count > hash_size) {
+		table = calloc(hash_size * 2, sizeof(struct map *));
+		if (!table) {
+			/* Longer chains, still works */
+			syslog(LOG_ERR, "out of memory growing mmc hash table");
+			return 0;
+		}
 
-	/* Clear it. */
-	for (i = 0; i < hash_size; ++i)
-		hash_table[i] = NULL;
+		old_table = hash_table;
+		old_size  = hash_size;
+		old_next  = 0;
 
-	/* And rehash all entries. */
-	for (m = maps; m; m = m->next) {
-		if (add_hash(m) < 0)
-			return -1;
+		hash_table = table;
+		hash_size *= 2;
+		hash_mask  = hash_size - 1;
 	}
 
+	migrate(HASH_MIGRATE);
+
 	return 0;
 }
 
 
-static int add_hash(struct map *m)
+static void add_hash(struct map *m)
 {
-	unsigned int h, he, i;
+	unsigned int i;
 
-	h = hash(m->ino, m->dev, m->size, m->ctime);
-	he = (h + hash_size - 1) & hash_mask;
-	for (i = h;; i = (i + 1) & hash_mask) {
-		if (!hash_table[i]) {
-			hash_table[i] = m;
-			m->hash = h;
-			m->hash_idx = i;
-			return 0;
-		}
+	m->hash = hash(m->ino, m->dev, m->size, m->ctime);
+	i = m->hash & hash_mask;
+	m->hnext = hash_table[i];
+	hash_table[i] = m;
+}
 
-		if (i == he)
-			break;
+
+static void del_hash(struct map *m)
+{
+	struct map **mm;
+
+	if (old_table) {
+		for (mm = &old_table[m->hash & (old_size - 1)]; *mm; mm = &(*mm)->hnext) {
+			if (*mm == m) {
+				*mm = m->hnext;
+				return;
+			}
+		}
 	}
 
-	return -1;
+	for (mm = &hash_table[m->hash & hash_mask]; *mm; mm = &(*mm)->hnext) {
+		if (*mm == m) {
+			*mm = m->hnext;
+			return;
+		}
+	}
 }
 
 
+static struct map *find_chain(struct map *m, unsigned int h, ino_t ino, dev_t dev, off_t size, time_t ctime)
+{
+	for (; m; m = m->hnext) {
+		if (m->hash == h && m->ino == ino && m->dev == dev && m->size == size && m->ctime == ctime)
+			return m;
+	}
+
+	return NULL;
+}
+
 static struct map *find_hash(ino_t ino, dev_t dev, off_t size, time_t ctime)
 {
-	unsigned int h, he, i;
+	unsigned int h;
 	struct map *m;
 
 	h = hash(ino, dev, size, ctime);
-	he = (h + hash_size - 1) & hash_mask;
-	for (i = h;; i = (i + 1) & hash_mask) {
-		m = hash_table[i];
-		if (!m)
-			break;
-
-		if (m->hash == h && m->ino == ino && m->dev == dev && m->size == size && m->ctime == ctime)
+	if (old_table) {
+		m = find_chain(old_table[h & (old_size - 1)], h, ino, dev, size, ctime);
+		if (m)
 			return m;
+	}
 
-		if (i == he)
-			break;
+	return find_chain(hash_table[h & hash_mask], h, ino, dev, size, ctime);
+}
+
+
+/* Find the map entry for this address.  First try a hash, then a full search. */
+static struct map *find_map(void *addr, struct stat *st)
+{
+	struct map *m = NULL;
+	int seg;
+
+	if (st)
+		m = find_hash(st->st_ino, st->st_dev, st->st_size, st->st_ctime);
+
+	if (m && m->addr != addr && m->gz_addr != addr)
+		m = NULL;
+
+	for (seg = 0; !m && seg < SEGMENTS; seg++) {
+		for (m = lru[seg].head; m; m = m->next) {
+			if (m->addr == addr || (m->gz_addr && m->gz_addr == addr))
+				break;
+		}
 	}
 
-	return NULL;
+	return m;
+}
+
+
+/* Move to, or insert at, the head of the LRU list of kept descriptors */
+static void fd_touch(struct map *m)
+{
+	if (m->fd < 0 || fd_head == m)
+		return;
+
+	if (m->fd_prev || m->fd_next || fd_tail == m) {
+		if (m->fd_prev)
+			m->fd_prev->fd_next = m->fd_next;
+		if (m->fd_next)
+			m->fd_next->fd_prev = m->fd_prev;
+		if (fd_tail == m)
+			fd_tail = m->fd_prev;
+	} else
+		fd_count++;
+
+	m->fd_prev = NULL;
+	m->fd_next = fd_head;
+	if (fd_head)
+		fd_head->fd_prev = m;
+	fd_head = m;
+	if (!fd_tail)
+		fd_tail = m;
+}
+
+/* Make room for one more kept descriptor, closing the least recently
+** used ones not in use.  Windowed maps cannot do without theirs, they
+** are released whole.  Returns 0 if there is room.
+*/
+static int fd_room(void)
+{
+	struct map *m, *prev;
+
+	for (m = fd_tail; m && fd_count >= max_fds; m = prev) {
+		prev = m->fd_prev;
+		if (m->refcount > 0)
+			continue;
+
+		if (m->windowed) {
+			really_unmap(m);
+			map_evicts++;
+			METRIC_INC(METRIC_MMC_EVICTS);
+		} else
+			fd_release(m);
+	}
+
+	return fd_count < max_fds ? 0 : -1;
+}
+
+/* Close kept descriptor and unlink from LRU list */
+static void fd_release(struct map *m)
+{
+	if (m->fd < 0)
+		return;
+
+	if (m->fd_prev)
+		m->fd_prev->fd_next = m->fd_next;
+	else if (fd_head == m)
+		fd_head = m->fd_next;
+	if (m->fd_next)
+		m->fd_next->fd_prev = m->fd_prev;
+	else if (fd_tail == m)
+		fd_tail = m->fd_prev;
+	m->fd_prev = m->fd_next = NULL;
+	fd_count--;
+
+	close(m->fd);
+	m->fd = -1;
+}
+
+/* Free compressed body and unlink from LRU list */
+static void gz_release(struct map *m)
+{
+	if (!m->gz_addr)
+		return;
+
+	if (m->gz_prev)
+		m->gz_prev->gz_next = m->gz_next;
+	else if (gz_head == m)
+		gz_head = m->gz_next;
+	if (m->gz_next)
+		m->gz_next->gz_prev = m->gz_prev;
+	else if (gz_tail == m)
+		gz_tail = m->gz_prev;
+	m->gz_prev = m->gz_next = NULL;
+
+	gz_bytes -= m->gz_size;
+	gz_count--;
+
+	free(m->gz_addr);
+	m->gz_addr = NULL;
+	m->gz_size = 0;
+}
+
+
+/* Unmap all windows of a large file */
+static void win_release(struct map *m)
+{
+	int i;
+
+	for (i = 0; i < MMC_WINDOWS; i++) {
+		if (!m->win[i].addr)
+			continue;
+
+		if (-1 == munmap(m->win[i].addr, m->win[i].len))
+			syslog(LOG_ERR, "munmap(): %s", strerror(errno));
+		mapped_bytes -= m->win[i].len;
+		m->win[i].addr = NULL;
+	}
+	account();
 }
 
 
@@ -598,17 +1717,52 @@ static unsigned int hash(ino_t ino, dev_t dev, off_t size, time_t ctime)
 	h += h << 5;
 	h ^= ctime;
 
-	return h & hash_mask;
+	return h;
+}
+
+
+static unsigned int ls_hash(ino_t ino, dev_t dev, const char *key)
+{
+	unsigned int h = 5381;
+
+	h ^= ino;
+	h += h << 5;
+	h ^= dev;
+	while (*key)
+		h = h * 33 + (unsigned char)*key++;
+
+	return h % LISTING_CACHE_SIZE;
 }
 
 
 /* Generate debugging statistics syslog message. */
 void mmc_logstats(long secs)
 {
-	syslog(LOG_INFO, "map cache - %d allocated, %d active (%lld bytes), "
-	       "%d free; hash size: %d; expire age: %lld", alloc_count,
-	       map_count, (long long)mapped_bytes, free_count, hash_size,
-	       (long long)expire_age);
+	long lookups = map_hits + map_misses;
+
+	syslog(LOG_INFO, "map cache - %d allocated, %d active (%lld of %lld bytes), "
+	       "%d free; hash size: %d%s; hit ratio: %.1f%% of %ld, %ld evicted", alloc_count,
+	       map_count, (long long)mapped_bytes, (long long)max_bytes, free_count,
+	       hash_size, old_table ? " (growing)" : "",
+	       lookups ? 100.0 * map_hits / lookups : 0.0, lookups, map_evicts);
+	syslog(LOG_INFO, "  protected %d maps (%lld bytes), probation %d maps (%lld bytes)",
+	       lru[PROTECTED].count, (long long)lru[PROTECTED].bytes,
+	       lru[PROBATION].count, (long long)lru[PROBATION].bytes);
+	map_hits = map_misses = map_evicts = 0;
+
+	if (gz_count > 0 || gz_hits || gz_misses)
+		syslog(LOG_INFO, "  compressed cache - %d entries (%lld bytes), %ld hits, %ld misses, %ld evicted",
+		       gz_count, (long long)gz_bytes, gz_hits, gz_misses, gz_evicts);
+	gz_hits = gz_misses = gz_evicts = 0;
+
+	if (ls_count > 0 || ls_hits || ls_misses)
+		syslog(LOG_INFO, "  listing cache - %d entries, %ld hits, %ld misses",
+		       ls_count, ls_hits, ls_misses);
+	ls_hits = ls_misses = 0;
+
+	if (win_maps)
+		syslog(LOG_INFO, "  windowed files - %ld windows mapped", win_maps);
+	win_maps = 0;
 
 	if (map_count + free_count != alloc_count)
 		syslog(LOG_ERR, "map counts don't add up!");
@@ -32,10 +32,14 @@
 extern int mmc_icon_check(char *filename, struct stat *st);
 
 /* Returns an mmap()ed area for the given file, or (void*) 0 on errors.
-** If you have a stat buffer on the file, pass it in, otherwise pass 0.
-** Same for the current time.
+** If you have the file open, pass in the fd, it is then always consumed,
+** otherwise pass -1.  If you have a stat buffer on the file, pass it in,
+** otherwise pass 0.  Same for the current time.
 */
-extern void *mmc_map(char *filename, struct stat *sbP, struct timeval *nowP);
+extern void *mmc_map(char *filename, int fd, struct stat *sbP, struct timeval *nowP);
+
+/* Returns 1 if the file is mapped already, mmc_map() will not open it */
+extern int mmc_mapped(struct stat *sbP);
 
 /* Done with an mmap()ed area that was returned by mmc_map().
 ** If you have a stat buffer on the file, pass it in, otherwise pass 0.
@@ -43,6 +47,111 @@ extern void *mmc_map(char *filename, struct stat *sbP, struct timeval *nowP);
 */
 extern void mmc_unmap(void *addr, struct stat *sbP, struct timeval *nowP);
 
+/* Files of 64 MiB, or more, are not mapped in one piece.  The area
+** returned by mmc_map() is then only a handle, use mmc_window() for the
+** data, or mmc_fd() to send it.  Returns 1 for such areas.
+*/
+extern int mmc_windowed(void *addr, struct stat *sbP);
+
+/* Returns the data at offset off of an area returned by mmc_map(), and
+** clamps *lenP to what is contiguous from there.  Large files are mapped
+** a window at a time, the pointer is valid until a few other windows of
+** the same file have been mapped, or the area is passed to mmc_unmap().
+** Returns (void*) 0 on errors.
+*/
+extern void *mmc_window(void *addr, struct stat *sbP, off_t off, size_t *lenP);
+
+/* Returns the quoted strong entity tag, an MD5 digest of the contents,
+** for an area returned by mmc_map().  Computed once per mapping and then
+** reused by every hit, or (char*) 0 if the area is not known.  Windowed
+** areas get a weak tag from the stat() info instead.
+*/
+extern const char *mmc_etag(void *addr, struct stat *sbP);
+
+/* Returns the "Last-Modified: ...\r\n" header line for the st_mtime of
+** an area returned by mmc_map() or mmc_listing(), formatted once and then
+** reused by every hit, or (char*) 0 if the area is not known.  The length
+** is returned in lenP.
+*/
+extern const char *mmc_lastmod(void *addr, struct stat *sbP, size_t *lenP);
+
+/* Returns what was attached to an area returned by mmc_map() with
+** mmc_attach(), or (void*) 0 if nothing is.
+*/
+extern void *mmc_attached(void *addr, struct stat *sbP);
+
+/* Attaches data derived from the contents, e.g. a parsed template, to an
+** area returned by mmc_map().  It lives as long as the map, so a changed
+** file gets a new map and starts out without, and is released with the
+** release function, if given, along with the map or when replaced.
+** Returns 0, or -1 if the area is not known.
+*/
+extern int mmc_attach(void *addr, struct stat *sbP, void *data, void (*release)(void *));
+
+/* Returns the open descriptor of an area returned by mmc_map(), for use
+** with sendfile(), or -1 if the file is small or not kept open.  Owned by
+** the mmc package, valid until the area is passed to mmc_unmap().
+*/
+extern int mmc_fd(void *addr, struct stat *sbP);
+
+/* Returns a cached compressed copy, COMPRESSION_GZIP with header and
+** trailer, or a COMPRESSION_ZSTD frame, of an area returned by mmc_map(),
+** compressing it on first use.  One copy per map, the last type asked
+** for.  The copy is released along with the map, or earlier by LRU order
+** when the total compressed bytes exceed the budget and the map is no
+** longer used.  Returns (void*) 0 if the file is too big, or on errors.
+** The length is returned in lenP.  Pass the address to mmc_unmap() when
+** done.
+*/
+extern void *mmc_compress(void *addr, struct stat *sbP, int type, int level, off_t *lenP);
+
+/* Returns the cached rendered listing of the directory in sbP, for the
+** variant named by key, or (void*) 0 if there is none or the directory
+** has changed since.  On a hit sbP is updated to describe the listing:
+** st_size is its length and st_mtime the newest of the directory and
+** its entries.  Pass the address to mmc_unmap() when done.
+*/
+extern void *mmc_listing(struct stat *sbP, const char *key, struct timeval *nowP);
+
+/* Adds a rendered listing, as returned by mmc_listing(), from buf, a
+** malloc()ed buffer of len bytes that the mmc package takes over.  The
+** newest modification time is passed in mtime.  Returns the address to
+** use, or (void*) 0 on errors, in which case buf is freed.
+*/
+extern void *mmc_listing_add(struct stat *sbP, const char *key, void *buf, off_t len, time_t mtime, struct timeval *nowP);
+
+/* Writes the paths of the most used files, one per line, to fd, which
+** is rewritten from the start.  Returns 0, or -1 on errors.
+*/
+extern int mmc_manifest_save(int fd);
+
+/* Reads a manifest, written by mmc_manifest_save() before a restart,
+** from fd.  Returns the number of files to warm up, or -1 on errors.
+*/
+extern int mmc_manifest_load(int fd);
+
+/* Maps at most max files from the manifest and starts reading them into
+** the page cache, without waiting.  Call until it returns 0, the number
+** of files left.  If you have the current time, pass it in, otherwise
+** pass 0.
+*/
+extern int mmc_warmup(int max, struct timeval *nowP);
+
+/* Sets the budget of the cache, in bytes mapped and number of maps.
+** Unused maps are released, least recently used first, to stay within
+** it.  Maps used only once go first, those used again keep a share of
+** the bytes as long as they are used more recently than the others.
+** Zero keeps the current value, by default DESIRED_MAX_MAPPED_BYTES and
+** DESIRED_MAX_MAPPED_FILES.
+*/
+extern void mmc_limits(off_t bytes, int files);
+
+/* Sets how many larger files may be kept open, for sendfile(), out of
+** descriptors the caller has set aside.  The least recently used are
+** closed to stay within it.  By default DESIRED_MAX_KEPT_FDS.
+*/
+extern void mmc_fd_limit(int fds);
+
 /* Clean up the mmc package, freeing any unused storage.
 ** This should be called periodically, say every five minutes.
 ** If you have the current time, pass it in, otherwise pass 0.
@@ -0,0 +1,64 @@
+/* Static tracepoints, USDT, on the request lifecycle
+**
+** Copyright (C) 2026  The Merecat contributors
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions
+** are met:
+** 1. Redistributions of source code must retain the above copyright
+**    notice, this list of conditions and the following disclaimer.
+** 2. Redistributions in binary form must reproduce the above copyright
+**    notice, this list of conditions and the following disclaimer in the
+**    documentation and/or other materials provided with the distribution.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNERS OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+** THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef PROBE_H_
+#define PROBE_H_
+
+/* Built in when <sys/sdt.h>, from systemtap, is found.  Each probe is a
+** single nop until a tracer attaches, e.g.
+**
+**     bpftrace -e 'usdt:/usr/sbin/merecat:merecat:send { @[arg3] = count(); }'
+**
+** Request probes carry the connection fd and request id first, see
+** httpd_got_request(), so per-request timelines can be put together.
+** Without <sys/sdt.h> the probes, and their arguments, compile to nothing.
+**
+**   accept        fd, client address
+**   request       fd, id, request length
+**   start         fd, id, URL
+**   start_done    fd, id, status, 0 or -1 when the connection is done
+**   mmc_hit       file name, size
+**   mmc_miss      file name, size
+**   send          fd, id, bytes written or -1, EAGAIN
+**   throttle      fd, id, bytes left to send
+**   cgi_fork      fd, id, pid
+**   cgi_exit      pid, wait status
+**   close         fd, id
+*/
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define PROBE2(name, a, b)       DTRACE_PROBE2(merecat, name, a, b)
+#define PROBE3(name, a, b, c)    DTRACE_PROBE3(merecat, name, a, b, c)
+#define PROBE4(name, a, b, c, d) DTRACE_PROBE4(merecat, name, a, b, c, d)
+#else
+#define PROBE2(name, a, b)       do { } while (0)
+#define PROBE3(name, a, b, c)    do { } while (0)
+#define PROBE4(name, a, b, c, d) do { } while (0)
+#endif
+
+#endif /* PROBE_H_ */
@@ -0,0 +1,124 @@
+/* Vectorized scanning of request lines and headers
+**
+** Copyright (C) 2026  The Merecat contributors
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions
+** are met:
+** 1. Redistributions of source code must retain the above copyright
+**    notice, this list of conditions and the following disclaimer.
+** 2. Redistributions in binary form must reproduce the above copyright
+**    notice, this list of conditions and the following disclaimer in the
+**    documentation and/or other materials provided with the distribution.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNERS OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+** THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <config.h>
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "scan.h"
+
+/* Unaligned loads are fine, we never read past end */
+#if defined(__AVX2__)
+#define SCAN_WIDTH 32
+typedef __m256i vec_t;
+#define vec_set(c)      _mm256_set1_epi8(c)
+#define vec_load(p)     _mm256_loadu_si256((const __m256i *)(p))
+#define vec_eq(a, b)    _mm256_cmpeq_epi8(a, b)
+#define vec_or(a, b)    _mm256_or_si256(a, b)
+#define vec_mask(v)     (uint64_t)(uint32_t)_mm256_movemask_epi8(v)
+#define MASK_SHIFT      0
+#elif defined(__SSE2__)
+#define SCAN_WIDTH 16
+typedef __m128i vec_t;
+#define vec_set(c)      _mm_set1_epi8(c)
+#define vec_load(p)     _mm_loadu_si128((const __m128i *)(p))
+#define vec_eq(a, b)    _mm_cmpeq_epi8(a, b)
+#define vec_or(a, b)    _mm_or_si128(a, b)
+#define vec_mask(v)     (uint64_t)_mm_movemask_epi8(v)
+#define MASK_SHIFT      0
+#elif defined(__ARM_NEON)
+#define SCAN_WIDTH 16
+typedef uint8x16_t vec_t;
+#define vec_set(c)      vdupq_n_u8(c)
+#define vec_load(p)     vld1q_u8((const uint8_t *)(p))
+#define vec_eq(a, b)    vceqq_u8(a, b)
+#define vec_or(a, b)    vorrq_u8(a, b)
+/* No movemask on NEON, narrow each byte to a nibble instead */
+#define vec_mask(v)     vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(v), 4)), 0)
+#define MASK_SHIFT      2
+#endif
+
+
+const char *scan_eol(const char *p, const char *end)
+{
+#ifdef SCAN_WIDTH
+	const vec_t cr = vec_set('\r');
+	const vec_t lf = vec_set('\n');
+
+	while (end - p >= SCAN_WIDTH) {
+		vec_t v = vec_load(p);
+		uint64_t mask;
+
+		mask = vec_mask(vec_or(vec_eq(v, cr), vec_eq(v, lf)));
+		if (mask)
+			return p + (__builtin_ctzll(mask) >> MASK_SHIFT);
+		p += SCAN_WIDTH;
+	}
+#endif
+
+	for (; p < end; p++) {
+		if (*p == '\r' || *p == '\n')
+			break;
+	}
+
+	return p;
+}
+
+const char *scan_word(const char *p, const char *end)
+{
+#ifdef SCAN_WIDTH
+	const vec_t cr = vec_set('\r');
+	const vec_t lf = vec_set('\n');
+	const vec_t sp = vec_set(' ');
+	const vec_t ht = vec_set('\t');
+
+	while (end - p >= SCAN_WIDTH) {
+		vec_t v = vec_load(p);
+		uint64_t mask;
+
+		mask = vec_mask(vec_or(vec_or(vec_eq(v, cr), vec_eq(v, lf)),
+				       vec_or(vec_eq(v, sp), vec_eq(v, ht))));
+		if (mask)
+			return p + (__builtin_ctzll(mask) >> MASK_SHIFT);
+		p += SCAN_WIDTH;
+	}
+#endif
+
+	for (; p < end; p++) {
+		if (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+			break;
+	}
+
+	return p;
+}
@@ -32,6 +32,7 @@
 #include <syslog.h>
 #include <sys/stat.h>
 
+#include "accesslog.h"
 #include "fdwatch.h"
 #include "libhttpd.h"
 #include "merecat.h"
@@ -182,6 +183,15 @@ struct httpd *srv_init(struct srv *srv)
 			httpd_ssl_log_errors();
 			exit(1);
 		}
+
+		if (httpd_ssl_session(ctx, srv->ssl_cache, srv->ssl_timeout, srv->ssl_tickets)) {
+			syslog(LOG_WARNING, "Failed setting up TLS session tickets");
+			httpd_ssl_log_errors();
+		}
+		if (srv->ktls)
+			(void)httpd_ssl_ktls(ctx);
+		if (do_http2)
+			(void)httpd_ssl_http2(ctx);
 	}
 
 	/* Initialize the HTTP layer.  Got to do this before giving up root,
@@ -194,6 +204,7 @@ struct httpd *srv_init(struct srv *srv)
 	if (!hs)
 		goto err;
 
+	hs->max_conns = srv->max_conns;
 	if (httpd_cgi_init(hs, cgi_enabled, cgi_pattern, cgi_limit))
 		goto release;
 
@@ -203,7 +214,17 @@ struct httpd *srv_init(struct srv *srv)
 				   srv->redirect[i].location);
 
 	for (i = 0; i < NELEMS(srv->location); i++)
-		httpd_location_add(hs, srv->location[i].pattern, srv->location[i].path);
+		httpd_location_add(hs, srv->location[i].pattern, srv->location[i].path,
+				   srv->location[i].cache);
+
+	if (fcgi_pattern && httpd_fcgi_init(hs, fcgi_pattern, fcgi_server, fcgi_num_servers))
+		goto release;
+
+	if (srv->access_log) {
+		hs->access_log = alog_open(srv->access_log, access_log_block ? ALOG_BLOCK : ALOG_DROP);
+		if (!hs->access_log)
+			goto release;
+	}
 
 	if (httpd_listen(hs, gotv4 ? &sa4 : NULL, gotv6 ? &sa6 : NULL))
 		goto err;
@@ -216,6 +237,28 @@ err:
 	return NULL;
 }
 
+/* In the supervisor, before forking, so the listen sockets outlive the
+** workers.  Each worker then claims its own in srv_init().
+*/
+int srv_bind(struct srv *srv, int id)
+{
+	sockaddr_t sa4;
+	sockaddr_t sa6;
+	int gotv4, gotv6;
+	int rc = -1;
+
+	if (!srv->port)
+		srv->port = srv->ssl ? DEFAULT_HTTPS_PORT : DEFAULT_HTTP_PORT;
+
+	lookup_hostname(srv->host, srv->port, &sa4, sizeof(sa4), &gotv4, &sa6, sizeof(sa6), &gotv6);
+	if (gotv6 && !httpd_listen_bind(&sa6, id))
+		rc = 0;
+	if (gotv4 && !httpd_listen_bind(&sa4, id))
+		rc = 0;
+
+	return rc;
+}
+
 void srv_start(struct httpd *hs)
 {
 	if (hs->listen4_fd != -1)
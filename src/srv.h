@@ -37,6 +37,8 @@ struct srv {
 	char      *host;	/* specific virtual-host, unused for now */
 	uint16_t   port;	/* Server listening port */
 	char      *path;	/* path within chroot/server dir, unused for now */
+	char      *access_log;	/* Log file, or syslog if unset */
+	int        max_conns;	/* Open connections, per worker, 0 unlimited */
 
 	int        ssl;		/* HTTPS or HTTP */
 	char      *ssl_proto;
@@ -44,6 +46,10 @@ struct srv {
 	char      *certfile;
 	char      *keyfile;
 	char      *dhfile;
+	int        ssl_cache;	/* Session cache size, 0 to disable */
+	int        ssl_timeout;	/* Session lifetime and ticket key rotation, sec */
+	int        ssl_tickets;	/* Stateless session tickets */
+	int        ktls;	/* Kernel TLS offload, if available */
 
 	struct {
 		char *pattern;	/* Pattern to match() against */
@@ -56,9 +62,11 @@ struct srv {
 		char *pattern;	/* Pattern to match() against */
 
 		char *path;	/* Path to use for matching requests */
+		int   cache;	/* Seconds to cache CGI responses, see cgicache.h */
 	} location[MAX_LOCATIONS];
 };
 
+int           srv_bind   (struct srv *srv, int id);
 struct httpd *srv_init   (struct srv *srv);
 void          srv_exit   (struct httpd *hs);
 
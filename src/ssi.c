@@ -0,0 +1,976 @@
+/* Built-in server-side includes
+**
+** Copyright (C) 2026  The Merecat contributors
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions
+** are met:
+** 1. Redistributions of source code must retain the above copyright
+**    notice, this list of conditions and the following disclaimer.
+** 2. Redistributions in binary form must reproduce the above copyright
+**    notice, this list of conditions and the following disclaimer in the
+**    documentation and/or other materials provided with the distribution.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNERS OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+** THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <config.h>
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+
+#include "libhttpd.h"
+#include "match.h"
+#include "merecat.h"
+#include "mmc.h"
+#include "ssi.h"
+#include "statcache.h"
+
+/* Defines. */
+#ifndef SSI_MAX_DEPTH
+#define SSI_MAX_DEPTH  8
+#endif
+#ifndef SSI_MAX_OUTPUT
+#define SSI_MAX_OUTPUT (8 * 1024 * 1024)
+#endif
+#define SSI_BLOCK_SIZE 4096
+#define SSI_TIME_MAX   500
+
+#define ERRMSG_DEFAULT  "[an error occurred while processing this directive]"
+#define TIMEFMT_DEFAULT "%a %b %e %T %Z %Y"
+
+#define SF_BYTES  0
+#define SF_ABBREV 1
+
+#define DI_CONFIG   0
+#define DI_INCLUDE  1
+#define DI_ECHO     2
+#define DI_FSIZE    3
+#define DI_FLASTMOD 4
+
+/* What a node does when rendered, one per tag of a directive */
+enum {
+	SSI_TEXT,		/* Span of the file, str points into its map */
+	SSI_ERROR,		/* Bad directive, tag, or value, logged when parsed */
+	SSI_TIMEFMT,
+	SSI_SIZEFMT,
+	SSI_ERRMSG,
+	SSI_INCLUDE,
+	SSI_FSIZE,
+	SSI_FLASTMOD,
+	SSI_ECHO,
+};
+
+/* Variables for echo, the SSI ones and most of the CGI environment
+** cgi-bin/ssi was run with.  Same order as vars[].
+*/
+enum {
+	VAR_DOCUMENT_NAME,
+	VAR_DOCUMENT_URI,
+	VAR_QUERY_STRING_UNESCAPED,
+	VAR_DATE_LOCAL,
+	VAR_DATE_GMT,
+	VAR_LAST_MODIFIED,
+	VAR_SERVER_SOFTWARE,
+	VAR_SERVER_NAME,
+	VAR_SERVER_PROTOCOL,
+	VAR_SERVER_PORT,
+	VAR_REQUEST_METHOD,
+	VAR_REQUEST_URI,
+	VAR_SCRIPT_NAME,
+	VAR_QUERY_STRING,
+	VAR_REMOTE_ADDR,
+	VAR_REMOTE_HOST,
+	VAR_REMOTE_USER,
+	VAR_HTTP_ACCEPT,
+	VAR_HTTP_ACCEPT_ENCODING,
+	VAR_HTTP_ACCEPT_LANGUAGE,
+	VAR_HTTP_COOKIE,
+	VAR_HTTP_HOST,
+	VAR_HTTP_REFERER,
+	VAR_HTTP_USER_AGENT,
+};
+
+static const char *vars[] = {
+	"DOCUMENT_NAME",
+	"DOCUMENT_URI",
+	"QUERY_STRING_UNESCAPED",
+	"DATE_LOCAL",
+	"DATE_GMT",
+	"LAST_MODIFIED",
+	"SERVER_SOFTWARE",
+	"SERVER_NAME",
+	"SERVER_PROTOCOL",
+	"SERVER_PORT",
+	"REQUEST_METHOD",
+	"REQUEST_URI",
+	"SCRIPT_NAME",
+	"QUERY_STRING",
+	"REMOTE_ADDR",
+	"REMOTE_HOST",
+	"REMOTE_USER",
+	"HTTP_ACCEPT",
+	"HTTP_ACCEPT_ENCODING",
+	"HTTP_ACCEPT_LANGUAGE",
+	"HTTP_COOKIE",
+	"HTTP_HOST",
+	"HTTP_REFERER",
+	"HTTP_USER_AGENT",
+};
+
+struct node {
+	int           type;
+	int           arg;	/* SF_*, VAR_*, or 1 for virtual= paths */
+	int           sep;	/* Space before, for every tag but the first */
+	char         *str;	/* Value of the tag */
+	size_t        len;
+};
+
+/* A parsed file, attached to its mmc map, see mmc_attach() */
+struct tmpl {
+	int           num;
+	int           max;
+	struct node  *node;
+};
+
+/* Generated text, dates and sizes, kept until the reply is assembled */
+struct block {
+	struct block *next;
+	size_t        len;
+	size_t        size;
+	char          buf[];
+};
+
+/* A map the reply points into, released when it has been assembled */
+struct ref {
+	void         *addr;
+	struct stat   sb;
+};
+
+struct render {
+	struct http_conn *hc;
+	struct timeval   *now;
+	const char       *root;	/* Document root for virtual= paths */
+	const char       *script;	/* URL path of the requested file */
+
+	struct iovec     *iov;
+	int               num, max;
+	size_t            len;
+	int               full;	/* At SSI_MAX_OUTPUT, the rest is dropped */
+	int               err;	/* Out of memory, reply with 500 */
+
+	struct block     *blocks;
+	struct ref       *ref;
+	int               nref, maxref;
+
+	char              timefmt[100];
+	int               sizefmt;
+	const char       *errmsg;
+};
+
+/* The file being rendered, the requested one or an included one */
+struct frame {
+	const char       *vname;	/* URL path */
+	const char       *fname;	/* File name, relative to the web root */
+	struct stat      *sb;
+	int               depth;
+};
+
+static void run(struct render *r, struct frame *f, struct tmpl *t);
+
+
+static void tmpl_free(void *arg)
+{
+	struct tmpl *t = arg;
+	int i;
+
+	for (i = 0; i < t->num; i++) {
+		if (t->node[i].type != SSI_TEXT)
+			free(t->node[i].str);
+	}
+	free(t->node);
+	free(t);
+}
+
+static int tmpl_add(struct tmpl *t, int type, int arg, int sep, const char *str, size_t len)
+{
+	struct node *n;
+
+	if (t->num == t->max) {
+		int max = t->max ? 2 * t->max : 16;
+
+		n = realloc(t->node, sizeof(struct node) * max);
+		if (!n)
+			return -1;
+		t->node = n;
+		t->max  = max;
+	}
+
+	n = &t->node[t->num];
+	n->type = type;
+	n->arg  = arg;
+	n->sep  = sep;
+	n->len  = len;
+	n->str  = (char *)str;
+	if (type != SSI_TEXT && str) {
+		n->str = strndup(str, len);
+		if (!n->str)
+			return -1;
+	}
+	t->num++;
+
+	return 0;
+}
+
+/* Logs why a tag is not rendered, it then shows the errmsg instead */
+static int tmpl_err(struct tmpl *t, int sep, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsyslog(LOG_NOTICE, fmt, ap);
+	va_end(ap);
+
+	return tmpl_add(t, SSI_ERROR, 0, sep, NULL, 0);
+}
+
+/* Any .. path component, not only ../ as cgi-bin/ssi checked */
+static int climbs(const char *path)
+{
+	const char *p = path;
+
+	while ((p = strstr(p, ".."))) {
+		if ((p == path || p[-1] == '/') && (p[2] == 0 || p[2] == '/'))
+			return 1;
+		p += 2;
+	}
+
+	return 0;
+}
+
+static int tag_add(struct tmpl *t, const char *fname, const char *directive, int dirn,
+		   int sep, const char *tag, const char *val, size_t len)
+{
+	size_t i;
+	int type;
+
+	switch (dirn) {
+	case DI_CONFIG:
+		if (!strcmp(tag, "timefmt"))
+			return tmpl_add(t, SSI_TIMEFMT, 0, sep, val, len);
+		if (!strcmp(tag, "errmsg"))
+			return tmpl_add(t, SSI_ERRMSG, 0, sep, val, len);
+		if (strcmp(tag, "sizefmt"))
+			break;
+		if (!strcmp(val, "bytes"))
+			return tmpl_add(t, SSI_SIZEFMT, SF_BYTES, sep, NULL, 0);
+		if (!strcmp(val, "abbrev"))
+			return tmpl_add(t, SSI_SIZEFMT, SF_ABBREV, sep, NULL, 0);
+		goto unknown_value;
+
+	case DI_ECHO:
+		if (strcmp(tag, "var"))
+			break;
+		for (i = 0; i < NELEMS(vars); i++) {
+			if (!strcmp(val, vars[i]))
+				return tmpl_add(t, SSI_ECHO, i, sep, NULL, 0);
+		}
+		goto unknown_value;
+
+	default:
+		type = dirn == DI_INCLUDE ? SSI_INCLUDE : dirn == DI_FSIZE ? SSI_FSIZE : SSI_FLASTMOD;
+		if (strcmp(tag, "virtual") && strcmp(tag, "file"))
+			break;
+		if (climbs(val) || (tag[0] == 'f' && val[0] == '/'))
+			return tmpl_err(t, sep, "The filename requested in the %s %s=%s directive, "
+					"is not allowed.", directive, tag, val);
+		return tmpl_add(t, type, tag[0] == 'v', sep, val, len);
+	}
+
+	return tmpl_err(t, sep, "The requested server-side-includes filename, %s, "
+			"tried to use directive %s with an unknown tag, %s.", fname, directive, tag);
+unknown_value:
+	return tmpl_err(t, sep, "The requested server-side-includes filename, %s, "
+			"tried to use directive %s %s with an unknown value, %s.", fname,
+			directive, tag, val);
+}
+
+/* Splits a directive into tag=value pairs, the same way cgi-bin/ssi did */
+static int directive_add(struct tmpl *t, const char *fname, const char *str, size_t len)
+{
+	char *buf, *directive, *cp, *val;
+	char *tags[200];
+	int dirn, ntags = 0;
+	int i, rc = 0;
+
+	buf = strndup(str, len);
+	if (!buf)
+		return -1;
+
+	directive = buf + strspn(buf, " \t\n\r");
+	cp = directive;
+	for (;;) {
+		cp = strpbrk(cp, " \t\n\r\"");
+		if (!cp)
+			break;
+		if (*cp == '"') {
+			cp = strchr(cp + 1, '"');
+			if (!cp || !*++cp)
+				break;
+		}
+		*cp++ = 0;
+		cp += strspn(cp, " \t\n\r");
+		if (!*cp)
+			break;
+		if (ntags < (int)NELEMS(tags))
+			tags[ntags++] = cp;
+	}
+
+	if (!strcmp(directive, "config"))
+		dirn = DI_CONFIG;
+	else if (!strcmp(directive, "include"))
+		dirn = DI_INCLUDE;
+	else if (!strcmp(directive, "echo"))
+		dirn = DI_ECHO;
+	else if (!strcmp(directive, "fsize"))
+		dirn = DI_FSIZE;
+	else if (!strcmp(directive, "flastmod"))
+		dirn = DI_FLASTMOD;
+	else {
+		rc = tmpl_err(t, 0, "The requested server-side-includes filename, %s, "
+			      "tried to use an unknown directive, %s.", fname, directive);
+		goto done;
+	}
+
+	for (i = 0; i < ntags && !rc; i++) {
+		size_t vlen;
+
+		val = strchr(tags[i], '=');
+		if (!val)
+			val = "";
+		else
+			*val++ = 0;
+
+		vlen = strlen(val);
+		if (vlen > 0 && val[0] == '"' && val[vlen - 1] == '"') {
+			val[vlen - 1] = 0;
+			val++;
+			vlen = vlen > 1 ? vlen - 2 : 0;
+		}
+
+		rc = tag_add(t, fname, directive, dirn, i > 0, tags[i], val, vlen);
+	}
+done:
+	free(buf);
+
+	return rc;
+}
+
+/* Splits the file into text spans, left in the map, and directives */
+static struct tmpl *parse(const char *fname, const char *data, size_t len)
+{
+	const char *p = data, *end = data + len;
+	const char *beg, *fin;
+	struct tmpl *t;
+
+	t = NEW(struct tmpl, 1);
+	if (!t)
+		return NULL;
+
+	while (p < end) {
+		beg = memmem(p, end - p, "<!--#", 5);
+		if (!beg)
+			beg = end;
+		if (beg > p && tmpl_add(t, SSI_TEXT, 0, 0, p, beg - p))
+			goto fail;
+		if (beg == end)
+			break;
+
+		/* Unterminated, dropped with the rest of the file like before */
+		beg += 5;
+		fin = memmem(beg, end - beg, "-->", 3);
+		if (!fin)
+			break;
+
+		if (directive_add(t, fname, beg, fin - beg))
+			goto fail;
+		p = fin + 3;
+	}
+
+	return t;
+fail:
+	tmpl_free(t);
+	return NULL;
+}
+
+
+/* Appends to the reply, adjacent spans of the same map are merged */
+static void out(struct render *r, const char *ptr, size_t len)
+{
+	struct iovec *iov;
+
+	if (!len || r->full || r->err)
+		return;
+
+	if (r->len + len > SSI_MAX_OUTPUT) {
+		syslog(LOG_WARNING, "SSI reply for %s over %d bytes, truncated.",
+		       r->hc->encodedurl, SSI_MAX_OUTPUT);
+		r->full = 1;
+		return;
+	}
+
+	if (r->num > 0) {
+		iov = &r->iov[r->num - 1];
+		if ((char *)iov->iov_base + iov->iov_len == ptr) {
+			iov->iov_len += len;
+			r->len += len;
+			return;
+		}
+	}
+
+	if (r->num == r->max) {
+		int max = r->max ? 2 * r->max : 32;
+
+		iov = realloc(r->iov, sizeof(struct iovec) * max);
+		if (!iov) {
+			syslog(LOG_CRIT, "Out of memory assembling SSI reply for %s", r->hc->encodedurl);
+			r->err = 1;
+			return;
+		}
+		r->iov = iov;
+		r->max = max;
+	}
+
+	r->iov[r->num].iov_base = (void *)ptr;
+	r->iov[r->num].iov_len  = len;
+	r->num++;
+	r->len += len;
+}
+
+/* Room for len bytes of generated text, see used() */
+static char *scratch(struct render *r, size_t len)
+{
+	struct block *b = r->blocks;
+
+	if (!b || b->size - b->len < len) {
+		size_t size = MAX(len, SSI_BLOCK_SIZE);
+
+		b = malloc(sizeof(struct block) + size);
+		if (!b) {
+			syslog(LOG_CRIT, "Out of memory assembling SSI reply for %s", r->hc->encodedurl);
+			r->err = 1;
+			return NULL;
+		}
+		b->size = size;
+		b->len  = 0;
+		b->next = r->blocks;
+		r->blocks = b;
+	}
+
+	return &b->buf[b->len];
+}
+
+static void used(struct render *r, char *ptr, size_t len)
+{
+	r->blocks->len += len;
+	out(r, ptr, len);
+}
+
+/* For text that does not outlive the directive, e.g. an include's name */
+static void copy(struct render *r, const char *str)
+{
+	size_t len = strlen(str);
+	char *buf;
+
+	buf = scratch(r, len);
+	if (!buf)
+		return;
+
+	memcpy(buf, str, len);
+	used(r, buf, len);
+}
+
+static void outf(struct render *r, const char *fmt, ...)
+{
+	va_list ap;
+	char *buf;
+	int len;
+
+	buf = scratch(r, 32);
+	if (!buf)
+		return;
+
+	va_start(ap, fmt);
+	len = vsnprintf(buf, 32, fmt, ap);
+	va_end(ap);
+	if (len > 0 && len < 32)
+		used(r, buf, len);
+}
+
+static void show_errmsg(struct render *r)
+{
+	if (r->errmsg)
+		out(r, r->errmsg, strlen(r->errmsg));
+}
+
+static void show_time(struct render *r, time_t t, int gmt)
+{
+	struct tm *tm;
+	char *buf;
+
+	tm = gmt ? gmtime(&t) : localtime(&t);
+	buf = scratch(r, SSI_TIME_MAX);
+	if (!tm || !buf)
+		return;
+
+	used(r, buf, strftime(buf, SSI_TIME_MAX, r->timefmt, tm));
+}
+
+static void show_size(struct render *r, off_t size)
+{
+	switch (r->sizefmt) {
+	case SF_BYTES:
+		outf(r, "%ld", (long)size);	/* spec says should have commas */
+		break;
+
+	case SF_ABBREV:
+		if (size < 1024)
+			outf(r, "%ld", (long)size);
+		else if (size < 1024 * 1024)
+			outf(r, "%ldK", (long)size / 1024L);
+		else if (size < 1024 * 1024 * 1024)
+			outf(r, "%ldM", (long)size / (1024L * 1024L));
+		else
+			outf(r, "%ldG", (long)size / (1024L * 1024L * 1024L));
+		break;
+	}
+}
+
+/* The file name, and URL path, of a virtual= tag, from the document
+** root, or a file= tag, next to the current file.
+*/
+static int resolve(struct render *r, struct frame *f, struct node *n, char *fn, char *vn, size_t size)
+{
+	const char *val = n->str, *cp;
+	int len, vlen;
+
+	if (n->arg) {
+		while (*val == '/')
+			val++;
+		len  = snprintf(fn, size, "%s%s%s", r->root, r->root[0] ? "/" : "", val);
+		vlen = snprintf(vn, size, "/%s", val);
+	} else {
+		cp   = strrchr(f->fname, '/');
+		len  = snprintf(fn, size, "%.*s%s", cp ? (int)(cp - f->fname + 1) : 0, f->fname, val);
+		cp   = strrchr(f->vname, '/');
+		vlen = snprintf(vn, size, "%.*s%s", cp ? (int)(cp - f->vname + 1) : 0, f->vname, val);
+	}
+
+	if (len < 0 || (size_t)len >= size || vlen < 0 || (size_t)vlen >= size) {
+		syslog(LOG_NOTICE, "The filename requested in %s, %s, is too long.", f->fname, val);
+		show_errmsg(r);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Same rules as cgi-bin/ssi: no password files, nothing from password
+** protected directories, and no scripts, their source is not for show.
+*/
+static int allowed(struct render *r, const char *fn)
+{
+	struct httpd *hs = r->hc->hs;
+	const char *path = fn;
+	size_t len = strlen(r->root);
+#ifdef AUTH_FILE
+	char buf[MAXPATHLEN];
+	struct stat sb;
+	const char *base;
+#endif
+
+	if (len && !strncmp(fn, r->root, len) && fn[len] == '/')
+		path = fn + len + 1;
+	if (match_exec(hs->cgi_match, path) || match_exec(hs->php_match, path) ||
+	    match_exec(hs->fcgi_match, path))
+		return 0;
+
+#ifdef AUTH_FILE
+	base = strrchr(fn, '/');
+	base = base ? base + 1 : fn;
+	if (!strcmp(base, AUTH_FILE))
+		return 0;
+
+	snprintf(buf, sizeof(buf), "%.*s%s", (int)(base - fn), fn, AUTH_FILE);
+	if (!stc_stat(buf, &sb))
+		return 0;
+#endif
+
+	return 1;
+}
+
+/* Maps a file for the reply, held until it has been assembled */
+static void *map(struct render *r, char *fn, struct stat *sb)
+{
+	void *addr;
+
+	if (r->nref == r->maxref) {
+		int max = r->maxref ? 2 * r->maxref : 8;
+		struct ref *ref;
+
+		ref = realloc(r->ref, sizeof(struct ref) * max);
+		if (!ref) {
+			syslog(LOG_CRIT, "Out of memory assembling SSI reply for %s", r->hc->encodedurl);
+			r->err = 1;
+			return NULL;
+		}
+		r->ref    = ref;
+		r->maxref = max;
+	}
+
+	addr = mmc_map(fn, -1, sb, r->now);
+	if (!addr)
+		return NULL;
+
+	if (mmc_windowed(addr, sb)) {
+		syslog(LOG_NOTICE, "The server-side-includes file %s is too large.", fn);
+		mmc_unmap(addr, sb, r->now);
+		return NULL;
+	}
+
+	r->ref[r->nref].addr = addr;
+	r->ref[r->nref].sb   = *sb;
+	r->nref++;
+
+	return addr;
+}
+
+/* Parsed once per map, a changed file has a new st_ctime and a new map */
+static struct tmpl *tmpl_get(struct render *r, const char *fn, void *addr, struct stat *sb)
+{
+	struct tmpl *t;
+
+	t = mmc_attached(addr, sb);
+	if (t)
+		return t;
+
+	t = parse(fn, addr, sb->st_size);
+	if (!t) {
+		syslog(LOG_CRIT, "Out of memory parsing %s", fn);
+		r->err = 1;
+		return NULL;
+	}
+
+	if (mmc_attach(addr, sb, t, tmpl_free)) {
+		tmpl_free(t);
+		r->err = 1;
+		return NULL;
+	}
+
+	return t;
+}
+
+static void include(struct render *r, struct frame *f, struct node *n)
+{
+	char fn[MAXPATHLEN], vn[MAXPATHLEN];
+	struct frame sub;
+	struct stat sb;
+	struct tmpl *t;
+	void *addr;
+
+	if (resolve(r, f, n, fn, vn, sizeof(fn)))
+		return;
+
+	if (!allowed(r, fn)) {
+		syslog(LOG_NOTICE, "The filename requested in the include %s=%s directive, "
+		       "is not allowed.", n->arg ? "virtual" : "file", n->str);
+		show_errmsg(r);
+		return;
+	}
+
+	if (f->depth >= SSI_MAX_DEPTH) {
+		syslog(LOG_NOTICE, "The include of %s in %s is nested too deep.", fn, f->fname);
+		show_errmsg(r);
+		return;
+	}
+
+	if (stc_stat(fn, &sb) || !S_ISREG(sb.st_mode) || !(addr = map(r, fn, &sb))) {
+		if (!r->err) {
+			syslog(LOG_NOTICE, "The filename requested in a include %s directive; %s, "
+			       "does not seem to exist.", n->arg ? "virtual" : "file", fn);
+			show_errmsg(r);
+		}
+		return;
+	}
+
+	t = tmpl_get(r, fn, addr, &sb);
+	if (!t)
+		return;
+
+	sub.vname = vn;
+	sub.fname = fn;
+	sub.sb    = &sb;
+	sub.depth = f->depth + 1;
+	run(r, &sub, t);
+}
+
+static void fileinfo(struct render *r, struct frame *f, struct node *n)
+{
+	char fn[MAXPATHLEN], vn[MAXPATHLEN];
+	struct stat sb;
+
+	if (resolve(r, f, n, fn, vn, sizeof(fn)))
+		return;
+
+	if (stc_stat(fn, &sb)) {
+		syslog(LOG_NOTICE, "The filename requested in a %s %s directive; %s, "
+		       "does not seem to exist.", n->type == SSI_FSIZE ? "fsize" : "flastmod",
+		       n->arg ? "virtual" : "file", fn);
+		show_errmsg(r);
+		return;
+	}
+
+	if (n->type == SSI_FSIZE)
+		show_size(r, sb.st_size);
+	else
+		show_time(r, sb.st_mtime, 0);
+}
+
+static void echo(struct render *r, struct frame *f, struct node *n)
+{
+	struct http_conn *hc = r->hc;
+	const char *val = NULL;
+
+	switch (n->arg) {
+	case VAR_DOCUMENT_NAME:
+		val = strrchr(f->vname, '/');
+		copy(r, val ? val + 1 : f->vname);
+		return;
+
+	case VAR_DOCUMENT_URI:
+		copy(r, f->vname);
+		return;
+
+	case VAR_QUERY_STRING_UNESCAPED:
+		out(r, hc->query, strlen(hc->query));
+		return;
+
+	case VAR_DATE_LOCAL:
+		show_time(r, time(NULL), 0);
+		return;
+
+	case VAR_DATE_GMT:
+		show_time(r, time(NULL), 1);
+		return;
+
+	case VAR_LAST_MODIFIED:
+		show_time(r, f->sb->st_mtime, 0);
+		return;
+
+	case VAR_SERVER_SOFTWARE:
+		val = SERVER_SOFTWARE;
+		break;
+
+	case VAR_SERVER_NAME:
+		if (hc->hs->vhost && hc->hostname)
+			val = hc->hostname;
+		else
+			val = hc->hs->server_hostname;
+		break;
+
+	case VAR_SERVER_PROTOCOL:
+		val = hc->protocol;
+		break;
+
+	case VAR_SERVER_PORT:
+		outf(r, "%d", (int)hc->hs->port);
+		return;
+
+	case VAR_REQUEST_METHOD:
+		val = httpd_method_str(hc->method);
+		break;
+
+	case VAR_REQUEST_URI:
+		val = hc->encodedurl;
+		break;
+
+	case VAR_SCRIPT_NAME:
+		val = r->script;
+		break;
+
+	case VAR_QUERY_STRING:
+		val = hc->query;
+		break;
+
+	case VAR_REMOTE_ADDR:
+	case VAR_REMOTE_HOST:
+		val = httpd_client(hc);
+		break;
+
+	case VAR_REMOTE_USER:
+		val = hc->remoteuser;
+		break;
+
+	case VAR_HTTP_ACCEPT:
+		val = hc->accept;
+		break;
+
+	case VAR_HTTP_ACCEPT_ENCODING:
+		val = hc->accepte;
+		break;
+
+	case VAR_HTTP_ACCEPT_LANGUAGE:
+		val = hc->acceptl;
+		break;
+
+	case VAR_HTTP_COOKIE:
+		val = hc->cookie;
+		break;
+
+	case VAR_HTTP_HOST:
+		val = hc->hdrhost;
+		break;
+
+	case VAR_HTTP_REFERER:
+		val = hc->referer;
+		break;
+
+	case VAR_HTTP_USER_AGENT:
+		val = hc->useragent;
+		break;
+	}
+
+	/* Like an unset environment variable was for cgi-bin/ssi */
+	if (!val || !val[0]) {
+		syslog(LOG_NOTICE, "The requested server-side-includes filename, %s, "
+		       "tried to use directive echo var with an unknown value, %s.",
+		       f->fname, vars[n->arg]);
+		show_errmsg(r);
+		return;
+	}
+
+	out(r, val, strlen(val));
+}
+
+static void run(struct render *r, struct frame *f, struct tmpl *t)
+{
+	struct node *n;
+	int i;
+
+	for (i = 0; i < t->num && !r->full && !r->err; i++) {
+		n = &t->node[i];
+		if (n->sep)
+			out(r, " ", 1);
+
+		switch (n->type) {
+		case SSI_TEXT:
+			out(r, n->str, n->len);
+			break;
+
+		case SSI_ERROR:
+			show_errmsg(r);
+			break;
+
+		case SSI_TIMEFMT:
+			strlcpy(r->timefmt, n->str, sizeof(r->timefmt));
+			break;
+
+		case SSI_SIZEFMT:
+			r->sizefmt = n->arg;
+			break;
+
+		case SSI_ERRMSG:
+			r->errmsg = n->str;
+			break;
+
+		case SSI_INCLUDE:
+			include(r, f, n);
+			break;
+
+		case SSI_FSIZE:
+		case SSI_FLASTMOD:
+			fileinfo(r, f, n);
+			break;
+
+		case SSI_ECHO:
+			echo(r, f, n);
+			break;
+		}
+	}
+}
+
+static void release(struct render *r)
+{
+	struct block *b;
+	int i;
+
+	for (i = 0; i < r->nref; i++)
+		mmc_unmap(r->ref[i].addr, &r->ref[i].sb, r->now);
+
+	while ((b = r->blocks)) {
+		r->blocks = b->next;
+		free(b);
+	}
+	free(r->ref);
+	free(r->iov);
+}
+
+int ssi_send(struct http_conn *hc, struct timeval *now)
+{
+	char vn[MAXPATHLEN];
+	struct render r;
+	struct frame f;
+	struct tmpl *t = NULL;
+	void *addr;
+
+	memset(&r, 0, sizeof(r));
+	r.hc      = hc;
+	r.now     = now;
+	r.root    = hc->hs->vhost && hc->hostdir[0] ? hc->hostdir : "";
+	r.script  = vn;
+	r.sizefmt = SF_BYTES;
+	r.errmsg  = ssi_silent ? NULL : ERRMSG_DEFAULT;
+	strlcpy(r.timefmt, TIMEFMT_DEFAULT, sizeof(r.timefmt));
+	snprintf(vn, sizeof(vn), "/%s", hc->origfilename);
+
+	addr = map(&r, hc->expnfilename, &hc->sb);
+	if (addr)
+		t = tmpl_get(&r, hc->expnfilename, addr, &hc->sb);
+	if (t) {
+		f.vname = vn;
+		f.fname = hc->expnfilename;
+		f.sb    = &hc->sb;
+		f.depth = 0;
+		run(&r, &f, t);
+	}
+
+	if (!t || r.err) {
+		httpd_send_err(hc, 500, httpd_err500title, "", httpd_err500form, hc->encodedurl);
+		release(&r);
+		return -1;
+	}
+
+	httpd_send_iov(hc, "text/html; charset=%s", r.iov, r.num);
+	release(&r);
+
+	return 0;
+}
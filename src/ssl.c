@@ -31,6 +31,7 @@
 #include <syslog.h>
 #include <sys/stat.h>
 #include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <openssl/ssl.h>
@@ -43,6 +44,11 @@
 #include <openssl/engine.h>
 #include <openssl/evp.h>
 #include <openssl/rand.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#else
+#include <openssl/hmac.h>
+#endif
 
 #include "libhttpd.h"
 #include "file.h"
@@ -185,6 +191,11 @@ void *httpd_ssl_init(char *cert, char *key, char *dhparm, char *proto, char *cip
 	}
 	SSL_CTX_set_min_proto_version(ctx, min_version);
 
+	/* Retried writes may come from another address, the HTTP/2 output
+	 * buffer grows, and windows of large files are mapped on demand.
+	 */
+	SSL_CTX_set_mode(ctx, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
 	if (ciphers) {
 		split_ciphers(ciphers, &list, &suite);
 		if (list) {
@@ -245,6 +256,248 @@ error:
 	return NULL;
 }
 
+/* Session ticket keys, derived from a secret created before any worker
+** processes are forked.  So all workers can decrypt each other's tickets,
+** and rotate keys in lock step, without having to talk to each other.
+*/
+struct ticket_key {
+	unsigned char name[16];
+	unsigned char aes[32];
+	unsigned char hmac[32];
+};
+
+static unsigned char ticket_secret[32];
+static int ticket_seeded;
+
+int httpd_ssl_ticket_init(void)
+{
+	/* Handed over by the process before a reload */
+	if (ticket_seeded)
+		return 0;
+
+	if (RAND_bytes(ticket_secret, sizeof(ticket_secret)) != 1) {
+		httpd_ssl_log_errors();
+		return -1;
+	}
+	ticket_seeded = 1;
+
+	return 0;
+}
+
+/* The secret, in a pipe to read it back from after execve() on reload.
+** Tickets issued before the reload then stay valid.
+*/
+int httpd_ssl_ticket_export(void)
+{
+	int fd[2];
+
+	if (!ticket_seeded || pipe(fd))
+		return -1;
+
+	/* Fits in any pipe buffer, never blocks */
+	if (write(fd[1], ticket_secret, sizeof(ticket_secret)) != sizeof(ticket_secret)) {
+		close(fd[0]);
+		close(fd[1]);
+		return -1;
+	}
+	close(fd[1]);
+
+	return fd[0];
+}
+
+int httpd_ssl_ticket_import(int fd)
+{
+	ssize_t len;
+
+	len = read(fd, ticket_secret, sizeof(ticket_secret));
+	close(fd);
+	if (len != sizeof(ticket_secret))
+		return -1;
+	ticket_seeded = 1;
+
+	return 0;
+}
+
+static void ticket_derive(long period, struct ticket_key *key)
+{
+	unsigned char buf[sizeof(ticket_secret) + sizeof(period) + 1];
+	unsigned char md[EVP_MAX_MD_SIZE];
+	struct {
+		unsigned char *ptr;
+		size_t         len;
+	} part[] = {
+		{ key->name, sizeof(key->name) },
+		{ key->aes,  sizeof(key->aes)  },
+		{ key->hmac, sizeof(key->hmac) },
+	};
+	size_t i;
+
+	memcpy(buf, ticket_secret, sizeof(ticket_secret));
+	memcpy(&buf[sizeof(ticket_secret)], &period, sizeof(period));
+	for (i = 0; i < NELEMS(part); i++) {
+		buf[sizeof(buf) - 1] = i;
+		EVP_Digest(buf, sizeof(buf), md, NULL, EVP_sha256(), NULL);
+		memcpy(part[i].ptr, md, part[i].len);
+	}
+
+	OPENSSL_cleanse(buf, sizeof(buf));
+	OPENSSL_cleanse(md, sizeof(md));
+}
+
+/*
+ * Keys are rotated every session timeout.  New tickets are encrypted
+ * with the current key, and tickets from the previous period are still
+ * accepted, but renewed.  Returns 1 for the current key, 2 for the old
+ * one, or 0 if the ticket's key is unknown, or has expired.
+ */
+static int ticket_init(SSL *ssl, unsigned char name[16], unsigned char *iv,
+		       EVP_CIPHER_CTX *cctx, int enc, struct ticket_key *key)
+{
+	long lifetime, period;
+	int i;
+
+	lifetime = SSL_CTX_get_timeout(SSL_get_SSL_CTX(ssl));
+	if (lifetime < 1)
+		lifetime = 1;
+	period = time(NULL) / lifetime;
+
+	for (i = 0; i < 2; i++) {
+		ticket_derive(period - i, key);
+		if (enc) {
+			memcpy(name, key->name, sizeof(key->name));
+			if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1)
+				return -1;
+			if (!EVP_EncryptInit_ex(cctx, EVP_aes_256_cbc(), NULL, key->aes, iv))
+				return -1;
+			return 1;
+		}
+
+		if (memcmp(name, key->name, sizeof(key->name)))
+			continue;
+		if (!EVP_DecryptInit_ex(cctx, EVP_aes_256_cbc(), NULL, key->aes, iv))
+			return -1;
+		return i + 1;
+	}
+
+	return 0;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+static int ticket_cb(SSL *ssl, unsigned char name[16], unsigned char *iv,
+		     EVP_CIPHER_CTX *cctx, EVP_MAC_CTX *hctx, int enc)
+{
+	struct ticket_key key;
+	OSSL_PARAM params[3];
+	int rc;
+
+	rc = ticket_init(ssl, name, iv, cctx, enc, &key);
+	if (rc > 0) {
+		params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key.hmac, sizeof(key.hmac));
+		params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "sha256", 0);
+		params[2] = OSSL_PARAM_construct_end();
+		if (!EVP_MAC_CTX_set_params(hctx, params))
+			rc = -1;
+	}
+	OPENSSL_cleanse(&key, sizeof(key));
+
+	return rc;
+}
+#else
+static int ticket_cb(SSL *ssl, unsigned char name[16], unsigned char *iv,
+		     EVP_CIPHER_CTX *cctx, HMAC_CTX *hctx, int enc)
+{
+	struct ticket_key key;
+	int rc;
+
+	rc = ticket_init(ssl, name, iv, cctx, enc, &key);
+	if (rc > 0 && !HMAC_Init_ex(hctx, key.hmac, sizeof(key.hmac), EVP_sha256(), NULL))
+		rc = -1;
+	OPENSSL_cleanse(&key, sizeof(key));
+
+	return rc;
+}
+#endif
+
+int httpd_ssl_session(void *arg, int cache, int timeout, int tickets)
+{
+	SSL_CTX *ctx = (SSL_CTX *)arg;
+
+	if (timeout > 0)
+		SSL_CTX_set_timeout(ctx, timeout);
+	SSL_CTX_set_session_id_context(ctx, (const unsigned char *)PACKAGE_NAME, strlen(PACKAGE_NAME));
+
+	/* Per process, so with workers it is mostly the tickets that help */
+	if (cache > 0) {
+		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+		SSL_CTX_sess_set_cache_size(ctx, cache);
+	} else {
+		SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+	}
+
+	if (!tickets) {
+		SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+		if (cache <= 0)
+			SSL_CTX_set_num_tickets(ctx, 0);
+		return 0;
+	}
+
+	if (!ticket_seeded && httpd_ssl_ticket_init())
+		return -1;
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	if (SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, ticket_cb) != 1)
+#else
+	if (SSL_CTX_set_tlsext_ticket_key_cb(ctx, ticket_cb) != 1)
+#endif
+		return -1;
+
+	return 0;
+}
+
+int httpd_ssl_ktls(void *arg)
+{
+#ifdef SSL_OP_ENABLE_KTLS
+	SSL_CTX_set_options((SSL_CTX *)arg, SSL_OP_ENABLE_KTLS);
+	return 0;
+#else
+	syslog(LOG_WARNING, "Kernel TLS requires OpenSSL 3.0, or later");
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/* Prefer h2, fall back to HTTP/1.1 also for clients without ALPN */
+static int alpn_cb(SSL *ssl, const unsigned char **out, unsigned char *outlen,
+		   const unsigned char *in, unsigned int inlen, void *arg)
+{
+	static const unsigned char protos[] = "\x02h2\x08http/1.1";
+
+	(void)ssl;
+	(void)arg;
+	if (SSL_select_next_proto((unsigned char **)out, outlen, protos, sizeof(protos) - 1,
+				  in, inlen) != OPENSSL_NPN_NEGOTIATED)
+		return SSL_TLSEXT_ERR_NOACK;
+
+	return SSL_TLSEXT_ERR_OK;
+}
+
+int httpd_ssl_http2(void *arg)
+{
+	SSL_CTX_set_alpn_select_cb((SSL_CTX *)arg, alpn_cb, NULL);
+
+	return 0;
+}
+
+int httpd_ssl_is_h2(struct http_conn *hc)
+{
+	const unsigned char *proto;
+	unsigned int len;
+
+	SSL_get0_alpn_selected(hc->ssl, &proto, &len);
+
+	return len == 2 && !memcmp(proto, "h2", 2);
+}
+
 void httpd_ssl_exit(struct httpd *hs)
 {
 	if (!hs || !hs->ctx)
@@ -367,10 +620,6 @@ int httpd_ssl_open(struct http_conn *hc)
 			return 1;
 		}
 
-		if (-1 == httpd_set_ndelay(hc->conn_fd))
-			syslog(LOG_ERR, "Failed setting SSL non-blocking: %s",
-			       strerror(errno));
-
 		SSL_set_fd(hc->ssl, hc->conn_fd);
 		if (-1 == accept_connection(hc)) {
 			ERR_clear_error();
@@ -385,8 +634,12 @@ int httpd_ssl_open(struct http_conn *hc)
 
 void httpd_ssl_close(struct http_conn *hc)
 {
-	if (hc->ssl)
+	if (hc->ssl) {
+		/* Without a close_notify the session is dropped from the cache */
+		SSL_shutdown(hc->ssl);
+		ERR_clear_error();
 		SSL_free(hc->ssl);
+	}
 	hc->ssl = NULL;
 }
 
@@ -417,10 +670,11 @@ void httpd_ssl_log_errors(void)
 
 ssize_t httpd_ssl_read(struct http_conn *hc, void *buf, size_t len)
 {
-	if (status(hc, SSL_read(hc->ssl, buf, len)))
+	int rc = SSL_read(hc->ssl, buf, len);
+	if (status(hc, rc))
 		return -1;
 
-	return len;
+	return rc;
 }
 
 ssize_t httpd_ssl_write(struct http_conn *hc, void *buf, size_t len)
@@ -455,3 +709,47 @@ ssize_t httpd_ssl_writev(struct http_conn *hc, struct iovec *iov, int num)
 	}
 	return sum;
 }
+
+/* Only if the kernel does the encryption, set up after the handshake */
+int httpd_ssl_ktls_send(struct http_conn *hc)
+{
+#ifdef SSL_OP_ENABLE_KTLS
+	return BIO_get_ktls_send(SSL_get_wbio(hc->ssl));
+#else
+	return 0;
+#endif
+}
+
+ssize_t httpd_ssl_sendfile(struct http_conn *hc, int fd, off_t offset, size_t len)
+{
+#ifdef SSL_OP_ENABLE_KTLS
+	ssize_t hlen = 0;
+	ossl_ssize_t rc;
+
+	/* Headers first, same semantics as the plain HTTP version */
+	if (hc->responselen > 0) {
+		hlen = httpd_ssl_write(hc, hc->response, hc->responselen);
+		if (hlen == -1)
+			return -1;
+		if ((size_t)hlen < hc->responselen)
+			return hlen;
+	}
+
+	rc = SSL_sendfile(hc->ssl, fd, offset, len, 0);
+	if (rc < 0) {
+		/* Report the headers, next call gets the error again */
+		if (hlen > 0)
+			return hlen;
+
+		status(hc, (int)rc);
+		return -1;
+	}
+
+	return hlen + rc;
+#else
+	errno = ENOSYS;
+	hc->errmsg = strerror(errno);
+
+	return -1;
+#endif
+}
@@ -37,6 +37,27 @@
 /* Initialize SSL and load certificate and key file */
 void *httpd_ssl_init(char *cert, char *key, char *dhparm, char *proto, char *ciphers);
 
+/* Create the secret session ticket keys are derived from, call before
+** forking any worker processes so they all share it.
+*/
+int httpd_ssl_ticket_init(void);
+
+/* Hand the secret over across execve() on reload, export returns a
+** pipe fd for the new process to import from, or -1.
+*/
+int httpd_ssl_ticket_export(void);
+int httpd_ssl_ticket_import(int fd);
+
+/* Set up session caching and, optionally, rotating session tickets */
+int httpd_ssl_session(void *ctx, int cache, int timeout, int tickets);
+
+/* Opt-in kernel TLS offload, if supported by OpenSSL and the kernel */
+int httpd_ssl_ktls(void *ctx);
+
+/* Offer h2 by ALPN, see httpd_ssl_is_h2() after the handshake */
+int httpd_ssl_http2(void *ctx);
+int httpd_ssl_is_h2(struct http_conn *hc);
+
 /* Unload SSL, called automatically at httpd_exit() */
 void httpd_ssl_exit(struct httpd *hs);
 
@@ -57,8 +78,19 @@ ssize_t httpd_ssl_read   (struct http_conn *hc, void *buf, size_t len);
 ssize_t httpd_ssl_write  (struct http_conn *hc, void *buf, size_t len);
 ssize_t httpd_ssl_writev (struct http_conn *hc, struct iovec *iov, int num);
 
+/* With kernel TLS active on the connection, files can be sent zero-copy */
+int     httpd_ssl_ktls_send(struct http_conn *hc);
+ssize_t httpd_ssl_sendfile (struct http_conn *hc, int fd, off_t offset, size_t len);
+
 #else
 #define httpd_ssl_init(cert, key, dhparm, proto, ciphers) NULL
+#define httpd_ssl_ticket_init()        0
+#define httpd_ssl_ticket_export()      -1
+#define httpd_ssl_ticket_import(fd)    -1
+#define httpd_ssl_session(ctx, cache, timeout, tickets) 0
+#define httpd_ssl_ktls(ctx)            -1
+#define httpd_ssl_http2(ctx)           -1
+#define httpd_ssl_is_h2(hc)            0
 #define httpd_ssl_exit(hs)
 
 #define httpd_ssl_open(hc)             (hc->ssl = NULL)
@@ -70,6 +102,9 @@ ssize_t httpd_ssl_writev (struct http_conn *hc, struct iovec *iov, int num);
 #define httpd_ssl_read(hc, buf, len)   -1
 #define httpd_ssl_write(hc, buf, len)  -1
 #define httpd_ssl_writev(hc, iov, num) -1
+
+#define httpd_ssl_ktls_send(hc)        0
+#define httpd_ssl_sendfile(hc, fd, offset, len) -1
 #endif
 
 #endif /* MERECAT_SSL_H_ */
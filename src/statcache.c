@@ -0,0 +1,268 @@
+/* Short-lived cache of stat(), lstat(), and readlink() results
+**
+** Copyright (C) 2026  The Merecat contributors
+** All rights reserved.
+**
+** Redistribution and use in source and binary forms, with or without
+** modification, are permitted provided that the following conditions
+** are met:
+** 1. Redistributions of source code must retain the above copyright
+**    notice, this list of conditions and the following disclaimer.
+** 2. Redistributions in binary form must reproduce the above copyright
+**    notice, this list of conditions and the following disclaimer in the
+**    documentation and/or other materials provided with the distribution.
+**
+** THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+** AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+** IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+** ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNERS OR CONTRIBUTORS BE
+** LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+** CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+** SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+** INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+** CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+** ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+** THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <config.h>
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "merecat.h"
+#include "statcache.h"
+
+/* Defines. */
+#ifndef STAT_CACHE_SIZE
+#define STAT_CACHE_SIZE 8192
+#endif
+
+#define STC_STAT     0
+#define STC_LSTAT    1
+#define STC_READLINK 2
+
+
+/* The table is direct mapped on hash of path and operation, a collision
+** simply replaces the older entry.  This keeps it bounded and O(1), and
+** the many thousand slots make collisions rare for a typical site.
+*/
+struct entry {
+	char          *path;
+	unsigned int   hash;
+	int            op;
+	time_t         expires;
+
+	ssize_t        rc;	/* return value of the call */
+	int            err;	/* errno, when rc < 0 */
+	struct stat    sb;
+	char          *link;	/* link target for readlink() */
+};
+
+static struct entry *table[STAT_CACHE_SIZE];
+static int entry_count;
+static long hits, misses;
+
+
+static unsigned int hash(const char *path, int op)
+{
+	unsigned int h = 5381 + op;
+
+	while (*path)
+		h = h * 33 + (unsigned char)*path++;
+
+	return h;
+}
+
+
+static void release(struct entry *e)
+{
+	free(e->path);
+	free(e->link);
+	free(e);
+	--entry_count;
+}
+
+
+/* Returns the cached entry, or NULL if the caller must do the syscall.
+** Sets *slotP to where a new entry for the same key should be stored.
+*/
+static struct entry *lookup(const char *path, int op, time_t now, struct entry ***slotP, unsigned int *hashP)
+{
+	struct entry *e;
+	unsigned int h;
+
+	h = hash(path, op);
+	*hashP = h;
+	*slotP = &table[h % STAT_CACHE_SIZE];
+
+	e = **slotP;
+	if (e && e->hash == h && e->op == op && now < e->expires && strcmp(e->path, path) == 0) {
+		++hits;
+		return e;
+	}
+	++misses;
+
+	return NULL;
+}
+
+
+static struct entry *store(struct entry **slot, unsigned int h, const char *path, int op, time_t now,
+			   ssize_t rc, int err)
+{
+	struct entry *e;
+
+	e = malloc(sizeof(struct entry));
+	if (!e)
+		return NULL;
+
+	e->path = strdup(path);
+	if (!e->path) {
+		free(e);
+		return NULL;
+	}
+	e->hash    = h;
+	e->op      = op;
+	e->expires = now + stat_cache;
+	e->rc      = rc;
+	e->err     = err;
+	e->link    = NULL;
+	++entry_count;
+
+	if (*slot)
+		release(*slot);
+	*slot = e;
+
+	return e;
+}
+
+
+static int do_stat(const char *path, struct stat *sb, int op)
+{
+	struct entry **slot, *e;
+	unsigned int h;
+	time_t now;
+	int rc, err;
+
+	if (stat_cache <= 0)
+		return op == STC_STAT ? stat(path, sb) : lstat(path, sb);
+
+	now = time(NULL);
+	e = lookup(path, op, now, &slot, &h);
+	if (e) {
+		if (e->rc < 0) {
+			errno = e->err;
+			return -1;
+		}
+
+		*sb = e->sb;
+		return 0;
+	}
+
+	rc = op == STC_STAT ? stat(path, sb) : lstat(path, sb);
+	err = errno;
+	e = store(slot, h, path, op, now, rc, err);
+	if (e && rc == 0)
+		e->sb = *sb;
+	errno = err;
+
+	return rc;
+}
+
+
+int stc_stat(const char *path, struct stat *sb)
+{
+	return do_stat(path, sb, STC_STAT);
+}
+
+
+int stc_lstat(const char *path, struct stat *sb)
+{
+	return do_stat(path, sb, STC_LSTAT);
+}
+
+
+ssize_t stc_readlink(const char *path, char *buf, size_t len)
+{
+	struct entry **slot, *e;
+	unsigned int h;
+	time_t now;
+	ssize_t rc;
+	int err;
+
+	if (stat_cache <= 0)
+		return readlink(path, buf, len);
+
+	now = time(NULL);
+	e = lookup(path, STC_READLINK, now, &slot, &h);
+	if (e) {
+		if (e->rc < 0) {
+			errno = e->err;
+			return -1;
+		}
+
+		rc = MIN((size_t)e->rc, len);
+		memcpy(buf, e->link, rc);
+		return rc;
+	}
+
+	rc = readlink(path, buf, len);
+	err = errno;
+	e = store(slot, h, path, STC_READLINK, now, rc, err);
+	if (e && rc >= 0) {
+		e->link = malloc(rc ? rc : 1);
+		if (e->link)
+			memcpy(e->link, buf, rc);
+		else
+			e->expires = 0;	/* can't cache it, let it expire */
+	}
+	errno = err;
+
+	return rc;
+}
+
+
+void stc_cleanup(void)
+{
+	time_t now = time(NULL);
+	int i;
+
+	for (i = 0; i < STAT_CACHE_SIZE; i++) {
+		if (table[i] && table[i]->expires <= now) {
+			release(table[i]);
+			table[i] = NULL;
+		}
+	}
+}
+
+
+void stc_destroy(void)
+{
+	int i;
+
+	for (i = 0; i < STAT_CACHE_SIZE; i++) {
+		if (table[i]) {
+			release(table[i]);
+			table[i] = NULL;
+		}
+	}
+}
+
+
+/* Generate debugging statistics syslog message. */
+void stc_logstats(long secs)
+{
+	if (hits + misses == 0)
+		return;
+
+	syslog(LOG_INFO, "  statcache - %d entries, %ld hits, %ld misses (%g%% hits)",
+	       entry_count, hits, misses, 100.0 * hits / (hits + misses));
+	hits = misses = 0;
+}
@@ -35,8 +35,18 @@
 #include "timers.h"
 
 
-#define HASH_SIZE 67
-static struct timer *timers[HASH_SIZE];
+/* Active timers are kept in a 4-ary min-heap ordered on trigger time.
+** Each timer knows its own heap index, so tmr_reset() and tmr_cancel()
+** fix up the heap in O(log n) without searching for the timer, and the
+** next timer to trigger is always at the top.
+*/
+#define HEAP_ARITY     4
+#define HEAP_PARENT(i) (((i) - 1) / HEAP_ARITY)
+#define HEAP_CHILD(i)  ((i) * HEAP_ARITY + 1)
+#define HEAP_MIN_SIZE  256
+
+static struct timer **heap;
+static int heap_len, heap_size;
 static struct timer *free_timers;
 static int alloc_count, active_count, free_count;
 
@@ -49,95 +59,134 @@ static int use_monotonic = 0;	/* monotonic clock runtime availability flag */
 static struct timeval tv_diff;	/* system time - monotonic difference at start */
 #endif
 
-static unsigned int hash(struct timer *t)
+static int before(struct timer *a, struct timer *b)
 {
-	/* We can hash on the trigger time, even though it can change over
-	** the life of a timer via either the periodic bit or the tmr_reset()
-	** call.  This is because both of those guys call l_resort(), which
-	** recomputes the hash and moves the timer to the appropriate list.
-	*/
-	return ((unsigned int)t->time.tv_sec ^ (unsigned int)t->time.tv_usec) % HASH_SIZE;
+	return  a->time.tv_sec   < b->time.tv_sec ||
+	       (a->time.tv_sec  == b->time.tv_sec &&
+		a->time.tv_usec  < b->time.tv_usec);
 }
 
 
-static void l_add(struct timer *t)
+static void h_set(int i, struct timer *t)
 {
-	int h = t->hash;
-	struct timer *t2;
-	struct timer *t2prev;
-
-	t2 = timers[h];
-	if (!t2) {
-		/* The list is empty. */
-		timers[h] = t;
-		t->prev = t->next = NULL;
-	} else {
-		if ( t->time.tv_sec   < t2->time.tv_sec ||
-		    (t->time.tv_sec  == t2->time.tv_sec &&
-		     t->time.tv_usec <= t2->time.tv_usec)) {
-			/* The new timer goes at the head of the list. */
-			timers[h] = t;
-			t->prev   = NULL;
-			t->next   = t2;
-			t2->prev  = t;
-		} else {
-			/* Walk the list to find the insertion point. */
-			for (t2prev = t2, t2 = t2->next; t2; t2prev = t2, t2 = t2->next) {
-				if (t->time.tv_sec < t2->time.tv_sec ||
-				    (t->time.tv_sec  == t2->time.tv_sec &&
-				     t->time.tv_usec <= t2->time.tv_usec)) {
-					/* Found it. */
-					t2prev->next = t;
-					t->prev      = t2prev;
-					t->next      = t2;
-					t2->prev     = t;
-					return;
-				}
-			}
+	heap[i]  = t;
+	t->index = i;
+}
 
-			/* Oops, got to the end of the list.  Add to tail. */
-			t2prev->next = t;
-			t->prev     = t2prev;
-			t->next     = NULL;
+
+static void h_up(int i)
+{
+	struct timer *t = heap[i];
+	int parent;
+
+	while (i > 0) {
+		parent = HEAP_PARENT(i);
+		if (!before(t, heap[parent]))
+			break;
+
+		h_set(i, heap[parent]);
+		i = parent;
+	}
+	h_set(i, t);
+}
+
+
+static void h_down(int i)
+{
+	struct timer *t = heap[i];
+	int child, last, min;
+
+	while ((child = HEAP_CHILD(i)) < heap_len) {
+		last = child + HEAP_ARITY;
+		if (last > heap_len)
+			last = heap_len;
+
+		/* Find the earliest of the (up to) four children. */
+		for (min = child++; child < last; child++) {
+			if (before(heap[child], heap[min]))
+				min = child;
 		}
+
+		if (!before(heap[min], t))
+			break;
+
+		h_set(i, heap[min]);
+		i = min;
 	}
+	h_set(i, t);
 }
 
 
-static void l_remove(struct timer *t)
+/* Move a timer up or down after its trigger time has changed. */
+static void h_resort(struct timer *t)
 {
-	if (!t)
+	int i = t->index;
+
+	if (i < 0)
 		return;
 
-	if (!t->prev)
-		timers[t->hash] = t->next;
+	if (i > 0 && before(t, heap[HEAP_PARENT(i)]))
+		h_up(i);
 	else
-		t->prev->next = t->next;
+		h_down(i);
+}
+
+
+static int h_add(struct timer *t)
+{
+	struct timer **h;
+	int size;
 
-	if (t->next)
-		t->next->prev = t->prev;
+	if (heap_len >= heap_size) {
+		size = heap_size ? heap_size * 2 : HEAP_MIN_SIZE;
+		h = realloc(heap, size * sizeof(struct timer *));
+		if (!h)
+			return -1;
+
+		heap = h;
+		heap_size = size;
+	}
+
+	h_set(heap_len++, t);
+	h_up(t->index);
+
+	return 0;
 }
 
 
-static void l_resort(struct timer *t)
+static void h_remove(struct timer *t)
 {
-	/* Remove the timer from its old list. */
-	l_remove(t);
+	struct timer *last;
+	int i = t->index;
 
-	/* Recompute the hash. */
-	t->hash = hash(t);
+	if (i < 0)
+		return;
+
+	/* Fill the hole with the last timer and let it find its place. */
+	t->index = -1;
+	last = heap[--heap_len];
+	if (last == t)
+		return;
 
-	/* And add it back in to its new list, sorted correctly. */
-	l_add(t);
+	h_set(i, last);
+	h_resort(last);
 }
 
 
-void tmr_init(void)
+static void tv_add(struct timeval *tv, long msecs)
 {
-	int h;
+	tv->tv_sec  +=  msecs / 1000L;
+	tv->tv_usec += (msecs % 1000L) * 1000L;
+	if (tv->tv_usec >= 1000000L) {
+		tv->tv_sec += tv->tv_usec / 1000000L;
+		tv->tv_usec %= 1000000L;
+	}
+}
+
 
-	for (h = 0; h < HASH_SIZE; ++h)
-		timers[h] = NULL;
+void tmr_init(void)
+{
+	heap_len = 0;
 	free_timers = NULL;
 	alloc_count = active_count = free_count = 0;
 
@@ -190,18 +239,15 @@ struct timer *tmr_create(struct timeval *now,
 		t->time = *now;
 	else
 		tmr_prepare_timeval(&t->time);
+	tv_add(&t->time, msecs);
 
-	t->time.tv_sec  +=  msecs / 1000L;
-	t->time.tv_usec += (msecs % 1000L) * 1000L;
-	if (t->time.tv_usec >= 1000000L) {
-		t->time.tv_sec += t->time.tv_usec / 1000000L;
-		t->time.tv_usec %= 1000000L;
+	/* Add the new timer to the heap. */
+	if (h_add(t)) {
+		t->next     = free_timers;
+		free_timers = t;
+		++free_count;
+		return NULL;
 	}
-
-	t->hash = hash(t);
-
-	/* Add the new timer to the proper active list. */
-	l_add(t);
 	++active_count;
 
 	return t;
@@ -226,37 +272,21 @@ struct timeval *tmr_timeout(struct timeval *now)
 
 long tmr_mstimeout(struct timeval *now)
 {
-	long msecs, m;
-	int gotone;
-	int h;
-
-	gotone = 0;
-	msecs  = 0;
-
-	/* Since the lists are sorted, we only need to look at
-	** the first timer on each one.
-	*/
-	for (h = 0; h < HASH_SIZE; ++h) {
-		struct timer *t;
-
-		t = timers[h];
-		if (!t)
-			continue;
-
-		m = (t->time.tv_sec - now->tv_sec) * 1000L + (t->time.tv_usec - now->tv_usec) / 1000L;
-		if (!gotone) {
-			msecs = m;
-			gotone = 1;
-		} else if (m < msecs) {
-			msecs = m;
-		}
-	}
+	struct timer *t;
+	long msecs;
 
-	if (!gotone)
+	/* The next timer to trigger is at the top of the heap. */
+	if (heap_len == 0)
 		return INFTIM;
 
-	if (msecs <= 0)
-		msecs = 500; /* Was 0, but we should never poll() < 500 msec */
+	/* Round up, so the timer is due when the wait is over.  A timer
+	** already due means no wait at all, throttled connections pace
+	** themselves with timers only a few msec out.
+	*/
+	t = heap[0];
+	msecs = (t->time.tv_sec - now->tv_sec) * 1000L + (t->time.tv_usec - now->tv_usec + 999L) / 1000L;
+	if (msecs < 0)
+		msecs = 0;
 
 	return msecs;
 }
@@ -264,33 +294,31 @@ long tmr_mstimeout(struct timeval *now)
 
 void tmr_run(struct timeval *now)
 {
-	int h;
 	struct timer *t;
-	struct timer *next;
 
-	for (h = 0; h < HASH_SIZE; ++h)
-		for (t = timers[h]; t; t = next) {
-			next = t->next;
-			/* Since the lists are sorted, as soon as we find a timer
-			** that isn't ready yet, we can go on to the next list.
+	while (heap_len > 0) {
+		t = heap[0];
+		if (t->time.tv_sec > now->tv_sec || (t->time.tv_sec == now->tv_sec &&
+						      t->time.tv_usec > now->tv_usec))
+			break;
+
+		(t->cb) (t->arg, now);
+		if (t->index < 0)
+			continue;	/* cancelled by the callback */
+
+		if (t->periodic) {
+			/* Reschedule, if we've fallen behind skip ahead
+			** rather than running the timer repeatedly.
 			*/
-			if (t->time.tv_sec > now->tv_sec || (t->time.tv_sec == now->tv_sec &&
-							      t->time.tv_usec > now->tv_usec))
-				break;
-
-			(t->cb) (t->arg, now);
-			if (t->periodic) {
-				/* Reschedule. */
-				t->time.tv_sec  +=  t->msecs / 1000L;
-				t->time.tv_usec += (t->msecs % 1000L) * 1000L;
-				if (t->time.tv_usec >= 1000000L) {
-					t->time.tv_sec += t->time.tv_usec / 1000000L;
-					t->time.tv_usec %= 1000000L;
-				}
-				l_resort(t);
-			} else
-				tmr_cancel(t);
-		}
+			tv_add(&t->time, t->msecs);
+			if (!timercmp(&t->time, now, >)) {
+				t->time = *now;
+				tv_add(&t->time, t->msecs > 0 ? t->msecs : 1);
+			}
+			h_resort(t);
+		} else
+			tmr_cancel(t);
+	}
 }
 
 
@@ -300,27 +328,21 @@ void tmr_reset(struct timeval *now, struct timer *t)
 		return;
 
 	t->time = *now;
-	t->time.tv_sec  +=  t->msecs / 1000L;
-	t->time.tv_usec += (t->msecs % 1000L) * 1000L;
-	if (t->time.tv_usec >= 1000000L) {
-		t->time.tv_sec += t->time.tv_usec / 1000000L;
-		t->time.tv_usec %= 1000000L;
-	}
-	l_resort(t);
+	tv_add(&t->time, t->msecs);
+	h_resort(t);
 }
 
 
 void tmr_cancel(struct timer *t)
 {
-	if (!t)
+	if (!t || t->index < 0)
 		return;
 
-	/* Remove it from its active list. */
-	l_remove(t);
+	/* Remove it from the heap. */
+	h_remove(t);
 	--active_count;
 
 	/* And put it on the free list. */
-	t->prev     = NULL;
 	t->next     = free_timers;
 	free_timers = t;
 
@@ -346,20 +368,21 @@ void tmr_cleanup(void)
 
 void tmr_destroy(void)
 {
-	int h;
-
-	for (h = 0; h < HASH_SIZE; ++h) {
-		while (timers[h])
-			tmr_cancel(timers[h]);
-	}
+	while (heap_len > 0)
+		tmr_cancel(heap[0]);
 	tmr_cleanup();
+
+	free(heap);
+	heap = NULL;
+	heap_size = 0;
 }
 
 
 /* Generate debugging statistics syslog message. */
 void tmr_logstats(long secs)
 {
-	syslog(LOG_INFO, "  timers - %d allocated, %d active, %d free", alloc_count, active_count, free_count);
+	syslog(LOG_INFO, "  timers - %d allocated, %d active, %d free, heap size %d", alloc_count, active_count,
+	       free_count, heap_size);
 	if (active_count + free_count != alloc_count)
 		syslog(LOG_ERR, "timer counts don't add up!");
 }
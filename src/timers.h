@@ -48,10 +48,9 @@ typedef union {
 extern arg_t noarg;	/* for use when you don't care */
 
 struct timer {
-	struct timer  *prev;
-	struct timer  *next;
+	struct timer  *next;	/* free list */
 
-	int            hash;
+	int            index;	/* position in heap, -1 when not active */
 	struct timeval time;
 	long           msecs;
 	int            periodic;
@@ -0,0 +1,27 @@
+#!/bin/sh
+# A slow script, cacheable for a minute, that replies with its PID.
+# Requests arriving while it runs wait for its response, and requests
+# after it are served from the cache, so all get the same reply.
+set -ex
+
+cat >srv/cgi-bin/counter <<EOT
+#!/bin/sh
+sleep 1
+echo "Content-Type: text/plain"
+echo "Cache-Control: max-age=60"
+echo ""
+echo "pid \$\$"
+EOT
+chmod 755 srv/cgi-bin/counter
+
+for i in 1 2 3 4; do
+    curl -s http://localhost:8086/cgi-bin/counter >counter$i.out &
+done
+wait
+curl -s http://localhost:8086/cgi-bin/counter >counter5.out
+
+grep -q '^pid [0-9]' counter1.out
+for i in 2 3 4 5; do
+    cmp counter1.out counter$i.out
+done
+rm -f counter[1-5].out srv/cgi-bin/counter
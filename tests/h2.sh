@@ -0,0 +1,7 @@
+#!/bin/sh
+# HTTP/2 with prior knowledge, h2c, on the plain HTTP port
+set -ex
+
+curl -V | grep -q HTTP2 || exit 77
+curl -s --http2-prior-knowledge -o /dev/null -w '%{http_version} %{http_code}\n' \
+     http://localhost:8086/index.html | grep -x '2 200'
@@ -0,0 +1,19 @@
+#!/bin/sh
+# One HEADERS frame adds a 4 kiB field to the HPACK table and refers to
+# it 12000 times, one byte each, which would decode to 48 MiB.  It must
+# be refused with GOAWAY, ENHANCE_YOUR_CALM, and the server must live on.
+set -ex
+
+{
+    printf 'PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n'
+    printf '\000\000\000\004\000\000\000\000\000'
+    printf '\000\076\206\001\005\000\000\000\001'
+    printf '\100\001x\177\241\036'
+    head -c 4000 /dev/zero | tr '\000' a
+    head -c 12000 /dev/zero | tr '\000' '\276'
+} >hpack.in
+
+curl -s --max-time 5 telnet://localhost:8086 <hpack.in >hpack.out || true
+od -An -v -tx1 hpack.out | tr -d ' \n' | grep -E '000008070000000000[0-9a-f]{8}0000000b'
+curl -s http://localhost:8086/index.html | grep -q '</html>'
+rm -f hpack.in hpack.out
@@ -0,0 +1,213 @@
+/* Micro-benchmarks of the request path, not run by 'make check'
+**
+** Usage: httpdbench [NUM]
+**
+** Runs NUM rounds, 100000 by default, of each of: httpd_got_request()
+** and httpd_parse_request() on a typical browser request, match() and
+** match_exec() with the default CGI pattern, figure_mime() on a mix of
+** file names, and mmc_map() + mmc_unmap() hits on a small file.  The
+** cost per call is reported, see also tmrbench for the timers.
+**
+** Built with all of the server, main() of merecat.c is renamed, and
+** libhttpd.c is included here to reach figure_mime().
+*/
+
+#undef main
+#include "../src/libhttpd.c"
+
+#include <stdio.h>
+#include <time.h>
+
+static const char request[] =
+	"GET /index.html HTTP/1.1\r\n"
+	"Host: localhost:8086\r\n"
+	"User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 Firefox/128.0\r\n"
+	"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+	"Accept-Language: en-US,en;q=0.5\r\n"
+	"Accept-Encoding: gzip, deflate, br, zstd\r\n"
+	"Connection: keep-alive\r\n"
+	"Upgrade-Insecure-Requests: 1\r\n"
+	"Sec-Fetch-Dest: document\r\n"
+	"Sec-Fetch-Mode: navigate\r\n"
+	"If-Modified-Since: Thu, 01 Jan 2015 00:00:00 GMT\r\n"
+	"\r\n";
+
+static char *files[] = {
+	"index.html",
+	"main.css",
+	"img/merecat.jpg",
+	"js/app.min.js",
+	"download/archive.tar.gz",
+	"page.html.gz",
+	"README",
+	"data.json",
+};
+
+static long sink;
+
+static double elapsed(struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return (end.tv_sec - start->tv_sec) * 1e9 + (end.tv_nsec - start->tv_nsec);
+}
+
+static void report(const char *what, double nsec, long num)
+{
+	printf("%-14s %8ld ops %10.1f ns/op\n", what, num, nsec / num);
+}
+
+static void bench_parse(struct httpd *hs, long num)
+{
+	struct http_conn hc;
+	struct timespec start;
+	double got = 0, parse = 0;
+	long i;
+
+	memset(&hc, 0, sizeof(hc));
+	hc.hs = hs;
+	hc.conn_fd = -1;
+	hc.file_fd = -1;
+	httpd_init_conn_mem(&hc);
+
+	for (i = 0; i < num; i++) {
+		httpd_init_conn_content(&hc);
+		memcpy(hc.read_buf, request, sizeof(request) - 1);
+		hc.read_idx = sizeof(request) - 1;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (httpd_got_request(&hc) != GR_GOT_REQUEST)
+			exit(1);
+		got += elapsed(&start);
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (httpd_parse_request(&hc))
+			exit(1);
+		parse += elapsed(&start);
+	}
+	report("got_request", got, num);
+	report("parse_request", parse, num);
+
+	httpd_destroy_conn(&hc);
+}
+
+static void bench_match(long num)
+{
+	const char *pattern = "**.cgi|/cgi-bin/*";
+	struct timespec start;
+	struct match *m;
+	long i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < num; i++)
+		sink += match(pattern, files[i % NELEMS(files)]);
+	report("match", elapsed(&start), num);
+
+	m = match_compile(pattern);
+	if (!m)
+		exit(1);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < num; i++)
+		sink += match_exec(m, files[i % NELEMS(files)]);
+	report("match_exec", elapsed(&start), num);
+
+	match_free(m);
+}
+
+static void bench_mime(struct httpd *hs, long num)
+{
+	struct http_conn hc;
+	struct timespec start;
+	double t = 0;
+	long i;
+
+	memset(&hc, 0, sizeof(hc));
+	hc.hs = hs;
+	hc.conn_fd = -1;
+	hc.file_fd = -1;
+	httpd_init_conn_mem(&hc);
+
+	for (i = 0; i < num; i++) {
+		const char *file = files[i % NELEMS(files)];
+
+		httpd_init_conn_content(&hc);
+		httpd_conn_str(&hc, &hc.expnfilename, &hc.maxexpnfilename, strlen(file) + 1);
+		strcpy(hc.expnfilename, file);
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		figure_mime(&hc);
+		t += elapsed(&start);
+		sink += hc.type_idx;
+	}
+	report("figure_mime", t, num);
+
+	httpd_destroy_conn(&hc);
+}
+
+static void bench_mmc(long num)
+{
+	char file[] = "/tmp/httpdbench.XXXXXX";
+	struct timespec start;
+	struct timeval now;
+	struct stat sb;
+	char buf[4096];
+	void *addr;
+	long i;
+	int fd;
+
+	fd = mkstemp(file);
+	if (fd < 0)
+		exit(1);
+	memset(buf, 'x', sizeof(buf));
+	if (write(fd, buf, sizeof(buf)) != sizeof(buf) || fstat(fd, &sb))
+		exit(1);
+	close(fd);
+
+	tmr_prepare_timeval(&now);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < num; i++) {
+		addr = mmc_map(file, -1, &sb, &now);
+		if (!addr)
+			exit(1);
+		mmc_unmap(addr, &sb, &now);
+	}
+	report("mmc_map+unmap", elapsed(&start), num);
+
+	mmc_destroy();
+	unlink(file);
+}
+
+int main(int argc, char *argv[])
+{
+	struct httpd *hs;
+	char cwd[MAXPATHLEN];
+	long num = 100000;
+
+	if (argc > 1)
+		num = atol(argv[1]);
+	if (num < 1)
+		return 1;
+
+	if (!getcwd(cwd, sizeof(cwd) - 1))
+		return 1;
+	strcat(cwd, "/");
+
+	tmr_init();
+	hs = httpd_init(NULL, 0, NULL, "UTF-8", -1, cwd, 1, 0, 0, 0,
+			NULL, NULL, 0, 0);
+	if (!hs)
+		return 1;
+
+	bench_parse(hs, num);
+	bench_match(num);
+	bench_mime(hs, num);
+	bench_mmc(num);
+
+	httpd_exit(hs);
+	tmr_destroy();
+
+	return sink == -1;
+}
@@ -0,0 +1,330 @@
+/* Load generator for loadtest.sh, not run by 'make check'
+**
+** Usage: loadgen [-c CONNS] [-n REQS] [-k] [-s] [-l LABEL] [-H HEADER] HOST PORT PATH
+**
+** Runs CONNS clients, 10 by default, one thread each, that together
+** send REQS requests, 10000 by default, for PATH and read the responses.
+** With -k connections are kept alive, otherwise one per request, and -s
+** is HTTPS.  Reports requests per second and p50, p99, and p99.9 of the
+** latency, from sending the request, or connecting, to the last byte of
+** the response.  Anything but a 2xx or 3xx status is an error.
+*/
+
+#include <config.h>
+
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#ifdef ENABLE_SSL
+#include <openssl/ssl.h>
+#endif
+
+#define MAX_HEADERS 8
+
+struct conn {
+	int   fd;
+	int   closed;	/* Server said Connection: close */
+#ifdef ENABLE_SSL
+	SSL  *ssl;
+#endif
+};
+
+static struct addrinfo *addr;
+static char  request[2048];
+static size_t request_len;
+static long  total = 10000;
+static long  next;
+static long  errors;
+static long *latency;	/* ns per request, -1 on errors */
+static int   keepalive;
+
+#ifdef ENABLE_SSL
+static SSL_CTX *ctx;
+#endif
+
+static long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static ssize_t io_read(struct conn *c, char *buf, size_t len)
+{
+#ifdef ENABLE_SSL
+	if (c->ssl)
+		return SSL_read(c->ssl, buf, len);
+#endif
+	return read(c->fd, buf, len);
+}
+
+static ssize_t io_write(struct conn *c, const char *buf, size_t len)
+{
+#ifdef ENABLE_SSL
+	if (c->ssl)
+		return SSL_write(c->ssl, buf, len);
+#endif
+	return write(c->fd, buf, len);
+}
+
+static void conn_close(struct conn *c)
+{
+#ifdef ENABLE_SSL
+	if (c->ssl) {
+		SSL_free(c->ssl);
+		c->ssl = NULL;
+	}
+#endif
+	if (c->fd >= 0)
+		close(c->fd);
+	c->fd = -1;
+	c->closed = 0;
+}
+
+static int conn_open(struct conn *c)
+{
+	c->fd = socket(addr->ai_family, SOCK_STREAM, 0);
+	if (c->fd < 0)
+		return -1;
+
+	if (connect(c->fd, addr->ai_addr, addr->ai_addrlen))
+		goto fail;
+
+#ifdef ENABLE_SSL
+	if (ctx) {
+		c->ssl = SSL_new(ctx);
+		if (!c->ssl || !SSL_set_fd(c->ssl, c->fd) || SSL_connect(c->ssl) != 1)
+			goto fail;
+	}
+#endif
+
+	return 0;
+fail:
+	conn_close(c);
+	return -1;
+}
+
+/* Sends the request and reads the whole response, framed by its
+** Content-Length, or by the server closing the connection.
+*/
+static int do_request(struct conn *c)
+{
+	char buf[16384], *end, *cp;
+	size_t len = 0, off;
+	long body = -1;
+	ssize_t n;
+	int status;
+
+	for (off = 0; off < request_len; off += n) {
+		n = io_write(c, request + off, request_len - off);
+		if (n <= 0)
+			return -1;
+	}
+
+	/* Headers */
+	while (1) {
+		n = io_read(c, buf + len, sizeof(buf) - 1 - len);
+		if (n <= 0)
+			return -1;
+		len += n;
+		buf[len] = 0;
+
+		end = strstr(buf, "\r\n\r\n");
+		if (end)
+			break;
+		if (len == sizeof(buf) - 1)
+			return -1;
+	}
+	*end = 0;
+	end += 4;
+
+	if (sscanf(buf, "HTTP/%*s %d", &status) != 1 || status < 200 || status >= 400)
+		return -1;
+
+	cp = strcasestr(buf, "\r\nContent-Length:");
+	if (cp)
+		body = atol(cp + 17);
+	if (!cp || strcasestr(buf, "\r\nConnection: close"))
+		c->closed = 1;
+
+	/* Body */
+	len -= end - buf;
+	while (body < 0 || (long)len < body) {
+		n = io_read(c, buf, sizeof(buf));
+		if (n < 0)
+			return -1;
+		if (n == 0)
+			return body < 0 ? 0 : -1;
+		len += n;
+	}
+
+	return 0;
+}
+
+static void *worker(void *arg)
+{
+	struct conn c = { .fd = -1 };
+	long i, start;
+
+	while ((i = __atomic_fetch_add(&next, 1, __ATOMIC_RELAXED)) < total) {
+		start = now_ns();
+		if ((c.fd < 0 && conn_open(&c)) || do_request(&c)) {
+			__atomic_fetch_add(&errors, 1, __ATOMIC_RELAXED);
+			latency[i] = -1;
+			conn_close(&c);
+			continue;
+		}
+		latency[i] = now_ns() - start;
+
+		if (!keepalive || c.closed)
+			conn_close(&c);
+	}
+	conn_close(&c);
+
+	return NULL;
+}
+
+static int compare(const void *a, const void *b)
+{
+	long x = *(const long *)a, y = *(const long *)b;
+
+	return (x > y) - (x < y);
+}
+
+static double percentile(long *lat, long num, double p)
+{
+	if (num < 1)
+		return 0;
+
+	return lat[(long)(p * (num - 1) + 0.5)] / 1e6;
+}
+
+static int usage(int rc)
+{
+	fprintf(stderr, "Usage: loadgen [-c CONNS] [-n REQS] [-k] [-s] [-l LABEL] [-H HEADER] HOST PORT PATH\n");
+	return rc;
+}
+
+int main(int argc, char *argv[])
+{
+	struct addrinfo hints = { .ai_socktype = SOCK_STREAM };
+	const char *header[MAX_HEADERS];
+	const char *label = "";
+	pthread_t *tid;
+	long i, ok, start, elapsed;
+	int conns = 10, num_headers = 0, tls = 0;
+	int c, rc;
+
+	while ((c = getopt(argc, argv, "c:H:hkl:n:s")) != EOF) {
+		switch (c) {
+		case 'c':
+			conns = atoi(optarg);
+			break;
+
+		case 'H':
+			if (num_headers == MAX_HEADERS)
+				return usage(1);
+			header[num_headers++] = optarg;
+			break;
+
+		case 'h':
+			return usage(0);
+
+		case 'k':
+			keepalive = 1;
+			break;
+
+		case 'l':
+			label = optarg;
+			break;
+
+		case 'n':
+			total = atol(optarg);
+			break;
+
+		case 's':
+			tls = 1;
+			break;
+
+		default:
+			return usage(1);
+		}
+	}
+
+	if (argc - optind != 3 || conns < 1 || total < 1)
+		return usage(1);
+
+	/* Servers may close kept-alive connections at any time */
+	signal(SIGPIPE, SIG_IGN);
+
+	rc = getaddrinfo(argv[optind], argv[optind + 1], &hints, &addr);
+	if (rc) {
+		fprintf(stderr, "loadgen: %s: %s\n", argv[optind], gai_strerror(rc));
+		return 1;
+	}
+
+	if (tls) {
+#ifdef ENABLE_SSL
+		ctx = SSL_CTX_new(TLS_client_method());
+		if (!ctx)
+			return 1;
+		SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, NULL);
+#else
+		fprintf(stderr, "loadgen: built without HTTPS support\n");
+		return 1;
+#endif
+	}
+
+	request_len = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s\r\n",
+			       argv[optind + 2], argv[optind]);
+	for (i = 0; i < num_headers && request_len < sizeof(request); i++)
+		request_len += snprintf(request + request_len, sizeof(request) - request_len,
+					"%s\r\n", header[i]);
+	if (request_len < sizeof(request))
+		request_len += snprintf(request + request_len, sizeof(request) - request_len,
+					"Connection: %s\r\n\r\n", keepalive ? "keep-alive" : "close");
+	if (request_len >= sizeof(request))
+		return usage(1);
+
+	latency = calloc(total, sizeof(long));
+	tid = calloc(conns, sizeof(pthread_t));
+	if (!latency || !tid)
+		return 1;
+
+	start = now_ns();
+	for (i = 0; i < conns; i++) {
+		if (pthread_create(&tid[i], NULL, worker, NULL))
+			return 1;
+	}
+	for (i = 0; i < conns; i++)
+		pthread_join(tid[i], NULL);
+	elapsed = now_ns() - start;
+
+	/* Failed requests sort first, skip them */
+	qsort(latency, total, sizeof(long), compare);
+	ok = total - errors;
+
+	printf("%-12s %9.0f req/s  p50 %8.3f ms  p99 %8.3f ms  p99.9 %8.3f ms  %ld errors\n",
+	       label, ok / (elapsed / 1e9),
+	       percentile(latency + errors, ok, 0.50),
+	       percentile(latency + errors, ok, 0.99),
+	       percentile(latency + errors, ok, 0.999),
+	       errors);
+
+	freeaddrinfo(addr);
+	free(latency);
+	free(tid);
+
+	return errors > 0;
+}
@@ -0,0 +1,91 @@
+#!/bin/sh
+# Macro load test, run by 'make bench', not part of 'make check'
+#
+# Starts a merecat of its own and runs loadgen against it for a few
+# workloads, one line of req/s and p50/p99/p99.9 latency each.  Tune
+# with REQS, CONNS, and PORT in the environment.  CGI can only be
+# enabled from a .conf file, so the CGI and HTTPS workloads are skipped
+# unless merecat is built with libconfuse.
+REQS=${REQS:-20000}
+CONNS=${CONNS:-16}
+PORT=${PORT:-8090}
+TLSPORT=$((PORT + 1))
+if [ -z "$srcdir" ]; then
+    srcdir=.
+fi
+
+dir=bench-srv
+merecat=../src/merecat
+loadgen=./loadgen
+
+cleanup()
+{
+    [ -n "$pid" ] && kill $pid 2>/dev/null
+    sleep 1
+    rm -rf $dir bench.conf bench.log bench.pid
+}
+trap cleanup EXIT INT TERM
+
+rm -rf $dir
+mkdir -p $dir/cgi-bin
+head -c 1024     /dev/urandom > $dir/small.bin
+head -c 16777216 /dev/urandom > $dir/large.bin
+cp ${srcdir}/../www/main.css $dir/
+cp ${srcdir}/../www/cgi-bin/printenv $dir/cgi-bin/
+
+conf=
+tls=
+if $merecat -h 2>&1 | grep -q -- '-f FILE'; then
+    conf=yes
+    if grep -q 'define ENABLE_SSL' ../config.h; then
+	openssl req -x509 -newkey rsa:2048 -nodes -days 1 -subj /CN=localhost \
+		-keyout $dir/key.pem -out $dir/cert.pem >/dev/null 2>&1 && tls=yes
+    fi
+fi
+
+if [ -n "$conf" ]; then
+    cat > bench.conf <<EOF
+cgi "/cgi-bin/*" {
+    enabled = true
+}
+server plain {
+    port = $PORT
+}
+EOF
+    [ -n "$tls" ] && cat >> bench.conf <<EOF
+server secure {
+    port = $TLSPORT
+    ssl {
+        certfile = $PWD/$dir/cert.pem
+        keyfile  = $PWD/$dir/key.pem
+    }
+}
+EOF
+    $merecat -f bench.conf -n -l err -P $PWD/bench.pid $dir >bench.log 2>&1 &
+else
+    # Without .conf support the data directory must be given
+    $merecat -n -l err -p $PORT -P $PWD/bench.pid -d / $dir >bench.log 2>&1 &
+fi
+pid=$!
+sleep 2
+
+few=$((REQS / 100 > 20 ? REQS / 100 : 20))
+cgi=$((REQS / 10))
+
+echo "Load test, $CONNS connections, merecat `$merecat -V 2>&1 | head -1`"
+$loadgen -l small        -c $CONNS -n $REQS -k    localhost $PORT /small.bin
+$loadgen -l small-close  -c $CONNS -n $REQS       localhost $PORT /small.bin
+$loadgen -l large        -c $CONNS -n $few  -k    localhost $PORT /large.bin
+$loadgen -l gzip         -c $CONNS -n $REQS -k -H "Accept-Encoding: gzip" \
+	                                          localhost $PORT /main.css
+if [ -n "$conf" ]; then
+    $loadgen -l cgi      -c $CONNS -n $cgi        localhost $PORT /cgi-bin/printenv
+else
+    echo "cgi          skipped, needs .conf file support"
+fi
+if [ -n "$tls" ]; then
+    $loadgen -l tls      -c $CONNS -n $REQS -k -s localhost $TLSPORT /small.bin
+    $loadgen -l tls-close -c $CONNS -n $few   -s  localhost $TLSPORT /small.bin
+else
+    echo "tls          skipped, needs HTTPS and .conf file support"
+fi
@@ -0,0 +1,14 @@
+#!/bin/sh
+# Two pipelined requests on one connection, the first a 404.  The error
+# page must be framed, so the status line of the second response follows
+# right after it instead of being lost or merged into the first body.
+set -ex
+
+printf 'GET /nonexistent HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\nGET /index.html HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n' \
+    | curl -s --max-time 5 telnet://localhost:8086 >pipeline.out || true
+
+grep -c '^HTTP/1.1 ' pipeline.out | grep -x 2
+grep -q '^HTTP/1.1 404 ' pipeline.out
+grep -q '^HTTP/1.1 200 ' pipeline.out
+head -n 20 pipeline.out | grep -qi '^Content-Length: '
+rm -f pipeline.out
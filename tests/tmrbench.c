@@ -0,0 +1,98 @@
+/* Micro-benchmark of the timer package, not run by 'make check'
+**
+** Usage: tmrbench [NUM]
+**
+** Creates NUM one-shot timers, 100000 by default, spread over the same
+** range of timeouts the server uses, then reports the cost per call of
+** tmr_create(), tmr_reset(), tmr_mstimeout(), tmr_cancel(), and of
+** running all of them with tmr_run().
+*/
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "timers.h"
+
+static long fired;
+
+static void cb(arg_t arg, struct timeval *now)
+{
+	fired++;
+}
+
+static double elapsed(struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return (end.tv_sec - start->tv_sec) * 1e9 + (end.tv_nsec - start->tv_nsec);
+}
+
+static void report(const char *what, double nsec, long num)
+{
+	printf("%-14s %8ld ops %10.1f ns/op\n", what, num, nsec / num);
+}
+
+int main(int argc, char *argv[])
+{
+	struct timespec start;
+	struct timeval now, later;
+	struct timer **t;
+	long num = 100000;
+	long i, sum = 0;
+
+	if (argc > 1)
+		num = atol(argv[1]);
+	if (num < 1)
+		return 1;
+
+	t = calloc(num, sizeof(struct timer *));
+	if (!t)
+		return 1;
+
+	srandom(1);
+	tmr_init();
+	tmr_prepare_timeval(&now);
+
+	/* Linger, wakeup, and idle timeouts range from 1 ms to 5 min */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < num; i++) {
+		t[i] = tmr_create(&now, cb, noarg, 1 + random() % 300000, 0);
+		if (!t[i])
+			return 1;
+	}
+	report("tmr_create", elapsed(&start), num);
+
+	/* Keep-alive and wouldblock churn, reset at a later point in time */
+	later = now;
+	later.tv_sec += 1;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < num; i++)
+		tmr_reset(&later, t[random() % num]);
+	report("tmr_reset", elapsed(&start), num);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < num; i++)
+		sum += tmr_mstimeout(&now);
+	report("tmr_mstimeout", elapsed(&start), num);
+
+	/* Cancel every other timer, then run the rest */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < num; i += 2)
+		tmr_cancel(t[i]);
+	report("tmr_cancel", elapsed(&start), (num + 1) / 2);
+
+	later.tv_sec += 400;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	tmr_run(&later);
+	report("tmr_run", elapsed(&start), fired ? fired : 1);
+
+	tmr_destroy();
+	free(t);
+
+	return sum == 0 || fired != num / 2;
+}